@@ -1,34 +1,39 @@
 #include <http_server.h>
+#include <http_template.h>
 
 #include <iostream>
 
+// The page is compiled once into static parts and variable slots,
+// each request only copies them to the response.
+const http::html_template my_page(
+    "<!DOCTYPE html>\n"
+    "<html>\n"
+    "<head>\n"
+    "  <title>2 Dynamic</title>\n"
+    "  <link rel=\"stylesheet\" type=\"text/css\" href=\"style.css\">\n"
+    "</head>\n"
+    "<body>\n"
+    "<h1>Example 2 - Dynamic Content</h1>\n"
+    "<p>This is a random number: {{random_number}}</p>\n"
+    "<p>Refresh at will or go back to <a href=\"/\">main page</a>.</p>\n"
+    "</body>\n"
+    "</html>\n");
+
 void my_action(std::ostream & out,
     const std::string & /* path */, const std::string & /* params */)
 {
     // This function generates the whole HTML content for the /my_action link.
     // The content of this page is dynamic.
 
-    // As you see, typing larger fragments of HTML in C++
-    // is cumbersome and not very practical.
-    // Still, assembling HTML blocks from external sources (dist, DB, etc.)
-    // and processing them with a template parsing engine can be very effective.
+    // The HTML is kept in the template (it could be read from a file as well),
+    // the values are HTML-encoded automatically unless written as {{{name}}}.
 
     // With small pieces of dynamic content see the AJAX example for a better alternative.
 
-    int random_number = std::rand();
-
-    out << "<!DOCTYPE html>\n"
-        << "<html>\n"
-        << "<head>\n"
-        << "  <title>2 Dynamic</title>\n"
-        << "  <link rel=\"stylesheet\" type=\"text/css\" href=\"style.css\">\n"
-        << "</head>\n"
-        << "<body>\n"
-        << "<h1>Example 2 - Dynamic Content</h1>\n"
-        << "<p>This is a random number: " << random_number << "</p>\n"
-        << "<p>Refresh at will or go back to <a href=\"/\">main page</a>.</p>\n"
-        << "</body>\n"
-        << "</html>\n";
+    http::template_values values(my_page);
+    values.set("random_number", std::rand());
+
+    my_page.render(out, values);
 }
 
 int main()
@@ -1,4 +1,5 @@
 #include <http_server.h>
+#include <http_multipart.h>
 
 #include <iostream>
 #include <vector>
@@ -31,9 +32,51 @@ void greet(std::ostream & out,
         << "</html>\n";
 }
 
+void upload(std::ostream & out,
+    const std::string & /* path */, const std::string & /* params */,
+    std::istream & in, std::size_t content_length, const std::string & content_type)
+{
+    // The multipart body is parsed as it arrives, in fixed-size chunks,
+    // so that even very large files are never kept in memory as a whole.
+    // Use http::multipart_fd_writer to store the parts directly in files.
+
+    std::string file_name;
+    std::size_t file_size = 0;
+
+    http::parse_multipart(in, content_length, content_type,
+        [&](const http::multipart_part & part, http::multipart_event event,
+            const char * /* data */, std::size_t size)
+        {
+            if ((event == http::part_begin) && (part.name == "file"))
+            {
+                file_name = part.file_name;
+            }
+            else if ((event == http::part_data) && (part.name == "file"))
+            {
+                file_size += size;
+            }
+        });
+
+    out << "<!DOCTYPE html>\n"
+        << "<html>\n"
+        << "<head>\n"
+        << "  <meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />\n"
+        << "  <title>5 Forms</title>\n"
+        << "  <link rel=\"stylesheet\" type=\"text/css\" href=\"style.css\">\n"
+        << "</head>\n"
+        << "<body>\n"
+        << "<h1>Example 5 - Forms</h1>\n"
+        << "<p>Received " << http::html_encode(file_name)
+            << " (" << file_size << " bytes).</p>\n"
+        << "<p>Go back to <a href=\"/\">main page</a>.</p>\n"
+        << "</body>\n"
+        << "</html>\n";
+}
+
 int main()
 {
     http::register_html_post_action("greet", greet);
+    http::register_html_post_action("upload", upload);
 
     http::server_start(8000, "dist", std::cerr);
 }
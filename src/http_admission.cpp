@@ -0,0 +1,183 @@
+
+#include <http_admission.h>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+using namespace http;
+
+namespace // unnamed
+{
+
+// how often each shard of the rate limiter is cleaned from full buckets
+const std::chrono::seconds sweep_interval(10);
+
+} // unnamed namespace
+
+codel_controller::codel_controller(std::chrono::microseconds target,
+    std::chrono::microseconds interval)
+    : origin_(clock_type::now()), target_(target.count()), interval_(interval.count()),
+      interval_end_(interval.count()), min_delay_(std::numeric_limits<std::int64_t>::max()),
+      overloaded_(false)
+{
+}
+
+void codel_controller::set_parameters(std::chrono::microseconds target,
+    std::chrono::microseconds interval)
+{
+    target_ = target.count();
+    interval_ = interval.count();
+    overloaded_ = false;
+}
+
+bool codel_controller::enabled() const
+{
+    return target_.load(std::memory_order_relaxed) != 0;
+}
+
+std::int64_t codel_controller::ticks(clock_type::time_point t) const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(t - origin_).count();
+}
+
+void codel_controller::record(clock_type::duration delay, clock_type::time_point now)
+{
+    std::int64_t target = target_.load(std::memory_order_relaxed);
+    if (target == 0)
+    {
+        return;
+    }
+
+    std::int64_t d = std::chrono::duration_cast<std::chrono::microseconds>(delay).count();
+    std::int64_t t = ticks(now);
+    std::int64_t end = interval_end_.load(std::memory_order_relaxed);
+
+    if (t > end)
+    {
+        // the interval is over, only one thread gets to close it
+        if (interval_end_.compare_exchange_strong(end,
+            t + interval_.load(std::memory_order_relaxed)))
+        {
+            std::int64_t min_delay = min_delay_.exchange(d);
+
+            overloaded_.store(min_delay > target, std::memory_order_relaxed);
+
+            return;
+        }
+    }
+
+    std::int64_t current = min_delay_.load(std::memory_order_relaxed);
+    while ((d < current) && (min_delay_.compare_exchange_weak(current, d) == false))
+    {
+    }
+}
+
+bool codel_controller::overloaded(clock_type::time_point now)
+{
+    if (overloaded_.load(std::memory_order_relaxed) == false)
+    {
+        return false;
+    }
+
+    // without any samples for the whole interval (because all new work
+    // was shed) there is no evidence of the standing queue
+    std::int64_t end = interval_end_.load(std::memory_order_relaxed);
+    if (ticks(now) > end + interval_.load(std::memory_order_relaxed))
+    {
+        overloaded_.store(false, std::memory_order_relaxed);
+
+        return false;
+    }
+
+    return true;
+}
+
+rate_limiter::rate_limiter(std::size_t shards)
+{
+    if (shards == 0)
+    {
+        shards = 1;
+    }
+
+    for (std::size_t i = 0; i != shards; ++i)
+    {
+        shards_.push_back(std::unique_ptr<shard>(new shard));
+        shards_.back()->last_sweep = clock_type::now();
+    }
+}
+
+bool rate_limiter::acquire(const std::string & key, double rate, double burst,
+    clock_type::time_point now)
+{
+    shard & s = *shards_[std::hash<std::string>()(key) % shards_.size()];
+
+    std::lock_guard<std::mutex> lck(s.mtx);
+
+    if (now - s.last_sweep > sweep_interval)
+    {
+        sweep(s, now);
+    }
+
+    auto it = s.buckets.find(key);
+    if (it == s.buckets.end())
+    {
+        it = s.buckets.emplace(key, bucket { burst, now, rate, burst }).first;
+    }
+
+    bucket & b = it->second;
+
+    // refill for the time elapsed since the previous request
+    std::chrono::duration<double> elapsed = now - b.updated;
+    if (elapsed.count() > 0)
+    {
+        b.tokens = std::min(burst, b.tokens + elapsed.count() * rate);
+        b.updated = now;
+    }
+
+    b.rate = rate;
+    b.burst = burst;
+
+    if (b.tokens < 1.0)
+    {
+        return false;
+    }
+
+    b.tokens -= 1.0;
+
+    return true;
+}
+
+std::size_t rate_limiter::size() const
+{
+    std::size_t result = 0;
+
+    for (const std::unique_ptr<shard> & s : shards_)
+    {
+        std::lock_guard<std::mutex> lck(s->mtx);
+
+        result += s->buckets.size();
+    }
+
+    return result;
+}
+
+void rate_limiter::sweep(shard & s, clock_type::time_point now)
+{
+    for (auto it = s.buckets.begin(); it != s.buckets.end(); )
+    {
+        const bucket & b = it->second;
+        std::chrono::duration<double> elapsed = now - b.updated;
+
+        if (b.tokens + elapsed.count() * b.rate >= b.burst)
+        {
+            it = s.buckets.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    s.last_sweep = now;
+}
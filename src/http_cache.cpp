@@ -0,0 +1,703 @@
+
+#include <http_cache.h>
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace http;
+
+namespace // unnamed
+{
+
+// approximate memory used by the cache entry beyond the key and response
+const std::size_t entry_overhead = 128;
+
+// the key of the file path, without empty and "." segments
+// (".." is kept, it does not cancel the previous segment that is a link)
+std::string normalized_path(const std::string & path)
+{
+    if ((path.find("//") == std::string::npos) && (path.find("/./") == std::string::npos) &&
+        (path.compare(0, 2, "./") != 0) &&
+        ((path.size() < 2) || (path.compare(path.size() - 2, 2, "/.") != 0)))
+    {
+        return path;
+    }
+
+    std::string result;
+    result.reserve(path.size());
+
+    if (path[0] == '/')
+    {
+        result.push_back('/');
+    }
+
+    for (std::size_t pos = 0; pos <= path.size(); )
+    {
+        std::size_t end = std::min(path.find('/', pos), path.size());
+
+        std::string_view segment(path.data() + pos, end - pos);
+
+        if ((segment.empty() == false) && (segment != "."))
+        {
+            if ((result.empty() == false) && (result.back() != '/'))
+            {
+                result.push_back('/');
+            }
+
+            result.append(segment);
+        }
+
+        pos = end + 1;
+    }
+
+    if ((path.back() == '/') && ((result.empty()) || (result.back() != '/')))
+    {
+        result.push_back('/');
+    }
+
+    return result;
+}
+
+} // unnamed namespace
+
+response_cache::response_cache(std::size_t budget, std::size_t shards)
+{
+    if (shards == 0)
+    {
+        shards = 1;
+    }
+
+    for (std::size_t i = 0; i != shards; ++i)
+    {
+        shards_.push_back(std::unique_ptr<shard>(new shard));
+        shards_.back()->bytes = 0;
+    }
+
+    shard_budget_ = budget / shards;
+}
+
+response_cache::shard & response_cache::shard_for(const std::string & key)
+{
+    std::size_t h = std::hash<std::string>()(key);
+
+    // the low bits are used by the shard's own hash table
+    return *shards_[(h >> 16) % shards_.size()];
+}
+
+void response_cache::remove(shard & s, lru_list::iterator it)
+{
+    s.bytes -= it->bytes;
+    s.index.erase(it->key);
+    s.lru.erase(it);
+}
+
+void response_cache::evict(shard & s, std::size_t budget)
+{
+    while ((s.bytes > budget) && (s.lru.empty() == false))
+    {
+        remove(s, std::prev(s.lru.end()));
+    }
+}
+
+response_cache::response_type response_cache::find(const std::string & key)
+{
+    shard & s = shard_for(key);
+
+    std::lock_guard<std::mutex> lck(s.mtx);
+
+    auto it = s.index.find(key);
+    if (it == s.index.end())
+    {
+        return response_type();
+    }
+
+    if (it->second->expires <= clock_type::now())
+    {
+        remove(s, it->second);
+        return response_type();
+    }
+
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+
+    return it->second->response;
+}
+
+void response_cache::insert(const std::string & key, response_type response,
+    clock_type::time_point expires)
+{
+    std::size_t bytes = key.size() + response->size() + entry_overhead;
+    std::size_t budget = shard_budget_;
+
+    if (bytes > budget)
+    {
+        // would evict everything else and still not fit
+        return;
+    }
+
+    shard & s = shard_for(key);
+
+    std::lock_guard<std::mutex> lck(s.mtx);
+
+    auto it = s.index.find(key);
+    if (it != s.index.end())
+    {
+        remove(s, it->second);
+    }
+
+    evict(s, budget - bytes);
+
+    entry e = { key, response, expires, bytes };
+    s.lru.push_front(e);
+    s.index[key] = s.lru.begin();
+    s.bytes += bytes;
+}
+
+void response_cache::erase(const std::string & key)
+{
+    shard & s = shard_for(key);
+
+    std::lock_guard<std::mutex> lck(s.mtx);
+
+    auto it = s.index.find(key);
+    if (it != s.index.end())
+    {
+        remove(s, it->second);
+    }
+}
+
+void response_cache::erase_prefix(const std::string & prefix)
+{
+    for (auto & sp : shards_)
+    {
+        shard & s = *sp;
+
+        std::lock_guard<std::mutex> lck(s.mtx);
+
+        for (auto it = s.lru.begin(); it != s.lru.end(); )
+        {
+            auto next = std::next(it);
+
+            if (it->key.compare(0, prefix.size(), prefix) == 0)
+            {
+                remove(s, it);
+            }
+
+            it = next;
+        }
+    }
+}
+
+void response_cache::clear()
+{
+    for (auto & sp : shards_)
+    {
+        shard & s = *sp;
+
+        std::lock_guard<std::mutex> lck(s.mtx);
+
+        s.index.clear();
+        s.lru.clear();
+        s.bytes = 0;
+    }
+}
+
+void response_cache::set_budget(std::size_t budget)
+{
+    std::size_t per_shard = budget / shards_.size();
+
+    shard_budget_ = per_shard;
+
+    for (auto & sp : shards_)
+    {
+        std::lock_guard<std::mutex> lck(sp->mtx);
+
+        evict(*sp, per_shard);
+    }
+}
+
+std::size_t response_cache::size() const
+{
+    std::size_t total = 0;
+
+    for (auto & sp : shards_)
+    {
+        std::lock_guard<std::mutex> lck(sp->mtx);
+
+        total += sp->bytes;
+    }
+
+    return total;
+}
+
+negative_cache::negative_cache(std::size_t capacity, std::size_t shards)
+{
+    if (shards == 0)
+    {
+        shards = 1;
+    }
+
+    for (std::size_t i = 0; i != shards; ++i)
+    {
+        shards_.push_back(std::unique_ptr<shard>(new shard));
+    }
+
+    shard_capacity_ = (capacity + shards - 1) / shards;
+}
+
+negative_cache::shard & negative_cache::shard_for(const std::string & path)
+{
+    std::size_t h = std::hash<std::string>()(path);
+
+    return *shards_[(h >> 16) % shards_.size()];
+}
+
+void negative_cache::evict(shard & s, std::size_t capacity)
+{
+    while (s.fifo.size() > capacity)
+    {
+        s.index.erase(s.fifo.back().path);
+        s.fifo.pop_back();
+    }
+}
+
+bool negative_cache::contains(const std::string & path)
+{
+    if (shard_capacity_ == 0)
+    {
+        return false;
+    }
+
+    std::string key = normalized_path(path);
+    shard & s = shard_for(key);
+
+    std::lock_guard<std::mutex> lck(s.mtx);
+
+    auto it = s.index.find(key);
+    if (it == s.index.end())
+    {
+        return false;
+    }
+
+    if (it->second->expires <= clock_type::now())
+    {
+        s.fifo.erase(it->second);
+        s.index.erase(it);
+
+        return false;
+    }
+
+    return true;
+}
+
+void negative_cache::insert(const std::string & path, clock_type::time_point expires)
+{
+    std::size_t capacity = shard_capacity_;
+
+    if (capacity == 0)
+    {
+        return;
+    }
+
+    std::string key = normalized_path(path);
+    shard & s = shard_for(key);
+
+    std::lock_guard<std::mutex> lck(s.mtx);
+
+    auto it = s.index.find(key);
+    if (it != s.index.end())
+    {
+        s.fifo.erase(it->second);
+        s.index.erase(it);
+    }
+
+    evict(s, capacity - 1);
+
+    s.fifo.push_front(entry { key, expires });
+    s.index[key] = s.fifo.begin();
+}
+
+void negative_cache::erase(const std::string & path)
+{
+    std::string key = normalized_path(path);
+    shard & s = shard_for(key);
+
+    std::lock_guard<std::mutex> lck(s.mtx);
+
+    auto it = s.index.find(key);
+    if (it != s.index.end())
+    {
+        s.fifo.erase(it->second);
+        s.index.erase(it);
+    }
+}
+
+void negative_cache::clear()
+{
+    for (auto & sp : shards_)
+    {
+        std::lock_guard<std::mutex> lck(sp->mtx);
+
+        sp->index.clear();
+        sp->fifo.clear();
+    }
+}
+
+void negative_cache::set_capacity(std::size_t capacity)
+{
+    std::size_t per_shard = (capacity + shards_.size() - 1) / shards_.size();
+
+    shard_capacity_ = per_shard;
+
+    for (auto & sp : shards_)
+    {
+        std::lock_guard<std::mutex> lck(sp->mtx);
+
+        evict(*sp, per_shard);
+    }
+}
+
+std::size_t negative_cache::size() const
+{
+    std::size_t total = 0;
+
+    for (auto & sp : shards_)
+    {
+        std::lock_guard<std::mutex> lck(sp->mtx);
+
+        total += sp->fifo.size();
+    }
+
+    return total;
+}
+
+#ifndef WIN32
+
+namespace // unnamed
+{
+
+// identity and version of the file, as seen by stat()
+bool same_file(const struct stat & st, const open_file_cache::file & f)
+{
+    return ((std::uint64_t)st.st_dev == f.device) && ((std::uint64_t)st.st_ino == f.inode) &&
+        ((std::uint64_t)st.st_size == f.size) && ((std::int64_t)st.st_mtime == f.mtime);
+}
+
+} // unnamed namespace
+
+open_file_cache::file::~file()
+{
+    if (fd != -1)
+    {
+        ::close(fd);
+    }
+}
+
+open_file_cache::open_file_cache(std::size_t capacity, std::chrono::milliseconds revalidate,
+    std::size_t shards)
+{
+    if (shards == 0)
+    {
+        shards = 1;
+    }
+
+    for (std::size_t i = 0; i != shards; ++i)
+    {
+        shards_.push_back(std::unique_ptr<shard>(new shard));
+    }
+
+    shard_capacity_ = (capacity + shards - 1) / shards;
+    revalidate_ms_ = revalidate.count();
+}
+
+open_file_cache::shard & open_file_cache::shard_for(const std::string & name)
+{
+    std::size_t h = std::hash<std::string>()(name);
+
+    return *shards_[(h >> 16) % shards_.size()];
+}
+
+void open_file_cache::remove(shard & s, lru_list::iterator it)
+{
+    s.index.erase(it->name);
+    s.lru.erase(it);
+}
+
+void open_file_cache::evict(shard & s, std::size_t capacity)
+{
+    while (s.lru.size() > capacity)
+    {
+        remove(s, std::prev(s.lru.end()));
+    }
+}
+
+open_file_cache::file_type open_file_cache::open(const std::string & root,
+    const std::string & name, const header_builder & headers)
+{
+    std::size_t capacity = shard_capacity_;
+    std::string key = normalized_path(name);
+    shard & s = shard_for(key);
+    clock_type::time_point now = clock_type::now();
+    file_type cached;
+
+    if (capacity != 0)
+    {
+        std::lock_guard<std::mutex> lck(s.mtx);
+
+        auto it = s.index.find(key);
+        if (it != s.index.end())
+        {
+            s.lru.splice(s.lru.begin(), s.lru, it->second);
+
+            if (now - it->second->validated < std::chrono::milliseconds(revalidate_ms_))
+            {
+                return it->second->file;
+            }
+
+            cached = it->second->file;
+        }
+    }
+
+    std::string path = root + name;
+
+    if (cached != nullptr)
+    {
+        // the file is still the same, unless it was changed or replaced
+        struct stat st;
+        if ((::stat(path.c_str(), &st) == 0) && same_file(st, *cached))
+        {
+            std::lock_guard<std::mutex> lck(s.mtx);
+
+            auto it = s.index.find(key);
+            if ((it != s.index.end()) && (it->second->file == cached))
+            {
+                it->second->validated = now;
+            }
+
+            return cached;
+        }
+    }
+
+    std::shared_ptr<file> f(new file);
+
+    f->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (f->fd == -1)
+    {
+        erase(name);
+
+        return file_type();
+    }
+
+    struct stat st;
+    if ((::fstat(f->fd, &st) != 0) || (S_ISREG(st.st_mode) == false))
+    {
+        erase(name);
+
+        return file_type();
+    }
+
+    f->size = (std::uint64_t)st.st_size;
+    f->mtime = (std::int64_t)st.st_mtime;
+    f->device = (std::uint64_t)st.st_dev;
+    f->inode = (std::uint64_t)st.st_ino;
+    f->headers = headers(name, *f);
+
+    if (capacity != 0)
+    {
+        std::lock_guard<std::mutex> lck(s.mtx);
+
+        auto it = s.index.find(key);
+        if (it != s.index.end())
+        {
+            remove(s, it->second);
+        }
+
+        evict(s, capacity - 1);
+
+        s.lru.push_front(entry { key, f, now });
+        s.index[key] = s.lru.begin();
+    }
+
+    return f;
+}
+
+void open_file_cache::erase(const std::string & name)
+{
+    std::string key = normalized_path(name);
+    shard & s = shard_for(key);
+
+    std::lock_guard<std::mutex> lck(s.mtx);
+
+    auto it = s.index.find(key);
+    if (it != s.index.end())
+    {
+        remove(s, it->second);
+    }
+}
+
+void open_file_cache::clear()
+{
+    for (auto & sp : shards_)
+    {
+        std::lock_guard<std::mutex> lck(sp->mtx);
+
+        sp->index.clear();
+        sp->lru.clear();
+    }
+}
+
+void open_file_cache::set_limits(std::size_t capacity, std::chrono::milliseconds revalidate)
+{
+    std::size_t per_shard = (capacity + shards_.size() - 1) / shards_.size();
+
+    shard_capacity_ = per_shard;
+    revalidate_ms_ = revalidate.count();
+
+    for (auto & sp : shards_)
+    {
+        std::lock_guard<std::mutex> lck(sp->mtx);
+
+        evict(*sp, per_shard);
+    }
+}
+
+std::size_t open_file_cache::size() const
+{
+    std::size_t total = 0;
+
+    for (auto & sp : shards_)
+    {
+        std::lock_guard<std::mutex> lck(sp->mtx);
+
+        total += sp->lru.size();
+    }
+
+    return total;
+}
+
+#endif // WIN32
+
+single_flight::response_type single_flight::run(const std::string & key,
+    const producer_type & produce)
+{
+    std::shared_ptr<call> c;
+    bool leader = false;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        auto it = calls_.find(key);
+        if (it != calls_.end())
+        {
+            c = it->second;
+        }
+        else
+        {
+            c = std::make_shared<call>();
+            calls_[key] = c;
+            leader = true;
+        }
+    }
+
+    if (leader == false)
+    {
+        std::unique_lock<std::mutex> lck(c->mtx);
+
+        c->cv.wait(lck, [&c] { return c->done; });
+
+        if (c->error)
+        {
+            std::rethrow_exception(c->error);
+        }
+
+        return c->result;
+    }
+
+    response_type result;
+    std::exception_ptr error;
+
+    try
+    {
+        result = produce();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    {
+        // new callers start their own call from now on
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        calls_.erase(key);
+    }
+
+    {
+        std::lock_guard<std::mutex> lck(c->mtx);
+
+        c->result = result;
+        c->error = error;
+        c->done = true;
+    }
+
+    c->cv.notify_all();
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    return result;
+}
+
+std::string http::cache_key(const std::string & path, const std::string & params)
+{
+    // split "a=1&b=2" into fields and sort them by name,
+    // the names are compared in their encoded form
+    std::vector<std::string> fields;
+
+    std::size_t pos = 0;
+    while (pos < params.size())
+    {
+        std::size_t amp = params.find('&', pos);
+        if (amp == std::string::npos)
+        {
+            amp = params.size();
+        }
+
+        if (amp != pos)
+        {
+            fields.push_back(params.substr(pos, amp - pos));
+        }
+
+        pos = amp + 1;
+    }
+
+    // stable with regard to repeated names, so that the last one still wins
+    std::stable_sort(fields.begin(), fields.end(),
+        [](const std::string & a, const std::string & b)
+        {
+            return a.compare(0, a.find('='), b, 0, b.find('=')) < 0;
+        });
+
+    std::string key(path);
+    key.append(1, '?');
+
+    for (std::size_t i = 0; i != fields.size(); ++i)
+    {
+        if (i != 0)
+        {
+            key.append(1, '&');
+        }
+
+        key.append(fields[i]);
+    }
+
+    return key;
+}
@@ -0,0 +1,303 @@
+
+#include <http_chunked.h>
+
+#include <cstdio>
+#include <exception>
+#include <string>
+
+using namespace http;
+
+namespace // unnamed
+{
+
+// the longest chunk size accepted from the client (hex digits)
+const std::size_t max_chunk_size_digits = 15;
+
+// the longest chunk size line (with extensions) and trailer section,
+// as for the request line and header section
+const std::size_t max_line_length = 8 * 1024;
+const std::size_t max_trailer_size = 64 * 1024;
+
+int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+    {
+        return c - '0';
+    }
+    else if ((c >= 'a') && (c <= 'f'))
+    {
+        return c - 'a' + 10;
+    }
+    else if ((c >= 'A') && (c <= 'F'))
+    {
+        return c - 'A' + 10;
+    }
+    else
+    {
+        return -1;
+    }
+}
+
+// reads a single CRLF (or LF) terminated line of at most max_size bytes,
+// false if it is longer or truncated
+bool read_line(std::istream & in, std::string & line, std::size_t max_size = max_line_length)
+{
+    line.clear();
+
+    char c;
+    while (in.get(c))
+    {
+        if (c == '\n')
+        {
+            if ((line.empty() == false) && (line[line.size() - 1] == '\r'))
+            {
+                line.erase(line.size() - 1);
+            }
+
+            return true;
+        }
+
+        if (line.size() == max_size)
+        {
+            return false;
+        }
+
+        line.push_back(c);
+    }
+
+    return false;
+}
+
+} // unnamed namespace
+
+chunked_output_buffer::chunked_output_buffer(std::ostream & out, std::size_t buffer_size)
+    : out_(out), buf_(buffer_size != 0 ? buffer_size : 1), finished_(false),
+      uncaught_(std::uncaught_exceptions())
+{
+    setp(&buf_[0], &buf_[0] + buf_.size());
+}
+
+chunked_output_buffer::~chunked_output_buffer()
+{
+    try
+    {
+        if (std::uncaught_exceptions() > uncaught_)
+        {
+            fail();
+        }
+        else
+        {
+            finish();
+        }
+    }
+    catch (...)
+    {
+        // there is not much we can do with errors in this context
+    }
+}
+
+void chunked_output_buffer::write_chunk()
+{
+    std::size_t size = pptr() - pbase();
+    if (size == 0)
+    {
+        // zero-size chunk would terminate the body
+        return;
+    }
+
+    char size_line[24];
+    int n = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+
+    out_.write(size_line, n);
+    out_.write(pbase(), size);
+    out_.write("\r\n", 2);
+
+    setp(&buf_[0], &buf_[0] + buf_.size());
+}
+
+chunked_output_buffer::int_type chunked_output_buffer::overflow(int_type c)
+{
+    if (finished_)
+    {
+        return traits_type::eof();
+    }
+
+    write_chunk();
+
+    if (traits_type::eq_int_type(c, traits_type::eof()) == false)
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+int chunked_output_buffer::sync()
+{
+    if (finished_ == false)
+    {
+        write_chunk();
+    }
+
+    out_.flush();
+
+    return out_ ? 0 : -1;
+}
+
+void chunked_output_buffer::finish()
+{
+    if (finished_)
+    {
+        return;
+    }
+
+    write_chunk();
+    finished_ = true;
+    setp(NULL, NULL);
+
+    out_.write("0\r\n\r\n", 5);
+    out_.flush();
+}
+
+void chunked_output_buffer::fail()
+{
+    if (finished_)
+    {
+        return;
+    }
+
+    write_chunk();
+    finished_ = true;
+    setp(NULL, NULL);
+
+    out_.flush();
+    out_.setstate(std::ios_base::badbit);
+}
+
+chunked_input_buffer::chunked_input_buffer(std::istream & in, std::size_t buffer_size)
+    : in_(in), buf_(buffer_size != 0 ? buffer_size : 1),
+      chunk_remaining_(0), finished_(false), failed_(false)
+{
+    setg(&buf_[0], &buf_[0], &buf_[0]);
+}
+
+bool chunked_input_buffer::read_chunk_size()
+{
+    std::string line;
+    if (read_line(in_, line) == false)
+    {
+        return false;
+    }
+
+    std::size_t size = 0;
+    std::size_t digits = 0;
+    for (char c : line)
+    {
+        int v = hex_value(c);
+        if (v < 0)
+        {
+            // chunk extensions are ignored
+            break;
+        }
+
+        if (++digits > max_chunk_size_digits)
+        {
+            return false;
+        }
+
+        size = size * 16 + (std::size_t)v;
+    }
+
+    if (digits == 0)
+    {
+        return false;
+    }
+
+    if (size == 0)
+    {
+        // skip the trailer section up to the empty line
+        for (std::size_t trailers = 0; ; trailers += line.size() + 2)
+        {
+            if ((trailers > max_trailer_size) ||
+                (read_line(in_, line, max_trailer_size - trailers) == false))
+            {
+                return false;
+            }
+
+            if (line.empty())
+            {
+                break;
+            }
+        }
+
+        finished_ = true;
+    }
+
+    chunk_remaining_ = size;
+
+    return true;
+}
+
+chunked_input_buffer::int_type chunked_input_buffer::underflow()
+{
+    if (gptr() < egptr())
+    {
+        return traits_type::to_int_type(*gptr());
+    }
+
+    if (finished_ || failed_)
+    {
+        return traits_type::eof();
+    }
+
+    if (chunk_remaining_ == 0)
+    {
+        if (read_chunk_size() == false)
+        {
+            failed_ = true;
+            return traits_type::eof();
+        }
+
+        if (finished_)
+        {
+            return traits_type::eof();
+        }
+    }
+
+    std::size_t n = chunk_remaining_ < buf_.size() ? chunk_remaining_ : buf_.size();
+
+    in_.read(&buf_[0], n);
+    std::size_t readn = (std::size_t)in_.gcount();
+    if (readn == 0)
+    {
+        failed_ = true;
+        return traits_type::eof();
+    }
+
+    chunk_remaining_ -= readn;
+
+    if (chunk_remaining_ == 0)
+    {
+        // every chunk is followed by CRLF
+        std::string line;
+        if ((read_line(in_, line) == false) || (line.empty() == false))
+        {
+            failed_ = true;
+        }
+    }
+
+    setg(&buf_[0], &buf_[0], &buf_[0] + readn);
+
+    return traits_type::to_int_type(*gptr());
+}
+
+bool chunked_input_buffer::drain()
+{
+    while (traits_type::eq_int_type(underflow(), traits_type::eof()) == false)
+    {
+        setg(&buf_[0], egptr(), egptr());
+    }
+
+    return finished_ && (failed_ == false);
+}
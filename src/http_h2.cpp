@@ -0,0 +1,1768 @@
+
+#include <http_h2.h>
+#include <http_hpack.h>
+#include <http_server.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+using namespace http;
+using namespace http::h2_details;
+
+namespace // unnamed
+{
+
+const char client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const std::size_t client_preface_size = sizeof(client_preface) - 1;
+
+// frame types
+const unsigned char data_frame = 0x0;
+const unsigned char headers_frame = 0x1;
+const unsigned char priority_frame = 0x2;
+const unsigned char rst_stream_frame = 0x3;
+const unsigned char settings_frame = 0x4;
+const unsigned char push_promise_frame = 0x5;
+const unsigned char ping_frame = 0x6;
+const unsigned char goaway_frame = 0x7;
+const unsigned char window_update_frame = 0x8;
+const unsigned char continuation_frame = 0x9;
+
+// frame flags
+const unsigned char end_stream_flag = 0x1;
+const unsigned char ack_flag = 0x1;
+const unsigned char end_headers_flag = 0x4;
+const unsigned char padded_flag = 0x8;
+const unsigned char priority_flag = 0x20;
+
+// settings
+const std::uint16_t settings_enable_push = 0x2;
+const std::uint16_t settings_max_concurrent_streams = 0x3;
+const std::uint16_t settings_initial_window_size = 0x4;
+const std::uint16_t settings_max_frame_size = 0x5;
+
+// error codes
+const std::uint32_t no_error = 0x0;
+const std::uint32_t protocol_error = 0x1;
+const std::uint32_t internal_error = 0x2;
+const std::uint32_t flow_control_error = 0x3;
+const std::uint32_t frame_size_error = 0x6;
+const std::uint32_t refused_stream_error = 0x7;
+const std::uint32_t compression_error = 0x9;
+
+const std::size_t frame_header_size = 9;
+
+// frames are never larger than this unless the peer allows it
+const std::size_t default_frame_size = 16384;
+const std::size_t max_frame_size_limit = 16777215;
+
+const std::int64_t default_window_size = 65535;
+const std::int64_t max_window_size = 0x7fffffff;
+
+// limits announced to the client
+const std::uint32_t max_concurrent_streams = 256;
+const std::int64_t stream_receive_window = 256 * 1024;
+const std::int64_t connection_receive_window = 16 * 1024 * 1024;
+
+// header blocks split into many frames are limited as a whole
+const std::size_t max_header_block_size = 64 * 1024;
+
+// the longest response head (or chunk size line) accepted from the action
+const std::size_t max_response_head_size = 64 * 1024;
+
+// amount of response body collected before it is sent as DATA
+const std::size_t response_buffer_size = 16 * 1024;
+
+// error of the whole connection, reported to the client with GOAWAY
+class connection_error : public std::runtime_error
+{
+public:
+    connection_error(std::uint32_t code, const char * what)
+        : std::runtime_error(what), code_(code)
+    {
+    }
+
+    std::uint32_t code() const { return code_; }
+
+private:
+    std::uint32_t code_;
+};
+
+std::uint32_t read_uint32(const unsigned char * p)
+{
+    return ((std::uint32_t)p[0] << 24) | ((std::uint32_t)p[1] << 16) |
+        ((std::uint32_t)p[2] << 8) | (std::uint32_t)p[3];
+}
+
+void append_uint32(std::string & out, std::uint32_t value)
+{
+    out.push_back((char)(value >> 24));
+    out.push_back((char)(value >> 16));
+    out.push_back((char)(value >> 8));
+    out.push_back((char)value);
+}
+
+void append_frame_header(std::string & out, std::size_t length, unsigned char type,
+    unsigned char flags, std::uint32_t stream_id)
+{
+    out.push_back((char)(length >> 16));
+    out.push_back((char)(length >> 8));
+    out.push_back((char)length);
+    out.push_back((char)type);
+    out.push_back((char)flags);
+    append_uint32(out, stream_id & 0x7fffffff);
+}
+
+void append_setting(std::string & out, std::uint16_t id, std::uint32_t value)
+{
+    out.push_back((char)(id >> 8));
+    out.push_back((char)id);
+    append_uint32(out, value);
+}
+
+// removes the padding from the payload of DATA or HEADERS
+void strip_padding(unsigned char flags, const unsigned char * & p, std::size_t & size)
+{
+    if ((flags & padded_flag) == 0)
+    {
+        return;
+    }
+
+    if (size == 0)
+    {
+        throw connection_error(protocol_error, "invalid padding");
+    }
+
+    std::size_t padding = *p;
+    ++p;
+    --size;
+
+    if (padding > size)
+    {
+        throw connection_error(protocol_error, "invalid padding");
+    }
+
+    size -= padding;
+}
+
+// value of the HTTP2-Settings header, base64url without padding
+std::string base64url_decode(std::string_view s)
+{
+    std::string result;
+    std::uint32_t pending = 0;
+    int bits = 0;
+
+    for (char c : s)
+    {
+        int v;
+        if ((c >= 'A') && (c <= 'Z'))
+        {
+            v = c - 'A';
+        }
+        else if ((c >= 'a') && (c <= 'z'))
+        {
+            v = c - 'a' + 26;
+        }
+        else if ((c >= '0') && (c <= '9'))
+        {
+            v = c - '0' + 52;
+        }
+        else if ((c == '-') || (c == '+'))
+        {
+            v = 62;
+        }
+        else if ((c == '_') || (c == '/'))
+        {
+            v = 63;
+        }
+        else
+        {
+            continue;
+        }
+
+        pending = (pending << 6) | (std::uint32_t)v;
+        bits += 6;
+
+        if (bits >= 8)
+        {
+            bits -= 8;
+            result.push_back((char)(pending >> bits));
+            pending &= (std::uint32_t(1) << bits) - 1;
+        }
+    }
+
+    return result;
+}
+
+std::string_view trim(std::string_view s)
+{
+    while ((s.empty() == false) && ((s.front() == ' ') || (s.front() == '\t')))
+    {
+        s.remove_prefix(1);
+    }
+
+    while ((s.empty() == false) && ((s.back() == ' ') || (s.back() == '\t') ||
+        (s.back() == '\r')))
+    {
+        s.remove_suffix(1);
+    }
+
+    return s;
+}
+
+// headers of the HTTP/1.1 response that describe the connection
+// and are not allowed in HTTP/2
+bool is_connection_specific(std::string_view name)
+{
+    return (name == "connection") || (name == "keep-alive") ||
+        (name == "proxy-connection") || (name == "transfer-encoding") ||
+        (name == "upgrade") || (name == "te");
+}
+
+// the request fields must be well-formed (RFC 9113, section 8.2), they are passed
+// to the actions and the proxy in the HTTP/1.1 format, which has no other escaping
+bool valid_request_field(const header_field & f, bool & regular_seen)
+{
+    std::string_view name = f.first;
+
+    if ((name.empty() == false) && (name[0] == ':'))
+    {
+        // the pseudo-header fields precede the regular ones
+        if (regular_seen)
+        {
+            return false;
+        }
+
+        name.remove_prefix(1);
+    }
+    else
+    {
+        regular_seen = true;
+
+        if (is_connection_specific(name) && ((name != "te") || (f.second != "trailers")))
+        {
+            return false;
+        }
+    }
+
+    if (name.empty())
+    {
+        return false;
+    }
+
+    for (char c : name)
+    {
+        unsigned char u = (unsigned char)c;
+        if ((u <= 0x20) || (u >= 0x7f) || (c == ':') || ((c >= 'A') && (c <= 'Z')))
+        {
+            return false;
+        }
+    }
+
+    if (f.second.find_first_of(std::string_view("\r\n\0", 3)) != std::string::npos)
+    {
+        return false;
+    }
+
+    if (f.first == ":path")
+    {
+        // the origin form (or the asterisk of OPTIONS), no whitespace or controls
+        if ((f.second.empty() || (f.second[0] != '/')) && (f.second != "*"))
+        {
+            return false;
+        }
+
+        for (char c : f.second)
+        {
+            unsigned char u = (unsigned char)c;
+            if ((u <= 0x20) || (u == 0x7f))
+            {
+                return false;
+            }
+        }
+    }
+    else if ((f.first[0] == ':') && (f.first != ":method") && (f.first != ":scheme") &&
+        (f.first != ":authority"))
+    {
+        // the pseudo-header fields of the responses or unknown ones
+        return false;
+    }
+
+    return true;
+}
+
+// state of the single stream, guarded by the mutex of the connection
+// (except for the request, which is not changed after the stream was opened)
+struct stream
+{
+    explicit stream(std::uint32_t stream_id)
+        : id(stream_id), send_window(0), receive_window(stream_receive_window),
+          consumed(0), remote_closed(false), reset(false)
+    {
+    }
+
+    std::uint32_t id;
+    stream_request request;
+    std::thread worker;
+
+    // signalled whenever anything below changes
+    std::condition_variable cv;
+
+    std::int64_t send_window;
+    std::int64_t receive_window; // how much the client can still send
+    std::size_t consumed;        // not yet returned to the client with WINDOW_UPDATE
+
+    std::deque<std::string> body; // received but not read by the action yet
+    bool remote_closed;           // the whole request was received
+    bool reset;                   // RST_STREAM was sent or received
+};
+
+class connection
+{
+public:
+    connection(std::istream & in, const write_function & write,
+        const stream_handler & handler, const wait_handler & waiting,
+        const connection_options & options)
+        : in_(in), write_(write), handler_(handler), waiting_(waiting), options_(options),
+          max_frame_size_(default_frame_size), send_window_(default_window_size),
+          initial_send_window_(default_window_size), received_(0), last_stream_id_(0),
+          closed_(false), going_away_(false), goaway_sent_(false), write_failed_(false),
+          header_stream_(0), header_flags_(0), continuation_expected_(false)
+    {
+    }
+
+    void run();
+
+    // sends the header block (if not empty) followed by the body,
+    // as the send windows allow; throws if the stream was reset
+    void send_response(stream & s, const std::string & block,
+        const char * data, std::size_t size, bool end_stream);
+
+    // waits for the next part of the request body, false at its end
+    bool read_body(stream & s, std::string & chunk);
+
+private:
+    // not for use
+    connection(const connection &);
+    void operator=(const connection &);
+
+    bool read_exactly(void * buf, std::size_t size);
+    bool read_preface();
+    bool read_frame();
+
+    void on_data(unsigned char flags, std::uint32_t id, const unsigned char * p, std::size_t size);
+    void on_headers(unsigned char flags, std::uint32_t id, const unsigned char * p, std::size_t size);
+    void on_continuation(unsigned char flags, std::uint32_t id,
+        const unsigned char * p, std::size_t size);
+    void on_settings(unsigned char flags, std::uint32_t id, const unsigned char * p, std::size_t size);
+    void on_window_update(std::uint32_t id, const unsigned char * p, std::size_t size);
+    void on_rst_stream(std::uint32_t id, std::size_t size);
+    void on_ping(unsigned char flags, std::uint32_t id, const unsigned char * p, std::size_t size);
+
+    void complete_headers();
+    void apply_settings(const unsigned char * p, std::size_t size);
+    void open_stream(std::uint32_t id, const stream_request & request, bool remote_closed);
+    void run_stream(std::shared_ptr<stream> s);
+    void join_finished_workers();
+    void close();
+
+    void append_headers(std::string & frames, std::uint32_t id,
+        const std::string & block, bool end_stream);
+    void write_frames(const std::string & frames);
+    void send_reset(stream & s, std::uint32_t code);
+    void send_reset(std::uint32_t id, std::uint32_t code);
+    void send_window_update(std::uint32_t id, std::uint32_t increment);
+    void go_away(std::uint32_t code);
+
+    std::istream & in_;
+    const write_function & write_;
+    const stream_handler & handler_;
+    const wait_handler & waiting_;
+    const connection_options & options_;
+
+    hpack_decoder decoder_; // used only by the reading thread
+
+    std::mutex mtx_;
+    std::condition_variable done_cv_; // signalled when the stream finishes
+    std::map<std::uint32_t, std::shared_ptr<stream> > streams_;
+    std::vector<std::thread> finished_workers_;
+    std::atomic<std::size_t> max_frame_size_;
+    std::int64_t send_window_;
+    std::int64_t initial_send_window_;
+    std::int64_t received_; // not yet returned to the client with WINDOW_UPDATE
+    std::uint32_t last_stream_id_;
+    bool closed_;
+    bool going_away_;
+
+    // serializes the frames written by all streams
+    std::mutex write_mtx_;
+    bool goaway_sent_;
+    bool write_failed_;
+
+    // header block being received in many frames
+    std::vector<unsigned char> payload_;
+    std::vector<unsigned char> header_block_;
+    std::uint32_t header_stream_;
+    unsigned char header_flags_;
+    bool continuation_expected_;
+};
+
+// input stream buffer with the request body received in DATA frames
+class body_buffer : public std::streambuf
+{
+public:
+    body_buffer(connection & c, stream & s)
+        : connection_(c), stream_(s)
+    {
+    }
+
+protected:
+    int_type underflow()
+    {
+        if (connection_.read_body(stream_, chunk_) == false)
+        {
+            return traits_type::eof();
+        }
+
+        setg(&chunk_[0], &chunk_[0], &chunk_[0] + chunk_.size());
+
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    // not for use
+    body_buffer(const body_buffer &);
+    void operator=(const body_buffer &);
+
+    connection & connection_;
+    stream & stream_;
+    std::string chunk_;
+};
+
+// output stream buffer translating the HTTP/1.1 response written by the action
+// into HEADERS and DATA frames: the status line and headers become the header
+// block, the body is unwrapped from its chunked encoding (if any)
+class response_buffer : public std::streambuf
+{
+public:
+    response_buffer(connection & c, stream & s)
+        : connection_(c), stream_(s), buf_(response_buffer_size),
+          state_(head_state), remaining_(0), length_known_(false), chunked_(false)
+    {
+        setp(buf_.data(), buf_.data() + buf_.size());
+    }
+
+    // sends the rest of the response, ending the stream
+    void finish();
+
+protected:
+    int_type overflow(int_type c);
+    int sync();
+
+private:
+    // not for use
+    response_buffer(const response_buffer &);
+    void operator=(const response_buffer &);
+
+    enum parse_state
+    {
+        head_state, body_state, chunk_size_state, chunk_data_state,
+        chunk_end_state, trailer_state, done_state
+    };
+
+    void consume(const char * p, std::size_t n);
+    void consume_buffer();
+    bool parse_head();
+    void send(bool end_stream);
+
+    connection & connection_;
+    stream & stream_;
+    std::vector<char> buf_;
+
+    parse_state state_;
+    std::string head_;    // status line and headers being collected
+    std::string line_;    // chunk size or trailer line being collected
+    std::string block_;   // encoded header block, until it is sent
+    std::string body_;    // body to be sent in the next DATA frames
+    std::size_t remaining_;
+    bool length_known_;
+    bool chunked_;
+};
+
+response_buffer::int_type response_buffer::overflow(int_type c)
+{
+    consume_buffer();
+
+    if (c != traits_type::eof())
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+int response_buffer::sync()
+{
+    consume_buffer();
+
+    // the complete response is sent at once by finish()
+    if ((state_ != head_state) && (state_ != done_state) &&
+        ((body_.empty() == false) || (block_.empty() == false)))
+    {
+        send(false);
+    }
+
+    return 0;
+}
+
+void response_buffer::consume_buffer()
+{
+    consume(pbase(), pptr() - pbase());
+
+    setp(buf_.data(), buf_.data() + buf_.size());
+}
+
+void response_buffer::consume(const char * p, std::size_t n)
+{
+    while (n != 0)
+    {
+        switch (state_)
+        {
+        case head_state:
+            {
+                std::size_t old_size = head_.size();
+                head_.append(p, n);
+
+                std::size_t end = head_.find("\r\n\r\n", (old_size >= 3) ? old_size - 3 : 0);
+                if (end == std::string::npos)
+                {
+                    if (head_.size() > max_response_head_size)
+                    {
+                        throw std::runtime_error("response head too large");
+                    }
+
+                    n = 0;
+                    break;
+                }
+
+                std::size_t used = end + 4 - old_size;
+                p += used;
+                n -= used;
+
+                // the last header line keeps its line terminator
+                head_.resize(end + 2);
+
+                if (parse_head())
+                {
+                    if (chunked_)
+                    {
+                        state_ = chunk_size_state;
+                    }
+                    else if (length_known_ && (remaining_ == 0))
+                    {
+                        state_ = done_state;
+                    }
+                    else
+                    {
+                        state_ = body_state;
+                    }
+                }
+
+                head_.clear();
+            }
+            break;
+
+        case body_state:
+            {
+                std::size_t k = length_known_ ? std::min(n, remaining_) : n;
+
+                body_.append(p, k);
+                p += k;
+                n -= k;
+
+                if (length_known_)
+                {
+                    remaining_ -= k;
+                    if (remaining_ == 0)
+                    {
+                        state_ = done_state;
+                    }
+                }
+            }
+            break;
+
+        case chunk_size_state:
+        case trailer_state:
+            {
+                const char * eol = (const char *)std::memchr(p, '\n', n);
+                std::size_t k = (eol != NULL) ? (std::size_t)(eol - p) + 1 : n;
+
+                line_.append(p, k);
+                p += k;
+                n -= k;
+
+                if (eol == NULL)
+                {
+                    if (line_.size() > max_response_head_size)
+                    {
+                        throw std::runtime_error("chunk size line too long");
+                    }
+
+                    break;
+                }
+
+                if (state_ == chunk_size_state)
+                {
+                    remaining_ = (std::size_t)std::strtoull(line_.c_str(), NULL, 16);
+                    state_ = (remaining_ == 0) ? trailer_state : chunk_data_state;
+                }
+                else if ((line_ == "\r\n") || (line_ == "\n"))
+                {
+                    // trailer fields are not forwarded
+                    state_ = done_state;
+                }
+
+                line_.clear();
+            }
+            break;
+
+        case chunk_data_state:
+            {
+                std::size_t k = std::min(n, remaining_);
+
+                body_.append(p, k);
+                p += k;
+                n -= k;
+
+                remaining_ -= k;
+                if (remaining_ == 0)
+                {
+                    state_ = chunk_end_state;
+                }
+            }
+            break;
+
+        case chunk_end_state:
+            {
+                const char * eol = (const char *)std::memchr(p, '\n', n);
+                std::size_t k = (eol != NULL) ? (std::size_t)(eol - p) + 1 : n;
+
+                p += k;
+                n -= k;
+
+                if (eol != NULL)
+                {
+                    state_ = chunk_size_state;
+                }
+            }
+            break;
+
+        case done_state:
+            // anything after the end of the response is ignored
+            n = 0;
+            break;
+        }
+
+        if (body_.size() >= response_buffer_size)
+        {
+            send(false);
+        }
+    }
+}
+
+bool response_buffer::parse_head()
+{
+    std::string_view head(head_);
+
+    std::size_t eol = head.find("\r\n");
+    std::string_view status_line = head.substr(0, eol);
+    head.remove_prefix(eol + 2);
+
+    int status = 0;
+    std::size_t pos = status_line.find(' ');
+    if (pos != std::string_view::npos)
+    {
+        status = std::atoi(std::string(status_line.substr(pos + 1, 3)).c_str());
+    }
+
+    if ((status >= 100) && (status < 200))
+    {
+        // informational responses (like 100 Continue) are not relayed
+        return false;
+    }
+
+    if ((status < 200) || (status > 999))
+    {
+        status = 500;
+    }
+
+    hpack_encoder::encode(":status", std::to_string(status), block_);
+
+    std::string name;
+
+    while (head.empty() == false)
+    {
+        eol = head.find("\r\n");
+        std::string_view line = head.substr(0, eol);
+        head.remove_prefix(eol + 2);
+
+        std::size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+        {
+            continue;
+        }
+
+        // field names are lowercase in HTTP/2
+        std::string_view n = trim(line.substr(0, colon));
+        name.resize(n.size());
+        std::transform(n.begin(), n.end(), name.begin(),
+            [](char c) { return (char)std::tolower((unsigned char)c); });
+
+        std::string_view value = trim(line.substr(colon + 1));
+
+        if (name == "transfer-encoding")
+        {
+            chunked_ = (value.find("chunked") != std::string_view::npos);
+            continue;
+        }
+
+        if (is_connection_specific(name))
+        {
+            continue;
+        }
+
+        if (name == "content-length")
+        {
+            length_known_ = true;
+            remaining_ = (std::size_t)std::strtoull(std::string(value).c_str(), NULL, 10);
+        }
+
+        hpack_encoder::encode(name, value, block_);
+    }
+
+    if ((status == 204) || (status == 304))
+    {
+        length_known_ = true;
+        remaining_ = 0;
+        chunked_ = false;
+    }
+
+    return true;
+}
+
+void response_buffer::send(bool end_stream)
+{
+    connection_.send_response(stream_, block_, body_.data(), body_.size(), end_stream);
+
+    block_.clear();
+    body_.clear();
+}
+
+void response_buffer::finish()
+{
+    consume_buffer();
+
+    if (state_ == head_state)
+    {
+        // the action did not produce the complete response
+        block_.clear();
+        body_.clear();
+
+        hpack_encoder::encode(":status", "500", block_);
+    }
+    else if ((state_ != done_state) && (chunked_ || length_known_))
+    {
+        // the body is truncated, the client must not take it as complete
+        send(false);
+
+        throw std::runtime_error("response body truncated");
+    }
+
+    send(true);
+}
+
+void connection::run()
+{
+    try
+    {
+        // the server preface, followed by the enlargement of the connection window
+        std::string frames;
+        append_frame_header(frames, 18, settings_frame, 0, 0);
+        append_setting(frames, settings_max_concurrent_streams, max_concurrent_streams);
+        append_setting(frames, settings_initial_window_size, (std::uint32_t)stream_receive_window);
+        append_setting(frames, settings_enable_push, 0);
+        append_frame_header(frames, 4, window_update_frame, 0, 0);
+        append_uint32(frames, (std::uint32_t)(connection_receive_window - default_window_size));
+        write_frames(frames);
+
+        if (options_.upgrade != nullptr)
+        {
+            // the upgraded request implicitly opens (and half-closes) the stream 1
+            std::string settings = base64url_decode(options_.upgrade_settings);
+            apply_settings((const unsigned char *)settings.data(), settings.size());
+
+            last_stream_id_ = 1;
+            open_stream(1, *options_.upgrade, true);
+        }
+
+        if (read_preface() == false)
+        {
+            throw connection_error(protocol_error, "invalid connection preface");
+        }
+
+        while (true)
+        {
+            bool going_away;
+            std::size_t open;
+
+            {
+                std::lock_guard<std::mutex> lck(mtx_);
+
+                going_away = going_away_;
+                open = streams_.size();
+            }
+
+            if ((going_away == false) && waiting_ && (waiting_(open) == false))
+            {
+                go_away(no_error);
+            }
+
+            {
+                std::lock_guard<std::mutex> lck(mtx_);
+
+                if (going_away_ && streams_.empty())
+                {
+                    break;
+                }
+            }
+
+            if (read_frame() == false)
+            {
+                break;
+            }
+        }
+    }
+    catch (const connection_error & e)
+    {
+        try
+        {
+            go_away(e.code());
+        }
+        catch (...)
+        {
+            // the connection is broken anyway
+        }
+    }
+    catch (...)
+    {
+        // the connection is broken
+    }
+
+    close();
+}
+
+bool connection::read_exactly(void * buf, std::size_t size)
+{
+    in_.read((char *)buf, (std::streamsize)size);
+
+    return (in_.gcount() == (std::streamsize)size);
+}
+
+bool connection::read_preface()
+{
+    const char * expected = client_preface;
+    std::size_t size = client_preface_size;
+
+    if (options_.request_line_received)
+    {
+        // the request line and its terminator were consumed
+        std::size_t consumed = preface_request_line.size() + 2;
+
+        expected += consumed;
+        size -= consumed;
+    }
+
+    char buf[client_preface_size];
+    if (read_exactly(buf, size) == false)
+    {
+        return false;
+    }
+
+    return std::memcmp(buf, expected, size) == 0;
+}
+
+bool connection::read_frame()
+{
+    unsigned char header[frame_header_size];
+    if (read_exactly(header, frame_header_size) == false)
+    {
+        return false;
+    }
+
+    std::size_t length = ((std::size_t)header[0] << 16) | ((std::size_t)header[1] << 8) | header[2];
+    unsigned char type = header[3];
+    unsigned char flags = header[4];
+    std::uint32_t id = read_uint32(header + 5) & 0x7fffffff;
+
+    if (length > default_frame_size)
+    {
+        throw connection_error(frame_size_error, "frame too large");
+    }
+
+    payload_.resize(length);
+    if ((length != 0) && (read_exactly(payload_.data(), length) == false))
+    {
+        return false;
+    }
+
+    if (continuation_expected_ && ((type != continuation_frame) || (id != header_stream_)))
+    {
+        throw connection_error(protocol_error, "CONTINUATION expected");
+    }
+
+    const unsigned char * p = payload_.data();
+
+    switch (type)
+    {
+    case data_frame:
+        on_data(flags, id, p, length);
+        break;
+
+    case headers_frame:
+        on_headers(flags, id, p, length);
+        break;
+
+    case priority_frame:
+        // all streams are served concurrently, the priorities are ignored
+        if (length != 5)
+        {
+            throw connection_error(frame_size_error, "invalid PRIORITY");
+        }
+        break;
+
+    case rst_stream_frame:
+        on_rst_stream(id, length);
+        break;
+
+    case settings_frame:
+        on_settings(flags, id, p, length);
+        break;
+
+    case push_promise_frame:
+        throw connection_error(protocol_error, "PUSH_PROMISE from the client");
+
+    case ping_frame:
+        on_ping(flags, id, p, length);
+        break;
+
+    case goaway_frame:
+        {
+            // the client does not open new streams, the current ones are finished
+            std::lock_guard<std::mutex> lck(mtx_);
+
+            going_away_ = true;
+        }
+        break;
+
+    case window_update_frame:
+        on_window_update(id, p, length);
+        break;
+
+    case continuation_frame:
+        on_continuation(flags, id, p, length);
+        break;
+
+    default:
+        // unknown frame types are ignored
+        break;
+    }
+
+    return true;
+}
+
+void connection::on_data(unsigned char flags, std::uint32_t id,
+    const unsigned char * p, std::size_t size)
+{
+    if (id == 0)
+    {
+        throw connection_error(protocol_error, "DATA on stream 0");
+    }
+
+    std::size_t length = size;
+    strip_padding(flags, p, size);
+
+    // the connection window is returned at once, the stream window
+    // only as the action reads the body, which limits the buffering
+    std::uint32_t connection_update = 0;
+
+    received_ += (std::int64_t)length;
+    if (received_ >= connection_receive_window / 2)
+    {
+        connection_update = (std::uint32_t)received_;
+        received_ = 0;
+    }
+
+    bool violated = false;
+    std::shared_ptr<stream> s;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        auto it = streams_.find(id);
+        if ((it != streams_.end()) && (it->second->remote_closed == false) &&
+            (it->second->reset == false))
+        {
+            s = it->second;
+
+            s->receive_window -= (std::int64_t)length;
+            if (s->receive_window < 0)
+            {
+                violated = true;
+            }
+            else
+            {
+                if (size != 0)
+                {
+                    s->body.emplace_back((const char *)p, size);
+                }
+
+                // the padding is consumed right away
+                s->consumed += length - size;
+
+                if ((flags & end_stream_flag) != 0)
+                {
+                    s->remote_closed = true;
+                }
+
+                s->cv.notify_all();
+            }
+        }
+    }
+
+    if (connection_update != 0)
+    {
+        send_window_update(0, connection_update);
+    }
+
+    if (violated)
+    {
+        send_reset(*s, flow_control_error);
+    }
+}
+
+void connection::on_headers(unsigned char flags, std::uint32_t id,
+    const unsigned char * p, std::size_t size)
+{
+    if ((id == 0) || ((id & 1) == 0))
+    {
+        throw connection_error(protocol_error, "invalid stream of HEADERS");
+    }
+
+    strip_padding(flags, p, size);
+
+    if ((flags & priority_flag) != 0)
+    {
+        if (size < 5)
+        {
+            throw connection_error(protocol_error, "invalid HEADERS");
+        }
+
+        p += 5;
+        size -= 5;
+    }
+
+    header_block_.assign(p, p + size);
+    header_stream_ = id;
+    header_flags_ = flags;
+
+    if ((flags & end_headers_flag) != 0)
+    {
+        complete_headers();
+    }
+    else
+    {
+        continuation_expected_ = true;
+    }
+}
+
+void connection::on_continuation(unsigned char flags, std::uint32_t id,
+    const unsigned char * p, std::size_t size)
+{
+    if ((continuation_expected_ == false) || (id != header_stream_))
+    {
+        throw connection_error(protocol_error, "unexpected CONTINUATION");
+    }
+
+    if (header_block_.size() + size > max_header_block_size)
+    {
+        throw connection_error(protocol_error, "header block too large");
+    }
+
+    header_block_.insert(header_block_.end(), p, p + size);
+
+    if ((flags & end_headers_flag) != 0)
+    {
+        continuation_expected_ = false;
+
+        complete_headers();
+    }
+}
+
+void connection::complete_headers()
+{
+    std::vector<header_field> fields;
+
+    // the block must be decoded even if the stream is refused,
+    // so that the dynamic table stays in sync with the client
+    try
+    {
+        decoder_.decode(header_block_.data(), header_block_.size(), fields);
+    }
+    catch (const std::runtime_error & e)
+    {
+        throw connection_error(compression_error, e.what());
+    }
+
+    std::uint32_t id = header_stream_;
+    bool end_stream = ((header_flags_ & end_stream_flag) != 0);
+
+    join_finished_workers();
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        auto it = streams_.find(id);
+        if (it != streams_.end())
+        {
+            // trailer fields end the request body, they are not passed to the action
+            it->second->remote_closed = true;
+            it->second->cv.notify_all();
+
+            return;
+        }
+
+        if (id <= last_stream_id_)
+        {
+            // the stream was already closed
+            return;
+        }
+
+        last_stream_id_ = id;
+
+        if (going_away_)
+        {
+            return;
+        }
+
+        if (streams_.size() >= max_concurrent_streams)
+        {
+            // handled below, without the lock
+            id = 0;
+        }
+    }
+
+    if (id == 0)
+    {
+        send_reset(header_stream_, refused_stream_error);
+
+        return;
+    }
+
+    stream_request request;
+    request.content_length = end_stream ? 0 : unknown_content_length;
+    request.has_body = (end_stream == false);
+
+    std::string_view authority;
+    bool host = false;
+    bool regular_seen = false;
+
+    for (const header_field & f : fields)
+    {
+        if (valid_request_field(f, regular_seen) == false)
+        {
+            send_reset(id, protocol_error);
+
+            return;
+        }
+
+        if ((f.first.empty() == false) && (f.first[0] == ':'))
+        {
+            if (f.first == ":method")
+            {
+                request.method = f.second;
+            }
+            else if (f.first == ":path")
+            {
+                request.resource = f.second;
+            }
+            else if (f.first == ":authority")
+            {
+                authority = f.second;
+            }
+
+            continue;
+        }
+
+        if (f.first == "content-type")
+        {
+            request.content_type = f.second;
+        }
+        else if ((f.first == "content-length") && (end_stream == false))
+        {
+            request.content_length = (std::size_t)std::strtoull(f.second.c_str(), NULL, 10);
+        }
+        else if (f.first == "host")
+        {
+            host = true;
+        }
+
+        request.headers.append(f.first).append(": ").append(f.second).append("\r\n");
+    }
+
+    if ((host == false) && (authority.empty() == false))
+    {
+        request.headers.insert(0, "host: " + std::string(authority) + "\r\n");
+    }
+
+    if (request.method.empty() || request.resource.empty() ||
+        ((request.resource == "*") && (request.method != "OPTIONS")))
+    {
+        send_reset(id, protocol_error);
+
+        return;
+    }
+
+    open_stream(id, request, end_stream);
+}
+
+void connection::on_settings(unsigned char flags, std::uint32_t id,
+    const unsigned char * p, std::size_t size)
+{
+    if (id != 0)
+    {
+        throw connection_error(protocol_error, "SETTINGS on a stream");
+    }
+
+    if ((flags & ack_flag) != 0)
+    {
+        if (size != 0)
+        {
+            throw connection_error(frame_size_error, "invalid SETTINGS acknowledgement");
+        }
+
+        return;
+    }
+
+    if (size % 6 != 0)
+    {
+        throw connection_error(frame_size_error, "invalid SETTINGS");
+    }
+
+    apply_settings(p, size);
+
+    std::string frame;
+    append_frame_header(frame, 0, settings_frame, ack_flag, 0);
+    write_frames(frame);
+}
+
+void connection::apply_settings(const unsigned char * p, std::size_t size)
+{
+    for (; size >= 6; p += 6, size -= 6)
+    {
+        std::uint16_t id = (std::uint16_t)((p[0] << 8) | p[1]);
+        std::uint32_t value = read_uint32(p + 2);
+
+        if (id == settings_initial_window_size)
+        {
+            if (value > max_window_size)
+            {
+                throw connection_error(flow_control_error, "invalid initial window size");
+            }
+
+            // applies to the streams in progress as well
+            std::lock_guard<std::mutex> lck(mtx_);
+
+            std::int64_t delta = (std::int64_t)value - initial_send_window_;
+            initial_send_window_ = value;
+
+            for (auto & it : streams_)
+            {
+                it.second->send_window += delta;
+                it.second->cv.notify_all();
+            }
+        }
+        else if (id == settings_max_frame_size)
+        {
+            if ((value < default_frame_size) || (value > max_frame_size_limit))
+            {
+                throw connection_error(protocol_error, "invalid maximum frame size");
+            }
+
+            max_frame_size_ = value;
+        }
+
+        // the encoder does not use the dynamic table, nothing is pushed,
+        // and the server does not open streams, so the rest is irrelevant
+    }
+}
+
+void connection::on_window_update(std::uint32_t id, const unsigned char * p, std::size_t size)
+{
+    if (size != 4)
+    {
+        throw connection_error(frame_size_error, "invalid WINDOW_UPDATE");
+    }
+
+    std::int64_t increment = read_uint32(p) & 0x7fffffff;
+
+    if (id == 0)
+    {
+        if (increment == 0)
+        {
+            throw connection_error(protocol_error, "invalid WINDOW_UPDATE");
+        }
+
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        send_window_ += increment;
+        if (send_window_ > max_window_size)
+        {
+            throw connection_error(flow_control_error, "connection window too large");
+        }
+
+        for (auto & it : streams_)
+        {
+            it.second->cv.notify_all();
+        }
+
+        return;
+    }
+
+    std::shared_ptr<stream> s;
+    bool violated = false;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        auto it = streams_.find(id);
+        if (it == streams_.end())
+        {
+            return;
+        }
+
+        s = it->second;
+        s->send_window += increment;
+        violated = (increment == 0) || (s->send_window > max_window_size);
+
+        s->cv.notify_all();
+    }
+
+    if (violated)
+    {
+        send_reset(*s, (increment == 0) ? protocol_error : flow_control_error);
+    }
+}
+
+void connection::on_rst_stream(std::uint32_t id, std::size_t size)
+{
+    if (size != 4)
+    {
+        throw connection_error(frame_size_error, "invalid RST_STREAM");
+    }
+
+    if (id == 0)
+    {
+        throw connection_error(protocol_error, "RST_STREAM on stream 0");
+    }
+
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    auto it = streams_.find(id);
+    if (it != streams_.end())
+    {
+        it->second->reset = true;
+        it->second->cv.notify_all();
+    }
+}
+
+void connection::on_ping(unsigned char flags, std::uint32_t id,
+    const unsigned char * p, std::size_t size)
+{
+    if (size != 8)
+    {
+        throw connection_error(frame_size_error, "invalid PING");
+    }
+
+    if (id != 0)
+    {
+        throw connection_error(protocol_error, "PING on a stream");
+    }
+
+    if ((flags & ack_flag) == 0)
+    {
+        std::string frame;
+        append_frame_header(frame, 8, ping_frame, ack_flag, 0);
+        frame.append((const char *)p, 8);
+        write_frames(frame);
+    }
+}
+
+void connection::open_stream(std::uint32_t id, const stream_request & request, bool remote_closed)
+{
+    std::shared_ptr<stream> s(new stream(id));
+    s->request = request;
+    s->remote_closed = remote_closed;
+
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    s->send_window = initial_send_window_;
+    streams_[id] = s;
+
+    try
+    {
+        // the worker cannot finish before it is stored, as it needs the lock
+        s->worker = std::thread(&connection::run_stream, this, s);
+    }
+    catch (...)
+    {
+        streams_.erase(id);
+
+        throw;
+    }
+}
+
+void connection::run_stream(std::shared_ptr<stream> s)
+{
+    try
+    {
+        body_buffer body_buf(*this, *s);
+        std::istream body(&body_buf);
+
+        response_buffer response(*this, *s);
+        std::ostream out(&response);
+
+        handler_(s->request, body, out);
+
+        out.flush();
+        response.finish();
+    }
+    catch (...)
+    {
+        try
+        {
+            send_reset(*s, internal_error);
+        }
+        catch (...)
+        {
+            // the connection is broken
+        }
+    }
+
+    bool unread_body = false;
+    bool last = false;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        // the response is complete, the rest of the request is not needed
+        if ((s->remote_closed == false) && (s->reset == false) && (closed_ == false))
+        {
+            s->reset = true;
+            unread_body = true;
+        }
+
+        finished_workers_.push_back(std::move(s->worker));
+        streams_.erase(s->id);
+
+        last = going_away_ && streams_.empty();
+
+        done_cv_.notify_all();
+    }
+
+    try
+    {
+        if (unread_body)
+        {
+            send_reset(s->id, no_error);
+        }
+    }
+    catch (...)
+    {
+        // the connection is broken
+    }
+
+    if (last && options_.shutdown)
+    {
+        // wakes up the reading thread to close the connection
+        options_.shutdown();
+    }
+}
+
+void connection::join_finished_workers()
+{
+    std::vector<std::thread> finished;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        finished.swap(finished_workers_);
+    }
+
+    for (std::thread & t : finished)
+    {
+        t.join();
+    }
+}
+
+void connection::close()
+{
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+
+        closed_ = true;
+
+        for (auto & it : streams_)
+        {
+            it.second->cv.notify_all();
+        }
+
+        done_cv_.wait(lck, [this]() { return streams_.empty(); });
+    }
+
+    join_finished_workers();
+}
+
+void connection::send_response(stream & s, const std::string & block,
+    const char * data, std::size_t size, bool end_stream)
+{
+    std::string frames;
+
+    if (block.empty() == false)
+    {
+        append_headers(frames, s.id, block, end_stream && (size == 0));
+    }
+    else if (size == 0)
+    {
+        if (end_stream)
+        {
+            append_frame_header(frames, 0, data_frame, end_stream_flag, s.id);
+        }
+    }
+
+    // the header block goes out together with the first DATA frame
+    do
+    {
+        std::size_t n = 0;
+
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+
+            if (size != 0)
+            {
+                s.cv.wait(lck, [this, &s]()
+                {
+                    return closed_ || s.reset || ((s.send_window > 0) && (send_window_ > 0));
+                });
+            }
+
+            if (closed_ || s.reset)
+            {
+                throw std::runtime_error("stream reset");
+            }
+
+            n = std::min(size, (std::size_t)max_frame_size_);
+            n = std::min(n, (std::size_t)std::min(s.send_window, send_window_));
+
+            s.send_window -= (std::int64_t)n;
+            send_window_ -= (std::int64_t)n;
+        }
+
+        if (n != 0)
+        {
+            append_frame_header(frames, n, data_frame,
+                (end_stream && (n == size)) ? end_stream_flag : 0, s.id);
+            frames.append(data, n);
+
+            data += n;
+            size -= n;
+        }
+
+        if (frames.empty() == false)
+        {
+            write_frames(frames);
+            frames.clear();
+        }
+    }
+    while (size != 0);
+}
+
+bool connection::read_body(stream & s, std::string & chunk)
+{
+    std::uint32_t update = 0;
+
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+
+        s.cv.wait(lck, [this, &s]()
+        {
+            return closed_ || s.reset || s.remote_closed || (s.body.empty() == false);
+        });
+
+        if (closed_ || s.reset || s.body.empty())
+        {
+            return false;
+        }
+
+        chunk.swap(s.body.front());
+        s.body.pop_front();
+
+        s.consumed += chunk.size();
+
+        if ((s.remote_closed == false) && (s.consumed >= (std::size_t)stream_receive_window / 2))
+        {
+            update = (std::uint32_t)s.consumed;
+            s.receive_window += (std::int64_t)s.consumed;
+            s.consumed = 0;
+        }
+    }
+
+    if (update != 0)
+    {
+        send_window_update(s.id, update);
+    }
+
+    return true;
+}
+
+void connection::append_headers(std::string & frames, std::uint32_t id,
+    const std::string & block, bool end_stream)
+{
+    std::size_t max_size = max_frame_size_;
+    std::size_t pos = 0;
+
+    do
+    {
+        std::size_t n = std::min(block.size() - pos, max_size);
+        bool last = (pos + n == block.size());
+
+        unsigned char flags = last ? end_headers_flag : 0;
+        if ((pos == 0) && end_stream)
+        {
+            flags |= end_stream_flag;
+        }
+
+        append_frame_header(frames, n, (pos == 0) ? headers_frame : continuation_frame, flags, id);
+        frames.append(block, pos, n);
+
+        pos += n;
+    }
+    while (pos != block.size());
+}
+
+void connection::write_frames(const std::string & frames)
+{
+    std::lock_guard<std::mutex> lck(write_mtx_);
+
+    if (write_failed_)
+    {
+        throw std::runtime_error("connection closed");
+    }
+
+    try
+    {
+        write_(frames.data(), frames.size());
+    }
+    catch (...)
+    {
+        write_failed_ = true;
+
+        throw;
+    }
+}
+
+void connection::send_reset(stream & s, std::uint32_t code)
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        if (s.reset)
+        {
+            return;
+        }
+
+        s.reset = true;
+        s.cv.notify_all();
+    }
+
+    send_reset(s.id, code);
+}
+
+void connection::send_reset(std::uint32_t id, std::uint32_t code)
+{
+    std::string frame;
+    append_frame_header(frame, 4, rst_stream_frame, 0, id);
+    append_uint32(frame, code);
+    write_frames(frame);
+}
+
+void connection::send_window_update(std::uint32_t id, std::uint32_t increment)
+{
+    std::string frame;
+    append_frame_header(frame, 4, window_update_frame, 0, id);
+    append_uint32(frame, increment);
+    write_frames(frame);
+}
+
+void connection::go_away(std::uint32_t code)
+{
+    std::uint32_t last_stream_id;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        going_away_ = true;
+        last_stream_id = last_stream_id_;
+    }
+
+    std::string frame;
+    append_frame_header(frame, 8, goaway_frame, 0, 0);
+    append_uint32(frame, last_stream_id);
+    append_uint32(frame, code);
+
+    {
+        std::lock_guard<std::mutex> lck(write_mtx_);
+
+        if (goaway_sent_)
+        {
+            return;
+        }
+
+        goaway_sent_ = true;
+    }
+
+    write_frames(frame);
+}
+
+} // unnamed namespace
+
+void http::h2_details::serve(std::istream & in, const write_function & write,
+    const stream_handler & handler, const wait_handler & waiting,
+    const connection_options & options)
+{
+    connection c(in, write, handler, waiting, options);
+
+    c.run();
+}
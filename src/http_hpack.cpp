@@ -0,0 +1,579 @@
+
+#include <http_hpack.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+using namespace http;
+
+namespace // unnamed
+{
+
+struct static_entry
+{
+    const char * name;
+    const char * value;
+};
+
+// static table of RFC 7541, appendix A, indexed from 1
+const static_entry static_table[] =
+{
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+};
+
+const std::size_t static_table_size = sizeof(static_table) / sizeof(static_table[0]);
+
+// the size of the entry in the dynamic table includes the fixed overhead
+const std::size_t entry_overhead = 32;
+
+struct huffman_code
+{
+    std::uint32_t code;
+    int bits;
+};
+
+// Huffman code of RFC 7541, appendix B, for all bytes and EOS
+const huffman_code huffman_table[257] =
+{
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+    { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+    { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+    { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+    { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+    { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+    { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+    { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+    { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+    { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+    { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+    { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+    { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+    { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+    { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+    { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+    { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+    { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+    { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+    { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+    { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+    { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 }
+};
+
+const int eos_symbol = 256;
+const int max_code_bits = 30;
+
+// tables for decoding the canonical Huffman code: the codes of the given
+// length are consecutive numbers assigned to the symbols in ascending order
+struct huffman_decoding
+{
+    huffman_decoding()
+    {
+        for (int bits = 0; bits <= max_code_bits; ++bits)
+        {
+            counts[bits] = 0;
+            first_code[bits] = 0;
+        }
+
+        for (int symbol = 0; symbol <= eos_symbol; ++symbol)
+        {
+            ++counts[huffman_table[symbol].bits];
+        }
+
+        int next[max_code_bits + 1];
+        int index = 0;
+        for (int bits = 0; bits <= max_code_bits; ++bits)
+        {
+            first_index[bits] = index;
+            next[bits] = index;
+            index += counts[bits];
+        }
+
+        for (int symbol = 0; symbol <= eos_symbol; ++symbol)
+        {
+            const huffman_code & h = huffman_table[symbol];
+
+            if (next[h.bits] == first_index[h.bits])
+            {
+                first_code[h.bits] = h.code;
+            }
+
+            symbols[next[h.bits]++] = (std::uint16_t)symbol;
+        }
+    }
+
+    std::uint32_t first_code[max_code_bits + 1];
+    int first_index[max_code_bits + 1];
+    int counts[max_code_bits + 1];
+    std::uint16_t symbols[eos_symbol + 1];
+};
+
+void huffman_decode(const unsigned char * p, std::size_t n, std::string & out)
+{
+    static const huffman_decoding d;
+
+    std::uint32_t code = 0;
+    int bits = 0;
+
+    for (std::size_t i = 0; i != n; ++i)
+    {
+        for (int shift = 7; shift >= 0; --shift)
+        {
+            code = (code << 1) | ((p[i] >> shift) & 1);
+            ++bits;
+
+            if (bits > max_code_bits)
+            {
+                throw std::runtime_error("invalid Huffman code");
+            }
+
+            std::uint32_t offset = code - d.first_code[bits];
+            if (offset < (std::uint32_t)d.counts[bits])
+            {
+                int symbol = d.symbols[d.first_index[bits] + offset];
+                if (symbol == eos_symbol)
+                {
+                    throw std::runtime_error("EOS in Huffman-coded string");
+                }
+
+                out.push_back((char)symbol);
+
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+
+    // the padding is the shortest possible prefix of EOS (all ones)
+    if ((bits > 7) || (code != (std::uint32_t(1) << bits) - 1))
+    {
+        throw std::runtime_error("invalid Huffman padding");
+    }
+}
+
+std::size_t huffman_length(std::string_view s)
+{
+    std::size_t bits = 0;
+    for (char c : s)
+    {
+        bits += huffman_table[(unsigned char)c].bits;
+    }
+
+    return (bits + 7) / 8;
+}
+
+void huffman_encode(std::string_view s, std::string & out)
+{
+    std::uint64_t pending = 0;
+    int bits = 0;
+
+    for (char c : s)
+    {
+        const huffman_code & h = huffman_table[(unsigned char)c];
+
+        pending = (pending << h.bits) | h.code;
+        bits += h.bits;
+
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back((char)(pending >> bits));
+        }
+
+        pending &= (std::uint64_t(1) << bits) - 1;
+    }
+
+    if (bits > 0)
+    {
+        out.push_back((char)((pending << (8 - bits)) | (0xff >> bits)));
+    }
+}
+
+std::size_t decode_integer(const unsigned char * & p, const unsigned char * end, int prefix_bits)
+{
+    std::size_t max_prefix = (std::size_t(1) << prefix_bits) - 1;
+    std::size_t value = *p++ & max_prefix;
+
+    if (value < max_prefix)
+    {
+        return value;
+    }
+
+    for (int shift = 0; ; shift += 7)
+    {
+        if (p == end)
+        {
+            throw std::runtime_error("truncated integer in header block");
+        }
+
+        if (shift > 28)
+        {
+            throw std::runtime_error("integer in header block too large");
+        }
+
+        unsigned char b = *p++;
+        value += (std::size_t)(b & 0x7f) << shift;
+
+        if ((b & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+}
+
+void decode_string(const unsigned char * & p, const unsigned char * end, std::string & out)
+{
+    if (p == end)
+    {
+        throw std::runtime_error("truncated string in header block");
+    }
+
+    bool huffman = ((*p & 0x80) != 0);
+    std::size_t length = decode_integer(p, end, 7);
+
+    if (length > (std::size_t)(end - p))
+    {
+        throw std::runtime_error("truncated string in header block");
+    }
+
+    out.clear();
+
+    if (huffman)
+    {
+        huffman_decode(p, length, out);
+    }
+    else
+    {
+        out.assign((const char *)p, length);
+    }
+
+    p += length;
+}
+
+void encode_integer(std::size_t value, int prefix_bits, unsigned char flags, std::string & out)
+{
+    std::size_t max_prefix = (std::size_t(1) << prefix_bits) - 1;
+
+    if (value < max_prefix)
+    {
+        out.push_back((char)(flags | value));
+
+        return;
+    }
+
+    out.push_back((char)(flags | max_prefix));
+    value -= max_prefix;
+
+    while (value >= 0x80)
+    {
+        out.push_back((char)(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+
+    out.push_back((char)value);
+}
+
+void encode_string(std::string_view s, std::string & out)
+{
+    std::size_t length = huffman_length(s);
+
+    if (length < s.size())
+    {
+        encode_integer(length, 7, 0x80, out);
+        huffman_encode(s, out);
+    }
+    else
+    {
+        encode_integer(s.size(), 7, 0x00, out);
+        out.append(s);
+    }
+}
+
+// the static table as header fields, so that indexed fields are copied directly
+const std::vector<header_field> & static_fields()
+{
+    static const std::vector<header_field> fields = []()
+    {
+        std::vector<header_field> result;
+        for (const static_entry & e : static_table)
+        {
+            result.emplace_back(e.name, e.value);
+        }
+
+        return result;
+    }();
+
+    return fields;
+}
+
+// the first index of each name in the static table,
+// entries with the same name follow each other
+const std::unordered_map<std::string_view, std::size_t> & static_names()
+{
+    static const std::unordered_map<std::string_view, std::size_t> names = []()
+    {
+        std::unordered_map<std::string_view, std::size_t> result;
+        for (std::size_t i = 0; i != static_table_size; ++i)
+        {
+            result.emplace(static_table[i].name, i + 1);
+        }
+
+        return result;
+    }();
+
+    return names;
+}
+
+} // unnamed namespace
+
+hpack_decoder::hpack_decoder(std::size_t max_table_size, std::size_t max_list_size)
+    : table_size_(0), table_limit_(max_table_size), max_table_size_(max_table_size),
+      max_list_size_(max_list_size)
+{
+}
+
+void hpack_decoder::decode(const unsigned char * data, std::size_t size,
+    std::vector<header_field> & headers)
+{
+    const unsigned char * p = data;
+    const unsigned char * end = data + size;
+
+    std::size_t list_size = 0;
+    bool fields_seen = false;
+
+    while (p != end)
+    {
+        unsigned char b = *p;
+
+        if ((b & 0xe0) == 0x20)
+        {
+            // dynamic table size update, allowed only at the beginning of the block
+            std::size_t limit = decode_integer(p, end, 5);
+
+            if (fields_seen || (limit > max_table_size_))
+            {
+                throw std::runtime_error("invalid dynamic table size update");
+            }
+
+            table_limit_ = limit;
+            evict(table_limit_);
+
+            continue;
+        }
+
+        fields_seen = true;
+
+        if ((b & 0x80) != 0)
+        {
+            // indexed field
+            headers.push_back(entry(decode_integer(p, end, 7)));
+        }
+        else
+        {
+            // literal field, incrementally indexed, not indexed or never indexed
+            bool indexed = ((b & 0xc0) == 0x40);
+            std::size_t index = decode_integer(p, end, indexed ? 6 : 4);
+
+            header_field field;
+            if (index == 0)
+            {
+                decode_string(p, end, field.first);
+            }
+            else
+            {
+                field.first = entry(index).first;
+            }
+
+            decode_string(p, end, field.second);
+
+            if (indexed)
+            {
+                insert(field);
+            }
+
+            headers.push_back(std::move(field));
+        }
+
+        list_size += headers.back().first.size() + headers.back().second.size() + entry_overhead;
+        if (list_size > max_list_size_)
+        {
+            throw std::runtime_error("header list too large");
+        }
+    }
+}
+
+const header_field & hpack_decoder::entry(std::size_t index) const
+{
+    if ((index != 0) && (index <= static_table_size))
+    {
+        return static_fields()[index - 1];
+    }
+
+    if ((index <= static_table_size) || (index - static_table_size > table_.size()))
+    {
+        throw std::runtime_error("invalid index in header block");
+    }
+
+    return table_[index - static_table_size - 1];
+}
+
+void hpack_decoder::insert(const header_field & field)
+{
+    std::size_t size = field.first.size() + field.second.size() + entry_overhead;
+
+    // the entry larger than the whole table just empties it
+    evict((size <= table_limit_) ? table_limit_ - size : 0);
+
+    if (size <= table_limit_)
+    {
+        table_.push_front(field);
+        table_size_ += size;
+    }
+}
+
+void hpack_decoder::evict(std::size_t limit)
+{
+    while (table_size_ > limit)
+    {
+        const header_field & oldest = table_.back();
+
+        table_size_ -= oldest.first.size() + oldest.second.size() + entry_overhead;
+        table_.pop_back();
+    }
+}
+
+void hpack_encoder::encode(std::string_view name, std::string_view value, std::string & block)
+{
+    const std::unordered_map<std::string_view, std::size_t> & names = static_names();
+
+    auto it = names.find(name);
+    if (it != names.end())
+    {
+        // fast path: the whole field is in the static table
+        for (std::size_t i = it->second; (i <= static_table_size) &&
+            (name == static_table[i - 1].name); ++i)
+        {
+            if (value == static_table[i - 1].value)
+            {
+                encode_integer(i, 7, 0x80, block);
+
+                return;
+            }
+        }
+
+        // literal without indexing, with the indexed name
+        encode_integer(it->second, 4, 0x00, block);
+    }
+    else
+    {
+        // literal without indexing, with the literal name
+        block.push_back('\0');
+        encode_string(name, block);
+    }
+
+    encode_string(value, block);
+}
@@ -0,0 +1,993 @@
+
+#include <http_json.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HTTP_JSON_SSE2
+#endif
+
+using namespace http;
+
+namespace // unnamed
+{
+
+inline bool is_string_special(char c)
+{
+    return (c == '"') || (c == '\\') || ((unsigned char)c < 0x20);
+}
+
+#ifdef HTTP_JSON_SSE2
+
+// index of the lowest set bit in non-zero mask
+inline unsigned int first_bit(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctz(mask);
+#else
+    unsigned int i = 0;
+    while ((mask & 1) == 0)
+    {
+        mask >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+// bit i is set if p[i] is quote, backslash or control character
+inline unsigned int string_special_mask_16(const char * p)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+
+    __m128i quote = _mm_cmpeq_epi8(x, _mm_set1_epi8('"'));
+    __m128i backslash = _mm_cmpeq_epi8(x, _mm_set1_epi8('\\'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x1f)), x);
+
+    return (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(quote, backslash), control));
+}
+
+#endif
+
+// length of the run of characters that need no escaping
+std::size_t find_string_special(const char * p, std::size_t n)
+{
+    std::size_t i = 0;
+
+#ifdef HTTP_JSON_SSE2
+    for (; i + 16 <= n; i += 16)
+    {
+        unsigned int mask = string_special_mask_16(p + i);
+        if (mask != 0)
+        {
+            return i + first_bit(mask);
+        }
+    }
+#endif
+
+    for (; i != n; ++i)
+    {
+        if (is_string_special(p[i]))
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+inline bool is_digit(char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+    {
+        return c - '0';
+    }
+    else if ((c >= 'a') && (c <= 'f'))
+    {
+        return c - 'a' + 10;
+    }
+    else if ((c >= 'A') && (c <= 'F'))
+    {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+char * encode_utf8(char * out, unsigned long code)
+{
+    if (code < 0x80)
+    {
+        *out++ = (char)code;
+    }
+    else if (code < 0x800)
+    {
+        *out++ = (char)(0xc0 | (code >> 6));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+        *out++ = (char)(0xe0 | (code >> 12));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    }
+    else
+    {
+        *out++ = (char)(0xf0 | (code >> 18));
+        *out++ = (char)(0x80 | ((code >> 12) & 0x3f));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    }
+
+    return out;
+}
+
+// the value of the valid number that does not fit the double: the infinity
+// if its magnitude is too large and zero if too small, as decided
+// by the decimal exponent of its first significant digit
+double out_of_range_number(const char * text, std::size_t size)
+{
+    const char * p = text;
+    const char * end = text + size;
+
+    bool negative = (*p == '-');
+    if (negative)
+    {
+        ++p;
+    }
+
+    bool significant = false;
+    long long magnitude = 0;
+
+    for (; (p != end) && is_digit(*p); ++p)
+    {
+        if (significant)
+        {
+            ++magnitude;
+        }
+        else
+        {
+            significant = (*p != '0');
+        }
+    }
+
+    if ((p != end) && (*p == '.'))
+    {
+        ++p;
+
+        for (long long position = 1; (p != end) && is_digit(*p); ++p, ++position)
+        {
+            if ((significant == false) && (*p != '0'))
+            {
+                significant = true;
+                magnitude = -position;
+            }
+        }
+    }
+
+    long long exponent = 0;
+
+    if ((p != end) && ((*p == 'e') || (*p == 'E')))
+    {
+        ++p;
+
+        bool negative_exponent = (*p == '-');
+        if ((*p == '-') || (*p == '+'))
+        {
+            ++p;
+        }
+
+        // saturated, far beyond the range of any floating-point type
+        for (; (p != end) && is_digit(*p); ++p)
+        {
+            exponent = std::min(exponent * 10 + (*p - '0'), 1000000000LL);
+        }
+
+        if (negative_exponent)
+        {
+            exponent = -exponent;
+        }
+    }
+
+    double result = (significant && (magnitude + exponent >= 0)) ? HUGE_VAL : 0.0;
+
+    return negative ? -result : result;
+}
+
+} // unnamed namespace
+
+void http::json_escape(std::string_view s, std::string & out)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+
+    out.reserve(out.size() + s.size() + 2);
+    out.push_back('"');
+
+    const char * p = s.data();
+    const char * end = p + s.size();
+
+    while (p != end)
+    {
+        std::size_t run = find_string_special(p, end - p);
+        out.append(p, run);
+        p += run;
+
+        if (p == end)
+        {
+            break;
+        }
+
+        char c = *p++;
+
+        switch (c)
+        {
+        case '"': out.append("\\\"", 2); break;
+        case '\\': out.append("\\\\", 2); break;
+        case '\n': out.append("\\n", 2); break;
+        case '\r': out.append("\\r", 2); break;
+        case '\t': out.append("\\t", 2); break;
+        case '\b': out.append("\\b", 2); break;
+        case '\f': out.append("\\f", 2); break;
+        default:
+            {
+                char u[6] = { '\\', 'u', '0', '0',
+                    hex_digits[(c >> 4) & 0xf], hex_digits[c & 0xf] };
+                out.append(u, sizeof(u));
+            }
+            break;
+        }
+    }
+
+    out.push_back('"');
+}
+
+void json_writer::separate()
+{
+    if (comma_)
+    {
+        out_.push_back(',');
+    }
+}
+
+json_writer & json_writer::begin_object()
+{
+    separate();
+    out_.push_back('{');
+    comma_ = false;
+
+    return *this;
+}
+
+json_writer & json_writer::end_object()
+{
+    out_.push_back('}');
+    comma_ = true;
+
+    return *this;
+}
+
+json_writer & json_writer::begin_array()
+{
+    separate();
+    out_.push_back('[');
+    comma_ = false;
+
+    return *this;
+}
+
+json_writer & json_writer::end_array()
+{
+    out_.push_back(']');
+    comma_ = true;
+
+    return *this;
+}
+
+json_writer & json_writer::key(std::string_view name)
+{
+    separate();
+    json_escape(name, out_);
+    out_.push_back(':');
+    comma_ = false;
+
+    return *this;
+}
+
+json_writer & json_writer::value(std::string_view s)
+{
+    separate();
+    json_escape(s, out_);
+    comma_ = true;
+
+    return *this;
+}
+
+json_writer & json_writer::value(const char * s)
+{
+    return value(std::string_view(s));
+}
+
+json_writer & json_writer::value(const std::string & s)
+{
+    return value(std::string_view(s));
+}
+
+json_writer & json_writer::value(bool b)
+{
+    separate();
+    out_.append(b ? "true" : "false");
+    comma_ = true;
+
+    return *this;
+}
+
+template <typename T>
+json_writer & json_writer::number(T n)
+{
+    separate();
+
+    // formatted in place, at the end of the output
+    std::size_t size = out_.size();
+    out_.resize(size + 32);
+
+    std::to_chars_result r = std::to_chars(&out_[size], &out_[size] + 32, n);
+    out_.resize(r.ptr - out_.data());
+
+    comma_ = true;
+
+    return *this;
+}
+
+json_writer & json_writer::value(int n) { return number(n); }
+json_writer & json_writer::value(long n) { return number(n); }
+json_writer & json_writer::value(long long n) { return number(n); }
+json_writer & json_writer::value(unsigned int n) { return number(n); }
+json_writer & json_writer::value(unsigned long n) { return number(n); }
+json_writer & json_writer::value(unsigned long long n) { return number(n); }
+
+json_writer & json_writer::value(double d)
+{
+    if (std::isfinite(d) == false)
+    {
+        return null();
+    }
+
+    return number(d);
+}
+
+json_writer & json_writer::null()
+{
+    separate();
+    out_.append("null", 4);
+    comma_ = true;
+
+    return *this;
+}
+
+json_writer & json_writer::raw(std::string_view json)
+{
+    separate();
+    out_.append(json.data(), json.size());
+    comma_ = true;
+
+    return *this;
+}
+
+struct json_document::parser
+{
+    const char * begin;
+    char * p;
+    char * end;
+    std::vector<node> & nodes;
+    std::size_t max_depth;
+
+    json_error error(const char * message) const
+    {
+        return json_error(message, p - begin);
+    }
+
+    void skip_whitespace()
+    {
+        while ((p != end) && ((*p == ' ') || (*p == '\n') || (*p == '\r') || (*p == '\t')))
+        {
+            ++p;
+        }
+    }
+
+    std::size_t add(json_value::value_type type, const char * text, std::size_t size)
+    {
+        nodes.push_back(node { type, text, size, nodes.size() + 1 });
+
+        return nodes.size() - 1;
+    }
+
+    void parse_value(std::size_t depth)
+    {
+        skip_whitespace();
+
+        if (p == end)
+        {
+            throw error("unexpected end of JSON text");
+        }
+
+        switch (*p)
+        {
+        case '{':
+            parse_object(depth);
+            break;
+
+        case '[':
+            parse_array(depth);
+            break;
+
+        case '"':
+            parse_string();
+            break;
+
+        case 't':
+            parse_literal("true", json_value::bool_type, 1);
+            break;
+
+        case 'f':
+            parse_literal("false", json_value::bool_type, 0);
+            break;
+
+        case 'n':
+            parse_literal("null", json_value::null_type, 0);
+            break;
+
+        default:
+            if ((*p == '-') || is_digit(*p))
+            {
+                parse_number();
+            }
+            else
+            {
+                throw error("unexpected character");
+            }
+            break;
+        }
+    }
+
+    void parse_object(std::size_t depth)
+    {
+        if (depth == max_depth)
+        {
+            throw error("JSON nested too deep");
+        }
+
+        std::size_t index = add(json_value::object_type, p, 0);
+        std::size_t members = 0;
+
+        ++p;
+        skip_whitespace();
+
+        if ((p != end) && (*p == '}'))
+        {
+            ++p;
+        }
+        else
+        {
+            while (true)
+            {
+                skip_whitespace();
+
+                if ((p == end) || (*p != '"'))
+                {
+                    throw error("expected member name");
+                }
+
+                parse_string();
+                skip_whitespace();
+
+                if ((p == end) || (*p != ':'))
+                {
+                    throw error("expected colon");
+                }
+
+                ++p;
+                parse_value(depth + 1);
+                ++members;
+
+                skip_whitespace();
+
+                if ((p != end) && (*p == ','))
+                {
+                    ++p;
+                }
+                else if ((p != end) && (*p == '}'))
+                {
+                    ++p;
+                    break;
+                }
+                else
+                {
+                    throw error("expected comma or closing brace");
+                }
+            }
+        }
+
+        nodes[index].size = members;
+        nodes[index].end = nodes.size();
+    }
+
+    void parse_array(std::size_t depth)
+    {
+        if (depth == max_depth)
+        {
+            throw error("JSON nested too deep");
+        }
+
+        std::size_t index = add(json_value::array_type, p, 0);
+        std::size_t elements = 0;
+
+        ++p;
+        skip_whitespace();
+
+        if ((p != end) && (*p == ']'))
+        {
+            ++p;
+        }
+        else
+        {
+            while (true)
+            {
+                parse_value(depth + 1);
+                ++elements;
+
+                skip_whitespace();
+
+                if ((p != end) && (*p == ','))
+                {
+                    ++p;
+                }
+                else if ((p != end) && (*p == ']'))
+                {
+                    ++p;
+                    break;
+                }
+                else
+                {
+                    throw error("expected comma or closing bracket");
+                }
+            }
+        }
+
+        nodes[index].size = elements;
+        nodes[index].end = nodes.size();
+    }
+
+    // decodes the string in place, the decoded text is never longer
+    void parse_string()
+    {
+        ++p;
+
+        char * start = p;
+        char * out = p;
+
+        while (true)
+        {
+            std::size_t run = find_string_special(p, end - p);
+
+            if (out != p)
+            {
+                std::memmove(out, p, run);
+            }
+
+            out += run;
+            p += run;
+
+            if (p == end)
+            {
+                throw error("unterminated string");
+            }
+
+            char c = *p;
+
+            if (c == '"')
+            {
+                ++p;
+                break;
+            }
+
+            if (c != '\\')
+            {
+                throw error("control character in string");
+            }
+
+            if (end - p < 2)
+            {
+                throw error("unterminated string");
+            }
+
+            switch (p[1])
+            {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/': *out++ = '/'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u':
+                {
+                    unsigned long code = parse_hex4(p + 2);
+                    p += 6;
+
+                    if ((code >= 0xd800) && (code <= 0xdbff))
+                    {
+                        // high surrogate, followed by the low one
+                        if ((end - p < 6) || (p[0] != '\\') || (p[1] != 'u'))
+                        {
+                            throw error("invalid surrogate pair");
+                        }
+
+                        unsigned long low = parse_hex4(p + 2);
+                        if ((low < 0xdc00) || (low > 0xdfff))
+                        {
+                            throw error("invalid surrogate pair");
+                        }
+
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        p += 6;
+                    }
+                    else if ((code >= 0xdc00) && (code <= 0xdfff))
+                    {
+                        throw error("invalid surrogate pair");
+                    }
+
+                    out = encode_utf8(out, code);
+                }
+                continue;
+
+            default:
+                throw error("invalid escape sequence");
+            }
+
+            p += 2;
+        }
+
+        add(json_value::string_type, start, out - start);
+    }
+
+    unsigned long parse_hex4(const char * h)
+    {
+        if (end - h < 4)
+        {
+            throw error("invalid escape sequence");
+        }
+
+        unsigned long code = 0;
+
+        for (int i = 0; i != 4; ++i)
+        {
+            int v = hex_value(h[i]);
+            if (v < 0)
+            {
+                throw error("invalid escape sequence");
+            }
+
+            code = (code << 4) | (unsigned long)v;
+        }
+
+        return code;
+    }
+
+    void parse_number()
+    {
+        char * start = p;
+
+        if (*p == '-')
+        {
+            ++p;
+        }
+
+        if ((p == end) || (is_digit(*p) == false))
+        {
+            throw error("invalid number");
+        }
+
+        if (*p == '0')
+        {
+            ++p;
+        }
+        else
+        {
+            while ((p != end) && is_digit(*p))
+            {
+                ++p;
+            }
+        }
+
+        if ((p != end) && (*p == '.'))
+        {
+            ++p;
+
+            if ((p == end) || (is_digit(*p) == false))
+            {
+                throw error("invalid number");
+            }
+
+            while ((p != end) && is_digit(*p))
+            {
+                ++p;
+            }
+        }
+
+        if ((p != end) && ((*p == 'e') || (*p == 'E')))
+        {
+            ++p;
+
+            if ((p != end) && ((*p == '+') || (*p == '-')))
+            {
+                ++p;
+            }
+
+            if ((p == end) || (is_digit(*p) == false))
+            {
+                throw error("invalid number");
+            }
+
+            while ((p != end) && is_digit(*p))
+            {
+                ++p;
+            }
+        }
+
+        add(json_value::number_type, start, p - start);
+    }
+
+    void parse_literal(const char * word, json_value::value_type type, std::size_t value)
+    {
+        std::size_t n = std::strlen(word);
+
+        if (((std::size_t)(end - p) < n) || (std::memcmp(p, word, n) != 0))
+        {
+            throw error("unexpected character");
+        }
+
+        add(type, p, value);
+        p += n;
+    }
+};
+
+void json_document::parse(char * text, std::size_t size, std::size_t max_depth)
+{
+    nodes_.clear();
+    text_ = text;
+
+    parser ps = { text, text, text + size, nodes_, max_depth };
+
+    try
+    {
+        ps.parse_value(0);
+        ps.skip_whitespace();
+
+        if (ps.p != ps.end)
+        {
+            throw ps.error("unexpected data after the value");
+        }
+    }
+    catch (...)
+    {
+        nodes_.clear();
+
+        throw;
+    }
+}
+
+json_error json_value::type_error(const char * message) const
+{
+    std::size_t offset = (doc_ != NULL) ? doc_->nodes_[index_].text - doc_->text_ : 0;
+
+    return json_error(message, offset);
+}
+
+json_value::value_type json_value::type() const
+{
+    return (doc_ != NULL) ? doc_->nodes_[index_].type : null_type;
+}
+
+bool json_value::as_bool() const
+{
+    if (type() != bool_type)
+    {
+        throw type_error("not a boolean");
+    }
+
+    return doc_->nodes_[index_].size != 0;
+}
+
+long long json_value::as_integer() const
+{
+    if (type() != number_type)
+    {
+        throw type_error("not a number");
+    }
+
+    const json_document::node & n = doc_->nodes_[index_];
+
+    long long result = 0;
+    std::from_chars_result r = std::from_chars(n.text, n.text + n.size, result);
+
+    if ((r.ec != std::errc()) || (r.ptr != n.text + n.size))
+    {
+        throw type_error("not an integer");
+    }
+
+    return result;
+}
+
+double json_value::as_double() const
+{
+    if (type() != number_type)
+    {
+        throw type_error("not a number");
+    }
+
+    const json_document::node & n = doc_->nodes_[index_];
+
+    double result = 0;
+    std::from_chars_result r = std::from_chars(n.text, n.text + n.size, result);
+
+    if (r.ec == std::errc::invalid_argument)
+    {
+        throw type_error("not a number");
+    }
+
+    if (r.ec == std::errc::result_out_of_range)
+    {
+        // the result is not set in this case
+        return out_of_range_number(n.text, n.size);
+    }
+
+    return result;
+}
+
+std::string_view json_value::as_string() const
+{
+    if (type() != string_type)
+    {
+        throw type_error("not a string");
+    }
+
+    const json_document::node & n = doc_->nodes_[index_];
+
+    return std::string_view(n.text, n.size);
+}
+
+bool json_value::as_bool(bool def) const
+{
+    return (type() == bool_type) ? as_bool() : def;
+}
+
+long long json_value::as_integer(long long def) const
+{
+    if (type() != number_type)
+    {
+        return def;
+    }
+
+    const json_document::node & n = doc_->nodes_[index_];
+
+    long long result = 0;
+    std::from_chars_result r = std::from_chars(n.text, n.text + n.size, result);
+
+    return ((r.ec == std::errc()) && (r.ptr == n.text + n.size)) ? result : def;
+}
+
+double json_value::as_double(double def) const
+{
+    return (type() == number_type) ? as_double() : def;
+}
+
+std::string_view json_value::as_string(std::string_view def) const
+{
+    return (type() == string_type) ? as_string() : def;
+}
+
+std::size_t json_value::size() const
+{
+    value_type t = type();
+
+    return ((t == array_type) || (t == object_type)) ? doc_->nodes_[index_].size : 0;
+}
+
+std::size_t json_value::child(std::size_t i) const
+{
+    std::size_t k = index_ + 1;
+
+    for (; i != 0; --i)
+    {
+        k = doc_->nodes_[k].end;
+    }
+
+    return k;
+}
+
+json_value json_value::operator[](std::size_t i) const
+{
+    value_type t = type();
+
+    if ((t == array_type) && (i < size()))
+    {
+        return json_value(doc_, child(i));
+    }
+    else if ((t == object_type) && (i < size()))
+    {
+        return json_value(doc_, child(2 * i + 1));
+    }
+
+    return json_value();
+}
+
+std::string_view json_value::name(std::size_t i) const
+{
+    if ((type() == object_type) && (i < size()))
+    {
+        const json_document::node & n = doc_->nodes_[child(2 * i)];
+
+        return std::string_view(n.text, n.size);
+    }
+
+    return std::string_view();
+}
+
+json_value json_value::operator[](std::string_view member) const
+{
+    if (type() != object_type)
+    {
+        return json_value();
+    }
+
+    // names and values alternate, the name is a single node
+    std::size_t k = index_ + 1;
+
+    for (std::size_t i = 0; i != size(); ++i)
+    {
+        const json_document::node & n = doc_->nodes_[k];
+
+        if (std::string_view(n.text, n.size) == member)
+        {
+            return json_value(doc_, k + 1);
+        }
+
+        k = doc_->nodes_[k + 1].end;
+    }
+
+    return json_value();
+}
+
+bool json_value::contains(std::string_view member) const
+{
+    if (type() != object_type)
+    {
+        return false;
+    }
+
+    std::size_t k = index_ + 1;
+
+    for (std::size_t i = 0; i != size(); ++i)
+    {
+        const json_document::node & n = doc_->nodes_[k];
+
+        if (std::string_view(n.text, n.size) == member)
+        {
+            return true;
+        }
+
+        k = doc_->nodes_[k + 1].end;
+    }
+
+    return false;
+}
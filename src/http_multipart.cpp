@@ -0,0 +1,434 @@
+
+#include <http_multipart.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace http;
+
+namespace // unnamed
+{
+
+// the longest boundary allowed by RFC 2046 is 70 characters
+const std::size_t max_boundary_length = 70;
+
+std::string to_lower(std::string s)
+{
+    for (char & c : s)
+    {
+        c = (char)std::tolower((unsigned char)c);
+    }
+
+    return s;
+}
+
+std::string trim(const std::string & s)
+{
+    std::size_t first = s.find_first_not_of(" \t");
+    if (first == std::string::npos)
+    {
+        return std::string();
+    }
+
+    std::size_t last = s.find_last_not_of(" \t");
+
+    return s.substr(first, last - first + 1);
+}
+
+// finds the value of the given parameter in header values like:
+// form-data; name="field"; filename="a.txt"
+std::string header_parameter(const std::string & value, const std::string & name)
+{
+    std::size_t pos = value.find(';');
+    while (pos != std::string::npos)
+    {
+        std::size_t eq = value.find('=', pos + 1);
+        if (eq == std::string::npos)
+        {
+            break;
+        }
+
+        std::string key = to_lower(trim(value.substr(pos + 1, eq - pos - 1)));
+
+        std::string v;
+        std::size_t next;
+        std::size_t start = value.find_first_not_of(" \t", eq + 1);
+        if ((start != std::string::npos) && (value[start] == '"'))
+        {
+            std::size_t i = start + 1;
+            while ((i < value.size()) && (value[i] != '"'))
+            {
+                if ((value[i] == '\\') && (i + 1 < value.size()))
+                {
+                    ++i;
+                }
+                v.append(1, value[i]);
+                ++i;
+            }
+
+            next = value.find(';', i);
+        }
+        else
+        {
+            next = value.find(';', eq + 1);
+            v = trim(value.substr(eq + 1,
+                next == std::string::npos ? std::string::npos : next - eq - 1));
+        }
+
+        if (key == name)
+        {
+            return v;
+        }
+
+        pos = next;
+    }
+
+    return std::string();
+}
+
+void write_fully(int fd, const char * data, std::size_t size)
+{
+    while (size != 0)
+    {
+#ifdef _WIN32
+        int written = ::_write(fd, data, (unsigned int)size);
+#else
+        ssize_t written = ::write(fd, data, size);
+        if ((written < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+#endif
+        if (written <= 0)
+        {
+            throw std::runtime_error("cannot write multipart content to file");
+        }
+
+        data += written;
+        size -= (std::size_t)written;
+    }
+}
+
+} // unnamed namespace
+
+multipart_parser::multipart_parser(const std::string & boundary,
+    multipart_callback_type callback, std::size_t buffer_size)
+    : delimiter_("\r\n--" + boundary), callback_(callback),
+      begin_(0), end_(0), state_(preamble)
+{
+    if (boundary.empty() || (boundary.size() > max_boundary_length))
+    {
+        throw std::runtime_error("invalid multipart boundary");
+    }
+
+    // the buffer has to keep the partial delimiter match
+    // and still have room for the new data
+    buf_.resize(std::max(buffer_size, 4 * delimiter_.size()));
+
+    // the body starts with the delimiter without the leading CRLF,
+    // pretend it was there so that the first delimiter is found as any other
+    buf_[0] = '\r';
+    buf_[1] = '\n';
+    end_ = 2;
+
+    // Horspool bad character table
+    const std::size_t m = delimiter_.size();
+    for (std::size_t & s : skip_)
+    {
+        s = m;
+    }
+    for (std::size_t i = 0; i + 1 < m; ++i)
+    {
+        skip_[(unsigned char)delimiter_[i]] = m - 1 - i;
+    }
+}
+
+std::size_t multipart_parser::find_delimiter(std::size_t from) const
+{
+    const std::size_t m = delimiter_.size();
+    const char * text = &buf_[0];
+    const char * pattern = delimiter_.data();
+    const char last = pattern[m - 1];
+
+    std::size_t pos = from;
+    while (pos + m <= end_)
+    {
+        char c = text[pos + m - 1];
+        if ((c == last) && (std::memcmp(text + pos, pattern, m - 1) == 0))
+        {
+            return pos;
+        }
+
+        pos += skip_[(unsigned char)c];
+    }
+
+    return std::string::npos;
+}
+
+void multipart_parser::parse_headers(const char * begin, const char * end)
+{
+    part_ = multipart_part();
+
+    const char * line = begin;
+    while (line < end)
+    {
+        const char * eol = std::search(line, end, "\r\n", "\r\n" + 2);
+
+        const char * colon = std::find(line, eol, ':');
+        if (colon != eol)
+        {
+            std::string name = to_lower(trim(std::string(line, colon)));
+            std::string value = trim(std::string(colon + 1, eol));
+
+            part_.headers[name] = value;
+        }
+
+        line = (eol == end) ? end : eol + 2;
+    }
+
+    auto it = part_.headers.find("content-disposition");
+    if (it != part_.headers.end())
+    {
+        part_.name = header_parameter(it->second, "name");
+        part_.file_name = header_parameter(it->second, "filename");
+    }
+
+    it = part_.headers.find("content-type");
+    if (it != part_.headers.end())
+    {
+        part_.content_type = it->second;
+    }
+}
+
+void multipart_parser::process()
+{
+    const std::size_t m = delimiter_.size();
+
+    while (true)
+    {
+        switch (state_)
+        {
+        case preamble:
+        case part_body:
+            {
+                std::size_t pos = find_delimiter(begin_);
+                std::size_t available = (pos != std::string::npos) ? pos :
+                    (end_ - begin_ > m - 1 ? end_ - (m - 1) : begin_);
+
+                if ((state_ == part_body) && (available > begin_))
+                {
+                    callback_(part_, part_data, &buf_[begin_], available - begin_);
+                }
+
+                begin_ = available;
+
+                if (pos == std::string::npos)
+                {
+                    return;
+                }
+
+                if (state_ == part_body)
+                {
+                    callback_(part_, part_end, NULL, 0);
+                }
+
+                begin_ += m;
+                state_ = delimiter_end;
+            }
+            break;
+
+        case delimiter_end:
+            if (end_ - begin_ < 2)
+            {
+                return;
+            }
+
+            if ((buf_[begin_] == '-') && (buf_[begin_ + 1] == '-'))
+            {
+                begin_ = end_;
+                state_ = epilogue;
+            }
+            else if ((buf_[begin_] == '\r') && (buf_[begin_ + 1] == '\n'))
+            {
+                begin_ += 2;
+                state_ = part_headers;
+            }
+            else if ((buf_[begin_] == ' ') || (buf_[begin_] == '\t'))
+            {
+                // transport padding
+                ++begin_;
+            }
+            else
+            {
+                throw std::runtime_error("malformed multipart delimiter");
+            }
+            break;
+
+        case part_headers:
+            {
+                const char * first = &buf_[0] + begin_;
+                const char * last = &buf_[0] + end_;
+                const char * stop;
+
+                if ((last - first >= 2) && (first[0] == '\r') && (first[1] == '\n'))
+                {
+                    // no headers at all
+                    stop = first;
+                }
+                else
+                {
+                    const char * terminator = "\r\n\r\n";
+                    stop = std::search(first, last, terminator, terminator + 4);
+                    if (stop == last)
+                    {
+                        if ((begin_ == 0) && (end_ == buf_.size()))
+                        {
+                            throw std::runtime_error("multipart part headers too large");
+                        }
+
+                        return;
+                    }
+
+                    stop += 2;
+                }
+
+                parse_headers(first, stop);
+
+                begin_ += (stop - first) + 2;
+                state_ = part_body;
+
+                callback_(part_, part_begin, NULL, 0);
+            }
+            break;
+
+        case epilogue:
+            begin_ = end_;
+            return;
+        }
+    }
+}
+
+void multipart_parser::feed(const char * data, std::size_t size)
+{
+    while (size != 0)
+    {
+        if (state_ == epilogue)
+        {
+            return;
+        }
+
+        // move the unconsumed bytes to the front
+        if (begin_ != 0)
+        {
+            std::memmove(&buf_[0], &buf_[begin_], end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+
+        std::size_t n = std::min(size, buf_.size() - end_);
+        std::memcpy(&buf_[end_], data, n);
+        end_ += n;
+        data += n;
+        size -= n;
+
+        process();
+    }
+}
+
+void multipart_parser::finish()
+{
+    if (state_ != epilogue)
+    {
+        throw std::runtime_error("unexpected end of multipart body");
+    }
+}
+
+std::string http::multipart_boundary(const std::string & content_type)
+{
+    if (to_lower(content_type.substr(0, 10)) != "multipart/")
+    {
+        return std::string();
+    }
+
+    return header_parameter(content_type, "boundary");
+}
+
+void http::parse_multipart(std::istream & in, std::size_t content_length,
+    const std::string & content_type, multipart_callback_type callback,
+    std::size_t buffer_size)
+{
+    std::string boundary = multipart_boundary(content_type);
+    if (boundary.empty())
+    {
+        throw std::runtime_error("missing multipart boundary");
+    }
+
+    multipart_parser parser(boundary, callback, buffer_size);
+
+    char chunk[4096];
+
+    while (content_length != 0)
+    {
+        std::size_t n = std::min(content_length, sizeof(chunk));
+
+        in.read(chunk, n);
+        std::size_t readn = (std::size_t)in.gcount();
+        if (readn == 0)
+        {
+            if (content_length == unknown_content_length)
+            {
+                // chunked body, read up to its end
+                break;
+            }
+
+            throw std::runtime_error("unexpected end of multipart body");
+        }
+
+        parser.feed(chunk, readn);
+
+        if (content_length != unknown_content_length)
+        {
+            content_length -= readn;
+        }
+    }
+
+    parser.finish();
+}
+
+multipart_callback_type http::multipart_fd_writer(multipart_fd_selector_type selector)
+{
+    // the descriptor chosen for the current part
+    std::shared_ptr<int> fd(new int(-1));
+
+    return [selector, fd](const multipart_part & part, multipart_event event,
+        const char * data, std::size_t size)
+    {
+        switch (event)
+        {
+        case part_begin:
+            *fd = selector(part);
+            break;
+
+        case part_data:
+            if (*fd >= 0)
+            {
+                write_fully(*fd, data, size);
+            }
+            break;
+
+        case part_end:
+            *fd = -1;
+            break;
+        }
+    };
+}
@@ -0,0 +1,440 @@
+
+#include <http_pack.h>
+#include <http_response.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace http;
+
+namespace // unnamed
+{
+
+// the pack consists of the header, the index (entries sorted by path),
+// the strings (paths, header lines and entity tags) and the contents;
+// all offsets are relative to the beginning of the pack,
+// all numbers are in the byte order of the writer (checked by the reader)
+
+const char pack_magic[8] = { 'H', 'T', 'T', 'P', 'P', 'A', 'C', 'K' };
+const std::uint32_t pack_version = 1;
+const std::uint32_t pack_byte_order = 0x01020304;
+
+struct pack_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t count;
+    std::uint64_t length; // of the whole pack
+};
+
+struct packed_string
+{
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+struct packed_variant
+{
+    packed_string headers;
+    packed_string etag;
+    packed_string content;
+};
+
+struct packed_entry
+{
+    packed_string path;
+    packed_variant identity;
+    packed_variant compressed; // empty content if there is no compressed variant
+};
+
+// contents start on the cache line, the large ones on the page
+const std::uint64_t content_alignment = 64;
+const std::uint64_t page_alignment = 4096;
+
+std::uint64_t align_content(std::uint64_t offset, std::uint64_t size)
+{
+    std::uint64_t alignment = (size >= page_alignment) ? page_alignment : content_alignment;
+
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// FNV-1a, good enough to tell the versions of the same file apart
+std::uint64_t content_hash(const std::string & s)
+{
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (unsigned char c : s)
+    {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+std::string entity_tag(const std::string & content, const char * suffix)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "\"%016llx%s\"",
+        (unsigned long long)content_hash(content), suffix);
+
+    return buf;
+}
+
+std::string variant_headers(const std::string & path, std::size_t size,
+    const std::string & etag, bool compressed, bool vary)
+{
+    response_builder r(256);
+
+    r.content_type(file_mime_type(path))
+        .content_length(size)
+        .cache_control(true)
+        .header("ETag", etag);
+
+    if (compressed)
+    {
+        r.header("Content-Encoding", std::string("gzip"));
+    }
+
+    if (vary)
+    {
+        r.header("Vary", std::string("Accept-Encoding"));
+    }
+
+    return r.release();
+}
+
+// appends the string to the string section
+packed_string add_string(std::string & strings, std::uint64_t base, const std::string & s)
+{
+    packed_string result;
+    result.offset = base + strings.size();
+    result.size = s.size();
+
+    strings.append(s);
+
+    return result;
+}
+
+void write_padding(std::ofstream & out, std::uint64_t & position, std::uint64_t offset)
+{
+    static const char zeros[page_alignment] = {};
+
+    while (position != offset)
+    {
+        std::uint64_t n = std::min<std::uint64_t>(offset - position, sizeof(zeros));
+
+        out.write(zeros, (std::streamsize)n);
+        position += n;
+    }
+}
+
+#ifndef WIN32
+
+bool in_pack(const packed_string & s, std::size_t length)
+{
+    return (s.offset <= length) && (s.size <= length - s.offset);
+}
+
+bool valid_variant(const packed_variant & v, std::size_t length)
+{
+    return in_pack(v.headers, length) && in_pack(v.etag, length) && in_pack(v.content, length);
+}
+
+#endif // WIN32
+
+} // unnamed namespace
+
+void asset_pack_writer::add(const std::string & path, std::string content,
+    std::string compressed)
+{
+    if (path.empty() || (path[0] != '/'))
+    {
+        throw std::runtime_error("asset path must start with slash: " + path);
+    }
+
+    assets_.push_back(asset { path, std::move(content), std::move(compressed) });
+}
+
+void asset_pack_writer::write(const std::string & pack_path)
+{
+    std::sort(assets_.begin(), assets_.end(),
+        [](const asset & a, const asset & b) { return a.path < b.path; });
+
+    for (std::size_t i = 1; i < assets_.size(); ++i)
+    {
+        if (assets_[i - 1].path == assets_[i].path)
+        {
+            throw std::runtime_error("asset added twice: " + assets_[i].path);
+        }
+    }
+
+    std::vector<packed_entry> entries(assets_.size());
+    std::string strings;
+
+    std::uint64_t strings_base = sizeof(pack_header) + entries.size() * sizeof(packed_entry);
+
+    for (std::size_t i = 0; i != assets_.size(); ++i)
+    {
+        const asset & a = assets_[i];
+        packed_entry & e = entries[i];
+        bool has_compressed = (a.compressed.empty() == false);
+
+        std::string etag = entity_tag(a.content, "");
+
+        e.path = add_string(strings, strings_base, a.path);
+        e.identity.headers = add_string(strings, strings_base,
+            variant_headers(a.path, a.content.size(), etag, false, has_compressed));
+        e.identity.etag = add_string(strings, strings_base, etag);
+        e.identity.content.size = a.content.size();
+
+        e.compressed = packed_variant();
+
+        if (has_compressed)
+        {
+            std::string compressed_etag = entity_tag(a.content, "-gz");
+
+            e.compressed.headers = add_string(strings, strings_base,
+                variant_headers(a.path, a.compressed.size(), compressed_etag, true, true));
+            e.compressed.etag = add_string(strings, strings_base, compressed_etag);
+            e.compressed.content.size = a.compressed.size();
+        }
+    }
+
+    // the contents follow the strings, in the order of the index
+    std::uint64_t offset = strings_base + strings.size();
+
+    for (packed_entry & e : entries)
+    {
+        offset = align_content(offset, e.identity.content.size);
+        e.identity.content.offset = offset;
+        offset += e.identity.content.size;
+
+        if (e.compressed.content.size != 0)
+        {
+            offset = align_content(offset, e.compressed.content.size);
+            e.compressed.content.offset = offset;
+            offset += e.compressed.content.size;
+        }
+    }
+
+    pack_header header;
+    std::memcpy(header.magic, pack_magic, sizeof(pack_magic));
+    header.version = pack_version;
+    header.byte_order = pack_byte_order;
+    header.count = entries.size();
+    header.length = offset;
+
+    // written aside and renamed, the readers see the complete old or new pack
+    std::string temporary = pack_path + ".tmp";
+
+    {
+        std::ofstream out(temporary, std::ofstream::binary | std::ofstream::trunc);
+        if (!out)
+        {
+            throw std::runtime_error("cannot create asset pack: " + temporary);
+        }
+
+        out.write((const char *)&header, sizeof(header));
+
+        if (entries.empty() == false)
+        {
+            out.write((const char *)entries.data(),
+                (std::streamsize)(entries.size() * sizeof(packed_entry)));
+        }
+
+        out.write(strings.data(), (std::streamsize)strings.size());
+
+        std::uint64_t position = strings_base + strings.size();
+
+        for (std::size_t i = 0; i != assets_.size(); ++i)
+        {
+            write_padding(out, position, entries[i].identity.content.offset);
+            out.write(assets_[i].content.data(), (std::streamsize)assets_[i].content.size());
+            position += assets_[i].content.size();
+
+            if (entries[i].compressed.content.size != 0)
+            {
+                write_padding(out, position, entries[i].compressed.content.offset);
+                out.write(assets_[i].compressed.data(), (std::streamsize)assets_[i].compressed.size());
+                position += assets_[i].compressed.size();
+            }
+        }
+
+        out.close();
+
+        if (!out)
+        {
+            std::remove(temporary.c_str());
+
+            throw std::runtime_error("cannot write asset pack: " + temporary);
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, pack_path, ec);
+
+    if (ec)
+    {
+        std::remove(temporary.c_str());
+
+        throw std::runtime_error("cannot replace asset pack " + pack_path + ": " + ec.message());
+    }
+}
+
+#ifndef WIN32
+
+asset_pack::asset_pack(const std::string & path)
+    : fd_(-1), data_(NULL), length_(0), count_(0), device_(0), inode_(0), mtime_(0)
+{
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0)
+    {
+        throw std::runtime_error("cannot open asset pack: " + path);
+    }
+
+    struct stat st;
+    if ((::fstat(fd_, &st) != 0) || (S_ISREG(st.st_mode) == false) ||
+        ((std::uint64_t)st.st_size < sizeof(pack_header)))
+    {
+        ::close(fd_);
+
+        throw std::runtime_error("not an asset pack: " + path);
+    }
+
+    length_ = (std::size_t)st.st_size;
+    device_ = (std::uint64_t)st.st_dev;
+    inode_ = (std::uint64_t)st.st_ino;
+    mtime_ = (std::int64_t)st.st_mtime;
+
+    void * p = ::mmap(NULL, length_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED)
+    {
+        ::close(fd_);
+
+        throw std::runtime_error("cannot map asset pack: " + path);
+    }
+
+    data_ = (const char *)p;
+
+    try
+    {
+        validate(path);
+    }
+    catch (...)
+    {
+        ::munmap(p, length_);
+        ::close(fd_);
+
+        throw;
+    }
+
+    count_ = (std::size_t)((const pack_header *)data_)->count;
+
+    // the index and the headers are needed by the first requests
+    (void)::madvise(p, std::min<std::size_t>(length_, page_alignment), MADV_WILLNEED);
+}
+
+asset_pack::~asset_pack()
+{
+    ::munmap((void *)data_, length_);
+    ::close(fd_);
+}
+
+void asset_pack::validate(const std::string & path) const
+{
+    const pack_header * header = (const pack_header *)data_;
+
+    if ((std::memcmp(header->magic, pack_magic, sizeof(pack_magic)) != 0) ||
+        (header->version != pack_version) || (header->byte_order != pack_byte_order) ||
+        (header->length != length_) ||
+        (header->count > (length_ - sizeof(pack_header)) / sizeof(packed_entry)))
+    {
+        throw std::runtime_error("not an asset pack: " + path);
+    }
+
+    const packed_entry * entries = (const packed_entry *)(data_ + sizeof(pack_header));
+    std::string_view previous;
+
+    for (std::uint64_t i = 0; i != header->count; ++i)
+    {
+        const packed_entry & e = entries[i];
+
+        if ((in_pack(e.path, length_) == false) || (e.path.size == 0) ||
+            (valid_variant(e.identity, length_) == false) ||
+            (valid_variant(e.compressed, length_) == false))
+        {
+            throw std::runtime_error("damaged asset pack: " + path);
+        }
+
+        std::string_view name(data_ + e.path.offset, (std::size_t)e.path.size);
+
+        if ((i != 0) && (name <= previous))
+        {
+            throw std::runtime_error("damaged asset pack: " + path);
+        }
+
+        previous = name;
+    }
+}
+
+bool asset_pack::find(std::string_view path, asset & result) const
+{
+    const packed_entry * first = (const packed_entry *)(data_ + sizeof(pack_header));
+    const packed_entry * last = first + count_;
+
+    auto name = [this](const packed_entry & e)
+    {
+        return std::string_view(data_ + e.path.offset, (std::size_t)e.path.size);
+    };
+
+    const packed_entry * it = std::lower_bound(first, last, path,
+        [&name](const packed_entry & e, std::string_view p) { return name(e) < p; });
+
+    if ((it == last) || (name(*it) != path))
+    {
+        return false;
+    }
+
+    auto make_variant = [this](const packed_variant & v)
+    {
+        variant result;
+        result.headers = std::string_view(data_ + v.headers.offset, (std::size_t)v.headers.size);
+        result.etag = std::string_view(data_ + v.etag.offset, (std::size_t)v.etag.size);
+        result.data = data_ + v.content.offset;
+        result.offset = v.content.offset;
+        result.size = v.content.size;
+
+        return result;
+    };
+
+    result.identity = make_variant(it->identity);
+    result.compressed = make_variant(it->compressed);
+    result.has_compressed = (it->compressed.content.size != 0);
+
+    return true;
+}
+
+bool asset_pack::same_file(const std::string & path) const
+{
+    struct stat st;
+
+    return (::stat(path.c_str(), &st) == 0) &&
+        ((std::uint64_t)st.st_dev == device_) && ((std::uint64_t)st.st_ino == inode_) &&
+        ((std::size_t)st.st_size == length_) && ((std::int64_t)st.st_mtime == mtime_);
+}
+
+#endif // WIN32
@@ -0,0 +1,924 @@
+
+#include <http_proxy.h>
+#include <http_response.h>
+#include <sockets.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+using namespace http;
+using namespace http::proxy_details;
+
+namespace // unnamed
+{
+
+// size of the buffers used for streaming the bodies
+const std::size_t relay_buffer_size = 16 * 1024;
+
+// bodies at least this large are forwarded between the sockets
+// without copying them through the user space
+const std::size_t splice_threshold = 64 * 1024;
+
+// the longest status or header line accepted from the upstream server
+const std::size_t max_line_length = 64 * 1024;
+
+std::atomic<std::size_t> max_idle_connections(32);
+
+// the longest wait for the upstream server, in milliseconds
+std::atomic<int> upstream_timeout(30 * 1000);
+
+bool iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    for (std::size_t i = 0; i != a.size(); ++i)
+    {
+        if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string_view trim(std::string_view s)
+{
+    while ((s.empty() == false) && ((s.front() == ' ') || (s.front() == '\t')))
+    {
+        s.remove_prefix(1);
+    }
+
+    while ((s.empty() == false) && ((s.back() == ' ') || (s.back() == '\t')))
+    {
+        s.remove_suffix(1);
+    }
+
+    return s;
+}
+
+// headers that describe the single connection and are not forwarded
+bool is_hop_by_hop(std::string_view name)
+{
+    return iequals(name, "Connection") || iequals(name, "Keep-Alive") ||
+        iequals(name, "Proxy-Connection") || iequals(name, "TE") ||
+        iequals(name, "Upgrade") || iequals(name, "Transfer-Encoding") ||
+        iequals(name, "Content-Length");
+}
+
+// adds the header names listed in the value of Connection,
+// which are specific to the single connection as well
+void add_connection_options(std::string_view value, std::vector<std::string> & options)
+{
+    while (value.empty() == false)
+    {
+        std::size_t comma = value.find(',');
+        std::string_view option = trim(value.substr(0, comma));
+
+        if (option.empty() == false)
+        {
+            options.emplace_back(option);
+        }
+
+        value.remove_prefix((comma == std::string_view::npos) ? value.size() : comma + 1);
+    }
+}
+
+bool is_connection_option(std::string_view name, const std::vector<std::string> & options)
+{
+    for (const std::string & option : options)
+    {
+        if (iequals(name, option))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// calls f with each header line (without CRLF) and its trimmed name
+template <typename Function>
+void for_each_header(std::string_view headers, Function f)
+{
+    while (headers.empty() == false)
+    {
+        std::size_t eol = headers.find("\r\n");
+        std::string_view line = headers.substr(0, eol);
+        headers.remove_prefix(eol == std::string_view::npos ? headers.size() : eol + 2);
+
+        f(line, trim(line.substr(0, line.find(':'))));
+    }
+}
+
+// connection to the upstream server, with its own read buffer
+class upstream_connection
+{
+public:
+    upstream_connection(const sockaddr_in & address, const std::string & unix_path)
+        : buf_(relay_buffer_size), begin_(0), end_(0)
+    {
+#ifndef WIN32
+        if (unix_path.empty() == false)
+        {
+            unix_socket_wrapper * s = new unix_socket_wrapper;
+            sock_.reset(s);
+            s->connect(unix_path);
+        }
+        else
+#endif
+        {
+            tcp_socket_wrapper * s = new tcp_socket_wrapper;
+            sock_.reset(s);
+            s->connect(address);
+        }
+
+        // the upstream server that stops responding must not pin the client
+        // connection (and its thread) forever
+        int timeout = upstream_timeout;
+        sock_->set_timeouts(timeout, timeout);
+    }
+
+    // whether the idle connection was closed by the upstream server
+    bool stale() const
+    {
+        return (begin_ != end_) || sock_->peer_closed();
+    }
+
+    void write(const char * data, std::size_t size)
+    {
+        sock_->write(data, size);
+    }
+
+    void write(std::string_view s)
+    {
+        sock_->write(s.data(), s.size());
+    }
+
+    // reads the line without its CRLF terminator,
+    // returns false if the connection was closed before the line was complete
+    bool read_line(std::string & line)
+    {
+        line.clear();
+
+        while (true)
+        {
+            const char * first = &buf_[0] + begin_;
+            const char * last = &buf_[0] + end_;
+            const char * nl = std::find(first, last, '\n');
+
+            line.append(first, nl);
+
+            if (nl != last)
+            {
+                begin_ += (nl - first) + 1;
+
+                if ((line.empty() == false) && (line.back() == '\r'))
+                {
+                    line.pop_back();
+                }
+
+                return true;
+            }
+
+            begin_ = end_;
+
+            if ((line.size() > max_line_length) || (fill() == false))
+            {
+                return false;
+            }
+        }
+    }
+
+    // number of bytes received, but not yet consumed
+    std::size_t buffered() const
+    {
+        return end_ - begin_;
+    }
+
+    base_socket_wrapper & socket()
+    {
+        return *sock_;
+    }
+
+    // reads up to size bytes, returns 0 if the connection was closed
+    std::size_t read_some(char * data, std::size_t size)
+    {
+        if ((begin_ == end_) && (fill() == false))
+        {
+            return 0;
+        }
+
+        std::size_t n = std::min(size, end_ - begin_);
+        std::memcpy(data, &buf_[0] + begin_, n);
+        begin_ += n;
+
+        return n;
+    }
+
+private:
+    bool fill()
+    {
+        begin_ = 0;
+        end_ = sock_->read(&buf_[0], buf_.size());
+
+        return end_ != 0;
+    }
+
+    std::unique_ptr<base_socket_wrapper> sock_;
+    std::vector<char> buf_;
+    std::size_t begin_;
+    std::size_t end_;
+};
+
+struct upstream_server
+{
+    std::string host;
+    int port;
+    std::string unix_path;
+    sockaddr_in address; // resolved once, when the route is registered
+
+    std::atomic<int> outstanding;
+
+    std::mutex mtx;
+    std::vector<std::unique_ptr<upstream_connection> > idle;
+};
+
+typedef std::vector<std::shared_ptr<proxy_route> > route_list;
+
+// the routes are replaced as a whole, each thread keeps its own reference
+// to the current list and locks routes_mtx only when the version changes
+std::mutex routes_mtx;
+
+// sorted by prefix length, longest first
+std::shared_ptr<const route_list> routes = std::make_shared<const route_list>();
+std::atomic<std::uint64_t> routes_version(1);
+
+std::atomic<bool> any_routes(false);
+
+struct route_list_view
+{
+    std::shared_ptr<const route_list> routes;
+    std::uint64_t version = 0;
+};
+
+thread_local route_list_view current_routes;
+
+// copies exactly size bytes from the upstream connection to the client,
+// large bodies are spliced directly to the client socket (if known)
+void relay_exactly(upstream_connection & conn, std::ostream & out, std::size_t size,
+    base_socket_wrapper * client = NULL)
+{
+    char buf[relay_buffer_size];
+
+    while ((size != 0) && (conn.buffered() != 0))
+    {
+        std::size_t n = conn.read_some(buf, std::min(size, sizeof(buf)));
+
+        out.write(buf, n);
+        size -= n;
+    }
+
+    if ((client != NULL) && (size >= splice_threshold))
+    {
+        out.flush();
+
+        if (conn.socket().forward_to(*client, size) != size)
+        {
+            throw std::runtime_error("upstream connection closed");
+        }
+
+        return;
+    }
+
+    while (size != 0)
+    {
+        std::size_t n = conn.read_some(buf, std::min(size, sizeof(buf)));
+        if (n == 0)
+        {
+            throw std::runtime_error("upstream connection closed");
+        }
+
+        out.write(buf, n);
+        size -= n;
+    }
+}
+
+// copies chunked body as it is, up to and including the trailer section
+void relay_chunked(upstream_connection & conn, std::ostream & out)
+{
+    std::string line;
+
+    while (true)
+    {
+        if (conn.read_line(line) == false)
+        {
+            throw std::runtime_error("upstream connection closed");
+        }
+
+        out << line << "\r\n";
+
+        unsigned long size = 0;
+        if (std::sscanf(line.c_str(), "%lx", &size) != 1)
+        {
+            throw std::runtime_error("malformed chunk from upstream");
+        }
+
+        if (size == 0)
+        {
+            break;
+        }
+
+        relay_exactly(conn, out, size + 2); // with CRLF after the chunk
+    }
+
+    // trailer section
+    while (true)
+    {
+        if (conn.read_line(line) == false)
+        {
+            throw std::runtime_error("upstream connection closed");
+        }
+
+        out << line << "\r\n";
+
+        if (line.empty())
+        {
+            break;
+        }
+    }
+}
+
+// sends the request body to the upstream server
+void send_body(upstream_connection & conn, const forwarded_request & request)
+{
+    char buf[relay_buffer_size];
+
+    if (request.chunked)
+    {
+        while (true)
+        {
+            request.body->read(buf, sizeof(buf));
+            std::size_t n = (std::size_t)request.body->gcount();
+            if (n == 0)
+            {
+                break;
+            }
+
+            char size_line[24];
+            int len = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", n);
+
+            conn.write(size_line, len);
+            conn.write(buf, n);
+            conn.write("\r\n", 2);
+        }
+
+        conn.write("0\r\n\r\n", 5);
+    }
+    else
+    {
+        std::size_t remaining = request.content_length;
+
+        // the part of the body that is already in the client stream buffer
+        std::streamsize available;
+        while ((remaining != 0) && ((available = request.body->rdbuf()->in_avail()) > 0))
+        {
+            request.body->read(buf, std::min({ remaining, sizeof(buf), (std::size_t)available }));
+            std::size_t n = (std::size_t)request.body->gcount();
+
+            conn.write(buf, n);
+            remaining -= n;
+        }
+
+        if ((request.client_socket != NULL) && (remaining >= splice_threshold))
+        {
+            if (request.client_socket->forward_to(conn.socket(), remaining) != remaining)
+            {
+                throw std::runtime_error("client closed the connection");
+            }
+
+            return;
+        }
+
+        while (remaining != 0)
+        {
+            request.body->read(buf, std::min(remaining, sizeof(buf)));
+            std::size_t n = (std::size_t)request.body->gcount();
+            if (n == 0)
+            {
+                throw std::runtime_error("client closed the connection");
+            }
+
+            conn.write(buf, n);
+            remaining -= n;
+        }
+    }
+}
+
+void send_head(upstream_connection & conn, upstream_server & server,
+    const forwarded_request & request)
+{
+    std::string head;
+    head.reserve(request.headers.size() + request.resource.size() + 256);
+
+    head.append(request.method);
+    head.append(1, ' ');
+    head.append(request.resource);
+    head.append(" HTTP/1.1\r\n");
+
+    bool has_host = false;
+
+    std::vector<std::string> options;
+    for_each_header(request.headers, [&options](std::string_view line, std::string_view name)
+        {
+            if (iequals(name, "Connection"))
+            {
+                add_connection_options(trim(line.substr(line.find(':') + 1)), options);
+            }
+        });
+
+    for_each_header(request.headers, [&](std::string_view line, std::string_view name)
+        {
+            if (is_hop_by_hop(name) || is_connection_option(name, options))
+            {
+                return;
+            }
+
+            if (iequals(name, "Host"))
+            {
+                has_host = true;
+            }
+
+            head.append(line);
+            head.append("\r\n");
+        });
+
+    if (has_host == false)
+    {
+        head.append("Host: ");
+        head.append(server.unix_path.empty() ? server.host : std::string("localhost"));
+        head.append("\r\n");
+    }
+
+    head.append("X-Forwarded-For: ");
+    head.append(request.client_address);
+    head.append("\r\n");
+
+    if (request.body != NULL)
+    {
+        if (request.chunked)
+        {
+            head.append("Transfer-Encoding: chunked\r\n");
+        }
+        else
+        {
+            head.append("Content-Length: ");
+            head.append(std::to_string(request.content_length));
+            head.append("\r\n");
+        }
+    }
+
+    head.append("\r\n");
+
+    conn.write(head);
+}
+
+// response head received from the upstream server
+struct response_head
+{
+    int status;
+    std::string status_line;
+    std::string headers;    // forwarded header lines
+    bool has_length;
+    std::size_t content_length;
+    bool chunked;
+    bool close;
+};
+
+bool read_head(upstream_connection & conn, response_head & head)
+{
+    std::string line;
+    std::vector<std::string> options;
+
+    // interim 1xx responses are not relayed,
+    // except for 101 Switching Protocols, after which there is no more HTTP
+    do
+    {
+        if (conn.read_line(head.status_line) == false)
+        {
+            return false;
+        }
+
+        head.status = 0;
+        (void)std::sscanf(head.status_line.c_str(), "HTTP/%*d.%*d %d", &head.status);
+        if (head.status == 0)
+        {
+            throw std::runtime_error("malformed status line from upstream");
+        }
+
+        head.headers.clear();
+        head.has_length = false;
+        head.content_length = 0;
+        head.chunked = false;
+        head.close = (head.status_line.compare(0, 8, "HTTP/1.0") == 0);
+        options.clear();
+
+        while (true)
+        {
+            if (conn.read_line(line) == false)
+            {
+                return false;
+            }
+
+            if (line.empty())
+            {
+                break;
+            }
+
+            std::size_t colon = line.find(':');
+            std::string_view name = trim(std::string_view(line).substr(0, colon));
+            std::string_view value = (colon == std::string::npos) ?
+                std::string_view() : trim(std::string_view(line).substr(colon + 1));
+
+            if (iequals(name, "Content-Length"))
+            {
+                head.has_length = true;
+                head.content_length = (std::size_t)std::strtoull(
+                    std::string(value).c_str(), NULL, 10);
+            }
+            else if (iequals(name, "Transfer-Encoding"))
+            {
+                head.chunked = (value.find("chunked") != std::string_view::npos);
+            }
+            else if (iequals(name, "Connection"))
+            {
+                if (iequals(value, "close"))
+                {
+                    head.close = true;
+                }
+                else if (iequals(value, "keep-alive"))
+                {
+                    head.close = false;
+                }
+
+                add_connection_options(value, options);
+            }
+
+            if ((is_hop_by_hop(name) == false) || iequals(name, "Content-Length") ||
+                (iequals(name, "Transfer-Encoding") && head.chunked))
+            {
+                head.headers.append(line);
+                head.headers.append("\r\n");
+            }
+        }
+    }
+    while ((head.status >= 100) && (head.status < 200) && (head.status != 101));
+
+    if (options.empty() == false)
+    {
+        // the headers named in Connection are not forwarded either
+        std::string forwarded;
+        for_each_header(head.headers, [&](std::string_view line, std::string_view name)
+            {
+                if (is_connection_option(name, options) == false)
+                {
+                    forwarded.append(line);
+                    forwarded.append("\r\n");
+                }
+            });
+
+        head.headers.swap(forwarded);
+    }
+
+    if (head.status == 101)
+    {
+        head.close = true;
+    }
+
+    return true;
+}
+
+upstream_server & pick_server(proxy_route & route);
+
+} // unnamed namespace
+
+namespace http
+{
+namespace proxy_details
+{
+
+class proxy_route
+{
+public:
+    std::string prefix;
+    std::vector<std::unique_ptr<upstream_server> > servers;
+    std::atomic<unsigned int> next;
+};
+
+} // namespace proxy_details
+} // namespace http
+
+namespace // unnamed
+{
+
+// the server with the least outstanding requests,
+// ties are resolved in round-robin fashion
+upstream_server & pick_server(proxy_route & route)
+{
+    std::size_t n = route.servers.size();
+    std::size_t start = route.next++ % n;
+
+    std::size_t best = start;
+    int best_outstanding = route.servers[start]->outstanding;
+
+    for (std::size_t i = 1; i != n; ++i)
+    {
+        std::size_t candidate = (start + i) % n;
+        int outstanding = route.servers[candidate]->outstanding;
+
+        if (outstanding < best_outstanding)
+        {
+            best = candidate;
+            best_outstanding = outstanding;
+        }
+    }
+
+    return *route.servers[best];
+}
+
+std::unique_ptr<upstream_connection> acquire(upstream_server & server, bool & reused)
+{
+    {
+        std::lock_guard<std::mutex> lck(server.mtx);
+
+        while (server.idle.empty() == false)
+        {
+            std::unique_ptr<upstream_connection> conn(std::move(server.idle.back()));
+            server.idle.pop_back();
+
+            if (conn->stale() == false)
+            {
+                reused = true;
+                return conn;
+            }
+        }
+    }
+
+    reused = false;
+
+    // connected without any shared lock, so that the slow server
+    // delays only the requests sent to it
+    return std::unique_ptr<upstream_connection>(
+        new upstream_connection(server.address, server.unix_path));
+}
+
+void release(upstream_server & server, std::unique_ptr<upstream_connection> conn)
+{
+    std::lock_guard<std::mutex> lck(server.mtx);
+
+    if (server.idle.size() < max_idle_connections)
+    {
+        server.idle.push_back(std::move(conn));
+    }
+}
+
+// keeps the number of outstanding requests of the server
+struct outstanding_guard
+{
+    explicit outstanding_guard(upstream_server & s) : server(s) { ++server.outstanding; }
+    ~outstanding_guard() { --server.outstanding; }
+
+    upstream_server & server;
+};
+
+} // unnamed namespace
+
+std::shared_ptr<proxy_route> http::proxy_details::find_route(std::string_view path)
+{
+    if (any_routes == false)
+    {
+        return std::shared_ptr<proxy_route>();
+    }
+
+    route_list_view & view = current_routes;
+
+    if (routes_version.load(std::memory_order_acquire) != view.version)
+    {
+        std::lock_guard<std::mutex> lck(routes_mtx);
+
+        view.routes = routes;
+        view.version = routes_version.load(std::memory_order_relaxed);
+    }
+
+    for (const std::shared_ptr<proxy_route> & r : *view.routes)
+    {
+        if (path.substr(0, r->prefix.size()) == r->prefix)
+        {
+            return r;
+        }
+    }
+
+    return std::shared_ptr<proxy_route>();
+}
+
+bool http::proxy_details::forward(proxy_route & route,
+    const forwarded_request & request, std::ostream & out)
+{
+    upstream_server & server = pick_server(route);
+    outstanding_guard guard(server);
+
+    std::unique_ptr<upstream_connection> conn;
+    response_head head;
+
+    bool body_sent = false;
+
+    // the idle connection might have been closed by the upstream server
+    // in the meantime, in which case the request is repeated once
+    // with the new connection (only if the body was not consumed yet)
+    for (int attempt = 0; ; ++attempt)
+    {
+        bool reused = false;
+
+        try
+        {
+            conn = acquire(server, reused);
+
+            send_head(*conn, server, request);
+
+            if (request.body != NULL)
+            {
+                body_sent = true;
+                send_body(*conn, request);
+            }
+
+            if (read_head(*conn, head))
+            {
+                break;
+            }
+
+            throw std::runtime_error("upstream connection closed");
+        }
+        catch (const std::exception &)
+        {
+            conn.reset();
+
+            if (reused && (body_sent == false) && (attempt == 0))
+            {
+                continue;
+            }
+
+            send_status(out, 502);
+
+            // the request body (unconsumed or only partly sent)
+            // would be taken as the next request
+            return request.body == NULL;
+        }
+    }
+
+    // the response to HEAD has the length of the body that would be sent for GET
+    bool no_body = (request.method == "HEAD") || (head.status < 200) ||
+        (head.status == 204) || (head.status == 304);
+    bool delimited = ((no_body || head.chunked || head.has_length) && (head.status != 101));
+
+    // the response without length is terminated by closing the connection,
+    // which has to be propagated to the client
+    if (delimited == false)
+    {
+        head.headers.append("Connection: close\r\n");
+    }
+
+    try
+    {
+        out << head.status_line << "\r\n" << head.headers << "\r\n";
+
+        if (no_body)
+        {
+        }
+        else if (head.chunked)
+        {
+            relay_chunked(*conn, out);
+        }
+        else if (head.has_length)
+        {
+            relay_exactly(*conn, out, head.content_length, request.client_socket);
+        }
+        else
+        {
+            char buf[relay_buffer_size];
+            while (conn->buffered() != 0)
+            {
+                out.write(buf, conn->read_some(buf, sizeof(buf)));
+            }
+
+            if (request.client_socket != NULL)
+            {
+                out.flush();
+
+                (void)conn->socket().forward_to(*request.client_socket,
+                    static_cast<std::size_t>(-1));
+            }
+            else
+            {
+                std::size_t n;
+                while ((n = conn->read_some(buf, sizeof(buf))) != 0)
+                {
+                    out.write(buf, n);
+                }
+            }
+        }
+
+        out.flush();
+    }
+    catch (const std::exception &)
+    {
+        // the response was cut in the middle
+        return false;
+    }
+
+    if (delimited && (head.close == false))
+    {
+        release(server, std::move(conn));
+    }
+
+    return delimited;
+}
+
+void http::register_proxy_route(const char * prefix, const std::vector<std::string> & upstreams)
+{
+    if (upstreams.empty())
+    {
+        throw std::invalid_argument("proxy route needs at least one upstream server");
+    }
+
+    std::shared_ptr<proxy_route> route(new proxy_route);
+    route->prefix = prefix;
+    route->next = 0;
+
+    for (const std::string & u : upstreams)
+    {
+        std::unique_ptr<upstream_server> server(new upstream_server);
+        server->port = 0;
+        server->outstanding = 0;
+        std::memset(&server->address, 0, sizeof(server->address));
+
+        if (u.compare(0, 5, "unix:") == 0)
+        {
+            server->unix_path = u.substr(5);
+        }
+        else
+        {
+            std::size_t colon = u.rfind(':');
+            if (colon == std::string::npos)
+            {
+                throw std::invalid_argument("upstream server must be given as host:port");
+            }
+
+            server->host = u.substr(0, colon);
+            server->port = std::stoi(u.substr(colon + 1));
+            server->address = tcp_socket_wrapper::resolve(server->host, server->port);
+        }
+
+        route->servers.push_back(std::move(server));
+    }
+
+    std::lock_guard<std::mutex> lck(routes_mtx);
+
+    std::shared_ptr<route_list> modified = std::make_shared<route_list>(*routes);
+
+    modified->erase(std::remove_if(modified->begin(), modified->end(),
+        [&route](const std::shared_ptr<proxy_route> & r)
+        {
+            return r->prefix == route->prefix;
+        }), modified->end());
+
+    modified->push_back(route);
+
+    std::stable_sort(modified->begin(), modified->end(),
+        [](const std::shared_ptr<proxy_route> & a, const std::shared_ptr<proxy_route> & b)
+        {
+            return a->prefix.size() > b->prefix.size();
+        });
+
+    routes = modified;
+    routes_version.fetch_add(1, std::memory_order_release);
+
+    any_routes = true;
+}
+
+void http::set_proxy_idle_connections(std::size_t n)
+{
+    max_idle_connections = n;
+}
+
+void http::set_proxy_timeout(std::chrono::milliseconds timeout)
+{
+    upstream_timeout = (int)timeout.count();
+}
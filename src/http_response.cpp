@@ -0,0 +1,342 @@
+
+#include <http_response.h>
+
+#include <charconv>
+#include <cstring>
+#include <ctime>
+
+using namespace http;
+
+namespace // unnamed
+{
+
+struct status_entry
+{
+    int code;
+    const char * reason;
+};
+
+const status_entry known_statuses[] =
+{
+    { 100, "Continue" },
+    { 101, "Switching Protocols" },
+    { 200, "OK" },
+    { 201, "Created" },
+    { 202, "Accepted" },
+    { 204, "No Content" },
+    { 206, "Partial Content" },
+    { 301, "Moved Permanently" },
+    { 302, "Found" },
+    { 303, "See Other" },
+    { 304, "Not Modified" },
+    { 307, "Temporary Redirect" },
+    { 308, "Permanent Redirect" },
+    { 400, "Bad Request" },
+    { 401, "Unauthorized" },
+    { 403, "Forbidden" },
+    { 404, "Not Found" },
+    { 405, "Method Not Allowed" },
+    { 408, "Request Timeout" },
+    { 409, "Conflict" },
+    { 411, "Length Required" },
+    { 413, "Payload Too Large" },
+    { 414, "URI Too Long" },
+    { 415, "Unsupported Media Type" },
+    { 429, "Too Many Requests" },
+    { 431, "Request Header Fields Too Large" },
+    { 500, "Internal Server Error" },
+    { 501, "Not Implemented" },
+    { 502, "Bad Gateway" },
+    { 503, "Service Unavailable" },
+    { 504, "Gateway Timeout" },
+    { 505, "HTTP Version Not Supported" }
+};
+
+const int min_status = 100;
+const int max_status = 599;
+
+// precomputed "HTTP/1.1 code reason\r\n" lines for all valid codes
+struct status_lines
+{
+    std::string lines[max_status - min_status + 1];
+
+    status_lines()
+    {
+        for (int code = min_status; code <= max_status; ++code)
+        {
+            lines[code - min_status] = "HTTP/1.1 " + std::to_string(code) + " "
+                + reason_phrase(code) + "\r\n";
+        }
+    }
+};
+
+const status_lines & status_table()
+{
+    static const status_lines table;
+
+    return table;
+}
+
+const char content_type_prefix[] = "Content-Type: ";
+const char content_length_prefix[] = "Content-Length: ";
+const char cache_line[] = "Cache-Control: public, max-age=31536000\r\n";
+const char no_cache_line[] = "Cache-Control: no-cache, no-store, must-revalidate\r\n";
+const char chunked_line[] = "Transfer-Encoding: chunked\r\n";
+const char close_line[] = "Connection: close\r\n";
+
+#define LITERAL(s) s, sizeof(s) - 1
+
+// Date header line, formatted once per second in each thread
+struct date_line
+{
+    std::time_t second;
+    char line[64];
+    std::size_t size;
+};
+
+const date_line & current_date()
+{
+    thread_local date_line cached = { (std::time_t)-1, { 0 }, 0 };
+
+    std::time_t now = std::time(NULL);
+    if (now != cached.second)
+    {
+        std::tm parts;
+#ifdef _WIN32
+        gmtime_s(&parts, &now);
+#else
+        gmtime_r(&now, &parts);
+#endif
+        cached.size = std::strftime(cached.line, sizeof(cached.line),
+            "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &parts);
+        cached.second = now;
+    }
+
+    return cached;
+}
+
+} // unnamed namespace
+
+const char * http::reason_phrase(int status_code)
+{
+    for (const status_entry & e : known_statuses)
+    {
+        if (e.code == status_code)
+        {
+            return e.reason;
+        }
+    }
+
+    return "Unknown";
+}
+
+const char * http::file_mime_type(std::string_view file_name)
+{
+    std::size_t pos = file_name.find('.');
+    std::string_view ext = file_name.substr(pos + 1);
+    if (ext == "html")
+    {
+        return "text/html";
+    }
+    else if (ext == "css")
+    {
+        return "text/css";
+    }
+    else if (ext == "js")
+    {
+        return "application/javascript";
+    }
+    else if (ext == "png")
+    {
+        return "image/png";
+    }
+    else if (ext == "jpg")
+    {
+        return "image/jpg";
+    }
+    else
+    {
+        return "text/plain";
+    }
+}
+
+response_builder::response_builder(std::size_t capacity)
+{
+    buf_.reserve(capacity);
+}
+
+response_builder & response_builder::start(int status_code)
+{
+    buf_.clear();
+
+    if ((status_code >= min_status) && (status_code <= max_status))
+    {
+        buf_.append(status_table().lines[status_code - min_status]);
+    }
+    else
+    {
+        buf_.append("HTTP/1.1 ");
+        buf_.append(std::to_string(status_code));
+        buf_.append(" Unknown\r\n");
+    }
+
+    return *this;
+}
+
+response_builder & response_builder::header(const char * name, const std::string & value)
+{
+    append(name, std::strlen(name));
+    append(": ", 2);
+    append(value.data(), value.size());
+    append("\r\n", 2);
+
+    return *this;
+}
+
+response_builder & response_builder::header(const char * name, std::size_t value)
+{
+    char digits[24];
+    char * end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+
+    append(name, std::strlen(name));
+    append(": ", 2);
+    append(digits, end - digits);
+    append("\r\n", 2);
+
+    return *this;
+}
+
+response_builder & response_builder::header_lines(std::string_view lines)
+{
+    append(lines.data(), lines.size());
+
+    return *this;
+}
+
+response_builder & response_builder::content_type(const std::string & mime_type)
+{
+    append(LITERAL(content_type_prefix));
+    append(mime_type.data(), mime_type.size());
+    append("\r\n", 2);
+
+    return *this;
+}
+
+response_builder & response_builder::content_length(std::size_t length)
+{
+    char digits[24];
+    char * end = std::to_chars(digits, digits + sizeof(digits), length).ptr;
+
+    append(LITERAL(content_length_prefix));
+    append(digits, end - digits);
+    append("\r\n", 2);
+
+    return *this;
+}
+
+response_builder & response_builder::cache_control(bool cache)
+{
+    if (cache)
+    {
+        append(LITERAL(cache_line));
+    }
+    else
+    {
+        append(LITERAL(no_cache_line));
+    }
+
+    return *this;
+}
+
+response_builder & response_builder::date()
+{
+    const date_line & d = current_date();
+
+    append(d.line, d.size);
+
+    return *this;
+}
+
+response_builder & response_builder::chunked()
+{
+    append(LITERAL(chunked_line));
+
+    return *this;
+}
+
+response_builder & response_builder::close()
+{
+    append(LITERAL(close_line));
+
+    return *this;
+}
+
+response_builder & response_builder::end_headers()
+{
+    append("\r\n", 2);
+
+    return *this;
+}
+
+response_builder & response_builder::body(const char * data, std::size_t size)
+{
+    append(data, size);
+
+    return *this;
+}
+
+response_builder & response_builder::body(const std::string & s)
+{
+    append(s.data(), s.size());
+
+    return *this;
+}
+
+std::string response_builder::release()
+{
+    std::string result;
+
+    result.swap(buf_);
+
+    return result;
+}
+
+void response_builder::send(std::ostream & out) const
+{
+    out.write(buf_.data(), buf_.size());
+    out.flush();
+}
+
+response_builder & http::connection_response()
+{
+    thread_local response_builder builder;
+
+    return builder;
+}
+
+void http::send_status(std::ostream & out, int status_code, const std::string & message)
+{
+    if ((status_code < 200) || (status_code == 204) || (status_code == 304))
+    {
+        // these responses never have a body
+        response_builder & r = connection_response();
+
+        r.start(status_code).date().end_headers().send(out);
+
+        return;
+    }
+
+    const char * text = message.empty() ? reason_phrase(status_code) : message.c_str();
+    std::size_t size = message.empty() ? std::strlen(text) : message.size();
+
+    response_builder & r = connection_response();
+
+    r.start(status_code)
+        .content_type("text/plain")
+        .content_length(size)
+        .cache_control(false)
+        .date()
+        .end_headers()
+        .body(text, size)
+        .send(out);
+}
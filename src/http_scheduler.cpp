@@ -0,0 +1,446 @@
+
+#include <http_scheduler.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using namespace http;
+
+namespace // unnamed
+{
+
+const std::size_t initial_deque_capacity = 256;
+
+// how long the waiting worker sleeps when there is nothing to help with
+const std::chrono::milliseconds help_poll(1);
+
+// Chase-Lev deque, in the formulation for weak memory models
+// by Le, Pop, Cohen and Zappa Nardelli: the owner pushes and pops
+// at the bottom, thieves take from the top; the arrays replaced
+// when growing are kept until the deque is destroyed, as thieves
+// can still read from them
+template <typename T>
+class work_deque
+{
+public:
+    work_deque()
+        : top_(0), bottom_(0), array_(new ring(initial_deque_capacity))
+    {
+        retired_.push_back(std::unique_ptr<ring>(array_.load()));
+    }
+
+    // owner only
+    void push(T * item)
+    {
+        std::int64_t b = bottom_.load(std::memory_order_relaxed);
+        std::int64_t t = top_.load(std::memory_order_acquire);
+        ring * a = array_.load(std::memory_order_relaxed);
+
+        if (b - t > (std::int64_t)a->capacity - 1)
+        {
+            a = grow(a, t, b);
+        }
+
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // owner only, NULL if empty
+    T * pop()
+    {
+        std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        ring * a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+
+            return NULL;
+        }
+
+        T * item = a->get(b);
+
+        if (t == b)
+        {
+            // the last item, thieves might be taking it as well
+            if (top_.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed) == false)
+            {
+                item = NULL;
+            }
+
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+
+        return item;
+    }
+
+    // any thread, NULL if empty or lost the race
+    T * steal()
+    {
+        std::int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t >= b)
+        {
+            return NULL;
+        }
+
+        ring * a = array_.load(std::memory_order_acquire);
+        T * item = a->get(t);
+
+        if (top_.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed) == false)
+        {
+            return NULL;
+        }
+
+        return item;
+    }
+
+private:
+    // not for use
+    work_deque(const work_deque &);
+    void operator=(const work_deque &);
+
+    struct ring
+    {
+        explicit ring(std::size_t n)
+            : capacity(n), slots(new std::atomic<T *>[n])
+        {
+        }
+
+        T * get(std::int64_t i) const
+        {
+            return slots[(std::size_t)i & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t i, T * item)
+        {
+            slots[(std::size_t)i & (capacity - 1)].store(item, std::memory_order_relaxed);
+        }
+
+        std::size_t capacity; // power of two
+        std::unique_ptr<std::atomic<T *>[]> slots;
+    };
+
+    ring * grow(ring * a, std::int64_t t, std::int64_t b)
+    {
+        ring * bigger = new ring(a->capacity * 2);
+        retired_.push_back(std::unique_ptr<ring>(bigger));
+
+        for (std::int64_t i = t; i != b; ++i)
+        {
+            bigger->put(i, a->get(i));
+        }
+
+        array_.store(bigger, std::memory_order_release);
+
+        return bigger;
+    }
+
+    alignas(64) std::atomic<std::int64_t> top_;
+    alignas(64) std::atomic<std::int64_t> bottom_;
+    std::atomic<ring *> array_;
+    std::vector<std::unique_ptr<ring> > retired_; // owner only, including the current one
+};
+
+} // unnamed namespace
+
+struct task_scheduler::task
+{
+    std::function<void()> function;
+    task_group * group;
+};
+
+struct task_scheduler::worker
+{
+    task_scheduler * owner;
+    std::size_t index;
+    std::uint64_t random; // xorshift state for choosing the victims
+    work_deque<task> deque;
+    std::thread thread;
+};
+
+thread_local task_scheduler::worker * task_scheduler::current_worker_ = NULL;
+
+task_scheduler::task_scheduler(std::size_t workers)
+    : queued_(0), sleeping_(0), stopping_(false)
+{
+    if (workers == 0)
+    {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (std::size_t i = 0; i != workers; ++i)
+    {
+        std::unique_ptr<worker> w(new worker);
+        w->owner = this;
+        w->index = i;
+        w->random = 0x9e3779b97f4a7c15ULL * (i + 1);
+
+        workers_.push_back(std::move(w));
+    }
+
+    // all deques exist before any worker can steal from them
+    for (std::unique_ptr<worker> & w : workers_)
+    {
+        w->thread = std::thread(&task_scheduler::worker_loop, this, w.get());
+    }
+}
+
+task_scheduler::~task_scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        stopping_ = true;
+        cv_.notify_all();
+    }
+
+    for (std::unique_ptr<worker> & w : workers_)
+    {
+        w->thread.join();
+    }
+}
+
+task_scheduler * task_scheduler::current()
+{
+    return (current_worker_ != NULL) ? current_worker_->owner : NULL;
+}
+
+void task_scheduler::submit(task * t)
+{
+    if ((current_worker_ != NULL) && (current_worker_->owner == this))
+    {
+        current_worker_->deque.push(t);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        shared_.push_back(t);
+    }
+
+    queued_.fetch_add(1);
+
+    // the sleeping worker registers itself before checking queued_,
+    // so either it sees the new task or it is seen here
+    if (sleeping_.load() != 0)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        cv_.notify_one();
+    }
+}
+
+task_scheduler::task * task_scheduler::find_task(worker * self)
+{
+    task * t = self->deque.pop();
+
+    if ((t == NULL) && (workers_.size() > 1))
+    {
+        // random victims, as many attempts as there are workers
+        std::uint64_t seed = self->random;
+
+        for (std::size_t attempt = 0; (t == NULL) && (attempt != workers_.size()); ++attempt)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+
+            worker * victim = workers_[seed % workers_.size()].get();
+            if (victim != self)
+            {
+                t = victim->deque.steal();
+            }
+        }
+
+        self->random = seed;
+    }
+
+    if (t == NULL)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        if (shared_.empty() == false)
+        {
+            t = shared_.front();
+            shared_.pop_front();
+        }
+    }
+
+    if (t != NULL)
+    {
+        queued_.fetch_sub(1);
+    }
+
+    return t;
+}
+
+void task_scheduler::run_task(task * t)
+{
+    task_group * group = t->group;
+
+    try
+    {
+        t->function();
+    }
+    catch (...)
+    {
+        group->fail(std::current_exception());
+    }
+
+    delete t;
+
+    group->finish();
+}
+
+void task_scheduler::worker_loop(worker * self)
+{
+    current_worker_ = self;
+
+    while (true)
+    {
+        task * t = find_task(self);
+        if (t != NULL)
+        {
+            run_task(t);
+
+            continue;
+        }
+
+        if (queued_.load() > 0)
+        {
+            // the task is there, but the steal lost the race
+            std::this_thread::yield();
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lck(mtx_);
+
+        sleeping_.fetch_add(1);
+
+        while ((queued_.load() <= 0) && (stopping_ == false))
+        {
+            cv_.wait(lck);
+        }
+
+        sleeping_.fetch_sub(1);
+
+        if (stopping_ && (queued_.load() <= 0))
+        {
+            break;
+        }
+    }
+
+    current_worker_ = NULL;
+}
+
+task_group::task_group()
+    : scheduler_(task_scheduler::current()), pending_(0)
+{
+}
+
+task_group::task_group(task_scheduler & scheduler)
+    : scheduler_(&scheduler), pending_(0)
+{
+}
+
+task_group::~task_group()
+{
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+        // ignore
+    }
+}
+
+void task_group::spawn(std::function<void()> f)
+{
+    if (scheduler_ == NULL)
+    {
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+        }
+
+        return;
+    }
+
+    pending_.fetch_add(1);
+
+    scheduler_->submit(new task_scheduler::task { std::move(f), this });
+}
+
+void task_group::wait()
+{
+    if ((scheduler_ != NULL) && (task_scheduler::current() == scheduler_))
+    {
+        // the worker executes other tasks instead of blocking
+        while (pending_.load() != 0)
+        {
+            task_scheduler::task * t = scheduler_->find_task(task_scheduler::current_worker_);
+            if (t != NULL)
+            {
+                scheduler_->run_task(t);
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lck(mtx_);
+
+                cv_.wait_for(lck, help_poll, [this]() { return pending_.load() == 0; });
+            }
+        }
+    }
+
+    std::exception_ptr error;
+
+    {
+        // also makes sure that the last finish has released the group
+        std::unique_lock<std::mutex> lck(mtx_);
+
+        cv_.wait(lck, [this]() { return pending_.load() == 0; });
+
+        error.swap(error_);
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void task_group::fail(std::exception_ptr e)
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    if (error_ == nullptr)
+    {
+        error_ = e;
+    }
+}
+
+void task_group::finish()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    if (pending_.fetch_sub(1) == 1)
+    {
+        cv_.notify_all();
+    }
+}
@@ -1,17 +1,63 @@
 
 #include <http_server.h>
+#include <http_admission.h>
+#include <http_cache.h>
+#include <http_chunked.h>
+#include <http_h2.h>
+#include <http_pack.h>
+#include <http_proxy.h>
+#include <http_response.h>
+#include <http_scheduler.h>
+#include <http_timer.h>
+#include <http_trace.h>
 #include <sockets.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <csignal>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <optional>
 #include <ostream>
 #include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_set>
 
+#include <condition_variable>
 #include <mutex>
 #include <thread>
 
+#ifndef WIN32
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HTTP_SERVER_SSE2
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HTTP_SERVER_AVX2
+#endif
+
 using namespace http;
 
 namespace // unnamed
@@ -25,760 +71,4733 @@ std::string base_dir;
 
 connection_callback_type connection_callback;
 
-// stores action functions and their known mime_types
+// stores GET action function with its known mime_type
+// (or "" if registered as generic action),
+// the time for which its responses are cached (zero if not cached)
+// and whether concurrent identical requests share the single execution
+struct get_route
+{
+    get_action_type action;
+    std::string mime_type;
+    std::chrono::milliseconds cache_ttl;
+    bool coalesce;
+};
+
+// stores POST action function with its known mime_type
 // (or "" if registered as generic action)
-std::unordered_map<std::string, std::pair<get_action_type, std::string> > get_actions;
-std::unordered_map<std::string, std::pair<post_action_type, std::string> > post_actions;
+struct post_route
+{
+    post_action_type action;
+    std::string mime_type;
+};
 
-std::mutex mtx;
+// isolated executor of the actions of some routes (bulkhead), with its own
+// workers and the bounded number of requests admitted to run or wait
+struct executor_pool
+{
+    std::string name;
+    std::size_t concurrency;
+    std::size_t queue_limit;
+    std::unique_ptr<task_scheduler> scheduler;
+    std::atomic<std::size_t> admitted;
+};
 
-int hex_digit_to_int(char c)
+// thrown when the executor pool of the route has no room for the request
+struct executor_rejected
 {
-    int t = (int)c;
-    int result;
-    
-    if ((t >= (int)'0') && (t <= (int)'9'))
-    {
-        result = t - (int)'0';
-    }
-    else if ((t >= (int)'a') && (t <= (int)'f'))
-    {
-        result = t - (int)'a' + 10;
-    }
-    else if ((t >= (int)'A') && (t <= (int)'F'))
-    {
-        result = t - (int)'A' + 10;
-    }
-    else
+};
+
+// named executor pools, guarded by mtx
+std::unordered_map<std::string, std::shared_ptr<executor_pool> > executor_pools;
+
+// allowed number of requests per second and burst size, zero rate means no limit
+struct route_limit
+{
+    double rate;
+    double burst;
+};
+
+// the routes are immutable once registered and shared with the requests
+// that use them, so that the lookup does not copy the action functions;
+// the whole table is immutable once published as well, each registration
+// publishes the modified copy
+struct route_table
+{
+    std::unordered_map<std::string, std::shared_ptr<const get_route> > get_actions;
+    std::unordered_map<std::string, std::shared_ptr<const post_route> > post_actions;
+    std::unordered_map<std::string, std::shared_ptr<executor_pool> > executors;
+
+    // token bucket parameters, published with the routes
+    // so that the requests read them without locking
+    route_limit client_limit = route_limit { 0.0, 0.0 };
+    std::unordered_map<std::string, route_limit> route_limits;
+
+    // routes that are shed also on open connections when overloaded
+    std::unordered_set<std::string> low_priority;
+
+    // executor pool of the route, NULL if not assigned to any
+    executor_pool * executor(const std::string & path) const
     {
-        // arbitrary failover value
-        result = 0;
+        auto it = executors.find(path);
+
+        return (it != executors.end()) ? it->second.get() : NULL;
     }
-    
-    return result;
+};
+
+// the latest routes, guarded by mtx
+std::shared_ptr<const route_table> published_routes = std::make_shared<const route_table>();
+
+class timed_socket;
+
+// independent part of the server, with its own listening sockets,
+// connection threads, replica of the routes, pool of request memory
+// and statistics; other threads communicate with the shard only through
+// its mailbox, which is emptied by the first thread of the shard
+// that needs the routes (or by its accept loops)
+//
+// still shared by all shards are the admission controller (updated once
+// per connection), the rate limiters and the file caches (locked by the key,
+// across the shards) and the logger
+struct alignas(64) server_shard
+{
+    typedef std::function<void(server_shard &)> message;
+
+    std::size_t index;
+    int cpu; // processor of all threads of the shard, -1 if not pinned
+
+    std::mutex mailbox_mtx;
+    std::vector<message> mailbox;
+    std::atomic<bool> has_mail;
+
+    // connection threads, each of them moves itself to the finished list when done,
+    // to be joined by the accept loop of the shard or by server_stop
+    std::mutex workers_mtx;
+    std::condition_variable workers_cv;
+    std::unordered_map<std::thread::id, std::thread> workers;
+    std::vector<std::thread> finished_workers;
+    std::unordered_set<timed_socket *> open_connections;
+
+    // replica of the routes, read by the connections of the shard
+    std::mutex routes_mtx;
+    std::shared_ptr<const route_table> routes;
+    std::atomic<std::uint64_t> routes_version;
+
+    // request memory of the finished connections, reused by the new ones
+    std::mutex arenas_mtx;
+    std::vector<std::unique_ptr<char[]> > free_arenas;
+
+    // written by the threads of the shard only, on their own cache line
+    alignas(64) std::atomic<std::size_t> connections;
+    std::atomic<std::size_t> requests;
+};
+
+// requested number of shards (zero for one per hardware thread)
+// and whether their threads are pinned
+std::size_t shard_count = 1;
+bool pin_shard_threads = true;
+
+// shards of the running server, guarded by mtx
+std::vector<std::shared_ptr<server_shard> > shards;
+
+// complete responses of cached GET actions
+response_cache cached_responses;
+
+// GET actions that are currently executed on behalf of many requests
+single_flight in_flight;
+
+// static files that were not found, checked again after the time to live
+// or as soon as anything is added to the directory tree (where supported)
+negative_cache missing_files;
+std::chrono::milliseconds missing_file_ttl(1000);
+
+// longer paths are not worth remembering
+const std::size_t max_missing_path = 1024;
+
+#ifndef WIN32
+// open static files, with their headers except for the status line and the date,
+// checked again after the revalidation interval or as soon as they are changed
+// (where supported)
+open_file_cache open_files;
+
+// static files packed into the single mapped file, served instead of base_dir,
+// mapped again when the file at the path is replaced
+std::mutex static_pack_mtx;
+std::string static_pack_path;                    // guarded by static_pack_mtx
+std::shared_ptr<const asset_pack> static_pack;   // guarded by static_pack_mtx
+std::atomic<std::uint64_t> static_pack_version(0);
+
+// when the pack file was last checked for replacement, in steady clock milliseconds
+std::atomic<std::int64_t> static_pack_checked(0);
+const std::chrono::milliseconds static_pack_check_interval(1000);
+#endif
+
+// written with the single write for the missing files
+const char not_found_response[] =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 9\r\n"
+    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+    "\r\n"
+    "Not Found";
+
+void send_not_found(std::ostream & out)
+{
+    out.write(not_found_response, sizeof(not_found_response) - 1);
+    out.flush();
 }
 
-std::string file_mime_type(const std::string & file_name)
+// sends the error response, after which the connection is closed
+// (typically because the rest of the request cannot be skipped)
+void send_closing_status(std::ostream & out, int status_code)
 {
-    std::size_t pos = file_name.find('.');
-    std::string ext = file_name.substr(pos + 1);
-    if (ext == "html")
-    {
-        return "text/html";
-    }
-    else if (ext == "css")
-    {
-        return "text/css";
-    }
-    else if (ext == "js")
+    const char * text = reason_phrase(status_code);
+    std::size_t size = std::strlen(text);
+
+    response_builder & r = connection_response();
+
+    r.start(status_code)
+        .content_type("text/plain")
+        .content_length(size)
+        .cache_control(false)
+        .date()
+        .close()
+        .end_headers()
+        .body(text, size)
+        .send(out);
+}
+
+#ifdef __linux__
+
+std::once_flag static_watch_started;
+
+// adds the directory and all its subdirectories to the watch
+void watch_directory_tree(int fd, const std::filesystem::path & root,
+    std::map<int, std::filesystem::path> & watched)
+{
+    const std::uint32_t mask = IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY |
+        IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR;
+
+    int wd = inotify_add_watch(fd, root.c_str(), mask);
+    if (wd < 0)
     {
-        return "application/javascript";
+        return;
     }
-    else if (ext == "png")
+
+    watched[wd] = root;
+
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator it(root,
+        std::filesystem::directory_options::skip_permission_denied, ec);
+
+    for (; (ec.value() == 0) && (it != std::filesystem::recursive_directory_iterator());
+        it.increment(ec))
     {
-        return "image/png";
+        if (it->is_directory(ec))
+        {
+            wd = inotify_add_watch(fd, it->path().c_str(), mask);
+            if (wd >= 0)
+            {
+                watched[wd] = it->path();
+            }
+        }
     }
-    else if (ext == "jpg")
+}
+
+// forgets the missing files whenever any file appears in the static directory tree
+// and the open files when they are changed
+void static_watch_thread(std::string root)
+{
+    while ((root.size() > 1) && (root.back() == '/'))
     {
-        return "image/jpg";
+        root.pop_back();
     }
-    else
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0)
     {
-        return "text/plain";
+        // the time to live still applies
+        return;
     }
-}
 
-params_map_type do_decode_params(const char * begin, const char * end, bool decode)
-{
-    enum decoder_state { key, value };
-    decoder_state state = key;
-    
-    std::string k;
-    std::string v;
-    
-    params_map_type result;
-    
-    for (const char * it = begin; it != end; ++it)
+    std::map<int, std::filesystem::path> watched;
+    watch_directory_tree(fd, root, watched);
+
+    alignas(inotify_event) char buffer[4096];
+
+    while (true)
     {
-        char c = *it;
-        
-        switch (state)
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0)
         {
-        case key:
-            if (c == '=')
-            {
-                state = value;
-            }
-            else
-            {
-                k.append(1, c);
-            }
-
             break;
+        }
+
+        for (ssize_t pos = 0; pos < length; )
+        {
+            const inotify_event * e = reinterpret_cast<const inotify_event *>(buffer + pos);
+            pos += sizeof(inotify_event) + e->len;
 
-        case value:
-            if (c == '&')
+            auto it = watched.find(e->wd);
+
+            if ((e->len == 0) || (it == watched.end()))
+            {
+                // lost events or the watched directory itself
+                open_files.clear();
+                missing_files.clear();
+            }
+            else if ((e->mask & IN_ISDIR) != 0)
             {
-                if (decode)
+                if ((e->mask & (IN_CREATE | IN_MOVED_TO)) != 0)
                 {
-                    result[url_decode(k)] = url_decode(v);
+                    watch_directory_tree(fd, it->second / e->name, watched);
                 }
-                else
+                else if ((e->mask & (IN_DELETE | IN_MOVED_FROM)) != 0)
                 {
-                    result[k] = v;
+                    open_files.clear();
                 }
 
-                k.clear();
-                v.clear();
-
-                state = key;
+                // any path below the directory can be found now
+                if ((e->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) != 0)
+                {
+                    missing_files.clear();
+                }
             }
             else
             {
-                v.append(1, c);
-            }
+                // the file is reopened by its next request,
+                // and looked up again if it was missing
+                std::string name = it->second.string().substr(root.size()) + "/" + e->name;
 
-            break;
+                open_files.erase(name);
+                missing_files.erase(name);
+            }
         }
     }
 
-    if (state == value)
-    {
-        if (decode)
-        {
-            result[url_decode(k)] = url_decode(v);
-        }
-        else
-        {
-            result[k] = v;
-        }
-    }
-    
-    return result;
+    close(fd);
 }
 
-void get_file(std::ostream & out, const std::string & file_name)
-{
-    if ((logger != NULL) && ((log_mask & log_static_requests) != 0))
-    {
-        std::lock_guard<std::mutex> lck(mtx);
-        
-        *logger << "GET file " << file_name << '\n';
-    }
+#endif // __linux__
 
-    std::ifstream file(base_dir + file_name, std::ifstream::binary);
+std::mutex mtx;
 
-    if (file)
-    {
-        std::filebuf * pbuf = file.rdbuf();
-        
-        std::size_t size = pbuf->pubseekoff(0, file.end, file.in);
-        pbuf->pubseekpos(0, file.in);
-        
-        std::vector<char> buffer(size);
-        
-        pbuf->sgetn(&buffer[0], size);
-        
-        file.close();
-        
-        out << header(file_mime_type(file_name), size, true);
-        out.write(&buffer[0], size);
+// connection timeouts, zero means no limit
+std::chrono::milliseconds idle_timeout(0);
+std::chrono::milliseconds header_timeout(0);
+std::chrono::milliseconds body_timeout(0);
+std::chrono::milliseconds write_timeout(0);
 
-        out << "\r\n";
+// deadlines of all connections, spread over several wheels
+// to reduce the contention on their locks
+const std::size_t timer_wheel_count = 8;
+const std::chrono::milliseconds timer_resolution(100);
 
-        out.flush();
+timer_wheel timer_wheels[timer_wheel_count] =
+{
+    timer_wheel(timer_resolution), timer_wheel(timer_resolution),
+    timer_wheel(timer_resolution), timer_wheel(timer_resolution),
+    timer_wheel(timer_resolution), timer_wheel(timer_resolution),
+    timer_wheel(timer_resolution), timer_wheel(timer_resolution)
+};
 
-        if ((logger != NULL) && ((log_mask & log_static_responses) != 0))
-        {
-            std::lock_guard<std::mutex> lck(mtx);
-            
-            *logger << "file " << file_name << " size " << size << " bytes was sent\n";
-        }
-    }
-    else
-    {
-        if ((logger != NULL) && ((log_mask & log_static_requests) != 0))
-        {
-            std::lock_guard<std::mutex> lck(mtx);
-            
-            *logger << "file not found: " << file_name << '\n';
-        }
-        
-        out << "HTTP/1.1 404 Not Found\r\n"
-            << "Content-Type: text/plain\r\n"
-            << "Content-Length: 0\r\n\r\n";
+std::atomic<std::size_t> next_timer_wheel(0);
 
-        out.flush();
-    }
+std::once_flag timer_thread_started;
+
+// set by the trace signal, the trace is written by the timer thread
+volatile std::sig_atomic_t trace_requested = 0;
+
+std::mutex trace_file_mtx;
+std::string trace_file_name;
+
+void on_trace_signal(int)
+{
+    trace_requested = 1;
 }
 
-void get_action(std::ostream & out,
-    const get_action_type & action, const std::string & mime_type,
-    const std::string & path, const std::string & params)
+// writes the recorded spans to the file given by set_trace_signal
+void write_trace_file()
 {
-    try
-    {
-        if ((logger != NULL) && ((log_mask & log_dynamic_requests) != 0))
-        {
-            *logger << "GET action " << path << '\n';
-        }
+    std::string json;
+    json_writer w(json);
+    trace_details::write_chrome_trace(w);
 
-        if (mime_type.empty() == false)
-        {
-            // collect content to buffer
-            // and automatically generate appropriate HTTP header,
-            // depending on the registered mime_type and size of collected content
+    std::lock_guard<std::mutex> lock(trace_file_mtx);
 
-            std::ostringstream str_buf;
-                    
-            action(str_buf, path, params);
-                    
-            out << header(mime_type, str_buf.str().size(), false);
-            out << str_buf.str();
+    std::ofstream f(trace_file_name, std::ios::binary | std::ios::trunc);
+    f.write(json.data(), json.size());
+    f.close();
 
-            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
-            {
-                *logger << "GET action " << path
-                    << " of type " << mime_type
-                    << " returned " << str_buf.str().size() << " bytes\n";
-            }
-            
-            out.flush();
+    if (logger != NULL)
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+
+        if (f)
+        {
+            *logger << "trace written to " << trace_file_name << '\n';
         }
         else
         {
-            // allow the user to generate both the header and content
-                    
-            action(out, path, params);
-                    
-            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
-            {
-                *logger << "generic GET action " << path << " executed\n";
-            }
+            *logger << "cannot write trace to " << trace_file_name << '\n';
         }
     }
-    catch (const std::exception & e)
+}
+
+void timer_thread()
+{
+    while (true)
     {
-        if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+        std::this_thread::sleep_for(timer_resolution);
+
+        timer_wheel::clock_type::time_point now = timer_wheel::clock_type::now();
+
+        for (timer_wheel & w : timer_wheels)
         {
-            std::lock_guard<std::mutex> lck(mtx);
-                    
-            *logger << "error in GET action " << path << ": " << e.what() << '\n';
+            w.advance(now);
         }
-    }
-    catch (...)
-    {
-        if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+
+        if (trace_requested != 0)
         {
-            std::lock_guard<std::mutex> lck(mtx);
-                    
-            *logger << "unknown error in GET action " << path << '\n';
+            trace_requested = 0;
+            write_trace_file();
         }
     }
 }
 
-void get(std::ostream & out, const std::string & what)
+// large files are sent in blocks, each of them within the write timeout
+const std::size_t send_file_block = 1024 * 1024;
+
+// connection socket with the timeouts of blocking operations,
+// enforced by shutting the socket down when the deadline passes
+class timed_socket
 {
-    std::string path;
-    std::string params;
-    std::size_t pos = what.find('?');
-    if (pos != std::string::npos)
-    {
-        path = what.substr(0, pos);
-        params = what.substr(pos + 1);
-    }
-    else
+public:
+    typedef base_socket_wrapper::sockstate_type sockstate_type;
+
+    static constexpr sockstate_type CONNECTED = base_socket_wrapper::CONNECTED;
+    static constexpr sockstate_type ACCEPTED = base_socket_wrapper::ACCEPTED;
+
+    explicit timed_socket(base_socket_wrapper & sock)
+        : sock_(sock),
+          wheel_(timer_wheels[next_timer_wheel++ % timer_wheel_count]),
+          timer_([this]() { timed_out_ = true; sock_.shutdown(); }),
+          write_timer_([this]() { timed_out_ = true; sock_.shutdown(); }),
+          phase_(idle_phase), served_(false), header_follows_(true), timed_out_(false)
     {
-        path = what;
     }
 
-    if (path == "/")
+    ~timed_socket()
     {
-        get_file(out, "/index.html");
+        wheel_.cancel(timer_);
+        wheel_.cancel(write_timer_);
     }
-    else
-    {
-        get_action_type action;
-        std::string mime_type;
-        
-        bool found = false;
 
-        {
-            std::lock_guard<std::mutex> lck(mtx);
+    sockstate_type state() const { return sock_.state(); }
 
-            auto it = get_actions.find(path);
-            if (it != get_actions.end())
-            {
-                action = it->second.first;
-                mime_type = it->second.second;
+    void close() { sock_.close(); }
 
-                found = true;
-            }
-        }
+    bool timed_out() const { return timed_out_; }
 
-        if (found)
-        {
-            get_action(out, action, mime_type, path, params);
-        }
-        else
+    // whether the connection waits for the next request after serving
+    // the previous one (the new connection is expected to send its first request)
+    bool idle() const { return served_ && (phase_ == idle_phase); }
+
+    // unblocks and terminates the connection
+    void shutdown() { sock_.shutdown(); }
+
+    // waiting for the next request, the first data received starts its header
+    // (unless the connection is multiplexed)
+    void begin_idle(bool header_follows = true)
+    {
+        phase_ = idle_phase;
+        served_ = true;
+        header_follows_ = header_follows;
+    }
+
+    // the request has started, the whole header (with the request line)
+    // is subject to the single deadline
+    void begin_header()
+    {
+        if (phase_ != header_phase)
         {
-            get_file(out, path);
+            phase_ = header_phase;
+            header_deadline_ = timer_wheel::clock_type::now() + header_timeout;
         }
     }
-}
 
-void post(std::ostream & out, const std::string & what,
-    std::istream & in, std::size_t content_length, const std::string & content_type)
-{
-    std::string path;
-    std::string params;
-    std::size_t pos = what.find('?');
-    if (pos != std::string::npos)
+    // the header was received, the body is read by the action
+    void begin_body()
     {
-        path = what.substr(0, pos);
-        params = what.substr(pos + 1);
+        phase_ = body_phase;
     }
-    else
+
+    std::size_t read(void * buf, std::size_t len)
     {
-        path = what;
-    }
+        timer_wheel::clock_type::time_point now;
 
-    post_action_type action;
-    std::string mime_type;
-    
-    bool found = false;
-    
+        switch (phase_)
+        {
+        case idle_phase:
+            {
+                std::size_t n = (idle_timeout.count() == 0) ? sock_.read(buf, len) :
+                    timed_read(buf, len, timer_wheel::clock_type::now() + idle_timeout);
+
+                // the client that sends the request slowly (or endlessly)
+                // is not protected by the idle timeout anymore
+                if ((n != 0) && header_follows_)
+                {
+                    begin_header();
+                }
+
+                return n;
+            }
+
+        case header_phase:
+            if (header_timeout.count() == 0)
+            {
+                return sock_.read(buf, len);
+            }
+
+            return timed_read(buf, len, header_deadline_);
+
+        default:
+            if (body_timeout.count() == 0)
+            {
+                return sock_.read(buf, len);
+            }
+
+            return timed_read(buf, len, timer_wheel::clock_type::now() + body_timeout);
+        }
+    }
+
+    void write(const void * buf, std::size_t len)
     {
-        std::lock_guard<std::mutex> lck(mtx);
-        
-        auto it = post_actions.find(path);
-        if (it != post_actions.end())
+        if (write_timeout.count() == 0)
         {
-            action = it->second.first;
-            mime_type = it->second.second;
-            
-            found = true;
+            sock_.write(buf, len);
+
+            return;
         }
+
+        deadline_guard guard(wheel_, write_timer_, timer_wheel::clock_type::now() + write_timeout);
+
+        sock_.write(buf, len);
     }
-    
-    if (found)
+
+#ifndef WIN32
+    std::size_t send_file(int file, off_t offset, std::size_t len)
     {
-        try
+        if (write_timeout.count() == 0)
         {
-            if ((logger != NULL) && ((log_mask & log_dynamic_requests) != 0))
-            {
-                *logger << "POST action " << path << '\n';
-            }
-            
-            if (mime_type.empty() == false)
+            return sock_.send_file(file, offset, len);
+        }
+
+        std::size_t total = 0;
+
+        while (total != len)
+        {
+            std::size_t block = std::min(len - total, send_file_block);
+            std::size_t sent;
+
             {
-                // collect content to buffer
-                // and automatically generate appropriate HTTP header,
-                // depending on the registered mime_type and size of collected content
-                
-                std::ostringstream str_buf;
-                
-                action(str_buf, path, params, in, content_length, content_type);
-                
-                out << header(mime_type, str_buf.str().size(), false);
-                out << str_buf.str();
+                deadline_guard guard(wheel_, write_timer_,
+                    timer_wheel::clock_type::now() + write_timeout);
 
-                out.flush();
-                
-                if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
-                {
-                    *logger << "POST action " << path
-                        << " of type " << mime_type
-                        << " returned " << str_buf.str().size() << " bytes\n";
-                }
+                sent = sock_.send_file(file, offset + (off_t)total, block);
             }
-            else
+
+            total += sent;
+
+            if (sent != block)
             {
-                // allow the user to generate both the header and content
-                
-                action(out, path, params, in, content_length, content_type);
-                
-                if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
-                {
-                    *logger << "generic POST action " << path << " executed\n";
-                }
+                break;
             }
         }
-        catch (const std::exception & e)
+
+        return total;
+    }
+#endif
+
+private:
+    // not for use
+    timed_socket(const timed_socket &);
+    void operator=(const timed_socket &);
+
+    enum read_phase { idle_phase, header_phase, body_phase };
+
+    // keeps the deadline armed for the duration of the blocking operation
+    struct deadline_guard
+    {
+        deadline_guard(timer_wheel & w, timer_wheel::timer & t,
+            timer_wheel::clock_type::time_point deadline)
+            : wheel(w), timer(t)
         {
-            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
-            {
-                std::lock_guard<std::mutex> lck(mtx);
-                
-                *logger << "error in POST action " << path << ": " << e.what() << '\n';
-            }
+            wheel.arm(timer, deadline);
         }
-        catch (...)
+
+        ~deadline_guard()
         {
-            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
-            {
-                std::lock_guard<std::mutex> lck(mtx);
-                
-                *logger << "unknown error in POST action " << path << '\n';
-            }
+            wheel.cancel(timer);
         }
+
+        timer_wheel & wheel;
+        timer_wheel::timer & timer;
+    };
+
+    std::size_t timed_read(void * buf, std::size_t len,
+        timer_wheel::clock_type::time_point deadline)
+    {
+        deadline_guard guard(wheel_, timer_, deadline);
+
+        return sock_.read(buf, len);
     }
-}
 
-void connection_thread(std::shared_ptr<tcp_socket_wrapper> sock)
+    base_socket_wrapper & sock_;
+    timer_wheel & wheel_;
+    timer_wheel::timer timer_;
+    timer_wheel::timer write_timer_; // HTTP/2 streams write while the connection is read
+    std::atomic<read_phase> phase_;
+    std::atomic<bool> served_;
+    std::atomic<bool> header_follows_;
+    timer_wheel::clock_type::time_point header_deadline_;
+    std::atomic<bool> timed_out_;
+};
+
+// applies the body and write timeouts to the socket itself while the proxy
+// splices the data to or from it, bypassing timed_socket
+class splice_timeouts
 {
-    if ((logger != NULL) && ((log_mask & log_connections) != 0))
+public:
+    explicit splice_timeouts(base_socket_wrapper & sock)
+        : sock_(sock), applied_((body_timeout.count() != 0) || (write_timeout.count() != 0))
     {
-        std::lock_guard<std::mutex> lck(mtx);
-        
-        *logger << "accepted new connection\n";
+        if (applied_)
+        {
+            sock_.set_timeouts((int)body_timeout.count(), (int)write_timeout.count());
+        }
     }
-    
-    try
+
+    ~splice_timeouts()
     {
-        tcp_stream stream(*sock);
-        
-        if (connection_callback != nullptr)
+        if (applied_)
         {
             try
             {
-                connection_callback(stream, just_connected);
+                sock_.set_timeouts(0, 0);
             }
             catch (...)
             {
-                // ignore
+                // the connection is closed anyway
             }
         }
-        
-        std::string line;
-        bool get_command = false;
-        bool post_command = false;
-        std::string resource;
-        std::size_t content_length;
-        std::string content_type;
+    }
+
+private:
+    // not for use
+    splice_timeouts(const splice_timeouts &);
+    void operator=(const splice_timeouts &);
+
+    base_socket_wrapper & sock_;
+    bool applied_;
+};
+
+// overload detection based on the dispatch delays: from accepting the connection
+// till starting its thread, and from each request being ready till starting
+// its handler (including the wait for a worker of the scheduler)
+codel_controller admission;
+
+// the request of the calling thread that is ready for its handler,
+// while its dispatch delay was not recorded yet
+thread_local bool dispatch_pending = false;
+thread_local codel_controller::clock_type::time_point dispatch_ready;
 
-        while (std::getline(stream, line))
+// dispatch of the request served by the calling thread: its delay is recorded
+// once, when the action starts (see run_action), or as none at all
+// if the request was served by the calling thread without waiting
+class request_dispatch
+{
+public:
+    request_dispatch()
+    {
+        if (admission.enabled())
         {
-            if (line[line.size() - 1] == '\r')
-            {
-                line = line.substr(0, line.size() - 1);
-            }
+            dispatch_ready = codel_controller::clock_type::now();
+            dispatch_pending = true;
+        }
+    }
 
-            if (line == "")
-            {
-                if (get_command)
-                {
-                    get(stream, resource);
-                }
-                else if (post_command)
-                {
-                    post(stream, resource, stream, content_length, content_type);
-                }
+    ~request_dispatch()
+    {
+        if (dispatch_pending)
+        {
+            dispatch_pending = false;
+            admission.record(codel_controller::clock_type::duration::zero(), dispatch_ready);
+        }
+    }
 
-                get_command = false;
-                post_command = false;
-            }
-            else
-            {
-                if ((get_command == false) && (post_command == false))
-                {
-                    if (line.substr(0, 3) == "GET")
-                    {
-                        get_command = true;
+    // the body was received in advance, which is not counted as the delay
+    static void restart()
+    {
+        if (dispatch_pending)
+        {
+            dispatch_ready = codel_controller::clock_type::now();
+        }
+    }
 
-                        std::size_t pos = line.find(' ', 4);
-                        if (pos != std::string::npos)
-                        {
-                            resource = line.substr(4, pos - 4);
-                        }
-                    }
-                    else if (line.substr(0, 4) == "POST")
-                    {
-                        post_command = true;
+    // takes the dispatch over to the handler, false if there is none
+    static bool take(codel_controller::clock_type::time_point & ready)
+    {
+        if (dispatch_pending == false)
+        {
+            return false;
+        }
 
-                        std::size_t pos = line.find(' ', 5);
-                        if (pos != std::string::npos)
-                        {
-                            resource = line.substr(5, pos - 5);
-                        }
-                    }
-                }
-                else if (line.substr(0, 15) == "Content-Length:")
-                {
-                    unsigned long t;
-                    (void)std::sscanf(line.c_str() + 15, "%lu", &t);
-                    content_length = (std::size_t)t;
-                }
-                else if (line.substr(0, 13) == "Content-Type:")
-                {
-                    content_type = line.substr(14);
-                }
+        dispatch_pending = false;
+        ready = dispatch_ready;
+
+        return true;
+    }
+
+    // the handler of the taken dispatch starts
+    static void started(codel_controller::clock_type::time_point ready)
+    {
+        codel_controller::clock_type::time_point now = codel_controller::clock_type::now();
+
+        admission.record(now - ready, now);
+    }
+
+private:
+    // not for use
+    request_dispatch(const request_dispatch &);
+    void operator=(const request_dispatch &);
+};
+
+// written straight from the accepting thread to the rejected connections
+const char shed_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 19\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Service Unavailable";
+
+// the connection closed by the server waits this long for the peer to close
+// its side, so that the unread request does not make the kernel reset
+// the connection and discard the response before the peer reads it
+const int linger_ms = 1000;
+
+// rejected connections kept by one accepting thread, the oldest are closed first
+const std::size_t max_lingering = 256;
+
+// rejected connection waiting for the peer to close
+struct lingering_connection
+{
+    std::shared_ptr<base_socket_wrapper> sock;
+    codel_controller::clock_type::time_point deadline;
+};
+
+// sends the end of stream and reads the rest of the input before closing,
+// blocks the calling connection thread
+void lingering_close(base_socket_wrapper & sock)
+{
+    try
+    {
+        sock.shutdown_write();
+
+        codel_controller::clock_type::time_point deadline =
+            codel_controller::clock_type::now() + std::chrono::milliseconds(linger_ms);
+
+        while (sock.discard_input() == false)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - codel_controller::clock_type::now());
+
+            if (remaining.count() <= 0)
+            {
+                break;
             }
+
+            sock.wait_readable((int)remaining.count());
         }
+    }
+    catch (...)
+    {
+        // ignore, the connection is closed anyway
+    }
+}
 
-        if (connection_callback != nullptr)
+// the accepting thread does not wait, it checks its lingering connections
+// between the accepts and closes those that are done
+void drain_lingering(std::deque<lingering_connection> & lingering,
+    codel_controller::clock_type::time_point now)
+{
+    std::erase_if(lingering, [now](const lingering_connection & c)
         {
             try
             {
-                connection_callback(stream, to_be_closed);
+                return (c.deadline <= now) || c.sock->discard_input();
             }
             catch (...)
             {
-                // ignore
+                return true;
             }
-        }
+        });
+}
 
-        if ((logger != NULL) && ((log_mask & log_connections) != 0))
-        {
-            std::lock_guard<std::mutex> lck(mtx);
+bool shed_request(const route_table & routes, const std::string & path)
+{
+    if (routes.low_priority.empty() ||
+        (admission.overloaded(codel_controller::clock_type::now()) == false))
+    {
+        return false;
+    }
 
-            *logger << "finished with this connection\n";
-        }
+    return routes.low_priority.count(path) != 0;
+}
+
+// token buckets of the clients and of the routes
+rate_limiter client_limits;
+rate_limiter route_limits;
+
+bool rate_limited(const route_table & routes,
+    const std::string & client_address, const std::string & path)
+{
+    const route_limit & client = routes.client_limit;
+
+    if ((client.rate == 0.0) && routes.route_limits.empty())
+    {
+        return false;
     }
-    catch (const std::exception & e)
+
+    rate_limiter::clock_type::time_point now = rate_limiter::clock_type::now();
+
+    if ((client.rate != 0.0) &&
+        (client_limits.acquire(client_address, client.rate, client.burst, now) == false))
     {
-        if ((logger != NULL) && ((log_mask & log_connections) != 0))
-        {
-            std::lock_guard<std::mutex> lck(mtx);
+        return true;
+    }
 
-            *logger << "error in connection thread: " << e.what() << '\n';
+    if (routes.route_limits.empty() == false)
+    {
+        auto it = routes.route_limits.find(path);
+        if (it == routes.route_limits.end())
+        {
+            return false;
         }
+
+        return route_limits.acquire(path, it->second.rate, it->second.burst, now) == false;
+    }
+
+    return false;
+}
+
+// the state of running server (but not of its connections,
+// which are kept by their shards), guarded by workers_mtx
+std::mutex workers_mtx;
+std::condition_variable workers_cv;
+
+std::atomic<bool> stopping(false);
+
+struct listener;
+std::vector<std::shared_ptr<listener> > active_listeners;
+std::vector<std::thread> acceptor_threads;
+
+void join_finished_workers(server_shard & s)
+{
+    std::vector<std::thread> finished;
+
+    {
+        std::lock_guard<std::mutex> lck(s.workers_mtx);
+
+        finished.swap(s.finished_workers);
+    }
+
+    for (std::thread & th : finished)
+    {
+        th.join();
+    }
+}
+
+// makes the connection visible to server_stop for the duration of its thread
+class connection_registration
+{
+public:
+    connection_registration(timed_socket & s, server_shard & shard)
+        : sock_(s), shard_(shard)
+    {
+        std::lock_guard<std::mutex> lck(shard_.workers_mtx);
+
+        shard_.open_connections.insert(&sock_);
+    }
+
+    ~connection_registration()
+    {
+        std::lock_guard<std::mutex> lck(shard_.workers_mtx);
+
+        shard_.open_connections.erase(&sock_);
+    }
+
+private:
+    // not for use
+    connection_registration(const connection_registration &);
+    void operator=(const connection_registration &);
+
+    timed_socket & sock_;
+    server_shard & shard_;
+};
+
+// size of the initial block of request-scoped memory of each connection
+const std::size_t request_arena_size = 16 * 1024;
+
+// upper bound of the memory kept in the pool of each shard
+const std::size_t max_free_arenas = 64;
+
+void post_message(server_shard & s, server_shard::message m)
+{
+    std::lock_guard<std::mutex> lck(s.mailbox_mtx);
+
+    s.mailbox.push_back(std::move(m));
+    s.has_mail = true;
+}
+
+// applies the messages sent to the shard, in the thread of the shard
+// that comes first; they are applied with the mailbox locked, so that
+// the older messages are not applied after the newer ones by another thread
+void deliver_messages(server_shard & s)
+{
+    std::lock_guard<std::mutex> lck(s.mailbox_mtx);
+
+    std::vector<server_shard::message> messages;
+    messages.swap(s.mailbox);
+    s.has_mail = false;
+
+    for (server_shard::message & m : messages)
+    {
+        m(s);
     }
 }
 
-} // unnamed namespace
+void install_routes(server_shard & s, std::shared_ptr<const route_table> routes)
+{
+    std::lock_guard<std::mutex> lck(s.routes_mtx);
+
+    s.routes = std::move(routes);
+    s.routes_version.fetch_add(1, std::memory_order_release);
+}
+
+// publishes the modified copy of the routes and sends it to all shards,
+// called with mtx locked
+template <typename Modify>
+void publish_routes(Modify modify)
+{
+    std::shared_ptr<route_table> routes = std::make_shared<route_table>(*published_routes);
+
+    modify(*routes);
+
+    published_routes = routes;
+
+    for (const std::shared_ptr<server_shard> & s : shards)
+    {
+        post_message(*s, [routes](server_shard & target) { install_routes(target, routes); });
+    }
+}
+
+// registration of the routes, called with mtx locked
+void add_get_route(const std::string & path, get_route route)
+{
+    std::shared_ptr<const get_route> r = std::make_shared<const get_route>(std::move(route));
+
+    publish_routes([&path, &r](route_table & routes) { routes.get_actions[path] = r; });
+}
+
+void add_post_route(const std::string & path, post_route route)
+{
+    std::shared_ptr<const post_route> r = std::make_shared<const post_route>(std::move(route));
+
+    publish_routes([&path, &r](route_table & routes) { routes.post_actions[path] = r; });
+}
+
+// the routes of the shard as seen by the single thread,
+// the shard is locked only when it has installed the new replica
+class route_view
+{
+public:
+    explicit route_view(server_shard & s)
+        : shard_(s), version_(0)
+    {
+    }
+
+    const route_table & current()
+    {
+        // the routes published since the last request are installed at once,
+        // not when the accept loop comes to it
+        if (shard_.has_mail)
+        {
+            deliver_messages(shard_);
+        }
+
+        if ((routes_ == nullptr) ||
+            (shard_.routes_version.load(std::memory_order_acquire) != version_))
+        {
+            std::lock_guard<std::mutex> lck(shard_.routes_mtx);
+
+            routes_ = shard_.routes;
+            version_ = shard_.routes_version.load(std::memory_order_relaxed);
+        }
+
+        return *routes_;
+    }
+
+private:
+    // not for use
+    route_view(const route_view &);
+    void operator=(const route_view &);
+
+    server_shard & shard_;
+    std::shared_ptr<const route_table> routes_;
+    std::uint64_t version_;
+};
+
+// request memory of the connection, taken from the pool of its shard
+class pooled_arena
+{
+public:
+    explicit pooled_arena(server_shard & s)
+        : shard_(s)
+    {
+        {
+            std::lock_guard<std::mutex> lck(shard_.arenas_mtx);
+
+            if (shard_.free_arenas.empty() == false)
+            {
+                buffer_ = std::move(shard_.free_arenas.back());
+                shard_.free_arenas.pop_back();
+            }
+        }
+
+        if (buffer_ == nullptr)
+        {
+            buffer_.reset(new char[request_arena_size]);
+        }
+    }
+
+    ~pooled_arena()
+    {
+        std::lock_guard<std::mutex> lck(shard_.arenas_mtx);
+
+        if (shard_.free_arenas.size() < max_free_arenas)
+        {
+            shard_.free_arenas.push_back(std::move(buffer_));
+        }
+    }
+
+    char * data() { return buffer_.get(); }
+
+private:
+    // not for use
+    pooled_arena(const pooled_arena &);
+    void operator=(const pooled_arena &);
+
+    server_shard & shard_;
+    std::unique_ptr<char[]> buffer_;
+};
+
+// processors available to the process, in the order in which they are given to shards
+std::vector<int> available_cpus()
+{
+    std::vector<int> result;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu != CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                result.push_back(cpu);
+            }
+        }
+    }
+#endif
+
+    return result;
+}
+
+// binds the calling thread (and the threads it creates later) to the processor
+void pin_thread(int cpu)
+{
+#ifdef __linux__
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        (void)sched_setaffinity(0, sizeof(set), &set);
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+// creates the shards of the starting server, each with the current routes
+void create_shards()
+{
+    std::size_t count = shard_count;
+    if (count == 0)
+    {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<int> cpus;
+    if (pin_shard_threads && (count > 1))
+    {
+        cpus = available_cpus();
+    }
+
+    std::lock_guard<std::mutex> lck(mtx);
+
+    shards.clear();
+
+    for (std::size_t i = 0; i != count; ++i)
+    {
+        std::shared_ptr<server_shard> s(new server_shard);
+        s->index = i;
+        s->cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        s->has_mail = false;
+        s->routes = published_routes;
+        s->routes_version = 1;
+        s->connections = 0;
+        s->requests = 0;
+
+        shards.push_back(s);
+    }
+}
+
+// request-scoped memory of the connection handled by the current thread
+thread_local std::pmr::memory_resource * current_request_memory = NULL;
+
+// decides whether the request served by the calling thread is sampled
+// and records its whole span, from the request line to the response
+class request_trace
+{
+public:
+    request_trace() {}
+
+    ~request_trace() { finish(); }
+
+    // the request line was received
+    void start(std::string_view resource)
+    {
+        finish();
+
+        trace_details::current_request = trace_details::sample_request();
+
+        if (trace_details::current_request != 0)
+        {
+            began_ = trace_details::clock_type::now();
+            resource_ = resource;
+        }
+    }
+
+    // records the phase from the request line till now
+    void phase(const char * name)
+    {
+        if (trace_details::current_request != 0)
+        {
+            trace_details::record(name, trace_details::current_request,
+                began_, trace_details::clock_type::now());
+        }
+    }
+
+    // the response was sent
+    void finish()
+    {
+        if (trace_details::current_request != 0)
+        {
+            trace_details::record("request", trace_details::current_request,
+                began_, trace_details::clock_type::now(), resource_);
+
+            trace_details::current_request = 0;
+        }
+    }
+
+private:
+    // not for use
+    request_trace(const request_trace &);
+    void operator=(const request_trace &);
+
+    trace_details::clock_type::time_point began_;
+    std::string_view resource_; // valid until finish
+};
+
+// executes the actions when set, instead of the connection threads
+std::unique_ptr<task_scheduler> action_scheduler;
+
+// set in the connection threads and in the threads executing actions,
+// server_stop called from them must not wait for the connections to finish
+thread_local bool serving_thread = false;
+
+// marks the thread executing the action, restored afterwards
+class serving_scope
+{
+public:
+    serving_scope()
+        : previous_(serving_thread)
+    {
+        serving_thread = true;
+    }
+
+    ~serving_scope()
+    {
+        serving_thread = previous_;
+    }
+
+private:
+    // not for use
+    serving_scope(const serving_scope &);
+    void operator=(const serving_scope &);
+
+    bool previous_;
+};
+
+// keeps the request admitted to the executor pool
+class executor_admission
+{
+public:
+    explicit executor_admission(executor_pool * pool)
+        : pool_(pool)
+    {
+        if ((pool_ != NULL) &&
+            (pool_->admitted.fetch_add(1) >= pool_->concurrency + pool_->queue_limit))
+        {
+            pool_->admitted.fetch_sub(1);
+
+            throw executor_rejected();
+        }
+    }
+
+    ~executor_admission()
+    {
+        release();
+    }
+
+    // frees the slot as soon as the action completes, the response
+    // is sent by the connection thread outside of the admitted section
+    void release()
+    {
+        if (pool_ != NULL)
+        {
+            pool_->admitted.fetch_sub(1);
+            pool_ = NULL;
+        }
+    }
+
+private:
+    // not for use
+    executor_admission(const executor_admission &);
+    void operator=(const executor_admission &);
+
+    executor_pool * pool_;
+};
+
+// executes the action as the task of the executor pool of its route
+// or of the common scheduler (if any), while the calling connection thread
+// waits for it; the request-scoped memory goes with the action
+template <typename Action>
+void run_action(executor_pool * pool, Action && action)
+{
+    executor_admission admission(pool);
+
+    task_scheduler * scheduler =
+        (pool != NULL) ? pool->scheduler.get() : action_scheduler.get();
+
+    codel_controller::clock_type::time_point ready;
+    bool dispatched = request_dispatch::take(ready);
+
+    if ((scheduler == nullptr) || (task_scheduler::current() != NULL))
+    {
+        if (dispatched)
+        {
+            request_dispatch::started(ready);
+        }
+
+        serving_scope serving;
+        trace_span span("handler");
+
+        action();
+
+        return;
+    }
+
+    std::pmr::memory_resource * memory = current_request_memory;
+    std::uint64_t traced = trace_details::current_request;
+
+    task_group group(*scheduler);
+
+    group.spawn([&action, &admission, memory, traced, dispatched, ready]()
+        {
+            if (dispatched)
+            {
+                // including the wait for the worker
+                request_dispatch::started(ready);
+            }
+
+            // the worker can be executing another action when it picks this one
+            std::pmr::memory_resource * previous = current_request_memory;
+            std::uint64_t previous_traced = trace_details::current_request;
+            current_request_memory = memory;
+            trace_details::current_request = traced;
+
+            try
+            {
+                serving_scope serving;
+                trace_span span("handler");
+
+                action();
+            }
+            catch (...)
+            {
+                admission.release();
+                current_request_memory = previous;
+                trace_details::current_request = previous_traced;
+                throw;
+            }
+
+            admission.release();
+            current_request_memory = previous;
+            trace_details::current_request = previous_traced;
+        });
+
+    group.wait();
+}
+
+// the actions executed as tasks get the request body and produce the response
+// in memory, the connection thread receives and sends them, so that the workers
+// never wait for the client (neither does any task that helps them)
+bool runs_as_task(executor_pool * pool)
+{
+    return (pool != NULL) || (action_scheduler != nullptr);
+}
+
+// the longest request body of the actions executed as tasks
+const std::size_t max_task_body = 16 * 1024 * 1024;
+
+// output buffer of the buffered actions, in request-scoped memory
+typedef std::basic_ostringstream<char, std::char_traits<char>,
+    std::pmr::polymorphic_allocator<char> > arena_ostringstream;
+
+// request body received in advance, in request-scoped memory
+typedef std::basic_string<char, std::char_traits<char>,
+    std::pmr::polymorphic_allocator<char> > arena_string;
+
+// reads the request body received in advance
+class memory_streambuf : public std::streambuf
+{
+public:
+    void assign(const char * data, std::size_t size)
+    {
+        char * p = const_cast<char *>(data);
+        setg(p, p, p + size);
+    }
+};
+
+// parts of the current request that are passed to actions as std::string,
+// reused by all requests of the given connection to keep their capacity
+struct request_buffers
+{
+    std::string path;
+    std::string params;
+    std::string content_type;
+    std::string_view headers; // raw header lines, valid during the request
+
+    void set_target(std::string_view what)
+    {
+        std::size_t pos = what.find('?');
+        if (pos != std::string_view::npos)
+        {
+            path.assign(what.data(), pos);
+            params.assign(what.data() + pos + 1, what.size() - pos - 1);
+        }
+        else
+        {
+            path.assign(what.data(), what.size());
+            params.clear();
+        }
+    }
+};
+
+// the longest request line and header section,
+// protecting the memory of the server from endless requests
+const std::size_t max_request_line = 8 * 1024;
+const std::size_t max_header_size = 64 * 1024;
+
+enum line_status { line_complete, line_too_long, line_end_of_stream };
+
+// reads the line up to '\n' (not stored), at most max_size bytes long
+line_status read_line(std::istream & in, std::pmr::string & line, std::size_t max_size)
+{
+    line.clear();
+
+    if (in.good() == false)
+    {
+        // the connection was abandoned while serving the previous request
+        return line_end_of_stream;
+    }
+
+    try
+    {
+        std::streambuf * sb = in.rdbuf();
+
+        while (true)
+        {
+            int c = sb->sbumpc();
+
+            if (c == std::char_traits<char>::eof())
+            {
+                in.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+
+                return line_end_of_stream;
+            }
+
+            if (c == '\n')
+            {
+                return line_complete;
+            }
+
+            if (line.size() == max_size)
+            {
+                return line_too_long;
+            }
+
+            line.push_back((char)c);
+        }
+    }
+    catch (...)
+    {
+        // the connection failed or timed out
+        in.setstate(std::ios_base::badbit);
+
+        return line_end_of_stream;
+    }
+}
+
+// request line and headers being parsed, in request-scoped memory
+struct request_data
+{
+    explicit request_data(std::pmr::memory_resource * mr)
+        : line(mr), method(mr), resource(mr), headers(mr), content_type(mr),
+          http2_settings(mr)
+    {
+    }
+
+    std::pmr::string line;
+    std::pmr::string method;
+    bool get_command = false;
+    bool post_command = false;
+    std::pmr::string resource;
+    std::pmr::string headers; // raw header lines, kept for the proxy routes
+    std::size_t content_length = 0;
+    std::pmr::string content_type;
+    bool chunked = false;
+    bool upgrade_h2c = false;
+    std::pmr::string http2_settings;
+    bool has_content_length = false;
+    bool has_transfer_encoding = false;
+    bool malformed = false; // the body cannot be delimited unambiguously
+};
+
+int hex_digit_to_int(char c)
+{
+    int t = (int)c;
+    int result;
+    
+    if ((t >= (int)'0') && (t <= (int)'9'))
+    {
+        result = t - (int)'0';
+    }
+    else if ((t >= (int)'a') && (t <= (int)'f'))
+    {
+        result = t - (int)'a' + 10;
+    }
+    else if ((t >= (int)'A') && (t <= (int)'F'))
+    {
+        result = t - (int)'A' + 10;
+    }
+    else
+    {
+        // arbitrary failover value
+        result = 0;
+    }
+    
+    return result;
+}
+
+// index of the lowest set bit in non-zero mask
+inline unsigned int first_bit(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctz(mask);
+#else
+    unsigned int i = 0;
+    while ((mask & 1) == 0)
+    {
+        mask >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+// scanners used by the encoding and decoding kernels below:
+// each of them returns the index of the first byte that needs
+// special treatment or n if the whole range can be copied as it is
+
+inline bool is_html_special(char c)
+{
+    return (c == '<') || (c == '>') || (c == '&');
+}
+
+inline bool is_url_safe(char c)
+{
+    return ((c >= '0') && (c <= '9')) ||
+        ((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) ||
+        (c == '-') || (c == '_') || (c == '.') || (c == '~');
+}
+
+inline bool is_url_escape(char c)
+{
+    return (c == '%') || (c == '+');
+}
+
+#ifdef HTTP_SERVER_SSE2
+
+// byte-wise lo <= x <= hi for printable ASCII bounds,
+// bytes with the high bit set are negative and never match
+inline __m128i in_range_16(__m128i x, char lo, char hi)
+{
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(x, _mm_set1_epi8((char)(lo - 1))),
+        _mm_cmplt_epi8(x, _mm_set1_epi8((char)(hi + 1))));
+}
+
+inline unsigned int html_special_mask_16(const char * p)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('<')),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('>'))),
+        _mm_cmpeq_epi8(x, _mm_set1_epi8('&')));
+    return (unsigned int)_mm_movemask_epi8(m);
+}
+
+inline unsigned int url_unsafe_mask_16(const char * p)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i safe = _mm_or_si128(
+        _mm_or_si128(in_range_16(x, '0', '9'), in_range_16(x, 'A', 'Z')),
+        _mm_or_si128(in_range_16(x, 'a', 'z'),
+            _mm_or_si128(
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('_'))),
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('.')),
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('~'))))));
+    return (unsigned int)_mm_movemask_epi8(safe) ^ 0xffffu;
+}
+
+inline unsigned int url_escape_mask_16(const char * p)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(
+        _mm_cmpeq_epi8(x, _mm_set1_epi8('%')),
+        _mm_cmpeq_epi8(x, _mm_set1_epi8('+')));
+    return (unsigned int)_mm_movemask_epi8(m);
+}
+
+#endif // HTTP_SERVER_SSE2
+
+#ifdef HTTP_SERVER_AVX2
+
+inline unsigned int html_special_mask_32(const char * p)
+{
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('<')),
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('>'))),
+        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('&')));
+    return (unsigned int)_mm256_movemask_epi8(m);
+}
+
+inline unsigned int url_escape_mask_32(const char * p)
+{
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i m = _mm256_or_si256(
+        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('%')),
+        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('+')));
+    return (unsigned int)_mm256_movemask_epi8(m);
+}
+
+#endif // HTTP_SERVER_AVX2
+
+std::size_t find_html_special(const char * p, std::size_t n)
+{
+    std::size_t i = 0;
+#ifdef HTTP_SERVER_AVX2
+    for (; i + 32 <= n; i += 32)
+    {
+        unsigned int mask = html_special_mask_32(p + i);
+        if (mask != 0)
+        {
+            return i + first_bit(mask);
+        }
+    }
+#endif
+#ifdef HTTP_SERVER_SSE2
+    for (; i + 16 <= n; i += 16)
+    {
+        unsigned int mask = html_special_mask_16(p + i);
+        if (mask != 0)
+        {
+            return i + first_bit(mask);
+        }
+    }
+#endif
+    for (; i != n; ++i)
+    {
+        if (is_html_special(p[i]))
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+std::size_t find_url_unsafe(const char * p, std::size_t n)
+{
+    std::size_t i = 0;
+#ifdef HTTP_SERVER_SSE2
+    for (; i + 16 <= n; i += 16)
+    {
+        unsigned int mask = url_unsafe_mask_16(p + i);
+        if (mask != 0)
+        {
+            return i + first_bit(mask);
+        }
+    }
+#endif
+    for (; i != n; ++i)
+    {
+        if (is_url_safe(p[i]) == false)
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+std::size_t find_url_escape(const char * p, std::size_t n)
+{
+    std::size_t i = 0;
+#ifdef HTTP_SERVER_AVX2
+    for (; i + 32 <= n; i += 32)
+    {
+        unsigned int mask = url_escape_mask_32(p + i);
+        if (mask != 0)
+        {
+            return i + first_bit(mask);
+        }
+    }
+#endif
+#ifdef HTTP_SERVER_SSE2
+    for (; i + 16 <= n; i += 16)
+    {
+        unsigned int mask = url_escape_mask_16(p + i);
+        if (mask != 0)
+        {
+            return i + first_bit(mask);
+        }
+    }
+#endif
+    for (; i != n; ++i)
+    {
+        if (is_url_escape(p[i]))
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+// output sinks for the kernels below
+
+template <class string_type>
+struct string_sink
+{
+    string_type & out;
+
+    void append(const char * p, std::size_t n) { out.append(p, n); }
+    void put(char c) { out.push_back(c); }
+};
+
+struct buffer_sink
+{
+    char * begin;
+    char * pos;
+
+    // memmove, because url_decode is allowed to work in place
+    void append(const char * p, std::size_t n) { std::memmove(pos, p, n); pos += n; }
+    void put(char c) { *pos++ = c; }
+};
+
+template <class sink>
+void html_encode_kernel(const char * s, std::size_t n, sink & out)
+{
+    const char * end = s + n;
+    while (s != end)
+    {
+        std::size_t run = find_html_special(s, end - s);
+        out.append(s, run);
+        s += run;
+        if (s == end)
+        {
+            break;
+        }
+
+        char c = *s++;
+        if (c == '<')
+        {
+            out.append("&lt;", 4);
+        }
+        else if (c == '>')
+        {
+            out.append("&gt;", 4);
+        }
+        else
+        {
+            out.append("&amp;", 5);
+        }
+    }
+}
+
+template <class sink>
+void url_encode_kernel(const char * s, std::size_t n, sink & out)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+
+    const char * end = s + n;
+    while (s != end)
+    {
+        std::size_t run = find_url_unsafe(s, end - s);
+        out.append(s, run);
+        s += run;
+        if (s == end)
+        {
+            break;
+        }
+
+        unsigned char c = (unsigned char)*s++;
+        if (c == ' ')
+        {
+            out.put('+');
+        }
+        else
+        {
+            char buf[3] = { '%', hex_digits[c >> 4], hex_digits[c & 0x0f] };
+            out.append(buf, 3);
+        }
+    }
+}
+
+template <class sink>
+void url_decode_kernel(const char * s, std::size_t n, sink & out)
+{
+    const char * end = s + n;
+    while (s != end)
+    {
+        std::size_t run = find_url_escape(s, end - s);
+        out.append(s, run);
+        s += run;
+        if (s == end)
+        {
+            break;
+        }
+
+        if (*s == '+')
+        {
+            out.put(' ');
+            ++s;
+        }
+        else if (end - s >= 3)
+        {
+            out.put((char)(16 * hex_digit_to_int(s[1]) + hex_digit_to_int(s[2])));
+            s += 3;
+        }
+        else
+        {
+            // incomplete escape sequence at the end of input is dropped
+            break;
+        }
+    }
+}
+
+// sends automatically handled response with the given body,
+// the header always carries the body length (even if zero),
+// so that the client can find the end of response
+void send_content(std::ostream & out, const std::string & mime_type,
+    const char * data, std::size_t size, bool cache)
+{
+    trace_span span("write");
+
+    response_builder & r = connection_response();
+
+    r.start(200)
+        .content_type(mime_type)
+        .content_length(size)
+        .cache_control(cache)
+        .date()
+        .end_headers();
+
+    out.write(r.data(), r.size());
+    out.write(data, size);
+
+    out.flush();
+}
+
+const std::string json_mime_type("application/json");
+
+// largest request body accepted by the JSON POST actions
+const std::size_t max_json_body = 16 * 1024 * 1024;
+
+// the buffers keep their capacity between requests, unless it grew too much
+const std::size_t max_retained_json_buffer = 1024 * 1024;
+
+// JSON request and response bodies of the actions executed by the calling thread
+thread_local std::string json_request_buffer;
+thread_local std::string json_response_buffer;
+thread_local json_document json_request_document;
+
+void release_json_buffers()
+{
+    if (json_request_buffer.capacity() > max_retained_json_buffer)
+    {
+        std::string().swap(json_request_buffer);
+    }
+
+    if (json_response_buffer.capacity() > max_retained_json_buffer)
+    {
+        std::string().swap(json_response_buffer);
+    }
+}
+
+// reads and ignores the body of the known length, false if it was truncated
+bool skip_body(std::istream & in, std::size_t content_length)
+{
+    char buf[16 * 1024];
+
+    // read in blocks, ignore() would wait for one byte past the body
+    for (std::size_t left = content_length; left != 0; )
+    {
+        std::size_t block = std::min(left, sizeof(buf));
+
+        if (!in.read(buf, (std::streamsize)block))
+        {
+            return false;
+        }
+
+        left -= block;
+    }
+
+    return true;
+}
+
+// reads the whole request body, false if it is longer than max_size
+// (the known length is then consumed, the chunked body is drained by the caller)
+template <class string_type>
+bool read_body(std::istream & in, std::size_t content_length, std::size_t max_size,
+    string_type & text)
+{
+    char buf[16 * 1024];
+
+    text.clear();
+
+    if (content_length != unknown_content_length)
+    {
+        if (content_length > max_size)
+        {
+            if (skip_body(in, content_length) == false)
+            {
+                throw std::runtime_error("request body truncated");
+            }
+
+            return false;
+        }
+
+        text.resize(content_length);
+        in.read(&text[0], (std::streamsize)content_length);
+
+        if ((std::size_t)in.gcount() != content_length)
+        {
+            throw std::runtime_error("request body truncated");
+        }
+
+        return true;
+    }
+
+    while (in.read(buf, sizeof(buf)) || (in.gcount() != 0))
+    {
+        if (text.size() + (std::size_t)in.gcount() > max_size)
+        {
+            return false;
+        }
+
+        text.append(buf, (std::size_t)in.gcount());
+    }
+
+    return true;
+}
+
+// decodes "key1=value1&key2=value2&..." into the given (empty) map,
+// the key extends up to the first '=' and the value up to the next '&'
+template <class map_type>
+map_type do_decode_params(const char * begin, const char * end, bool decode,
+    map_type result)
+{
+    typedef typename map_type::key_type string_type;
+
+    const char * pos = begin;
+    while (pos != end)
+    {
+        const char * eq = std::find(pos, end, '=');
+        if (eq == end)
+        {
+            break;
+        }
+
+        const char * amp = std::find(eq + 1, end, '&');
+
+        string_type k(result.get_allocator());
+        string_type v(result.get_allocator());
+
+        if (decode)
+        {
+            url_decode(pos, eq - pos, k);
+            url_decode(eq + 1, amp - eq - 1, v);
+        }
+        else
+        {
+            k.assign(pos, eq);
+            v.assign(eq + 1, amp);
+        }
+
+        result[std::move(k)] = std::move(v);
+
+        if (amp == end)
+        {
+            break;
+        }
+
+        pos = amp + 1;
+    }
+
+    return result;
+}
+
+#ifndef WIN32
+
+// smaller files are read and written through the connection stream
+const std::size_t send_file_threshold = 16 * 1024;
+
+std::string static_file_headers(const std::string & name, const open_file_cache::file & f)
+{
+    response_builder r(256);
+
+    r.content_type(file_mime_type(name))
+        .content_length((std::size_t)f.size)
+        .cache_control(true);
+
+    return r.release();
+}
+
+// sends the open file, straight from the file to the connection socket (if known)
+// when the file is large enough
+void send_open_file(std::ostream & out, const open_file_cache::file & f, timed_socket * client)
+{
+    trace_span span("write");
+
+    response_builder & r = connection_response();
+
+    r.start(200).header_lines(f.headers).date().end_headers();
+
+    out.write(r.data(), r.size());
+
+    if ((client != NULL) && (f.size >= send_file_threshold))
+    {
+        out.flush();
+
+        if (client->send_file(f.fd, 0, (std::size_t)f.size) != f.size)
+        {
+            throw std::runtime_error("static file truncated while sent");
+        }
+
+        return;
+    }
+
+    char buf[16 * 1024];
+    std::uint64_t offset = 0;
+
+    while (offset != f.size)
+    {
+        std::size_t block = (std::size_t)std::min<std::uint64_t>(f.size - offset, sizeof(buf));
+
+        ssize_t readn = ::pread(f.fd, buf, block, (off_t)offset);
+        if (readn <= 0)
+        {
+            if ((readn < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+
+            throw std::runtime_error("static file truncated while sent");
+        }
+
+        out.write(buf, readn);
+        offset += readn;
+    }
+
+    out.flush();
+}
+
+// whether the header line is the field of the given name (compared in either case)
+bool is_field(std::string_view line, std::string_view name)
+{
+    return (line.size() > name.size()) && (line[name.size()] == ':') &&
+        std::equal(name.begin(), name.end(), line.begin(), [](char a, char b)
+            { return std::tolower((unsigned char)a) == std::tolower((unsigned char)b); });
+}
+
+// value of the header line, without the field name and the surrounding whitespace
+std::string_view field_value(std::string_view line)
+{
+    std::string_view value = line.substr(line.find(':') + 1);
+
+    while ((value.empty() == false) && ((value.front() == ' ') || (value.front() == '\t')))
+    {
+        value.remove_prefix(1);
+    }
+
+    while ((value.empty() == false) &&
+        ((value.back() == ' ') || (value.back() == '\t') || (value.back() == '\r')))
+    {
+        value.remove_suffix(1);
+    }
+
+    return value;
+}
+
+// whether the list contains the element, compared in either case
+bool contains_token(std::string_view list, std::string_view token)
+{
+    for (std::size_t i = 0; i + token.size() <= list.size(); ++i)
+    {
+        if (std::equal(token.begin(), token.end(), list.begin() + i, [](char a, char b)
+            { return std::tolower((unsigned char)a) == std::tolower((unsigned char)b); }))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// value of the header field in the raw header lines (in either case),
+// empty if there is no such field
+std::string_view header_value(std::string_view headers, std::string_view name)
+{
+    std::size_t pos = 0;
+
+    while (pos < headers.size())
+    {
+        std::size_t end = headers.find('\n', pos);
+        if (end == std::string_view::npos)
+        {
+            end = headers.size();
+        }
+
+        std::string_view line = headers.substr(pos, end - pos);
+
+        if (is_field(line, name))
+        {
+            return field_value(line);
+        }
+
+        pos = end + 1;
+    }
+
+    return std::string_view();
+}
+
+// calls f with each trimmed element of the comma-separated list,
+// until f returns true
+template <typename Function>
+bool any_list_element(std::string_view list, Function f)
+{
+    while (list.empty() == false)
+    {
+        std::size_t comma = list.find(',');
+        std::string_view element = list.substr(0, comma);
+
+        while ((element.empty() == false) && (element.front() == ' '))
+        {
+            element.remove_prefix(1);
+        }
+
+        while ((element.empty() == false) && (element.back() == ' '))
+        {
+            element.remove_suffix(1);
+        }
+
+        if (f(element))
+        {
+            return true;
+        }
+
+        if (comma == std::string_view::npos)
+        {
+            break;
+        }
+
+        list.remove_prefix(comma + 1);
+    }
+
+    return false;
+}
+
+// whether Accept-Encoding allows gzip (and not with zero quality)
+bool accepts_gzip(std::string_view headers)
+{
+    return any_list_element(header_value(headers, "accept-encoding"), [](std::string_view coding)
+    {
+        std::size_t semicolon = coding.find(';');
+        std::string_view name = coding.substr(0, semicolon);
+
+        while ((name.empty() == false) && (name.back() == ' '))
+        {
+            name.remove_suffix(1);
+        }
+
+        if ((name != "gzip") && (name != "*"))
+        {
+            return false;
+        }
+
+        std::size_t q = coding.find("q=", semicolon);
+        if ((semicolon == std::string_view::npos) || (q == std::string_view::npos))
+        {
+            return true;
+        }
+
+        std::string_view quality = coding.substr(q + 2);
+
+        return quality.find_first_not_of("0.") != std::string_view::npos;
+    });
+}
+
+// whether If-None-Match lists the entity tag (weak comparison)
+bool etag_matches(std::string_view headers, std::string_view etag)
+{
+    return any_list_element(header_value(headers, "if-none-match"), [etag](std::string_view tag)
+    {
+        if (tag.substr(0, 2) == "W/")
+        {
+            tag.remove_prefix(2);
+        }
+
+        return (tag == "*") || (tag == etag);
+    });
+}
+
+// the pack seen by the calling thread, which takes the latest one when it is replaced
+const asset_pack * current_static_pack()
+{
+    thread_local std::shared_ptr<const asset_pack> pack;
+    thread_local std::uint64_t version = 0;
+
+    if (static_pack_version.load(std::memory_order_acquire) != version)
+    {
+        std::lock_guard<std::mutex> lck(static_pack_mtx);
+
+        pack = static_pack;
+        version = static_pack_version.load(std::memory_order_relaxed);
+    }
+
+    return pack.get();
+}
+
+// maps the pack again if its file was replaced, checked by one request per interval
+void revalidate_static_pack()
+{
+    std::int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    std::int64_t checked = static_pack_checked.load(std::memory_order_relaxed);
+
+    if ((now - checked < static_pack_check_interval.count()) ||
+        (static_pack_checked.compare_exchange_strong(checked, now) == false))
+    {
+        return;
+    }
+
+    std::shared_ptr<const asset_pack> pack;
+    std::string path;
+
+    {
+        std::lock_guard<std::mutex> lck(static_pack_mtx);
+
+        pack = static_pack;
+        path = static_pack_path;
+    }
+
+    if ((pack == nullptr) || pack->same_file(path))
+    {
+        return;
+    }
+
+    try
+    {
+        std::shared_ptr<const asset_pack> replaced = std::make_shared<const asset_pack>(path);
+
+        {
+            std::lock_guard<std::mutex> lck(static_pack_mtx);
+
+            // unless the pack was changed in the meantime by set_static_pack
+            if ((static_pack == pack) && (static_pack_path == path))
+            {
+                static_pack = replaced;
+                static_pack_version.fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        if ((logger != NULL) && ((log_mask & log_static_responses) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "static pack " << path << " mapped again, "
+                << replaced->size() << " files\n";
+        }
+    }
+    catch (const std::exception & e)
+    {
+        // the old pack is served until the new one is valid
+        if (logger != NULL)
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "error: " << e.what() << '\n';
+        }
+    }
+}
+
+// sends the packed file, its compressed variant if the client accepts it,
+// or only the headers if the client already has the same variant
+bool send_packed_file(std::ostream & out, const asset_pack & pack, const std::string & name,
+    std::string_view request_headers, timed_socket * client, std::size_t & size)
+{
+    asset_pack::asset a;
+    if (pack.find(name, a) == false)
+    {
+        return false;
+    }
+
+    const asset_pack::variant & v =
+        (a.has_compressed && accepts_gzip(request_headers)) ? a.compressed : a.identity;
+
+    trace_span span("write");
+
+    response_builder & r = connection_response();
+
+    if (etag_matches(request_headers, v.etag))
+    {
+        size = 0;
+
+        r.start(304).header("ETag", std::string(v.etag)).date().end_headers();
+        r.send(out);
+
+        return true;
+    }
+
+    size = (std::size_t)v.size;
+
+    r.start(200).header_lines(v.headers).date().end_headers();
+
+    out.write(r.data(), r.size());
+
+    if ((client != NULL) && (v.size >= send_file_threshold))
+    {
+        out.flush();
+
+        if (client->send_file(pack.fd(), (off_t)v.offset, (std::size_t)v.size) != v.size)
+        {
+            throw std::runtime_error("static file truncated while sent");
+        }
+
+        return true;
+    }
+
+    out.write(v.data, (std::streamsize)v.size);
+    out.flush();
+
+    return true;
+}
+
+#endif // WIN32
+
+void get_file(std::ostream & out, const std::string & file_name, std::string_view headers,
+    timed_socket * client)
+{
+    trace_span span("handler", file_name);
+
+    if ((logger != NULL) && ((log_mask & log_static_requests) != 0))
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        
+        *logger << "GET file " << file_name << '\n';
+    }
+
+#ifndef WIN32
+    revalidate_static_pack();
+
+    if (const asset_pack * pack = current_static_pack())
+    {
+        std::size_t size = 0;
+
+        if (send_packed_file(out, *pack, file_name, headers, client, size))
+        {
+            if ((logger != NULL) && ((log_mask & log_static_responses) != 0))
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+
+                *logger << "file " << file_name << " size " << size << " bytes was sent from the pack\n";
+            }
+        }
+        else
+        {
+            if ((logger != NULL) && ((log_mask & log_static_requests) != 0))
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+
+                *logger << "file not found: " << file_name << '\n';
+            }
+
+            send_not_found(out);
+        }
+
+        return;
+    }
+#else
+    (void)headers;
+#endif
+
+    if (missing_files.contains(file_name))
+    {
+        send_not_found(out);
+
+        return;
+    }
+
+    bool found = false;
+    std::size_t size = 0;
+
+#ifndef WIN32
+    open_file_cache::file_type file = open_files.open(base_dir, file_name, static_file_headers);
+
+    if (file != nullptr)
+    {
+        found = true;
+        size = (std::size_t)file->size;
+
+        send_open_file(out, *file, client);
+    }
+#else
+    (void)client;
+
+    std::ifstream file(base_dir + file_name, std::ifstream::binary);
+
+    if (file)
+    {
+        std::filebuf * pbuf = file.rdbuf();
+        
+        size = pbuf->pubseekoff(0, file.end, file.in);
+        pbuf->pubseekpos(0, file.in);
+        
+        std::vector<char> buffer(size);
+        
+        pbuf->sgetn(&buffer[0], size);
+        
+        file.close();
+        
+        found = true;
+
+        send_content(out, file_mime_type(file_name), buffer.data(), size, true);
+    }
+#endif
+
+    if (found)
+    {
+        if ((logger != NULL) && ((log_mask & log_static_responses) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            
+            *logger << "file " << file_name << " size " << size << " bytes was sent\n";
+        }
+    }
+    else
+    {
+        if ((logger != NULL) && ((log_mask & log_static_requests) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            
+            *logger << "file not found: " << file_name << '\n';
+        }
+
+        if (file_name.size() <= max_missing_path)
+        {
+            missing_files.insert(file_name, negative_cache::clock_type::now() + missing_file_ttl);
+        }
+
+        send_not_found(out);
+    }
+}
+
+// executes the buffered action and produces the complete response
+response_cache::response_type render_response(const get_route & route,
+    executor_pool * pool, const std::string & path, const std::string & params)
+{
+    arena_ostringstream str_buf(std::ios_base::out, request_memory());
+
+    run_action(pool, [&]() { route.action(str_buf, path, params); });
+
+    std::string_view content = str_buf.view();
+
+    response_builder r(content.size() + 256);
+    r.start(200)
+        .content_type(route.mime_type)
+        .content_length(content.size())
+        .cache_control(false)
+        .date()
+        .end_headers()
+        .body(content.data(), content.size());
+
+    return std::make_shared<const std::string>(r.release());
+}
+
+void get_action(std::ostream & out, const get_route & route, executor_pool * pool,
+    const std::string & path, const std::string & params)
+{
+    const get_action_type & action = route.action;
+    const std::string & mime_type = route.mime_type;
+
+    // nothing is sent before the buffered action completes,
+    // so that its failure can be still reported to the client
+    bool buffered = (mime_type.empty() == false);
+
+    try
+    {
+        if ((logger != NULL) && ((log_mask & log_dynamic_requests) != 0))
+        {
+            *logger << "GET action " << path << '\n';
+        }
+
+        if ((mime_type.empty() == false) &&
+            ((route.cache_ttl.count() > 0) || route.coalesce))
+        {
+            // reuse the complete response, if it was already generated
+            // for the same parameters and is still valid,
+            // or if it is just being generated for another request
+
+            std::string key = cache_key(path, params);
+            bool cached = (route.cache_ttl.count() > 0);
+
+            response_cache::response_type response;
+            if (cached)
+            {
+                response = cached_responses.find(key);
+            }
+
+            if (response == nullptr)
+            {
+                response = in_flight.run(key, [&]()
+                {
+                    if (cached)
+                    {
+                        // the previous flight might have just stored it
+                        response_cache::response_type r = cached_responses.find(key);
+                        if (r != nullptr)
+                        {
+                            return r;
+                        }
+                    }
+
+                    response_cache::response_type r = render_response(route, pool, path, params);
+
+                    if (cached)
+                    {
+                        cached_responses.insert(key, r,
+                            response_cache::clock_type::now() + route.cache_ttl);
+                    }
+
+                    return r;
+                });
+            }
+            else if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+            {
+                *logger << "GET action " << path << " served from cache\n";
+            }
+
+            buffered = false;
+
+            trace_span span("write");
+
+            out.write(response->data(), response->size());
+            out.flush();
+        }
+        else if (mime_type.empty() == false)
+        {
+            // collect content to buffer
+            // and automatically generate appropriate HTTP header,
+            // depending on the registered mime_type and size of collected content
+
+            arena_ostringstream str_buf(std::ios_base::out, request_memory());
+                    
+            run_action(pool, [&]() { action(str_buf, path, params); });
+
+            std::string_view content = str_buf.view();
+
+            buffered = false;
+            send_content(out, mime_type, content.data(), content.size(), false);
+
+            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+            {
+                *logger << "GET action " << path
+                    << " of type " << mime_type
+                    << " returned " << content.size() << " bytes\n";
+            }
+        }
+        else if (runs_as_task(pool))
+        {
+            // the header and content generated by the user, sent afterwards
+
+            arena_ostringstream str_buf(std::ios_base::out, request_memory());
+
+            buffered = true;
+            run_action(pool, [&]() { action(str_buf, path, params); });
+
+            std::string_view response = str_buf.view();
+
+            buffered = false;
+
+            trace_span span("write");
+
+            out.write(response.data(), response.size());
+            out.flush();
+
+            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+            {
+                *logger << "generic GET action " << path << " executed\n";
+            }
+        }
+        else
+        {
+            // allow the user to generate both the header and content
+                    
+            run_action(pool, [&]() { action(out, path, params); });
+                    
+            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+            {
+                *logger << "generic GET action " << path << " executed\n";
+            }
+        }
+    }
+    catch (const executor_rejected &)
+    {
+        if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "GET action " << path << " rejected by its executor pool\n";
+        }
+
+        send_status(out, 503);
+    }
+    catch (const std::exception & e)
+    {
+        if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+                    
+            *logger << "error in GET action " << path << ": " << e.what() << '\n';
+        }
+
+        if (buffered)
+        {
+            send_status(out, 500);
+        }
+    }
+    catch (...)
+    {
+        if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+                    
+            *logger << "unknown error in GET action " << path << '\n';
+        }
+
+        if (buffered)
+        {
+            send_status(out, 500);
+        }
+    }
+}
+
+void get(std::ostream & out, const request_buffers & request, const route_table & routes,
+    timed_socket * client)
+{
+    const std::string & path = request.path;
+    const std::string & params = request.params;
+
+    if (path == "/")
+    {
+        get_file(out, "/index.html", request.headers, client);
+    }
+    else
+    {
+        const get_route * route = NULL;
+        executor_pool * pool = NULL;
+        {
+            trace_span span("route", path);
+
+            auto it = routes.get_actions.find(path);
+            if (it != routes.get_actions.end())
+            {
+                route = it->second.get();
+                pool = routes.executor(path);
+            }
+        }
+
+        if (route != NULL)
+        {
+            get_action(out, *route, pool, path, params);
+        }
+        else
+        {
+            get_file(out, path, request.headers, client);
+        }
+    }
+}
+
+// the longest body of the unknown resource that is read to keep the connection
+const std::size_t max_skipped_body = 64 * 1024;
+
+// returns false if the connection cannot be used for the next request,
+// because the body of the known length was not consumed
+// (the chunked body is drained by the caller)
+bool post(std::ostream & out, const request_buffers & request,
+    std::istream & in, std::size_t content_length, const route_table & routes)
+{
+    const std::string & path = request.path;
+    const std::string & params = request.params;
+    const std::string & content_type = request.content_type;
+
+    const post_route * route = NULL;
+    executor_pool * pool = NULL;
+    {
+        trace_span span("route", path);
+
+        auto it = routes.post_actions.find(path);
+        if (it != routes.post_actions.end())
+        {
+            route = it->second.get();
+            pool = routes.executor(path);
+        }
+    }
+
+    if (route != NULL)
+    {
+        const post_action_type & action = route->action;
+        const std::string & mime_type = route->mime_type;
+
+        bool buffered = (mime_type.empty() == false);
+
+        try
+        {
+            if ((logger != NULL) && ((log_mask & log_dynamic_requests) != 0))
+            {
+                *logger << "POST action " << path << '\n';
+            }
+
+            bool task = runs_as_task(pool);
+
+            arena_string body(request_memory());
+            memory_streambuf body_buf;
+            std::istream body_in(&body_buf);
+
+            std::istream * action_in = &in;
+            std::size_t action_length = content_length;
+
+            if (task)
+            {
+                trace_span span("body");
+
+                if (read_body(in, content_length, max_task_body, body) == false)
+                {
+                    send_status(out, 413);
+
+                    return true;
+                }
+
+                body_buf.assign(body.data(), body.size());
+                request_dispatch::restart();
+                action_in = &body_in;
+                action_length = body.size();
+            }
+
+            if (mime_type.empty() == false)
+            {
+                // collect content to buffer
+                // and automatically generate appropriate HTTP header,
+                // depending on the registered mime_type and size of collected content
+                
+                arena_ostringstream str_buf(std::ios_base::out, request_memory());
+                
+                run_action(pool, [&]()
+                    {
+                        action(str_buf, path, params, *action_in, action_length, content_type);
+                    });
+
+                std::string_view content = str_buf.view();
+
+                buffered = false;
+                send_content(out, mime_type, content.data(), content.size(), false);
+
+                if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+                {
+                    *logger << "POST action " << path
+                        << " of type " << mime_type
+                        << " returned " << content.size() << " bytes\n";
+                }
+            }
+            else if (task)
+            {
+                // the header and content generated by the user, sent afterwards
+
+                arena_ostringstream str_buf(std::ios_base::out, request_memory());
+
+                buffered = true;
+                run_action(pool, [&]()
+                    {
+                        action(str_buf, path, params, *action_in, action_length, content_type);
+                    });
+
+                std::string_view response = str_buf.view();
+
+                buffered = false;
+
+                trace_span span("write");
+
+                out.write(response.data(), response.size());
+                out.flush();
+
+                if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+                {
+                    *logger << "generic POST action " << path << " executed\n";
+                }
+            }
+            else
+            {
+                // allow the user to generate both the header and content
+                
+                run_action(pool, [&]()
+                    {
+                        action(out, path, params, in, content_length, content_type);
+                    });
+                
+                if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+                {
+                    *logger << "generic POST action " << path << " executed\n";
+                }
+            }
+        }
+        catch (const executor_rejected &)
+        {
+            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+
+                *logger << "POST action " << path << " rejected by its executor pool\n";
+            }
+
+            send_status(out, 503);
+        }
+        catch (const std::exception & e)
+        {
+            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                
+                *logger << "error in POST action " << path << ": " << e.what() << '\n';
+            }
+
+            if (buffered)
+            {
+                send_status(out, 500);
+            }
+        }
+        catch (...)
+        {
+            if ((logger != NULL) && ((log_mask & log_dynamic_responses) != 0))
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                
+                *logger << "unknown error in POST action " << path << '\n';
+            }
+
+            if (buffered)
+            {
+                send_status(out, 500);
+            }
+        }
+    }
+    else
+    {
+        // the unwanted body would be taken as the next request
+        if ((content_length != unknown_content_length) &&
+            ((content_length > max_skipped_body) || (skip_body(in, content_length) == false)))
+        {
+            send_closing_status(out, 404);
+
+            return false;
+        }
+
+        send_not_found(out);
+    }
+
+    return true;
+}
+
+// stream over the accepted connection, TCP or Unix
+typedef socket_generic_stream<timed_socket, char> connection_stream;
+
+// serves the single HTTP/2 stream the same way as the HTTP/1.1 request
+void serve_stream(const h2_details::stream_request & request, std::istream & body,
+    std::ostream & out, const std::string & client_address, server_shard & shard)
+{
+    shard.requests.fetch_add(1, std::memory_order_relaxed);
+
+    request_dispatch dispatch;
+
+    request_trace trace;
+    trace.start(request.resource);
+
+    request_buffers buffers;
+    buffers.set_target(request.resource);
+
+    route_view routes(shard);
+
+    if (rate_limited(routes.current(), client_address, buffers.path))
+    {
+        send_status(out, 429);
+
+        return;
+    }
+
+    if (shed_request(routes.current(), buffers.path))
+    {
+        send_status(out, 503);
+
+        return;
+    }
+
+    std::shared_ptr<proxy_details::proxy_route> route =
+        proxy_details::find_route(request.resource);
+
+    if (route)
+    {
+        proxy_details::forwarded_request forwarded;
+        forwarded.method = request.method;
+        forwarded.resource = request.resource;
+        forwarded.headers = request.headers;
+        forwarded.client_address = client_address;
+        forwarded.body = request.has_body ? &body : NULL;
+        forwarded.content_length = request.content_length;
+        forwarded.chunked = request.has_body &&
+            (request.content_length == unknown_content_length);
+        forwarded.client_socket = NULL;
+
+        (void)proxy_details::forward(*route, forwarded, out);
+    }
+    else if (request.method == "GET")
+    {
+        buffers.headers = request.headers;
+        get(out, buffers, routes.current(), NULL);
+    }
+    else if (request.method == "POST")
+    {
+        buffers.content_type = request.content_type;
+
+        (void)post(out, buffers, body, request.content_length, routes.current());
+    }
+    else
+    {
+        send_status(out, 501);
+    }
+}
+
+// serves the connection switched to HTTP/2 (with prior knowledge or by the upgrade),
+// each stream in its own thread
+void serve_h2(connection_stream & stream, timed_socket & timed,
+    const std::string & client_address, server_shard & shard,
+    const h2_details::stream_request * upgrade, std::string_view upgrade_settings)
+{
+    if ((logger != NULL) && ((log_mask & log_connections) != 0))
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+
+        *logger << "switched to HTTP/2\n";
+    }
+
+    h2_details::connection_options options;
+    options.request_line_received = (upgrade == nullptr);
+    options.upgrade = upgrade;
+    options.upgrade_settings = upgrade_settings;
+    options.shutdown = [&timed]() { timed.shutdown(); };
+
+    h2_details::serve(stream,
+        [&timed](const char * data, std::size_t size)
+        {
+            timed.write(data, size);
+        },
+        [&client_address, &shard](const h2_details::stream_request & request,
+            std::istream & body, std::ostream & out)
+        {
+            serve_stream(request, body, out, client_address, shard);
+        },
+        [&timed](std::size_t open_streams)
+        {
+            // the connection without streams in progress is idle
+            if (open_streams == 0)
+            {
+                timed.begin_idle(false);
+            }
+            else
+            {
+                timed.begin_body();
+            }
+
+            return stopping == false;
+        },
+        options);
+}
+
+void connection_thread(std::shared_ptr<base_socket_wrapper> sock, std::string client_address,
+    codel_controller::clock_type::time_point accepted, server_shard & shard)
+{
+    codel_controller::clock_type::time_point started = codel_controller::clock_type::now();
+
+    admission.record(started - accepted, started);
+
+    if ((logger != NULL) && ((log_mask & log_connections) != 0))
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        
+        *logger << "accepted new connection\n";
+    }
+    
+    try
+    {
+        timed_socket timed(*sock);
+        connection_registration registration(timed, shard);
+        connection_stream stream(timed);
+        
+        if (connection_callback != nullptr)
+        {
+            try
+            {
+                connection_callback(stream, just_connected);
+            }
+            catch (...)
+            {
+                // ignore
+            }
+        }
+        
+        // request-scoped memory, released wholesale after each request
+        pooled_arena arena_buffer(shard);
+        std::pmr::monotonic_buffer_resource arena(arena_buffer.data(), request_arena_size);
+
+        current_request_memory = &arena;
+
+        request_buffers buffers;
+        route_view routes(shard);
+
+        std::optional<request_data> request;
+        request.emplace(&arena);
+
+        // declared after the request, to which it refers
+        request_trace trace;
+        bool first_request = true;
+
+        while (true)
+        {
+            // the request line, or the header line within the rest of the header section
+            bool request_line = request->method.empty();
+            std::size_t limit = request_line ? max_request_line :
+                max_header_size - std::min(request->headers.size(), max_header_size);
+
+            line_status status = read_line(stream, request->line, limit);
+
+            if (status == line_end_of_stream)
+            {
+                break;
+            }
+
+            if (status == line_too_long)
+            {
+                send_closing_status(stream, request_line ? 414 : 431);
+
+                break;
+            }
+
+            std::string_view line(request->line);
+
+            if ((line.empty() == false) && (line.back() == '\r'))
+            {
+                line.remove_suffix(1);
+            }
+
+            if (line.empty())
+            {
+                bool in_sync = true;
+
+                request_dispatch dispatch;
+
+                timed.begin_body();
+                trace.phase("parse");
+
+                if (request->malformed ||
+                    (request->has_content_length && request->has_transfer_encoding))
+                {
+                    // the body cannot be found reliably, nor the next request
+                    send_closing_status(stream, 400);
+
+                    break;
+                }
+
+                if (request->upgrade_h2c && (request->http2_settings.empty() == false) &&
+                    (request->content_length == 0) && (request->chunked == false))
+                {
+                    // the request is answered as the stream 1 of the HTTP/2 connection
+                    h2_details::stream_request upgraded;
+                    upgraded.method = request->method;
+                    upgraded.resource = request->resource;
+                    upgraded.headers = request->headers;
+                    upgraded.content_type = request->content_type;
+                    upgraded.content_length = 0;
+                    upgraded.has_body = false;
+
+                    // the stream is traced on its own
+                    trace.finish();
+
+                    stream << "HTTP/1.1 101 Switching Protocols\r\n"
+                        "Connection: Upgrade\r\n"
+                        "Upgrade: h2c\r\n\r\n" << std::flush;
+
+                    serve_h2(stream, timed, client_address, shard,
+                        &upgraded, request->http2_settings);
+
+                    break;
+                }
+
+                std::shared_ptr<proxy_details::proxy_route> route;
+                if (request->method.empty() == false)
+                {
+                    route = proxy_details::find_route(request->resource);
+                }
+
+                int rejected = 0;
+                if (request->method.empty() == false)
+                {
+                    shard.requests.fetch_add(1, std::memory_order_relaxed);
+
+                    buffers.set_target(request->resource);
+
+                    if (rate_limited(routes.current(), client_address, buffers.path))
+                    {
+                        rejected = 429;
+                    }
+                    else if (shed_request(routes.current(), buffers.path))
+                    {
+                        rejected = 503;
+                    }
+                }
+
+                if (rejected != 0)
+                {
+                    send_status(stream, rejected);
+
+                    // the body (if any) is not consumed
+                    in_sync = (request->chunked == false) && (request->content_length == 0);
+                }
+                else if (route)
+                {
+                    proxy_details::forwarded_request forwarded;
+                    forwarded.method = request->method;
+                    forwarded.resource = request->resource;
+                    forwarded.headers = request->headers;
+                    forwarded.client_address = client_address;
+                    forwarded.content_length = request->content_length;
+                    forwarded.chunked = request->chunked;
+                    forwarded.client_socket = sock.get();
+
+                    splice_timeouts timeouts(*sock);
+
+                    if (request->chunked)
+                    {
+                        chunked_istream body(stream);
+
+                        forwarded.body = &body;
+                        in_sync = proxy_details::forward(*route, forwarded, stream);
+                        in_sync = in_sync && body.drain();
+                    }
+                    else
+                    {
+                        forwarded.body = (request->content_length != 0) ? &stream : NULL;
+                        in_sync = proxy_details::forward(*route, forwarded, stream);
+                    }
+                }
+                else if (request->get_command)
+                {
+                    buffers.headers = request->headers;
+                    get(stream, buffers, routes.current(), &timed);
+                }
+                else if (request->post_command)
+                {
+                    buffers.content_type.assign(request->content_type);
+
+                    if (request->chunked)
+                    {
+                        chunked_istream body(stream);
+
+                        in_sync = post(stream, buffers, body, unknown_content_length,
+                            routes.current());
+
+                        in_sync = in_sync && body.drain();
+                    }
+                    else
+                    {
+                        in_sync = post(stream, buffers, stream, request->content_length,
+                            routes.current());
+                    }
+                }
+                else if (request->method.empty() == false)
+                {
+                    send_status(stream, 501);
+
+                    // the body (if any) is not consumed
+                    in_sync = (request->chunked == false) && (request->content_length == 0);
+                }
+
+                // start the next request from scratch
+                timed.begin_idle();
+                trace.finish();
+
+                request.reset();
+                arena.release();
+                request.emplace(&arena);
+
+                if (in_sync == false)
+                {
+                    // the connection is out of sync
+                    break;
+                }
+
+                if (stopping)
+                {
+                    // the server is being stopped, the request was the last one
+                    break;
+                }
+            }
+            else
+            {
+                if (request->method.empty())
+                {
+                    // request line: method, resource and protocol version
+                    if (line == h2_details::preface_request_line)
+                    {
+                        // HTTP/2 with prior knowledge
+                        serve_h2(stream, timed, client_address, shard,
+                            nullptr, std::string_view());
+
+                        break;
+                    }
+
+                    std::size_t pos = line.find(' ');
+                    if (pos == std::string_view::npos)
+                    {
+                        continue;
+                    }
+
+                    timed.begin_header();
+
+                    request->method.assign(line.substr(0, pos));
+                    request->get_command = (request->method == "GET");
+                    request->post_command = (request->method == "POST");
+
+                    std::size_t end = line.find(' ', pos + 1);
+                    if (end != std::string_view::npos)
+                    {
+                        request->resource.assign(line.substr(pos + 1, end - pos - 1));
+                    }
+
+                    trace.start(request->resource);
+
+                    if (first_request && (trace_details::current_request != 0))
+                    {
+                        // from the accept till the connection thread started
+                        trace_details::record("accept", trace_details::current_request,
+                            accepted, started);
+                    }
+
+                    first_request = false;
+
+                    continue;
+                }
+
+                request->headers.append(line);
+                request->headers.append("\r\n");
+
+                // field names in either case, the same way as the proxy
+                // recognizes them, so that both agree where the body ends
+                if (is_field(line, "content-length"))
+                {
+                    std::string_view value = field_value(line);
+
+                    std::size_t length = 0;
+                    std::from_chars_result r =
+                        std::from_chars(value.data(), value.data() + value.size(), length);
+
+                    if (value.empty() || (r.ec != std::errc()) ||
+                        (r.ptr != value.data() + value.size()) ||
+                        (request->has_content_length && (request->content_length != length)))
+                    {
+                        request->malformed = true;
+                    }
+
+                    request->has_content_length = true;
+                    request->content_length = length;
+                }
+                else if (is_field(line, "content-type"))
+                {
+                    request->content_type.assign(field_value(line));
+                }
+                else if (is_field(line, "transfer-encoding"))
+                {
+                    // only the chunked coding delimits the body
+                    request->has_transfer_encoding = true;
+                    request->chunked = contains_token(field_value(line), "chunked");
+                    request->malformed = request->malformed || (request->chunked == false);
+                }
+                else if (is_field(line, "upgrade"))
+                {
+                    request->upgrade_h2c = contains_token(field_value(line), "h2c");
+                }
+                else if (is_field(line, "http2-settings"))
+                {
+                    request->http2_settings.assign(field_value(line));
+                }
+            }
+        }
+
+        request.reset();
+        current_request_memory = NULL;
+
+        if (timed.timed_out() == false)
+        {
+            // the response might be followed by the request that is not read
+            // (for example after the error), which must not reset the connection
+            stream.flush();
+            lingering_close(*sock);
+        }
+
+        if (timed.timed_out() && (logger != NULL) && ((log_mask & log_connections) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "connection timed out\n";
+        }
+
+        if (connection_callback != nullptr)
+        {
+            try
+            {
+                connection_callback(stream, to_be_closed);
+            }
+            catch (...)
+            {
+                // ignore
+            }
+        }
+
+        if ((logger != NULL) && ((log_mask & log_connections) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "finished with this connection\n";
+        }
+    }
+    catch (const std::exception & e)
+    {
+        if ((logger != NULL) && ((log_mask & log_connections) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "error in connection thread: " << e.what() << '\n';
+        }
+    }
+}
+
+// runs the connection and hands its own thread over to be joined
+void worker_thread(std::shared_ptr<base_socket_wrapper> sock, std::string client_address,
+    codel_controller::clock_type::time_point accepted, std::shared_ptr<server_shard> shard)
+{
+    // the streams of HTTP/2 connections inherit the processor
+    pin_thread(shard->cpu);
+
+    serving_thread = true;
+
+    connection_thread(sock, std::move(client_address), accepted, *shard);
+
+    sock.reset();
+
+    std::lock_guard<std::mutex> lck(shard->workers_mtx);
+
+    auto it = shard->workers.find(std::this_thread::get_id());
+    if (it != shard->workers.end())
+    {
+        shard->finished_workers.push_back(std::move(it->second));
+        shard->workers.erase(it);
+    }
+
+    shard->workers_cv.notify_all();
+}
+
+// listening socket, either TCP or Unix
+struct listener
+{
+    std::string address; // as given to server_start
+    std::string name;     // for diagnostics
+    std::unique_ptr<tcp_socket_wrapper> tcp;
+#ifndef WIN32
+    std::unique_ptr<unix_socket_wrapper> local;
+#endif
+    std::atomic<bool> closed;
+    std::shared_ptr<server_shard> shard; // serving the accepted connections
+
+    base_socket_wrapper & socket()
+    {
+#ifndef WIN32
+        if (local)
+        {
+            return *local;
+        }
+#endif
+        return *tcp;
+    }
+};
+
+// how often the accept loops check whether they should finish
+const int accept_poll_ms = 200;
+
+// how often the accept loops check their lingering connections
+const int linger_poll_ms = 20;
+
+// listening sockets taken over from the previous instance of the server,
+// by their addresses
+typedef std::map<std::string, base_socket_wrapper::socket_type> inherited_listeners_type;
+
+// the TCP address of the shard other than the first one is "port#shard",
+// bound with SO_REUSEPORT by all shards
+std::shared_ptr<listener> create_listener(const std::string & address,
+    const inherited_listeners_type & inherited, std::shared_ptr<server_shard> shard,
+    bool reuse_port)
+{
+    std::shared_ptr<listener> l(new listener);
+    l->address = address;
+    l->name = address;
+    l->closed = false;
+    l->shard = shard;
+
+    inherited_listeners_type::const_iterator it = inherited.find(address);
+
+#ifndef WIN32
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        l->local.reset(new unix_socket_wrapper);
+
+        if (it != inherited.end())
+        {
+            l->local->adopt_listening(it->second);
+        }
+        else
+        {
+            l->local->listen(address.substr(5));
+        }
+    }
+    else
+#endif
+    {
+        l->name = "port " + address;
+        l->tcp.reset(new tcp_socket_wrapper);
+
+        if (it != inherited.end())
+        {
+            l->tcp->adopt_listening(it->second);
+        }
+        else
+        {
+            l->tcp->listen(std::stoi(address.substr(0, address.find('#'))), 100, reuse_port);
+        }
+    }
+
+    if (it != inherited.end())
+    {
+        l->name += " (inherited)";
+    }
+
+    // the listening socket can be shared with another instance of the server,
+    // so the accept loop waits for connections with poll and can lose the race
+    l->socket().set_blocking(false);
+
+    return l;
+}
+
+bool would_block(const socket_runtime_error & e)
+{
+#ifdef WIN32
+    return e.errornumber() == WSAEWOULDBLOCK;
+#else
+    return (e.errornumber() == EAGAIN) || (e.errornumber() == EWOULDBLOCK) ||
+        (e.errornumber() == ECONNABORTED) || (e.errornumber() == EINTR);
+#endif
+}
+
+#ifndef WIN32
+
+// the clients of the Unix socket are told apart by their user id (on Linux),
+// so that each user has its own token bucket; elsewhere they share one
+std::string unix_client_address(const unix_socket_wrapper & s)
+{
+#ifdef __linux__
+    ucred cred;
+    socklen_t size = sizeof(cred);
+
+    if (getsockopt(s.handle(), SOL_SOCKET, SO_PEERCRED, &cred, &size) == 0)
+    {
+        return "unix:uid=" + std::to_string(cred.uid);
+    }
+#else
+    (void)s;
+#endif
+
+    return "unix";
+}
+
+#endif
+
+// accepts the pending connection, returns false if there is none
+bool accept_connection(listener & l, std::shared_ptr<base_socket_wrapper> & sock,
+    std::string & client_address)
+{
+    try
+    {
+#ifndef WIN32
+        if (l.local)
+        {
+            unix_socket_wrapper * s = new unix_socket_wrapper(l.local->accept());
+            sock.reset(s);
+            client_address = unix_client_address(*s);
+        }
+        else
+#endif
+        {
+            tcp_socket_wrapper * s = new tcp_socket_wrapper(l.tcp->accept());
+            sock.reset(s);
+            client_address = s->address();
+        }
+    }
+    catch (const socket_runtime_error & e)
+    {
+        if (would_block(e))
+        {
+            return false;
+        }
+
+        throw;
+    }
+
+    // the accepted socket might inherit the non-blocking mode
+    sock->set_blocking(true);
+
+    return true;
+}
+
+void accept_loop(std::shared_ptr<listener> l)
+{
+    server_shard & shard = *l->shard;
+
+    // rejected connections, closed when their peers read the response
+    std::deque<lingering_connection> lingering;
+
+    try
+    {
+        while (l->closed == false)
+        {
+            std::shared_ptr<base_socket_wrapper> sock;
+            std::string client_address;
+
+            if (shard.has_mail)
+            {
+                deliver_messages(shard);
+            }
+
+            if (lingering.empty() == false)
+            {
+                drain_lingering(lingering, codel_controller::clock_type::now());
+            }
+
+            // polled more often while there are lingering connections
+            int poll_ms = lingering.empty() ? accept_poll_ms : linger_poll_ms;
+
+            if ((l->socket().wait_readable(poll_ms) == false) ||
+                (accept_connection(*l, sock, client_address) == false))
+            {
+                continue;
+            }
+
+            codel_controller::clock_type::time_point accepted =
+                codel_controller::clock_type::now();
+
+            shard.connections.fetch_add(1, std::memory_order_relaxed);
+
+            if (admission.overloaded(accepted))
+            {
+                try
+                {
+                    sock->write(shed_response, sizeof(shed_response) - 1);
+                    sock->shutdown_write();
+
+                    if (lingering.size() == max_lingering)
+                    {
+                        lingering.pop_front();
+                    }
+
+                    lingering.push_back(lingering_connection{ sock,
+                        accepted + std::chrono::milliseconds(linger_ms) });
+                }
+                catch (...)
+                {
+                    // ignore, the connection is closed anyway
+                }
+
+                continue;
+            }
+
+            {
+                // the thread is registered before it can finish
+                std::lock_guard<std::mutex> lck(shard.workers_mtx);
+
+                std::thread th(worker_thread, sock, std::move(client_address), accepted,
+                    l->shard);
+                std::thread::id id = th.get_id();
+                shard.workers.emplace(id, std::move(th));
+            }
+
+            join_finished_workers(shard);
+        }
+    }
+    catch (const std::exception & e)
+    {
+        if ((logger != NULL) && ((log_mask & log_connections) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "HTTP server error on " << l->name << ": " << e.what() << '\n';
+        }
+    }
+}
+
+// handoff of the listening sockets from the old instance of the server
+// to the new one, through the Unix socket
+std::string handoff_path;
+std::chrono::milliseconds handoff_drain(30000);
+std::shared_ptr<listener> handoff_listener;
+
+// limit of each step of the exchange, so that the instance that stopped
+// responding does not hold the other one
+const int handoff_timeout_ms = 5000;
+
+// reads listening sockets passed in the environment as "address=handle;..."
+void read_inherited_environment(inherited_listeners_type & inherited)
+{
+    const char * value = std::getenv("HTTP_SERVER_LISTEN_FDS");
+    if (value == NULL)
+    {
+        return;
+    }
+
+    std::string_view rest(value);
+    while (rest.empty() == false)
+    {
+        std::size_t end = rest.find(';');
+        std::string_view item = rest.substr(0, end);
+        rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+
+        std::size_t eq = item.rfind('=');
+        if (eq != std::string_view::npos)
+        {
+            inherited[std::string(item.substr(0, eq))] = (base_socket_wrapper::socket_type)
+                std::strtoul(std::string(item.substr(eq + 1)).c_str(), NULL, 10);
+        }
+    }
+}
+
+#ifndef WIN32
+
+// asks the previous instance (if any) for its listening sockets,
+// returns the connection on which the takeover has to be confirmed
+std::unique_ptr<unix_socket_wrapper> request_handoff(inherited_listeners_type & inherited)
+{
+    std::unique_ptr<unix_socket_wrapper> conn(new unix_socket_wrapper);
+
+    try
+    {
+        conn->connect(handoff_path);
+    }
+    catch (const socket_runtime_error &)
+    {
+        // there is no previous instance
+        return std::unique_ptr<unix_socket_wrapper>();
+    }
+
+    conn->set_timeouts(handoff_timeout_ms, handoff_timeout_ms);
+
+    // addresses, one per line, in the order of handles
+    std::vector<base_socket_wrapper::socket_type> handles;
+    std::string addresses = conn->receive_handles(handles);
+
+    std::string_view rest(addresses);
+    for (base_socket_wrapper::socket_type h : handles)
+    {
+        std::size_t end = rest.find('\n');
+        inherited[std::string(rest.substr(0, end))] = h;
+        rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+    }
+
+    return conn;
+}
+
+// closes the inherited sockets that this instance does not use
+// when the previous instance closes the handoff connection, that is,
+// when it has served the connections it accepted on them
+void close_after_handoff(std::unique_ptr<unix_socket_wrapper> previous,
+    inherited_listeners_type unused)
+{
+    try
+    {
+        int drain_ms = (int)std::min<std::chrono::milliseconds::rep>(
+            handoff_drain.count() + handoff_timeout_ms, 24 * 3600 * 1000);
+
+        previous->set_timeouts(drain_ms, 0);
+
+        char rest[16];
+        while (previous->read(rest, sizeof(rest)) != 0)
+        {
+        }
+    }
+    catch (...)
+    {
+        // closed anyway
+    }
+
+    for (const auto & u : unused)
+    {
+        tcp_socket_wrapper closing;
+        closing.adopt_listening(u.second);
+    }
+}
+
+// serves the next instance of the server and stops this one after the handoff
+void handoff_loop(std::shared_ptr<listener> l)
+{
+    try
+    {
+        while (l->closed == false)
+        {
+            std::shared_ptr<base_socket_wrapper> sock;
+            std::string client_address;
+
+            if ((l->socket().wait_readable(accept_poll_ms) == false) ||
+                (accept_connection(*l, sock, client_address) == false))
+            {
+                continue;
+            }
+
+            unix_socket_wrapper & conn = static_cast<unix_socket_wrapper &>(*sock);
+
+            std::string addresses;
+            std::vector<base_socket_wrapper::socket_type> handles;
+
+            {
+                std::lock_guard<std::mutex> lck(workers_mtx);
+
+                for (const std::shared_ptr<listener> & a : active_listeners)
+                {
+                    addresses += a->address + "\n";
+                    handles.push_back(a->socket().handle());
+                }
+            }
+
+            // the new instance confirms when it accepts on the sockets,
+            // if it fails before that (or does not confirm in time),
+            // this one continues to serve
+            try
+            {
+                conn.set_timeouts(handoff_timeout_ms, handoff_timeout_ms);
+                conn.send_handles(addresses, handles);
+
+                char confirmation[16];
+                if (conn.read(confirmation, sizeof(confirmation)) == 0)
+                {
+                    continue;
+                }
+            }
+            catch (const socket_runtime_error & e)
+            {
+                if ((logger != NULL) && ((log_mask & log_connections) != 0))
+                {
+                    std::lock_guard<std::mutex> lck(mtx);
+
+                    *logger << "HTTP server handoff failed: " << e.what() << '\n';
+                }
+
+                continue;
+            }
+
+            if ((logger != NULL) && ((log_mask & log_connections) != 0))
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+
+                *logger << "listening sockets handed over to the new instance\n";
+            }
+
+            server_stop(handoff_drain);
+
+            return;
+        }
+    }
+    catch (const std::exception & e)
+    {
+        if ((logger != NULL) && ((log_mask & log_connections) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "HTTP server handoff error: " << e.what() << '\n';
+        }
+    }
+}
+
+#endif // WIN32
+
+} // unnamed namespace
+
+void http::server_start(const std::vector<std::string> & listeners,
+    const char * base_directory)
+{
+#ifdef _WIN32
+    WORD versionRequested = MAKEWORD(2, 0);
+    WSADATA wsadata;
+    (void)WSAStartup(versionRequested, &wsadata);
+#endif
+
+    base_dir = base_directory;
+
+#ifdef __linux__
+    std::call_once(static_watch_started, []()
+        {
+            std::thread th(static_watch_thread, base_dir);
+            th.detach();
+        });
+#endif
+
+    std::vector<std::shared_ptr<listener> > sockets;
+
+    inherited_listeners_type inherited;
+    read_inherited_environment(inherited);
+
+#ifndef WIN32
+    std::unique_ptr<unix_socket_wrapper> previous;
+#endif
+
+    create_shards();
+
+    std::vector<std::shared_ptr<server_shard> > running_shards;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+
+        running_shards = shards;
+    }
+
+    try
+    {
+#ifndef WIN32
+        if (handoff_path.empty() == false)
+        {
+            previous = request_handoff(inherited);
+        }
+#endif
+
+        // all listeners are bound before any connection is accepted,
+        // with many shards each of them binds its own socket for every TCP address
+        for (const std::string & address : listeners)
+        {
+            bool local = (address.compare(0, 5, "unix:") == 0);
+            std::size_t count = local ? 1 : running_shards.size();
+
+            for (std::size_t i = 0; i != count; ++i)
+            {
+                std::string shard_address =
+                    (i == 0) ? address : address + "#" + std::to_string(i);
+
+                sockets.push_back(create_listener(shard_address, inherited,
+                    running_shards[i], count > 1));
+                inherited.erase(shard_address);
+
+                if ((logger != NULL) && ((log_mask & log_connections) != 0))
+                {
+                    *logger << "HTTP server is listening on " << sockets.back()->name << '\n';
+                }
+            }
+        }
+
+#ifndef WIN32
+        if (previous)
+        {
+            // the previous instance can stop now, the inherited sockets
+            // that are no longer used are kept until it finishes
+            previous->write("ok\n", 3);
+
+            std::thread th(close_after_handoff, std::move(previous), inherited);
+            th.detach();
+
+            inherited.clear();
+        }
+#endif
+
+        // inherited sockets that are no longer used are closed
+        // (those handed over by the previous instance when it finishes)
+        for (const auto & unused : inherited)
+        {
+            tcp_socket_wrapper closing;
+            closing.adopt_listening(unused.second);
+        }
+
+#ifndef WIN32
+        if (handoff_path.empty() == false)
+        {
+            std::shared_ptr<listener> l = create_listener("unix:" + handoff_path,
+                inherited_listeners_type(), running_shards[0], false);
+
+            {
+                std::lock_guard<std::mutex> lck(workers_mtx);
+
+                handoff_listener = l;
+            }
+
+            std::thread th(handoff_loop, l);
+            th.detach();
+        }
+#endif
+    }
+    catch (const std::exception & e)
+    {
+        if ((logger != NULL) && ((log_mask & log_connections) != 0))
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            *logger << "HTTP server error: " << e.what() << '\n';
+        }
+
+        return;
+    }
+
+    if (sockets.empty())
+    {
+        return;
+    }
+
+    std::vector<std::thread> started;
+
+    try
+    {
+        std::lock_guard<std::mutex> lck(workers_mtx);
+
+        if (stopping)
+        {
+            return;
+        }
+
+        // the first listener is operated by the calling thread
+        for (std::size_t i = 1; i < sockets.size(); ++i)
+        {
+            started.push_back(std::thread(accept_loop, sockets[i]));
+        }
+
+        acceptor_threads.reserve(acceptor_threads.size() + started.size());
+        active_listeners.insert(active_listeners.end(), sockets.begin(), sockets.end());
+
+        for (std::thread & th : started)
+        {
+            acceptor_threads.push_back(std::move(th));
+        }
+    }
+    catch (...)
+    {
+        // the acceptors already started notice it at their next poll
+        for (const std::shared_ptr<listener> & l : sockets)
+        {
+            l->closed = true;
+        }
+
+        for (std::thread & th : started)
+        {
+            if (th.joinable())
+            {
+                th.join();
+            }
+        }
+
+        throw;
+    }
+
+    accept_loop(sockets[0]);
+
+    // when stopped, return only after all connections are finished
+    std::unique_lock<std::mutex> lck(workers_mtx);
+
+    workers_cv.wait(lck, []() { return stopping == false; });
+}
+
+void http::server_stop(std::chrono::milliseconds deadline)
+{
+    if (serving_thread)
+    {
+        // the calling thread is one of those that would be waited for
+        std::thread th([deadline]() { server_stop(deadline); });
+        th.detach();
+
+        return;
+    }
+
+    std::vector<std::thread> acceptors;
+    std::vector<std::shared_ptr<server_shard> > running_shards;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+
+        running_shards = shards;
+    }
+
+    {
+        std::lock_guard<std::mutex> lck(workers_mtx);
+
+        stopping = true;
+
+        // no more connections are accepted, the accept loops notice it
+        // at their next poll (the sockets themselves are not shut down,
+        // as they can be shared with the new instance of the server)
+        for (const std::shared_ptr<listener> & l : active_listeners)
+        {
+            l->closed = true;
+        }
+
+        if (handoff_listener)
+        {
+            handoff_listener->closed = true;
+            handoff_listener.reset();
+        }
+
+        active_listeners.clear();
+        acceptors.swap(acceptor_threads);
+
+        // connections waiting for the next request are closed immediately,
+        // the others are closed after their current request
+        for (const std::shared_ptr<server_shard> & shard : running_shards)
+        {
+            std::lock_guard<std::mutex> shard_lck(shard->workers_mtx);
+
+            for (timed_socket * s : shard->open_connections)
+            {
+                if (s->idle())
+                {
+                    s->shutdown();
+                }
+            }
+        }
+    }
+
+    for (std::thread & th : acceptors)
+    {
+        th.join();
+    }
+
+    std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + deadline;
+    bool interrupted = false;
+
+    for (const std::shared_ptr<server_shard> & shard : running_shards)
+    {
+        std::unique_lock<std::mutex> lck(shard->workers_mtx);
+
+        if ((interrupted == false) &&
+            shard->workers_cv.wait_until(lck, until,
+                [&shard]() { return shard->workers.empty(); }))
+        {
+            continue;
+        }
+
+        lck.unlock();
+
+        // the requests that did not finish in time are interrupted, in all shards
+        if (interrupted == false)
+        {
+            interrupted = true;
+
+            for (const std::shared_ptr<server_shard> & other : running_shards)
+            {
+                std::lock_guard<std::mutex> other_lck(other->workers_mtx);
+
+                for (timed_socket * s : other->open_connections)
+                {
+                    s->shutdown();
+                }
+            }
+        }
+
+        lck.lock();
+
+        shard->workers_cv.wait(lck, [&shard]() { return shard->workers.empty(); });
+    }
+
+    for (const std::shared_ptr<server_shard> & shard : running_shards)
+    {
+        join_finished_workers(*shard);
+    }
+
+    if ((logger != NULL) && ((log_mask & log_connections) != 0))
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+
+        *logger << "HTTP server stopped\n";
+    }
+
+    std::lock_guard<std::mutex> lck(workers_mtx);
+
+    stopping = false;
+    workers_cv.notify_all();
+}
+
+void http::server_start(const std::vector<std::string> & listeners,
+    const char * base_directory, std::ostream & error_log, unsigned int log_events_mask)
+{
+    logger = &error_log;
+    log_mask = log_events_mask;
+
+    server_start(listeners, base_directory);
+}
+
+void http::server_start(int port_number, const char * base_directory)
+{
+    listening_port = port_number;
+
+    server_start(std::vector<std::string>(1, std::to_string(port_number)), base_directory);
+}
+
+void http::server_start(int port_number, const char * base_directory,
+    std::ostream & error_log, unsigned int log_events_mask)
+{
+    logger = &error_log;
+    log_mask = log_events_mask;
+    
+    server_start(port_number, base_directory);
+}
+
+void http::set_listener_handoff(const char * path, std::chrono::milliseconds drain_deadline)
+{
+    handoff_path = path;
+    handoff_drain = drain_deadline;
+}
+
+void http::set_action_workers(std::size_t workers)
+{
+    action_scheduler.reset(new task_scheduler(workers));
+}
+
+void http::set_missing_file_cache(std::size_t capacity, std::chrono::milliseconds ttl)
+{
+    missing_file_ttl = ttl;
+    missing_files.set_capacity((ttl.count() > 0) ? capacity : 0);
+}
+
+void http::set_open_file_cache(std::size_t capacity, std::chrono::milliseconds revalidate)
+{
+#ifndef WIN32
+    open_files.set_limits(capacity, revalidate);
+#else
+    (void)capacity;
+    (void)revalidate;
+#endif
+}
+
+void http::set_static_pack(const char * path)
+{
+#ifndef WIN32
+    std::shared_ptr<const asset_pack> pack;
+    if ((path != NULL) && (*path != '\0'))
+    {
+        pack = std::make_shared<const asset_pack>(path);
+    }
+
+    std::lock_guard<std::mutex> lck(static_pack_mtx);
+
+    static_pack_path = (pack != nullptr) ? path : "";
+    static_pack = pack;
+    static_pack_version.fetch_add(1, std::memory_order_release);
+#else
+    (void)path;
+
+    throw std::runtime_error("static packs are not supported on this platform");
+#endif
+}
+
+void http::create_executor_pool(const char * name, std::size_t concurrency,
+    std::size_t queue_limit)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    if (executor_pools.count(name) != 0)
+    {
+        throw std::runtime_error(std::string("executor pool already exists: ") + name);
+    }
+
+    std::shared_ptr<executor_pool> pool(new executor_pool);
+    pool->name = name;
+    pool->concurrency = (concurrency == 0) ? 1 : concurrency;
+    pool->queue_limit = queue_limit;
+    pool->scheduler.reset(new task_scheduler(pool->concurrency));
+    pool->admitted = 0;
+
+    executor_pools[name] = pool;
+}
+
+void http::set_route_executor(const char * name, const char * pool)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    std::string path = std::string("/") + name;
+
+    if (*pool == '\0')
+    {
+        publish_routes([&path](route_table & routes) { routes.executors.erase(path); });
+
+        return;
+    }
+
+    auto it = executor_pools.find(pool);
+    if (it == executor_pools.end())
+    {
+        throw std::runtime_error(std::string("unknown executor pool: ") + pool);
+    }
+
+    std::shared_ptr<executor_pool> p = it->second;
+
+    publish_routes([&path, &p](route_table & routes) { routes.executors[path] = p; });
+}
+
+void http::set_server_shards(std::size_t count, bool pin_threads)
+{
+    shard_count = count;
+    pin_shard_threads = pin_threads;
+}
+
+std::vector<shard_statistics> http::get_shard_statistics()
+{
+    std::vector<shard_statistics> result;
+
+    std::lock_guard<std::mutex> lck(mtx);
+
+    for (const std::shared_ptr<server_shard> & s : shards)
+    {
+        result.push_back(shard_statistics {
+            s->connections.load(std::memory_order_relaxed),
+            s->requests.load(std::memory_order_relaxed) });
+    }
+
+    return result;
+}
+
+void http::set_connection_timeouts(std::chrono::milliseconds idle,
+    std::chrono::milliseconds header, std::chrono::milliseconds body,
+    std::chrono::milliseconds write)
+{
+    idle_timeout = idle;
+    header_timeout = header;
+    body_timeout = body;
+    write_timeout = write;
+
+    std::call_once(timer_thread_started, []()
+        {
+            std::thread th(timer_thread);
+            th.detach();
+        });
+}
+
+void http::set_load_shedding(std::chrono::microseconds target,
+    std::chrono::microseconds interval)
+{
+    admission.set_parameters(target, interval);
+}
+
+void http::set_low_priority_route(const char * name)
+{
+    std::string path = std::string("/") + name;
+
+    std::lock_guard<std::mutex> lck(mtx);
+
+    publish_routes([&path](route_table & routes) { routes.low_priority.insert(path); });
+}
+
+void http::set_client_rate_limit(double rate, double burst)
+{
+    route_limit limit { rate, (burst < 1.0) ? 1.0 : burst };
+
+    std::lock_guard<std::mutex> lck(mtx);
+
+    publish_routes([&limit](route_table & routes) { routes.client_limit = limit; });
+}
+
+void http::set_route_rate_limit(const char * name, double rate, double burst)
+{
+    std::string path = std::string("/") + name;
+    route_limit limit { rate, (burst < 1.0) ? 1.0 : burst };
+
+    std::lock_guard<std::mutex> lck(mtx);
+
+    publish_routes([&path, &limit](route_table & routes)
+        {
+            if (limit.rate == 0.0)
+            {
+                routes.route_limits.erase(path);
+            }
+            else
+            {
+                routes.route_limits[path] = limit;
+            }
+        });
+}
+
+void http::register_connection_callback(connection_callback_type callback)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    
+    connection_callback = callback;
+}
+
+void http::register_generic_get_action(const char * name, get_action_type f)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    add_get_route(std::string("/") + name,
+        get_route { f, std::string(""), std::chrono::milliseconds(0), false });
+}
 
-void http::server_start(int port_number, const char * base_directory)
+void http::register_html_get_action(const char * name, get_action_type f)
 {
-#ifdef _WIN32
-    WORD versionRequested = MAKEWORD(2, 0);
-    WSADATA wsadata;
-    (void)WSAStartup(versionRequested, &wsadata);
-#endif
+    std::lock_guard<std::mutex> lck(mtx);
 
-    listening_port = port_number;
-    base_dir = base_directory;
-    
-    try
-    {
-        tcp_socket_wrapper sockserver;
+    add_get_route(std::string("/") + name,
+        get_route { f, std::string("text/html"), std::chrono::milliseconds(0), false });
+}
 
-        sockserver.listen(port_number);
+void http::register_text_get_action(const char * name, get_action_type f)
+{
+    std::lock_guard<std::mutex> lck(mtx);
 
-        if ((logger != NULL) && ((log_mask & log_connections) != 0))
-        {
-            *logger << "HTTP server is listening on port " << port_number << '\n';
-        }
+    add_get_route(std::string("/") + name,
+        get_route { f, std::string("text/plain"), std::chrono::milliseconds(0), false });
+}
 
-        while (true)
-        {
-            std::shared_ptr<tcp_socket_wrapper> sock(
-                new tcp_socket_wrapper(sockserver.accept()));
+void http::register_cached_html_get_action(const char * name, get_action_type f,
+    std::chrono::milliseconds ttl)
+{
+    std::lock_guard<std::mutex> lck(mtx);
 
-            std::thread th(connection_thread, sock);
-            th.detach();
-        }
-    }
-    catch (const std::exception & e)
-    {
-        if ((logger != NULL) && ((log_mask & log_connections) != 0))
-        {
-            std::lock_guard<std::mutex> lck(mtx);
+    std::string path = std::string("/") + name;
 
-            *logger << "HTTP server error: " << e.what() << '\n';
-        }
-    }
+    add_get_route(path,
+        get_route { f, std::string("text/html"), ttl, true });
+
+    // responses of the previous registration are no longer valid
+    cached_responses.erase_prefix(path + "?");
 }
 
-void http::server_start(int port_number, const char * base_directory,
-    std::ostream & error_log, unsigned int log_events_mask)
+void http::register_cached_text_get_action(const char * name, get_action_type f,
+    std::chrono::milliseconds ttl)
 {
-    logger = &error_log;
-    log_mask = log_events_mask;
-    
-    server_start(port_number, base_directory);
+    std::lock_guard<std::mutex> lck(mtx);
+
+    std::string path = std::string("/") + name;
+
+    add_get_route(path,
+        get_route { f, std::string("text/plain"), ttl, true });
+
+    cached_responses.erase_prefix(path + "?");
 }
 
-void http::register_connection_callback(connection_callback_type callback)
+void http::register_coalesced_html_get_action(const char * name, get_action_type f)
 {
     std::lock_guard<std::mutex> lck(mtx);
-    
-    connection_callback = callback;
+
+    add_get_route(std::string("/") + name,
+        get_route { f, std::string("text/html"), std::chrono::milliseconds(0), true });
 }
 
-void http::register_generic_get_action(const char * name, get_action_type f)
+void http::register_coalesced_text_get_action(const char * name, get_action_type f)
 {
     std::lock_guard<std::mutex> lck(mtx);
 
-    get_actions[std::string("/") + name] = std::make_pair(f, std::string(""));
+    add_get_route(std::string("/") + name,
+        get_route { f, std::string("text/plain"), std::chrono::milliseconds(0), true });
 }
 
-void http::register_html_get_action(const char * name, get_action_type f)
+void http::invalidate_cached_action(const char * name)
 {
-    std::lock_guard<std::mutex> lck(mtx);
+    cached_responses.erase_prefix(std::string("/") + name + "?");
+}
 
-    get_actions[std::string("/") + name] = std::make_pair(f, std::string("text/html"));
+void http::invalidate_cached_response(const char * name, const std::string & params)
+{
+    cached_responses.erase(cache_key(std::string("/") + name, params));
 }
 
-void http::register_text_get_action(const char * name, get_action_type f)
+void http::set_response_cache_size(std::size_t bytes)
 {
+    cached_responses.set_budget(bytes);
+}
+
+void http::register_chunked_get_action(const char * name, const char * mime_type,
+    get_action_type f)
+{
+    std::string type(mime_type);
+
+    // registered as generic action, with the headers and chunked coding
+    // handled by this wrapper
+    get_action_type wrapper = [f, type](std::ostream & out,
+        const std::string & path, const std::string & params)
+    {
+        response_builder & r = connection_response();
+        r.start(200).content_type(type).chunked().cache_control(false).date().end_headers();
+        out.write(r.data(), r.size());
+
+        chunked_ostream chunked(out);
+
+        try
+        {
+            f(chunked, path, params);
+        }
+        catch (...)
+        {
+            // the response is already under way, it can be only cut short
+            chunked.fail();
+
+            throw;
+        }
+
+        chunked.finish();
+    };
+
     std::lock_guard<std::mutex> lck(mtx);
 
-    get_actions[std::string("/") + name] = std::make_pair(f, std::string("text/plain"));
+    add_get_route(std::string("/") + name,
+        get_route { wrapper, std::string(""), std::chrono::milliseconds(0), false });
 }
 
 void http::register_generic_post_action(const char * name, post_action_type f)
 {
     std::lock_guard<std::mutex> lck(mtx);
 
-    post_actions[std::string("/") + name] = std::make_pair(f, std::string(""));
+    add_post_route(std::string("/") + name,
+        post_route { f, std::string("") });
 }
 
 void http::register_html_post_action(const char * name, post_action_type f)
 {
     std::lock_guard<std::mutex> lck(mtx);
 
-    post_actions[std::string("/") + name] = std::make_pair(f, std::string("text/html"));
+    add_post_route(std::string("/") + name,
+        post_route { f, std::string("text/html") });
 }
 
 void http::register_text_post_action(const char * name, post_action_type f)
 {
     std::lock_guard<std::mutex> lck(mtx);
 
-    post_actions[std::string("/") + name] = std::make_pair(f, std::string("text/plain"));
+    add_post_route(std::string("/") + name,
+        post_route { f, std::string("text/plain") });
 }
 
-std::string http::html_encode(const std::string & s)
+void http::register_chunked_post_action(const char * name, const char * mime_type,
+    post_action_type f)
 {
-    std::string result;
+    std::string type(mime_type);
 
-    for (char c : s)
+    post_action_type wrapper = [f, type](std::ostream & out,
+        const std::string & path, const std::string & params,
+        std::istream & in, std::size_t content_length, const std::string & content_type)
     {
-        if (c == '<')
+        response_builder & r = connection_response();
+        r.start(200).content_type(type).chunked().cache_control(false).date().end_headers();
+        out.write(r.data(), r.size());
+
+        chunked_ostream chunked(out);
+
+        try
         {
-            result.append("&lt;");
+            f(chunked, path, params, in, content_length, content_type);
         }
-        else if (c == '>')
+        catch (...)
         {
-            result.append("&gt;");
+            chunked.fail();
+
+            throw;
         }
-        else if (c == '&')
+
+        chunked.finish();
+    };
+
+    std::lock_guard<std::mutex> lck(mtx);
+
+    add_post_route(std::string("/") + name,
+        post_route { wrapper, std::string("") });
+}
+
+void http::register_json_get_action(const char * name, json_get_action_type f)
+{
+    // registered as generic action, with the buffering and headers
+    // handled by this wrapper
+    get_action_type wrapper = [f](std::ostream & out,
+        const std::string & path, const std::string & params)
+    {
+        std::string & body = json_response_buffer;
+        body.clear();
+
+        try
         {
-            result.append("&amp;");
+            json_writer w(body);
+
+            f(w, path, params);
         }
-        else
+        catch (...)
         {
-            result.append(1, c);
+            send_status(out, 500);
+
+            throw;
         }
-    }
 
-    return result;
+        send_content(out, json_mime_type, body.data(), body.size(), false);
+        release_json_buffers();
+    };
+
+    std::lock_guard<std::mutex> lck(mtx);
+
+    add_get_route(std::string("/") + name,
+        get_route { wrapper, std::string(""), std::chrono::milliseconds(0), false });
 }
 
-std::string http::url_encode(const std::string & s)
+void http::register_json_post_action(const char * name, json_post_action_type f)
 {
-    std::string result;
-    
-    for (char c : s)
+    post_action_type wrapper = [f](std::ostream & out,
+        const std::string & path, const std::string & params,
+        std::istream & in, std::size_t content_length, const std::string & /* content_type */)
     {
-        if ((std::isalnum(c) != 0) ||
-            (c == '-') || (c == '_') || (c == '.') || (c == '~'))
+        std::string & text = json_request_buffer;
+
+        if (read_body(in, content_length, max_json_body, text) == false)
+        {
+            send_status(out, 413);
+            release_json_buffers();
+
+            return;
+        }
+
+        json_document & doc = json_request_document;
+
+        try
         {
-            result.append(1, c);
+            doc.parse(&text[0], text.size());
         }
-        else if (c == ' ')
+        catch (const json_error & e)
         {
-            result.append(1, '+');
+            send_status(out, 400, std::string("Bad Request: ") + e.what());
+            release_json_buffers();
+
+            return;
         }
-        else
+
+        std::string & body = json_response_buffer;
+        body.clear();
+
+        try
         {
-            char buf[4];
-            
-            std::sprintf(buf, "%%%x", (int)c);
-            
-            result.append(buf);
+            json_writer w(body);
+
+            f(w, path, params, doc.root());
+        }
+        catch (...)
+        {
+            send_status(out, 500);
+
+            throw;
         }
+
+        send_content(out, json_mime_type, body.data(), body.size(), false);
+        release_json_buffers();
+    };
+
+    std::lock_guard<std::mutex> lck(mtx);
+
+    add_post_route(std::string("/") + name,
+        post_route { wrapper, std::string("") });
+}
+
+std::string http::html_encode(const std::string & s)
+{
+    std::string result;
+
+    html_encode(s.data(), s.size(), result);
+
+    return result;
+}
+
+void http::set_trace_sampling(double probability)
+{
+    trace_details::set_sampling(probability);
+}
+
+void http::set_trace_buffer_size(std::size_t events)
+{
+    trace_details::set_buffer_size(events);
+}
+
+void http::register_trace_action(const char * name)
+{
+    register_json_get_action(name, [](json_writer & w,
+        const std::string &, const std::string &)
+        {
+            trace_details::write_chrome_trace(w);
+        });
+}
+
+void http::set_trace_signal(int signal_number, const char * file_name)
+{
+    {
+        std::lock_guard<std::mutex> lock(trace_file_mtx);
+        trace_file_name = file_name;
     }
-    
+
+    if (std::signal(signal_number, on_trace_signal) == SIG_ERR)
+    {
+        throw std::runtime_error("cannot install the trace signal handler");
+    }
+
+    std::call_once(timer_thread_started, []()
+        {
+            std::thread th(timer_thread);
+            th.detach();
+        });
+}
+
+void http::html_encode(const char * s, std::size_t n, std::string & out)
+{
+    out.reserve(out.size() + n + n / 8);
+
+    string_sink<std::string> sink = { out };
+    html_encode_kernel(s, n, sink);
+}
+
+void http::html_encode(const char * s, std::size_t n, std::pmr::string & out)
+{
+    out.reserve(out.size() + n + n / 8);
+
+    string_sink<std::pmr::string> sink = { out };
+    html_encode_kernel(s, n, sink);
+}
+
+void http::html_encode(const std::string & s, std::string & out)
+{
+    html_encode(s.data(), s.size(), out);
+}
+
+std::size_t http::html_encode(const char * s, std::size_t n, char * buf)
+{
+    buffer_sink sink = { buf, buf };
+    html_encode_kernel(s, n, sink);
+
+    return sink.pos - sink.begin;
+}
+
+std::string http::url_encode(const std::string & s)
+{
+    std::string result;
+
+    url_encode(s.data(), s.size(), result);
+
     return result;
 }
 
+void http::url_encode(const char * s, std::size_t n, std::string & out)
+{
+    out.reserve(out.size() + n + n / 4);
+
+    string_sink<std::string> sink = { out };
+    url_encode_kernel(s, n, sink);
+}
+
+void http::url_encode(const char * s, std::size_t n, std::pmr::string & out)
+{
+    out.reserve(out.size() + n + n / 4);
+
+    string_sink<std::pmr::string> sink = { out };
+    url_encode_kernel(s, n, sink);
+}
+
+void http::url_encode(const std::string & s, std::string & out)
+{
+    url_encode(s.data(), s.size(), out);
+}
+
+std::size_t http::url_encode(const char * s, std::size_t n, char * buf)
+{
+    buffer_sink sink = { buf, buf };
+    url_encode_kernel(s, n, sink);
+
+    return sink.pos - sink.begin;
+}
+
 std::string http::url_decode(const std::string & s)
 {
-    enum decoder_state { regular, percent_1, percent_2 };
-    decoder_state state = regular;
-    int hex_1, hex_2;
-    
     std::string result;
-    
-    for (char c : s)
-    {
-        switch (state)
-        {
-        case regular:
-            if (c == '%')
-            {
-                state = percent_1;
-            }
-            else if (c == '+')
-            {
-                result.append(1, ' ');
-            }
-            else
-            {
-                result.append(1, c);
-            }
-            
-            break;
-            
-        case percent_1:
-            hex_1 = hex_digit_to_int(c);
-            state = percent_2;
-            
-            break;
-            
-        case percent_2:
-            hex_2 = hex_digit_to_int(c);
-            
-            result.append(1, (char)(16 * hex_1 + hex_2)); 
-            
-            state = regular;
-            
-            break;
-        }
-    }
-    
+
+    url_decode(s.data(), s.size(), result);
+
     return result;
 }
 
+void http::url_decode(const char * s, std::size_t n, std::string & out)
+{
+    out.reserve(out.size() + n);
+
+    string_sink<std::string> sink = { out };
+    url_decode_kernel(s, n, sink);
+}
+
+void http::url_decode(const char * s, std::size_t n, std::pmr::string & out)
+{
+    out.reserve(out.size() + n);
+
+    string_sink<std::pmr::string> sink = { out };
+    url_decode_kernel(s, n, sink);
+}
+
+void http::url_decode(const std::string & s, std::string & out)
+{
+    url_decode(s.data(), s.size(), out);
+}
+
+std::size_t http::url_decode(const char * s, std::size_t n, char * buf)
+{
+    buffer_sink sink = { buf, buf };
+    url_decode_kernel(s, n, sink);
+
+    return sink.pos - sink.begin;
+}
+
 params_map_type http::decode_params(const std::string & params, bool decode)
 {
     const char * begin = params.data();
     const char * end = begin + params.size();
 
-    return do_decode_params(begin, end, decode);
+    return do_decode_params(begin, end, decode, params_map_type());
 }
 
 params_map_type http::decode_params(const std::vector<char> & params, bool decode)
 {
-    const char * begin = &params[0];
+    const char * begin = params.data();
     const char * end = begin + params.size();
 
-    return do_decode_params(begin, end, decode);
+    return do_decode_params(begin, end, decode, params_map_type());
+}
+
+pmr_params_map_type http::decode_params(const char * params, std::size_t size,
+    bool decode, std::pmr::memory_resource * mr)
+{
+    return do_decode_params(params, params + size, decode, pmr_params_map_type(mr));
+}
+
+std::pmr::memory_resource * http::request_memory()
+{
+    if (current_request_memory != NULL)
+    {
+        return current_request_memory;
+    }
+
+    return std::pmr::get_default_resource();
 }
 
 std::string http::header(const std::string & mime_type,
     std::size_t content_length, bool cache)
 {
-    std::string res = std::string("HTTP/1.1 200 OK\r\n")
-        + "Content-Type: " + mime_type + "\r\n"
-        + (content_length != 0 ?
-            "Content-Length: " + std::to_string(content_length) + "\r\n" :
-            "")
-        + (cache ?
-            "Cache-Control: public, max-age=31536000\r\n" :
-            "Cache-Control: no-cache, no-store, must-revalidate\r\n")
-        + "\r\n";
-
-    return res;
+    response_builder r(256);
+
+    r.start(200).content_type(mime_type);
+    if (content_length != 0)
+    {
+        r.content_length(content_length);
+    }
+    r.cache_control(cache).date().end_headers();
+
+    return r.str();
+}
+
+std::string http::chunked_header(const std::string & mime_type, bool cache)
+{
+    response_builder r(256);
+
+    r.start(200).content_type(mime_type).chunked().cache_control(cache).date().end_headers();
+
+    return r.str();
 }
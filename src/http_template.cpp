@@ -0,0 +1,279 @@
+
+#include <http_template.h>
+#include <http_server.h>
+
+#include <atomic>
+#include <charconv>
+#include <memory>
+#include <stdexcept>
+
+using namespace http;
+
+namespace // unnamed
+{
+
+std::atomic<std::uint64_t> next_template_id(1);
+
+std::string_view trim(std::string_view s)
+{
+    while ((s.empty() == false) && ((s.front() == ' ') || (s.front() == '\t')))
+    {
+        s.remove_prefix(1);
+    }
+
+    while ((s.empty() == false) && ((s.back() == ' ') || (s.back() == '\t')))
+    {
+        s.remove_suffix(1);
+    }
+
+    return s;
+}
+
+struct stream_sink
+{
+    std::ostream & out;
+    std::string & scratch;
+
+    void append(const char * p, std::size_t n) { out.write(p, (std::streamsize)n); }
+
+    void append_encoded(const char * p, std::size_t n)
+    {
+        scratch.clear();
+        html_encode(p, n, scratch);
+        out.write(scratch.data(), (std::streamsize)scratch.size());
+    }
+};
+
+struct string_sink
+{
+    std::string & out;
+
+    void append(const char * p, std::size_t n) { out.append(p, n); }
+    void append_encoded(const char * p, std::size_t n) { html_encode(p, n, out); }
+};
+
+void append_number(std::string & out, std::uint64_t n)
+{
+    char buf[24];
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), n);
+
+    out.append(buf, r.ptr - buf);
+}
+
+// per-thread buffers, reused to keep their capacity
+thread_local std::string encode_buffer;
+thread_local std::string key_buffer;
+
+} // unnamed namespace
+
+html_template::html_template(std::string text)
+    : text_(std::move(text)), static_size_(0), id_(next_template_id.fetch_add(1))
+{
+    std::size_t pos = 0;
+
+    while (pos < text_.size())
+    {
+        std::size_t open = text_.find("{{", pos);
+        std::size_t end = (open == std::string::npos) ? text_.size() : open;
+
+        if (end != pos)
+        {
+            program_.push_back(instruction { instruction::text, pos, end - pos, 0 });
+            static_size_ += end - pos;
+        }
+
+        if (open == std::string::npos)
+        {
+            break;
+        }
+
+        bool raw = (text_.compare(open, 3, "{{{") == 0);
+        const char * terminator = raw ? "}}}" : "}}";
+        std::size_t name_begin = open + (raw ? 3 : 2);
+
+        std::size_t close = text_.find(terminator, name_begin);
+        if (close == std::string::npos)
+        {
+            throw std::runtime_error("unterminated template placeholder at offset " +
+                std::to_string(open));
+        }
+
+        std::string_view name = trim(std::string_view(text_).substr(name_begin, close - name_begin));
+        if (name.empty())
+        {
+            throw std::runtime_error("template placeholder without name at offset " +
+                std::to_string(open));
+        }
+
+        std::size_t s = slot(name);
+        if (s == npos)
+        {
+            s = names_.size();
+            names_.emplace_back(name);
+        }
+
+        program_.push_back(instruction {
+            raw ? instruction::raw : instruction::encoded, 0, 0, s });
+
+        pos = close + (raw ? 3 : 2);
+    }
+}
+
+std::size_t html_template::slot(std::string_view name) const
+{
+    for (std::size_t i = 0; i != names_.size(); ++i)
+    {
+        if (names_[i] == name)
+        {
+            return i;
+        }
+    }
+
+    return npos;
+}
+
+template <class Sink>
+void html_template::execute(Sink & sink, const template_values & values) const
+{
+    if (&values.owner() != this)
+    {
+        throw std::runtime_error("template values created for another template");
+    }
+
+    const char * text = text_.data();
+
+    for (const instruction & i : program_)
+    {
+        switch (i.kind)
+        {
+        case instruction::text:
+            sink.append(text + i.offset, i.size);
+            break;
+
+        case instruction::encoded:
+            {
+                std::string_view v = values.get(i.slot);
+                sink.append_encoded(v.data(), v.size());
+            }
+            break;
+
+        case instruction::raw:
+            {
+                std::string_view v = values.get(i.slot);
+                sink.append(v.data(), v.size());
+            }
+            break;
+        }
+    }
+}
+
+void html_template::render(std::ostream & out, const template_values & values) const
+{
+    stream_sink sink = { out, encode_buffer };
+    execute(sink, values);
+}
+
+void html_template::render(std::string & out, const template_values & values) const
+{
+    // the static text and the values, typically without any entities
+    std::size_t size = static_size_;
+    for (std::size_t i = 0; i != names_.size(); ++i)
+    {
+        size += values.get(i).size();
+    }
+
+    out.reserve(out.size() + size);
+
+    string_sink sink = { out };
+    execute(sink, values);
+}
+
+void html_template::render(std::ostream & out, const template_values & values,
+    response_cache & fragments) const
+{
+    // the template and all values, each prefixed with its length
+    std::string & key = key_buffer;
+    key.assign("template:");
+    append_number(key, id_);
+
+    for (std::size_t i = 0; i != names_.size(); ++i)
+    {
+        std::string_view v = values.get(i);
+
+        key.push_back('/');
+        append_number(key, v.size());
+        key.push_back(':');
+        key.append(v.data(), v.size());
+    }
+
+    response_cache::response_type fragment = fragments.find(key);
+
+    if (fragment == nullptr)
+    {
+        std::shared_ptr<std::string> rendered = std::make_shared<std::string>();
+        render(*rendered, values);
+
+        fragment = rendered;
+        fragments.insert(key, fragment, response_cache::clock_type::time_point::max());
+    }
+
+    out.write(fragment->data(), (std::streamsize)fragment->size());
+}
+
+template_values::template_values(const html_template & t)
+    : owner_(t), values_(t.slots())
+{
+    for (value & v : values_)
+    {
+        v.data = NULL;
+        v.size = 0;
+    }
+}
+
+std::size_t template_values::checked_slot(std::string_view name) const
+{
+    std::size_t s = owner_.slot(name);
+    if (s == html_template::npos)
+    {
+        throw std::runtime_error("template has no variable " + std::string(name));
+    }
+
+    return s;
+}
+
+template_values & template_values::set(std::string_view name, std::string_view value)
+{
+    return set_slot(checked_slot(name), value);
+}
+
+template_values & template_values::set(std::string_view name, long long value)
+{
+    return set_slot(checked_slot(name), value);
+}
+
+template_values & template_values::set_slot(std::size_t slot, std::string_view value)
+{
+    values_.at(slot).data = value.data();
+    values_[slot].size = value.size();
+
+    return *this;
+}
+
+template_values & template_values::set_slot(std::size_t slot, long long value)
+{
+    struct value & v = values_.at(slot);
+
+    std::to_chars_result r = std::to_chars(v.digits, v.digits + sizeof(v.digits), value);
+
+    v.data = v.digits;
+    v.size = r.ptr - v.digits;
+
+    return *this;
+}
+
+std::string_view template_values::get(std::size_t slot) const
+{
+    const value & v = values_[slot];
+
+    return (v.data != NULL) ? std::string_view(v.data, v.size) : std::string_view();
+}
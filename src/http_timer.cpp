@@ -0,0 +1,174 @@
+
+#include <http_timer.h>
+
+using namespace http;
+
+timer_wheel::timer_wheel(std::chrono::milliseconds resolution)
+    : origin_(clock_type::now()), resolution_(resolution), current_(0)
+{
+    if (resolution_ <= clock_type::duration::zero())
+    {
+        resolution_ = std::chrono::milliseconds(1);
+    }
+
+    for (int level = 0; level != levels; ++level)
+    {
+        for (int slot = 0; slot != slots_per_level; ++slot)
+        {
+            slots_[level][slot] = NULL;
+        }
+    }
+}
+
+void timer_wheel::arm(timer & t, clock_type::time_point deadline)
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    if (t.slot_ != NULL)
+    {
+        unlink(t);
+    }
+
+    std::uint64_t ticks = 0;
+    if (deadline > origin_)
+    {
+        // rounded up, so that the timer never fires too early
+        ticks = (std::uint64_t)((deadline - origin_ + resolution_ - clock_type::duration(1))
+            / resolution_);
+    }
+
+    // the slot of the current tick was already processed
+    if (ticks <= current_)
+    {
+        ticks = current_ + 1;
+    }
+
+    t.expires_ = ticks;
+
+    insert(t);
+}
+
+void timer_wheel::cancel(timer & t)
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    if (t.slot_ != NULL)
+    {
+        unlink(t);
+    }
+}
+
+void timer_wheel::advance(clock_type::time_point now)
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    if (now < origin_)
+    {
+        return;
+    }
+
+    std::uint64_t target = (std::uint64_t)((now - origin_) / resolution_);
+
+    while (current_ < target)
+    {
+        ++current_;
+
+        // when the lower level wraps around, the timers from the matching
+        // slot of the higher level are redistributed to the lower levels
+        for (int level = 1; level != levels; ++level)
+        {
+            if ((current_ & ((std::uint64_t(1) << (level_bits * level)) - 1)) != 0)
+            {
+                break;
+            }
+
+            cascade(level);
+        }
+
+        timer * & head = slots_[0][current_ & (slots_per_level - 1)];
+        timer * t = head;
+        head = NULL;
+
+        while (t != NULL)
+        {
+            timer * next = t->next_;
+
+            t->slot_ = NULL;
+            t->prev_ = NULL;
+            t->next_ = NULL;
+
+            t->callback_();
+
+            t = next;
+        }
+    }
+}
+
+void timer_wheel::insert(timer & t)
+{
+    const std::uint64_t max_delta = (std::uint64_t(1) << (level_bits * levels)) - 1;
+
+    if (t.expires_ - current_ > max_delta)
+    {
+        t.expires_ = current_ + max_delta;
+    }
+
+    std::uint64_t delta = t.expires_ - current_;
+
+    int level = 0;
+    while ((level != levels - 1) && (delta >= (std::uint64_t(1) << (level_bits * (level + 1)))))
+    {
+        ++level;
+    }
+
+    timer * & head =
+        slots_[level][(t.expires_ >> (level_bits * level)) & (slots_per_level - 1)];
+
+    t.slot_ = &head;
+    t.prev_ = NULL;
+    t.next_ = head;
+
+    if (head != NULL)
+    {
+        head->prev_ = &t;
+    }
+
+    head = &t;
+}
+
+void timer_wheel::unlink(timer & t)
+{
+    if (t.prev_ != NULL)
+    {
+        t.prev_->next_ = t.next_;
+    }
+    else
+    {
+        *t.slot_ = t.next_;
+    }
+
+    if (t.next_ != NULL)
+    {
+        t.next_->prev_ = t.prev_;
+    }
+
+    t.slot_ = NULL;
+    t.prev_ = NULL;
+    t.next_ = NULL;
+}
+
+void timer_wheel::cascade(int level)
+{
+    timer * & head = slots_[level][(current_ >> (level_bits * level)) & (slots_per_level - 1)];
+    timer * t = head;
+    head = NULL;
+
+    while (t != NULL)
+    {
+        timer * next = t->next_;
+
+        insert(*t);
+
+        t = next;
+    }
+}
@@ -0,0 +1,243 @@
+
+#include <http_trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace http;
+
+namespace // unnamed
+{
+
+typedef trace_details::clock_type clock_type;
+
+const std::size_t max_detail = 48;
+
+struct trace_event
+{
+    const char * name;
+    std::uint64_t request;
+    clock_type::time_point begin;
+    clock_type::time_point end;
+    unsigned char detail_size;
+    char detail[max_detail];
+};
+
+// spans recorded by one thread, the oldest ones are overwritten
+struct trace_ring
+{
+    std::mutex mtx; // taken by the owner and by the export, practically never contended
+    std::vector<trace_event> events;
+    std::size_t next;  // position of the next span
+    std::size_t count; // number of valid spans
+    unsigned thread;   // tid in the exported trace
+};
+
+// sampling probability scaled to 2^32, zero if disabled
+std::atomic<std::uint64_t> sampling_threshold(0);
+std::atomic<std::uint64_t> next_request(1);
+std::atomic<std::size_t> buffer_size(4096);
+
+const clock_type::time_point trace_epoch = clock_type::now();
+
+// rings of all threads, kept for the export after the threads finish
+// and reused by the new threads
+std::mutex rings_mtx;
+std::vector<std::unique_ptr<trace_ring>> all_rings;
+std::vector<trace_ring *> free_rings;
+unsigned next_thread = 1;
+
+struct ring_holder
+{
+    trace_ring * ring = NULL;
+
+    ~ring_holder()
+    {
+        if (ring != NULL)
+        {
+            std::lock_guard<std::mutex> lock(rings_mtx);
+            free_rings.push_back(ring);
+        }
+    }
+};
+
+thread_local ring_holder thread_ring;
+thread_local std::uint64_t random_state = 0;
+
+trace_ring * acquire_ring()
+{
+    std::lock_guard<std::mutex> lock(rings_mtx);
+
+    if (free_rings.empty() == false)
+    {
+        trace_ring * ring = free_rings.back();
+        free_rings.pop_back();
+        return ring;
+    }
+
+    all_rings.push_back(std::make_unique<trace_ring>());
+
+    trace_ring * ring = all_rings.back().get();
+    ring->next = 0;
+    ring->count = 0;
+    ring->thread = next_thread++;
+
+    return ring;
+}
+
+std::uint64_t next_random()
+{
+    std::uint64_t x = random_state;
+
+    if (x == 0)
+    {
+        // seeded by the address of the thread-local state and the time
+        x = (std::uint64_t)(std::uintptr_t)&random_state ^
+            (std::uint64_t)clock_type::now().time_since_epoch().count();
+        x |= 1;
+    }
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    random_state = x;
+    return x;
+}
+
+double microseconds(clock_type::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+} // unnamed namespace
+
+thread_local std::uint64_t http::trace_details::current_request = 0;
+
+std::uint64_t http::trace_details::sample_request()
+{
+    std::uint64_t threshold = sampling_threshold.load(std::memory_order_relaxed);
+
+    if ((threshold == 0) || ((next_random() & 0xffffffffu) >= threshold))
+    {
+        return 0;
+    }
+
+    return next_request.fetch_add(1, std::memory_order_relaxed);
+}
+
+void http::trace_details::record(const char * name, std::uint64_t request,
+    clock_type::time_point begin, clock_type::time_point end, std::string_view detail)
+{
+    trace_ring * ring = thread_ring.ring;
+    if (ring == NULL)
+    {
+        ring = thread_ring.ring = acquire_ring();
+    }
+
+    std::lock_guard<std::mutex> lock(ring->mtx);
+
+    std::size_t size = buffer_size.load(std::memory_order_relaxed);
+    if (ring->events.size() != size)
+    {
+        ring->events.resize(size);
+        ring->next = 0;
+        ring->count = 0;
+    }
+
+    trace_event & e = ring->events[ring->next];
+    e.name = name;
+    e.request = request;
+    e.begin = begin;
+    e.end = end;
+    e.detail_size = (unsigned char)std::min(detail.size(), max_detail);
+    std::memcpy(e.detail, detail.data(), e.detail_size);
+
+    if (++ring->next == size)
+    {
+        ring->next = 0;
+    }
+
+    if (ring->count < size)
+    {
+        ++ring->count;
+    }
+}
+
+void http::trace_details::write_chrome_trace(json_writer & w)
+{
+    std::vector<trace_ring *> rings;
+    {
+        std::lock_guard<std::mutex> lock(rings_mtx);
+        for (const std::unique_ptr<trace_ring> & ring : all_rings)
+        {
+            rings.push_back(ring.get());
+        }
+    }
+
+    w.begin_object().key("traceEvents").begin_array();
+
+    for (trace_ring * ring : rings)
+    {
+        std::lock_guard<std::mutex> lock(ring->mtx);
+
+        // from the oldest span
+        std::size_t size = ring->events.size();
+        std::size_t first = (ring->next + size - ring->count) % std::max(size, (std::size_t)1);
+
+        for (std::size_t i = 0; i != ring->count; ++i)
+        {
+            const trace_event & e = ring->events[(first + i) % size];
+
+            w.begin_object()
+                .member("name", e.name)
+                .member("cat", "http")
+                .member("ph", "X")
+                .member("pid", 1)
+                .member("tid", ring->thread)
+                .member("ts", microseconds(e.begin - trace_epoch))
+                .member("dur", microseconds(e.end - e.begin))
+                .key("args").begin_object()
+                    .member("request", e.request);
+
+            if (e.detail_size != 0)
+            {
+                w.member("detail", std::string_view(e.detail, e.detail_size));
+            }
+
+            w.end_object().end_object();
+        }
+    }
+
+    w.end_array().end_object();
+}
+
+void http::trace_details::set_sampling(double probability)
+{
+    probability = std::clamp(probability, 0.0, 1.0);
+
+    sampling_threshold.store((std::uint64_t)(probability * 4294967296.0),
+        std::memory_order_relaxed);
+}
+
+void http::trace_details::set_buffer_size(std::size_t events)
+{
+    // the rings are resized by their threads when they record the next span
+    buffer_size.store(std::max(events, (std::size_t)1), std::memory_order_relaxed);
+}
+
+void http::trace_details::clear()
+{
+    std::lock_guard<std::mutex> lock(rings_mtx);
+
+    for (const std::unique_ptr<trace_ring> & ring : all_rings)
+    {
+        std::lock_guard<std::mutex> ring_lock(ring->mtx);
+        ring->next = 0;
+        ring->count = 0;
+    }
+}
@@ -0,0 +1,127 @@
+//
+// This file declares the admission control of the HTTP server.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_ADMISSION_H_INCLUDED
+#define HTTP_ADMISSION_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace http
+{
+
+/// \brief Overload detector based on queueing delay (CoDel).
+///
+/// Overload detector following the Controlled Delay idea:
+/// occasional long delays are tolerated as bursts, but when even
+/// the smallest delay observed during the whole interval exceeds
+/// the target, the queue is standing and the system is overloaded.
+/// The detector stays in this state for at least the next interval.
+/// All operations are lock-free and can be used from any thread.
+class codel_controller
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+    /// Create the controller.
+    /// @param target acceptable queueing delay, zero disables the detection.
+    /// @param interval window in which the minimum delay is tracked.
+    explicit codel_controller(
+        std::chrono::microseconds target = std::chrono::microseconds(0),
+        std::chrono::microseconds interval = std::chrono::milliseconds(100));
+
+    /// Change the parameters, see constructor.
+    void set_parameters(std::chrono::microseconds target, std::chrono::microseconds interval);
+
+    /// Check whether the detection is enabled (the target is not zero).
+    bool enabled() const;
+
+    /// Record the queueing delay of the work that was just dispatched.
+    void record(clock_type::duration delay, clock_type::time_point now);
+
+    /// Check whether the system is overloaded and new work should be shed.
+    bool overloaded(clock_type::time_point now);
+
+private:
+    // not for use
+    codel_controller(const codel_controller &);
+    void operator=(const codel_controller &);
+
+    std::int64_t ticks(clock_type::time_point t) const;
+
+    // all times in microseconds since the creation of the controller
+    clock_type::time_point origin_;
+    std::atomic<std::int64_t> target_;
+    std::atomic<std::int64_t> interval_;
+    std::atomic<std::int64_t> interval_end_;
+    std::atomic<std::int64_t> min_delay_;
+    std::atomic<bool> overloaded_;
+};
+
+/// \brief Token-bucket rate limiter.
+///
+/// Table of token buckets, one for each key (like the client address),
+/// divided into independently locked shards. Each request takes one token,
+/// tokens are refilled continuously with the given rate up to the burst size.
+/// Buckets that were refilled completely are indistinguishable from
+/// the new ones, so they are periodically removed from the table.
+class rate_limiter
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+    /// Create the limiter.
+    /// @param shards number of independently locked shards.
+    explicit rate_limiter(std::size_t shards = 64);
+
+    /// Take the token from the bucket of the given key.
+    /// @param key identity of the limited entity.
+    /// @param rate number of tokens refilled per second.
+    /// @param burst capacity of the bucket.
+    /// @param now current time.
+    /// @return true if the request is allowed.
+    bool acquire(const std::string & key, double rate, double burst,
+        clock_type::time_point now);
+
+    /// Get the number of buckets currently kept in the table.
+    std::size_t size() const;
+
+private:
+    // not for use
+    rate_limiter(const rate_limiter &);
+    void operator=(const rate_limiter &);
+
+    struct bucket
+    {
+        double tokens;
+        clock_type::time_point updated;
+        double rate;
+        double burst;
+    };
+
+    struct shard
+    {
+        std::mutex mtx;
+        std::unordered_map<std::string, bucket> buckets;
+        clock_type::time_point last_sweep;
+    };
+
+    void sweep(shard & s, clock_type::time_point now);
+
+    std::vector<std::unique_ptr<shard> > shards_;
+};
+
+} // namespace http
+
+#endif // HTTP_ADMISSION_H_INCLUDED
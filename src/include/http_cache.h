@@ -0,0 +1,329 @@
+//
+// This file declares the cache of complete responses of dynamic actions
+// and the caches of static files.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_CACHE_H_INCLUDED
+#define HTTP_CACHE_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace http
+{
+
+/// \brief Cache of serialized responses.
+///
+/// Cache of serialized responses (headers and body), with expiration time
+/// for each entry and the total size limited by the byte budget.
+/// The cache is divided into independently locked shards,
+/// each of them evicting its least recently used entries when over budget.
+class response_cache
+{
+public:
+    /// Type of the cached response, shared with the threads that send it.
+    typedef std::shared_ptr<const std::string> response_type;
+
+    typedef std::chrono::steady_clock clock_type;
+
+    /// Create the cache.
+    /// @param budget maximum number of bytes kept in the cache.
+    /// @param shards number of independently locked shards.
+    explicit response_cache(std::size_t budget = 64 * 1024 * 1024,
+        std::size_t shards = 16);
+
+    /// Find the response that has not yet expired.
+    /// @param key cache key, see cache_key.
+    /// @return cached response or null pointer.
+    response_type find(const std::string & key);
+
+    /// Store the response, replacing the previous one (if any).
+    /// @param key cache key, see cache_key.
+    /// @param response serialized response.
+    /// @param expires time after which the response is no longer valid.
+    void insert(const std::string & key, response_type response,
+        clock_type::time_point expires);
+
+    /// Remove the response stored with the given key.
+    void erase(const std::string & key);
+
+    /// Remove all responses with keys starting with the given prefix.
+    void erase_prefix(const std::string & prefix);
+
+    /// Remove all responses.
+    void clear();
+
+    /// Change the byte budget, evicting the entries that no longer fit.
+    void set_budget(std::size_t budget);
+
+    /// Get the number of bytes currently kept in the cache.
+    std::size_t size() const;
+
+private:
+    // not for use
+    response_cache(const response_cache &);
+    void operator=(const response_cache &);
+
+    struct entry
+    {
+        std::string key;
+        response_type response;
+        clock_type::time_point expires;
+        std::size_t bytes;
+    };
+
+    typedef std::list<entry> lru_list;
+
+    struct shard
+    {
+        std::mutex mtx;
+        lru_list lru; // most recently used first
+        std::unordered_map<std::string, lru_list::iterator> index;
+        std::size_t bytes;
+    };
+
+    shard & shard_for(const std::string & key);
+    void evict(shard & s, std::size_t budget);
+    void remove(shard & s, lru_list::iterator it);
+
+    std::vector<std::unique_ptr<shard> > shards_;
+    std::atomic<std::size_t> shard_budget_;
+};
+
+/// \brief Cache of paths known to be missing.
+///
+/// Bounded cache of paths for which no static file was found, so that
+/// repeated requests for them (typically from bots probing for well-known
+/// paths) are answered without touching the file system.
+/// The entry is trusted only until its expiration time, which bounds
+/// the staleness where file changes are not observed; where they are,
+/// the path is erased as soon as the file appears (and the whole cache
+/// is cleared when a directory appears). Different spellings of the path
+/// ("/a//b", "/./a/b") are kept as one entry, so that the erased path
+/// is not left behind under another spelling. When full, the oldest
+/// entries are evicted first.
+class negative_cache
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+    /// Create the cache.
+    /// @param capacity maximum number of paths kept in the cache, zero disables it.
+    /// @param shards number of independently locked shards.
+    explicit negative_cache(std::size_t capacity = 16384, std::size_t shards = 16);
+
+    /// Check whether the path is known to be missing.
+    /// @param path the path, as requested.
+    /// @return true if the path was inserted and has not yet expired.
+    bool contains(const std::string & path);
+
+    /// Remember the missing path.
+    /// @param path the path, as requested.
+    /// @param expires time after which the path has to be checked again.
+    void insert(const std::string & path, clock_type::time_point expires);
+
+    /// Forget the path, for example when the file was created.
+    void erase(const std::string & path);
+
+    /// Remove all paths.
+    void clear();
+
+    /// Change the capacity, evicting the entries that no longer fit.
+    void set_capacity(std::size_t capacity);
+
+    /// Get the number of paths currently kept in the cache.
+    std::size_t size() const;
+
+private:
+    // not for use
+    negative_cache(const negative_cache &);
+    void operator=(const negative_cache &);
+
+    struct entry
+    {
+        std::string path;
+        clock_type::time_point expires;
+    };
+
+    typedef std::list<entry> fifo_list;
+
+    struct shard
+    {
+        std::mutex mtx;
+        fifo_list fifo; // the newest first
+        std::unordered_map<std::string, fifo_list::iterator> index;
+    };
+
+    shard & shard_for(const std::string & path);
+    void evict(shard & s, std::size_t capacity);
+
+    std::vector<std::unique_ptr<shard> > shards_;
+    std::atomic<std::size_t> shard_capacity_;
+};
+
+#ifndef WIN32
+
+/// \brief Cache of open static files.
+///
+/// Cache of open file descriptors of static files, together with their
+/// metadata and precomputed response headers, shared by concurrent requests.
+/// The cache owns one reference to each file and every request using it
+/// another, so the descriptor is closed only when the last of them is gone:
+/// an evicted or invalidated file stays open for the responses still
+/// sending it, and its descriptor is never reused under them.
+/// The capacity therefore bounds the descriptors kept by the cache, not those
+/// in use. The cached files are checked with stat() when they were not
+/// validated for the given interval, so that changed or replaced files
+/// are reopened, and can be also invalidated explicitly when a change is
+/// known; the file is found under the same key whatever spelling of its
+/// name ("/a//b", "/./a/b") was used.
+class open_file_cache
+{
+public:
+    /// Open static file.
+    struct file
+    {
+        file() : fd(-1), size(0), mtime(0), device(0), inode(0) {}
+        ~file();
+
+        int fd;
+        std::uint64_t size;
+        std::int64_t mtime;
+        std::uint64_t device;
+        std::uint64_t inode;
+        std::string headers; ///< response headers, completed by the caller
+    };
+
+    typedef std::shared_ptr<const file> file_type;
+
+    /// Function producing the headers of the file response.
+    typedef std::function<std::string(const std::string & name, const file & f)>
+        header_builder;
+
+    typedef std::chrono::steady_clock clock_type;
+
+    /// Create the cache.
+    /// @param capacity maximum number of open files, zero disables the cache.
+    /// @param revalidate interval after which the file is checked again.
+    /// @param shards number of independently locked shards.
+    explicit open_file_cache(std::size_t capacity = 256,
+        std::chrono::milliseconds revalidate = std::chrono::seconds(1),
+        std::size_t shards = 16);
+
+    /// Get the open regular file, opening it if needed.
+    /// @param root directory of the files.
+    /// @param name name of the file (starting with slash), used as the key.
+    /// @param headers produces the headers when the file is opened.
+    /// @return the open file or null pointer if the file cannot be opened.
+    file_type open(const std::string & root, const std::string & name,
+        const header_builder & headers);
+
+    /// Forget the file with the given name.
+    void erase(const std::string & name);
+
+    /// Forget all files.
+    void clear();
+
+    /// Change the capacity and the revalidation interval,
+    /// evicting the files that no longer fit.
+    void set_limits(std::size_t capacity, std::chrono::milliseconds revalidate);
+
+    /// Get the number of files currently kept in the cache.
+    std::size_t size() const;
+
+private:
+    // not for use
+    open_file_cache(const open_file_cache &);
+    void operator=(const open_file_cache &);
+
+    struct entry
+    {
+        std::string name;
+        file_type file;
+        clock_type::time_point validated;
+    };
+
+    typedef std::list<entry> lru_list;
+
+    struct shard
+    {
+        std::mutex mtx;
+        lru_list lru; // most recently used first
+        std::unordered_map<std::string, lru_list::iterator> index;
+    };
+
+    shard & shard_for(const std::string & name);
+    void evict(shard & s, std::size_t capacity);
+    void remove(shard & s, lru_list::iterator it);
+
+    std::vector<std::unique_ptr<shard> > shards_;
+    std::atomic<std::size_t> shard_capacity_;
+    std::atomic<std::int64_t> revalidate_ms_;
+};
+
+#endif // WIN32
+
+/// \brief Coalescing of concurrent identical requests.
+///
+/// Coalescing of concurrent identical requests (single-flight).
+/// The first caller with the given key produces the response,
+/// the callers that arrive with the same key while it is in progress
+/// wait and receive the same response object (or the same exception).
+class single_flight
+{
+public:
+    typedef response_cache::response_type response_type;
+    typedef std::function<response_type()> producer_type;
+
+    single_flight() {}
+
+    /// Produce the response or wait for the one produced by the concurrent call.
+    /// @param key identity of the request, see cache_key.
+    /// @param produce function generating the response.
+    /// @return shared response.
+    response_type run(const std::string & key, const producer_type & produce);
+
+private:
+    // not for use
+    single_flight(const single_flight &);
+    void operator=(const single_flight &);
+
+    struct call
+    {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false;
+        response_type result;
+        std::exception_ptr error;
+    };
+
+    std::mutex mtx_;
+    std::unordered_map<std::string, std::shared_ptr<call> > calls_;
+};
+
+/// Compose the cache key from the resource path and its URL parameters.
+///
+/// The parameters are normalized (sorted by name), so that
+/// "?a=1&b=2" and "?b=2&a=1" share the same cache entry.
+/// @param path name of the requested resource.
+/// @param params the URL parameters.
+/// @return cache key.
+std::string cache_key(const std::string & path, const std::string & params);
+
+} // namespace http
+
+#endif // HTTP_CACHE_H_INCLUDED
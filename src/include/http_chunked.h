@@ -0,0 +1,163 @@
+//
+// This file declares stream wrappers implementing the chunked
+// transfer coding of HTTP/1.1, for both responses and request bodies.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_CHUNKED_H_INCLUDED
+#define HTTP_CHUNKED_H_INCLUDED
+
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+namespace http
+{
+
+/// \brief Stream buffer encoding its content as HTTP chunks.
+///
+/// Stream buffer encoding its content as HTTP chunks.
+/// Every flush of the buffer (or filling it up) produces one chunk
+/// in the underlying stream, which is flushed as well.
+class chunked_output_buffer : public std::streambuf
+{
+public:
+    /// Create the buffer on top of the given (connection) stream.
+    /// @param out underlying stream receiving the encoded chunks.
+    /// @param buffer_size maximum size of a single chunk.
+    explicit chunked_output_buffer(std::ostream & out, std::size_t buffer_size = 8192);
+
+    /// Finish the body, if it was not finished explicitly,
+    /// or abandon it (see fail) if destroyed by the exception.
+    ~chunked_output_buffer();
+
+    /// Write out the pending data and the terminating zero-size chunk.
+    ///
+    /// Nothing can be written to the buffer after it was finished.
+    void finish();
+
+    /// Abandon the body that cannot be completed (for example because
+    /// its producer failed).
+    ///
+    /// The pending data is written out, but not the terminating chunk,
+    /// so that the client does not take the truncated body as complete,
+    /// and the underlying stream is marked as bad, so that the connection
+    /// is closed instead of being used for the next request.
+    /// Nothing can be written to the buffer afterwards.
+    void fail();
+
+protected:
+    int_type overflow(int_type c);
+    int sync();
+
+private:
+    // not for use
+    chunked_output_buffer(const chunked_output_buffer &);
+    void operator=(const chunked_output_buffer &);
+
+    void write_chunk();
+
+    std::ostream & out_;
+    std::vector<char> buf_;
+    bool finished_;
+    int uncaught_; // exceptions in flight when the buffer was created
+};
+
+/// \brief Output stream encoding its content as HTTP chunks.
+///
+/// Output stream encoding its content as HTTP chunks, see chunked_output_buffer.
+class chunked_ostream :
+    private chunked_output_buffer,
+    public std::ostream
+{
+public:
+    /// Create the stream on top of the given (connection) stream.
+    /// @param out underlying stream receiving the encoded chunks.
+    /// @param buffer_size maximum size of a single chunk.
+    explicit chunked_ostream(std::ostream & out, std::size_t buffer_size = 8192)
+        : chunked_output_buffer(out, buffer_size),
+          std::ostream(this)
+    {
+    }
+
+    using chunked_output_buffer::finish;
+    using chunked_output_buffer::fail;
+
+private:
+    // not for use
+    chunked_ostream(const chunked_ostream &);
+    void operator=(const chunked_ostream &);
+};
+
+/// \brief Stream buffer decoding HTTP chunks.
+///
+/// Stream buffer decoding the chunked request body on the fly.
+/// The end of the stream is reported after the terminating zero-size chunk
+/// and the trailer section were consumed from the underlying stream,
+/// which is then positioned at the beginning of the next request.
+class chunked_input_buffer : public std::streambuf
+{
+public:
+    /// Create the buffer on top of the given (connection) stream.
+    /// @param in underlying stream with the encoded chunks.
+    /// @param buffer_size size of the decoding buffer.
+    explicit chunked_input_buffer(std::istream & in, std::size_t buffer_size = 8192);
+
+    /// Consume the remaining part of the body from the underlying stream.
+    ///
+    /// @return true if the body was complete and well-formed.
+    bool drain();
+
+    /// Check whether the body was malformed or truncated.
+    bool failed() const { return failed_; }
+
+protected:
+    int_type underflow();
+
+private:
+    // not for use
+    chunked_input_buffer(const chunked_input_buffer &);
+    void operator=(const chunked_input_buffer &);
+
+    bool read_chunk_size();
+
+    std::istream & in_;
+    std::vector<char> buf_;
+    std::size_t chunk_remaining_;
+    bool finished_;
+    bool failed_;
+};
+
+/// \brief Input stream decoding HTTP chunks.
+///
+/// Input stream decoding HTTP chunks, see chunked_input_buffer.
+class chunked_istream :
+    private chunked_input_buffer,
+    public std::istream
+{
+public:
+    /// Create the stream on top of the given (connection) stream.
+    /// @param in underlying stream with the encoded chunks.
+    /// @param buffer_size size of the decoding buffer.
+    explicit chunked_istream(std::istream & in, std::size_t buffer_size = 8192)
+        : chunked_input_buffer(in, buffer_size),
+          std::istream(this)
+    {
+    }
+
+    using chunked_input_buffer::drain;
+    using chunked_input_buffer::failed;
+
+private:
+    // not for use
+    chunked_istream(const chunked_istream &);
+    void operator=(const chunked_istream &);
+};
+
+} // namespace http
+
+#endif // HTTP_CHUNKED_H_INCLUDED
@@ -0,0 +1,77 @@
+//
+// This file declares the cleartext HTTP/2 (h2c) support of the HTTP server.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_H2_H_INCLUDED
+#define HTTP_H2_H_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace http
+{
+
+namespace h2_details
+{
+
+// the request line of the connection preface sent with prior knowledge
+const std::string_view preface_request_line = "PRI * HTTP/2.0";
+
+// request carried by the single stream
+struct stream_request
+{
+    std::string method;
+    std::string resource;
+    std::string headers;         // regular fields, each as "name: value" terminated with CRLF
+    std::string content_type;
+    std::size_t content_length;  // unknown_content_length if not announced
+    bool has_body;
+};
+
+// serves the request of the stream, writing the response to out
+// in the HTTP/1.1 format (status line, headers, body), as all actions do;
+// runs in its own thread, concurrently with other streams of the connection
+typedef std::function<void(const stream_request & request, std::istream & body,
+    std::ostream & out)> stream_handler;
+
+// called before waiting for the next frame with the number of streams in progress,
+// returning false starts the graceful shutdown of the connection
+typedef std::function<bool(std::size_t open_streams)> wait_handler;
+
+// writes to the connection, blocking until everything is written
+typedef std::function<void(const char * data, std::size_t size)> write_function;
+
+struct connection_options
+{
+    // the request line of the preface was already consumed
+    bool request_line_received = false;
+
+    // the request upgraded from HTTP/1.1 becomes the stream 1
+    const stream_request * upgrade = nullptr;
+
+    // value of the HTTP2-Settings header of the upgraded request
+    std::string_view upgrade_settings;
+
+    // unblocks the reading of the connection (to finish the graceful shutdown)
+    std::function<void()> shutdown;
+};
+
+// serves the HTTP/2 connection until it is closed; frames are read from in
+// and written with write, never through the put area of the connection stream
+void serve(std::istream & in, const write_function & write,
+    const stream_handler & handler, const wait_handler & waiting,
+    const connection_options & options);
+
+} // namespace h2_details
+
+} // namespace http
+
+#endif // HTTP_H2_H_INCLUDED
@@ -0,0 +1,87 @@
+//
+// This file declares the HPACK header compression used by HTTP/2.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_HPACK_H_INCLUDED
+#define HTTP_HPACK_H_INCLUDED
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace http
+{
+
+/// Header field, the name and the value.
+typedef std::pair<std::string, std::string> header_field;
+
+/// \brief Decoder of HPACK header blocks.
+///
+/// Decoder of HPACK (RFC 7541) header blocks, with the dynamic table
+/// shared by all header blocks of the connection. The blocks must be decoded
+/// in the order in which they were received. Entries of the static table
+/// are used directly, without any lookup.
+class hpack_decoder
+{
+public:
+    /// Create the decoder.
+    /// @param max_table_size maximum size of the dynamic table,
+    /// as announced to the peer in the settings.
+    /// @param max_list_size maximum size of the decoded header list.
+    explicit hpack_decoder(std::size_t max_table_size = 4096,
+        std::size_t max_list_size = 64 * 1024);
+
+    /// Decode the complete header block.
+    ///
+    /// Decode the complete header block, appending the fields to the given list.
+    /// Throws std::runtime_error if the block is malformed, in which case
+    /// the state of the decoder is undefined and the connection must be closed.
+    /// @param data the header block.
+    /// @param size size of the header block.
+    /// @param headers receives the decoded fields.
+    void decode(const unsigned char * data, std::size_t size,
+        std::vector<header_field> & headers);
+
+private:
+    // not for use
+    hpack_decoder(const hpack_decoder &);
+    void operator=(const hpack_decoder &);
+
+    const header_field & entry(std::size_t index) const;
+    void insert(const header_field & field);
+    void evict(std::size_t limit);
+
+    std::deque<header_field> table_; // the newest entry first
+    std::size_t table_size_;
+    std::size_t table_limit_;        // current maximum, changed by the peer
+    std::size_t max_table_size_;     // upper bound of the current maximum
+    std::size_t max_list_size_;
+};
+
+/// \brief Encoder of HPACK header blocks.
+///
+/// Encoder of HPACK header blocks that does not use the dynamic table,
+/// so that the blocks can be encoded in any order (for example by many
+/// threads sending responses concurrently). Fields found in the static table
+/// are encoded as a single byte, known names are referenced by their index,
+/// and string literals are Huffman-coded when that makes them shorter.
+class hpack_encoder
+{
+public:
+    /// Append the encoded field to the header block.
+    /// @param name name of the field, lowercase.
+    /// @param value value of the field.
+    /// @param block the header block being built.
+    static void encode(std::string_view name, std::string_view value, std::string & block);
+};
+
+} // namespace http
+
+#endif // HTTP_HPACK_H_INCLUDED
@@ -0,0 +1,222 @@
+//
+// This file declares the JSON writer and the in-situ JSON reader.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_JSON_H_INCLUDED
+#define HTTP_JSON_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http
+{
+
+/// \brief Streaming JSON writer.
+///
+/// Writer appending JSON text to the string (typically the response body),
+/// with numbers formatted by std::to_chars (independently of the locale)
+/// and strings escaped in blocks of 16 bytes where SSE2 is available.
+/// Commas are inserted automatically, the structure is not validated.
+///
+///     w.begin_object()
+///         .member("id", 42)
+///         .key("tags").begin_array().value("a").value("b").end_array()
+///      .end_object();
+class json_writer
+{
+public:
+    /// Create the writer.
+    /// @param out string to which the JSON text is appended.
+    explicit json_writer(std::string & out) : out_(out), comma_(false) {}
+
+    json_writer & begin_object();
+    json_writer & end_object();
+    json_writer & begin_array();
+    json_writer & end_array();
+
+    /// Write the member name, followed by its value or container.
+    json_writer & key(std::string_view name);
+
+    json_writer & value(std::string_view s);
+    json_writer & value(const char * s);
+    json_writer & value(const std::string & s);
+    json_writer & value(bool b);
+    json_writer & value(int n);
+    json_writer & value(long n);
+    json_writer & value(long long n);
+    json_writer & value(unsigned int n);
+    json_writer & value(unsigned long n);
+    json_writer & value(unsigned long long n);
+    /// Non-finite numbers are written as null.
+    json_writer & value(double d);
+    json_writer & null();
+
+    /// Write the text that is already valid JSON.
+    json_writer & raw(std::string_view json);
+
+    /// Write the member name and its value.
+    template <typename T>
+    json_writer & member(std::string_view name, const T & v)
+    {
+        key(name);
+        return value(v);
+    }
+
+    /// The text written so far (with anything that was in the string before).
+    const std::string & str() const { return out_; }
+
+private:
+    // not for use
+    json_writer(const json_writer &);
+    void operator=(const json_writer &);
+
+    void separate();
+
+    template <typename T>
+    json_writer & number(T n);
+
+    std::string & out_;
+    bool comma_; // the next value is preceded by comma
+};
+
+/// Append the string as JSON string literal (with quotes).
+void json_escape(std::string_view s, std::string & out);
+
+/// \brief Error in the JSON text.
+class json_error : public std::runtime_error
+{
+public:
+    json_error(const std::string & message, std::size_t offset)
+        : std::runtime_error(message + " at offset " + std::to_string(offset)), offset_(offset)
+    {
+    }
+
+    /// Offset of the error in the parsed text.
+    std::size_t offset() const { return offset_; }
+
+private:
+    std::size_t offset_;
+};
+
+class json_document;
+
+/// \brief Value in the parsed JSON document.
+///
+/// Lightweight reference to the value in json_document, valid as long
+/// as the document and its text. Strings refer to the parsed text,
+/// numbers are converted on access. Missing members and elements
+/// are null values, so that lookups can be chained.
+class json_value
+{
+public:
+    enum value_type { null_type, bool_type, number_type, string_type, array_type, object_type };
+
+    /// Null value.
+    json_value() : doc_(NULL), index_(0) {}
+
+    value_type type() const;
+
+    bool is_null() const { return type() == null_type; }
+    bool is_bool() const { return type() == bool_type; }
+    bool is_number() const { return type() == number_type; }
+    bool is_string() const { return type() == string_type; }
+    bool is_array() const { return type() == array_type; }
+    bool is_object() const { return type() == object_type; }
+
+    /// Get the value, throws json_error if the value has other type
+    /// (or, for as_integer, is not an integer in the range of long long).
+    bool as_bool() const;
+    long long as_integer() const;
+    double as_double() const;
+    std::string_view as_string() const;
+
+    /// Get the value, or the default if the value has other type.
+    bool as_bool(bool def) const;
+    long long as_integer(long long def) const;
+    double as_double(double def) const;
+    std::string_view as_string(std::string_view def) const;
+
+    /// Number of elements of the array or members of the object, zero otherwise.
+    std::size_t size() const;
+
+    /// Element of the array, or value of the member of the object, by position.
+    json_value operator[](std::size_t i) const;
+    json_value operator[](int i) const { return operator[]((std::size_t)i); }
+
+    /// Name of the member of the object, by position.
+    std::string_view name(std::size_t i) const;
+
+    /// Value of the member of the object, by name (the first one if repeated).
+    json_value operator[](std::string_view member) const;
+    json_value operator[](const char * member) const { return operator[](std::string_view(member)); }
+
+    /// Check whether the object has the member.
+    bool contains(std::string_view member) const;
+
+private:
+    friend class json_document;
+
+    json_value(const json_document * doc, std::size_t index) : doc_(doc), index_(index) {}
+
+    // index of the i-th child node (member names count for objects)
+    std::size_t child(std::size_t i) const;
+
+    json_error type_error(const char * message) const;
+
+    const json_document * doc_;
+    std::size_t index_;
+};
+
+/// \brief Parsed JSON document.
+///
+/// Document parsed in situ: escaped strings are decoded within the parsed
+/// text, which therefore has to be writable and outlive the document,
+/// and the values are kept as the flat array of nodes referring to the text.
+/// The document can be reused for many texts, keeping its capacity.
+class json_document
+{
+public:
+    json_document() : text_(NULL) {}
+
+    /// Parse the text, replacing the previous document.
+    /// Throws json_error if the text is not valid JSON.
+    /// @param text JSON text, modified by parsing.
+    /// @param size number of bytes of the text.
+    /// @param max_depth maximum nesting of arrays and objects.
+    void parse(char * text, std::size_t size, std::size_t max_depth = 256);
+
+    /// The top-level value.
+    json_value root() const { return nodes_.empty() ? json_value() : json_value(this, 0); }
+
+private:
+    // not for use
+    json_document(const json_document &);
+    void operator=(const json_document &);
+
+    friend class json_value;
+
+    struct node
+    {
+        json_value::value_type type;
+        const char * text;  // string contents or number literal
+        std::size_t size;   // length of the text, or number of children
+        std::size_t end;    // index of the first node after the subtree
+    };
+
+    struct parser;
+
+    const char * text_;
+    std::vector<node> nodes_;
+};
+
+} // namespace http
+
+#endif // HTTP_JSON_H_INCLUDED
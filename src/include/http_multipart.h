@@ -0,0 +1,137 @@
+//
+// This file declares the streaming parser for multipart/form-data
+// request bodies.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_MULTIPART_H_INCLUDED
+#define HTTP_MULTIPART_H_INCLUDED
+
+#include <http_server.h>
+
+#include <istream>
+#include <string>
+#include <functional>
+#include <vector>
+
+namespace http
+{
+
+/// Description of a single part of the multipart/form-data body.
+struct multipart_part
+{
+    std::string name;         ///< Field name from Content-Disposition.
+    std::string file_name;    ///< File name from Content-Disposition (empty for plain fields).
+    std::string content_type; ///< Content-Type of the part (empty if not given).
+    params_map_type headers;  ///< All part headers, with lower-case names.
+};
+
+/// Type defining possible multipart parser events, used to notify the part callback.
+enum multipart_event
+{
+    part_begin, ///< Headers of the new part were parsed, no data yet.
+    part_data,  ///< Next chunk of the part content is available.
+    part_end    ///< The part is complete.
+};
+
+/// Type of function callback for multipart parser notifications.
+/// @param part description of the current part.
+/// @param event the name of current event.
+/// @param data pointer to the part content (only for part_data).
+/// @param size number of bytes available at data (only for part_data).
+typedef std::function<void(const multipart_part &, multipart_event,
+    const char *, std::size_t)>
+    multipart_callback_type;
+
+/// \brief Streaming multipart/form-data parser.
+///
+/// Streaming multipart/form-data parser.
+/// The parser consumes the body in arbitrary pieces and delivers the content
+/// of each part to the callback in chunks, so that the memory used
+/// does not depend on the size of the body or of the individual parts.
+/// Boundaries are located with Boyer-Moore-Horspool search.
+class multipart_parser
+{
+public:
+    /// Create the parser.
+    ///
+    /// @param boundary boundary string, as declared in the Content-Type header.
+    /// @param callback function callback that will receive the parts.
+    /// @param buffer_size size of the internal buffer, it also limits
+    /// the size of headers of any single part.
+    multipart_parser(const std::string & boundary,
+        multipart_callback_type callback, std::size_t buffer_size = 8192);
+
+    /// Consume the next piece of the body.
+    ///
+    /// @param data pointer to the body bytes.
+    /// @param size number of bytes available at data.
+    void feed(const char * data, std::size_t size);
+
+    /// Signal the end of the body.
+    ///
+    /// Throws std::runtime_error if the body was not properly terminated.
+    void finish();
+
+    /// Check whether the closing boundary was already seen.
+    bool done() const { return state_ == epilogue; }
+
+private:
+    enum parser_state { preamble, delimiter_end, part_headers, part_body, epilogue };
+
+    void process();
+    std::size_t find_delimiter(std::size_t from) const;
+    void parse_headers(const char * begin, const char * end);
+
+    std::string delimiter_;
+    std::size_t skip_[256];
+    multipart_callback_type callback_;
+    std::vector<char> buf_;
+    std::size_t begin_;
+    std::size_t end_;
+    parser_state state_;
+    multipart_part part_;
+};
+
+/// Extract the boundary parameter from the multipart Content-Type value.
+///
+/// @param content_type value of the Content-Type header.
+/// @return boundary string or empty string if there is none.
+std::string multipart_boundary(const std::string & content_type);
+
+/// Parse multipart/form-data body from the input stream.
+///
+/// Parse multipart/form-data body, typically in the POST handler.
+/// Exactly content_length bytes are consumed from the in stream
+/// (or everything up to its end, if content_length is unknown_content_length).
+///
+/// @param in stream object handling the input part of the requesting connection
+/// @param content_length number of bytes to be consumed from the in stream
+/// @param content_type MIME type declared for the POST request by the client
+/// @param callback function callback that will receive the parts.
+/// @param buffer_size size of the parser buffer.
+void parse_multipart(std::istream & in, std::size_t content_length,
+    const std::string & content_type, multipart_callback_type callback,
+    std::size_t buffer_size = 8192);
+
+/// Type of function selecting the file descriptor for the given part.
+/// @param part description of the part that starts.
+/// @return file descriptor for the part content or -1 to ignore the part.
+typedef std::function<int(const multipart_part &)> multipart_fd_selector_type;
+
+/// Create multipart callback that writes parts to file descriptors.
+///
+/// Create multipart callback that writes the content of each part
+/// directly to the file descriptor chosen by the selector.
+/// The descriptors are not closed by the callback.
+///
+/// @param selector function choosing the descriptor for each part.
+/// @return callback to be used with parse_multipart or multipart_parser.
+multipart_callback_type multipart_fd_writer(multipart_fd_selector_type selector);
+
+} // namespace http
+
+#endif // HTTP_MULTIPART_H_INCLUDED
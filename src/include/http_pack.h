@@ -0,0 +1,136 @@
+//
+// This file declares the pack of static files served from the single mapped file.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_PACK_H_INCLUDED
+#define HTTP_PACK_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http
+{
+
+/// \brief Writer of static asset packs.
+///
+/// Collects static files and writes them as the single pack file:
+/// the index of the files sorted by their paths, the paths
+/// and the precomputed response headers (with ETag), and the contents,
+/// each aligned to the cache line (or to the page when it is at least
+/// that large), optionally followed by the gzip-compressed variant.
+/// The pack is written to the temporary file that is then renamed
+/// over the target, so that the server never maps the incomplete pack.
+class asset_pack_writer
+{
+public:
+    asset_pack_writer() {}
+
+    /// Add the file.
+    /// @param path request path of the file (starting with slash).
+    /// @param content content of the file.
+    /// @param compressed gzip-compressed content, empty if there is no such variant.
+    void add(const std::string & path, std::string content,
+        std::string compressed = std::string());
+
+    /// Write the pack, replacing the existing file.
+    /// @param pack_path name of the pack file.
+    void write(const std::string & pack_path);
+
+    /// Number of files added so far.
+    std::size_t size() const { return assets_.size(); }
+
+private:
+    // not for use
+    asset_pack_writer(const asset_pack_writer &);
+    void operator=(const asset_pack_writer &);
+
+    struct asset
+    {
+        std::string path;
+        std::string content;
+        std::string compressed;
+    };
+
+    std::vector<asset> assets_;
+};
+
+#ifndef WIN32
+
+/// \brief Memory-mapped static asset pack.
+///
+/// Pack written by asset_pack_writer, mapped into memory as a whole,
+/// so that the files are found by the binary search in the mapped index
+/// and sent straight from the mapping (or from the pack file with sendfile).
+/// The pages of the pack are shared by all processes that map it.
+class asset_pack
+{
+public:
+    /// Variant of the packed file.
+    struct variant
+    {
+        std::string_view headers; ///< header lines except for the status line and the date
+        std::string_view etag;    ///< quoted entity tag
+        const char * data;        ///< content, inside the mapping
+        std::uint64_t offset;     ///< offset of the content in the pack file
+        std::uint64_t size;
+    };
+
+    /// Packed file.
+    struct asset
+    {
+        variant identity;
+        variant compressed; ///< gzip variant, valid if has_compressed is true
+        bool has_compressed;
+    };
+
+    /// Map the pack.
+    /// Throws std::runtime_error if the pack cannot be opened or is not valid.
+    /// @param path name of the pack file.
+    explicit asset_pack(const std::string & path);
+
+    /// Unmap the pack.
+    ~asset_pack();
+
+    /// Find the file.
+    /// @param path request path of the file (starting with slash).
+    /// @param result the file, if found.
+    /// @return whether the file is in the pack.
+    bool find(std::string_view path, asset & result) const;
+
+    /// Check whether the file with the given name is still this pack.
+    bool same_file(const std::string & path) const;
+
+    /// Descriptor of the pack file.
+    int fd() const { return fd_; }
+
+    /// Number of files in the pack.
+    std::size_t size() const { return count_; }
+
+private:
+    // not for use
+    asset_pack(const asset_pack &);
+    void operator=(const asset_pack &);
+
+    void validate(const std::string & path) const;
+
+    int fd_;
+    const char * data_;
+    std::size_t length_;
+    std::size_t count_;
+    std::uint64_t device_;
+    std::uint64_t inode_;
+    std::int64_t mtime_;
+};
+
+#endif // WIN32
+
+} // namespace http
+
+#endif // HTTP_PACK_H_INCLUDED
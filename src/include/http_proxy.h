@@ -0,0 +1,88 @@
+//
+// This file declares the reverse proxy mode of the HTTP server.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_PROXY_H_INCLUDED
+#define HTTP_PROXY_H_INCLUDED
+
+#include <chrono>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class base_socket_wrapper;
+
+namespace http
+{
+
+/// Register reverse proxy route.
+///
+/// Register reverse proxy route. Requests for resources starting
+/// with the given prefix are forwarded to one of the upstream servers
+/// (the one with the least number of outstanding requests)
+/// and its response is relayed back to the client.
+/// Request and response bodies are streamed, without buffering them
+/// as a whole. Upstream connections are kept alive and reused.
+/// The longest matching prefix wins, proxy routes take precedence
+/// over registered actions and static files.
+/// Host names of the upstream servers are resolved once, when the route
+/// is registered (std::runtime_error is thrown if they cannot be resolved).
+///
+/// @param prefix beginning of the path handled by the route, for example "/api/".
+/// @param upstreams upstream servers, each given as "host:port"
+/// or as "unix:/path/to/socket".
+void register_proxy_route(const char * prefix, const std::vector<std::string> & upstreams);
+
+/// Set the maximum number of idle connections kept for each upstream server.
+///
+/// @param n maximum number of idle connections (32 by default).
+void set_proxy_idle_connections(std::size_t n);
+
+/// Set the timeout of the upstream connections.
+///
+/// Set the longest time for which the upstream server may keep
+/// the proxy waiting for the next part of the response (or for accepting
+/// the next part of the request); the request fails with 502 Bad Gateway
+/// if the response has not started yet, and the client connection is closed
+/// otherwise.
+///
+/// @param timeout the timeout (30 seconds by default), zero means no limit.
+void set_proxy_timeout(std::chrono::milliseconds timeout);
+
+namespace proxy_details
+{
+
+class proxy_route;
+
+// finds the route for the given path, or returns null pointer
+std::shared_ptr<proxy_route> find_route(std::string_view path);
+
+// description of the request to be forwarded
+struct forwarded_request
+{
+    std::string_view method;
+    std::string_view resource;
+    std::string_view headers;        // raw header lines, each terminated with CRLF
+    std::string_view client_address;
+    std::istream * body;             // null if there is no body
+    std::size_t content_length;      // for bodies that are not chunked
+    bool chunked;
+    base_socket_wrapper * client_socket; // for splicing large bodies, may be null
+};
+
+// forwards the request and relays the response to the client,
+// returns false if the client connection cannot be reused afterwards
+bool forward(proxy_route & route, const forwarded_request & request, std::ostream & out);
+
+} // namespace proxy_details
+
+} // namespace http
+
+#endif // HTTP_PROXY_H_INCLUDED
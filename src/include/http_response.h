@@ -0,0 +1,132 @@
+//
+// This file declares the builder of HTTP response headers.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_RESPONSE_H_INCLUDED
+#define HTTP_RESPONSE_H_INCLUDED
+
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace http
+{
+
+/// Get the reason phrase for the given status code.
+///
+/// @param status_code HTTP status code.
+/// @return reason phrase, like "Not Found", or "Unknown" for unknown codes.
+const char * reason_phrase(int status_code);
+
+/// Get the MIME type of the static file.
+///
+/// @param file_name name of the file, the type is determined by its extension.
+/// @return MIME type, like "text/html", or "text/plain" for unknown extensions.
+const char * file_mime_type(std::string_view file_name);
+
+/// \brief Builder of HTTP responses.
+///
+/// Builder of HTTP responses with arbitrary status codes and headers.
+/// The response is assembled in the internal buffer, which retains its
+/// capacity between responses, so that a builder that is reused
+/// for the whole connection does not allocate memory in the steady state.
+/// Status lines and common header lines are taken from precomputed tables
+/// and the Date header is formatted at most once per second in each thread.
+///
+/// Typical use in the generic handler:
+///
+///     http::response_builder & r = http::connection_response();
+///     r.start(404).content_type("text/plain").content_length(0).end_headers();
+///     r.send(out);
+class response_builder
+{
+public:
+    /// Create the builder.
+    /// @param capacity initial capacity of the buffer.
+    explicit response_builder(std::size_t capacity = 1024);
+
+    /// Discard the current content and write the status line.
+    /// @param status_code HTTP status code.
+    response_builder & start(int status_code = 200);
+
+    /// Append arbitrary header line.
+    /// @param name header name (without colon).
+    /// @param value header value.
+    response_builder & header(const char * name, const std::string & value);
+
+    /// Append arbitrary header line with numeric value.
+    response_builder & header(const char * name, std::size_t value);
+
+    /// Append header lines prepared in advance, each terminated with CRLF
+    /// (for example by the builder that was not started).
+    response_builder & header_lines(std::string_view lines);
+
+    /// Append Content-Type header.
+    response_builder & content_type(const std::string & mime_type);
+
+    /// Append Content-Length header (also for zero length).
+    response_builder & content_length(std::size_t length);
+
+    /// Append Cache-Control header.
+    /// @param cache whether the response is supposed to be cached.
+    response_builder & cache_control(bool cache);
+
+    /// Append Date header with the current time.
+    response_builder & date();
+
+    /// Append Transfer-Encoding: chunked header.
+    response_builder & chunked();
+
+    /// Append Connection: close header.
+    response_builder & close();
+
+    /// Terminate the header section.
+    response_builder & end_headers();
+
+    /// Append part of the response body.
+    response_builder & body(const char * data, std::size_t size);
+    response_builder & body(const std::string & s);
+
+    /// Access the assembled bytes.
+    const char * data() const { return buf_.data(); }
+    std::size_t size() const { return buf_.size(); }
+    const std::string & str() const { return buf_; }
+
+    /// Move the assembled bytes out of the builder, leaving it empty.
+    std::string release();
+
+    /// Write the assembled response to the (connection) stream and flush it.
+    void send(std::ostream & out) const;
+
+private:
+    void append(const char * s, std::size_t n) { buf_.append(s, n); }
+
+    std::string buf_;
+};
+
+/// Get the response builder owned by the calling connection.
+///
+/// The builder is reused by all responses produced in the context
+/// of the calling thread, and in particular by the server itself
+/// for automatically generated headers, so it should be used
+/// for one response at a time (start() resets it).
+response_builder & connection_response();
+
+/// Send complete response with the given status and text/plain message.
+///
+/// Useful for error responses from the generic handlers, for example:
+///     http::send_status(out, 404);
+///
+/// @param out stream object handling the requesting client connection
+/// @param status_code HTTP status code.
+/// @param message response body, reason phrase is used if empty.
+void send_status(std::ostream & out, int status_code,
+    const std::string & message = std::string());
+
+} // namespace http
+
+#endif // HTTP_RESPONSE_H_INCLUDED
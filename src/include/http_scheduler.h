@@ -0,0 +1,130 @@
+//
+// This file declares the work-stealing scheduler that executes the actions.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_SCHEDULER_H_INCLUDED
+#define HTTP_SCHEDULER_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace http
+{
+
+class task_group;
+
+/// \brief Work-stealing scheduler.
+///
+/// Scheduler with the fixed number of worker threads, each owning
+/// the Chase-Lev deque of tasks: the worker pushes and pops its own tasks
+/// at the bottom of its deque (so that the subtasks it spawns are executed
+/// while their data is still in its cache), while idle workers steal tasks
+/// from the top of the deques of randomly chosen victims.
+/// Tasks submitted from threads other than workers go to the shared queue.
+/// Tasks are submitted and waited for through task_group.
+class task_scheduler
+{
+public:
+    /// Create the scheduler and start its workers.
+    /// @param workers number of worker threads, zero means one per hardware thread.
+    explicit task_scheduler(std::size_t workers = 0);
+
+    /// Execute the remaining tasks and join the workers.
+    ~task_scheduler();
+
+    /// Number of worker threads.
+    std::size_t workers() const { return workers_.size(); }
+
+    /// Scheduler of the calling thread, NULL if it is not a worker thread.
+    static task_scheduler * current();
+
+private:
+    // not for use
+    task_scheduler(const task_scheduler &);
+    void operator=(const task_scheduler &);
+
+    friend class task_group;
+
+    struct task;
+    struct worker;
+
+    void submit(task * t);
+    task * find_task(worker * self);
+    void run_task(task * t);
+    void worker_loop(worker * self);
+
+    std::vector<std::unique_ptr<worker> > workers_;
+
+    // tasks submitted from outside, and sleeping workers, guarded by mtx_
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<task *> shared_;
+
+    std::atomic<std::int64_t> queued_;   // tasks not taken by any worker yet
+    std::atomic<std::size_t> sleeping_;
+    std::atomic<bool> stopping_;
+
+    static thread_local worker * current_worker_;
+};
+
+/// \brief Group of tasks that are waited for together.
+///
+/// Group of tasks executed by the scheduler. The thread that waits
+/// for the group does not block when it is the worker of the same scheduler,
+/// instead it executes other tasks (its own subtasks most likely)
+/// until all tasks of the group are finished, so that tasks can spawn
+/// and wait for their own subtasks at any depth.
+/// Without the scheduler, the tasks are executed immediately by spawn.
+class task_group
+{
+public:
+    /// Create the group of tasks executed by the scheduler of the calling
+    /// worker thread, or immediately if the calling thread is not a worker.
+    task_group();
+
+    /// Create the group of tasks executed by the given scheduler.
+    explicit task_group(task_scheduler & scheduler);
+
+    /// Wait for the tasks, ignoring their errors.
+    ~task_group();
+
+    /// Submit the task.
+    /// @param f the function executed as the task.
+    void spawn(std::function<void()> f);
+
+    /// Wait until all submitted tasks are finished.
+    /// Rethrows the first exception thrown by any of the tasks.
+    void wait();
+
+private:
+    // not for use
+    task_group(const task_group &);
+    void operator=(const task_group &);
+
+    friend class task_scheduler;
+
+    void fail(std::exception_ptr e);
+    void finish();
+
+    task_scheduler * scheduler_;
+    std::atomic<std::size_t> pending_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::exception_ptr error_;
+};
+
+} // namespace http
+
+#endif // HTTP_SCHEDULER_H_INCLUDED
@@ -11,9 +11,14 @@
 #ifndef HTTP_SERVER_H_INCLUDED
 #define HTTP_SERVER_H_INCLUDED
 
+#include <http_json.h>
+#include <http_trace.h>
+
+#include <chrono>
 #include <ostream>
 #include <string>
 #include <functional>
+#include <memory_resource>
 #include <unordered_map>
 #include <vector>
 
@@ -44,6 +49,255 @@ void server_start(int port_number, const char * base_directory);
 void server_start(int port_number, const char * base_directory,
     std::ostream & error_log, unsigned int log_events_mask = log_everything);
 
+/// \brief Start the embedded HTTP server on several listening sockets.
+///
+/// Start the singleton embedded HTTP server that accepts connections
+/// on all given listening sockets, TCP and Unix domain sockets can be mixed.
+/// All of them share the same registered actions and static files.
+/// The first listener is operated in the context of the calling thread,
+/// each of the others in its own thread.
+///
+/// Besides HTTP/1.1, the connections can speak cleartext HTTP/2 (h2c),
+/// either with prior knowledge or after the "Upgrade: h2c" request.
+/// Streams of the HTTP/2 connection are served concurrently, each in its own
+/// thread, by the same registered actions (which write their responses
+/// as for HTTP/1.1, the translation to frames is transparent).
+///
+/// @param listeners listening addresses, each given as port number
+/// (for example "8080") or as "unix:/path/to/socket".
+/// @param base_directory directory containing static dist.
+/// @param error_log optional output stream for diagnostic logs
+/// @param log_events_mask bit mask for selecting active categories of log messages
+/// @return This function does not return as long as the server functions properly.
+void server_start(const std::vector<std::string> & listeners, const char * base_directory);
+void server_start(const std::vector<std::string> & listeners, const char * base_directory,
+    std::ostream & error_log, unsigned int log_events_mask = log_everything);
+
+/// \brief Stop the embedded HTTP server.
+///
+/// Stop the embedded HTTP server gracefully: stop accepting new connections,
+/// close the connections waiting for the next request and let the requests
+/// in progress finish (closing their connections afterwards).
+/// The connections that are still busy after the deadline are closed forcibly.
+/// The function returns when all connection threads have been joined,
+/// server_start returns in the thread that called it.
+/// When called from an action or a connection callback, whose own request
+/// would be waited for, the function only starts the stop in another thread
+/// and returns at once.
+///
+/// @param deadline maximum time given to the requests in progress.
+void server_stop(std::chrono::milliseconds deadline = std::chrono::seconds(30));
+
+/// \brief Enable zero-downtime upgrades through the listening socket handoff.
+///
+/// When set before server_start, the server first asks the instance
+/// serving on the handoff socket (the previous one) for its listening
+/// sockets and accepts on them instead of binding new ones, so that
+/// the pending and incoming connections are never refused.
+/// The previous instance then stops gracefully (see server_stop),
+/// while the new one serves the handoff socket for its own successor.
+///
+/// Listening sockets can be also inherited through the environment variable
+/// HTTP_SERVER_LISTEN_FDS, as a list of address=descriptor pairs separated
+/// with semicolons, for example "8080=3;unix:/run/app.sock=4".
+///
+/// @param path path of the Unix socket used for the handoff.
+/// @param drain_deadline deadline for the requests in progress of the previous instance.
+void set_listener_handoff(const char * path,
+    std::chrono::milliseconds drain_deadline = std::chrono::seconds(30));
+
+/// \brief Execute the actions on the work-stealing scheduler.
+///
+/// Execute the registered GET and POST actions as tasks of the work-stealing
+/// scheduler (see task_scheduler in http_scheduler.h), while the connection
+/// threads only wait for them. The number of actions executed in parallel is then
+/// bounded by the number of workers instead of the number of connections,
+/// and the actions can spawn subtasks with task_group, which are balanced
+/// across all workers. Static files and cached responses are still served
+/// directly by the connection threads.
+/// The workers never wait for the client: the connection thread receives
+/// the whole request body before the action is executed (bodies longer
+/// than 16MB are rejected with 413 Payload Too Large) and sends the response
+/// after the action completes, as collected in memory (also the chunked one).
+/// The actions can use request_memory() and connection_response()
+/// as usual, but their subtasks, running concurrently, must not.
+/// Must be called before server_start.
+///
+/// @param workers number of worker threads, zero means one per hardware thread.
+void set_action_workers(std::size_t workers);
+
+/// Set the cache of missing static files.
+///
+/// Set the cache of paths for which no static file was found, so that
+/// repeated requests for them are answered with the precomputed 404 response
+/// without any file system access. The paths are checked again after
+/// the time to live or, on Linux, as soon as any file or directory
+/// appears in the tree of static files. The cache is enabled by default,
+/// with 16384 paths and 1 second.
+///
+/// @param capacity maximum number of paths, zero disables the cache.
+/// @param ttl time for which the path is known to be missing.
+void set_missing_file_cache(std::size_t capacity, std::chrono::milliseconds ttl);
+
+/// Set the cache of open static files.
+///
+/// Set the cache of open descriptors of static files, with their metadata
+/// and precomputed headers, so that serving the cached file needs neither
+/// open() nor stat(). Large files are sent directly from the file to
+/// the socket (with sendfile() on Linux). The files are checked again after
+/// the revalidation interval or, on Linux, as soon as they are changed.
+/// The cache is enabled by default, with 256 files and 1 second
+/// (each cached file keeps its descriptor open). Not supported on Windows.
+///
+/// @param capacity maximum number of open files, zero disables the cache.
+/// @param revalidate interval after which the file is checked for changes.
+void set_open_file_cache(std::size_t capacity, std::chrono::milliseconds revalidate);
+
+/// Serve the static files from the asset pack.
+///
+/// Serve the static files from the pack created by the pack_assets tool
+/// instead of the base directory. The pack is mapped into memory as a whole
+/// when this function is called, files are found in its sorted index
+/// and sent straight from the mapping with their precomputed headers,
+/// compressed if the pack has the gzip variant and the client accepts it,
+/// or as 304 Not Modified if the client already has the same variant.
+/// The pack is mapped again when its file is replaced (for example
+/// by the next run of pack_assets), checked at most once per second.
+/// Throws std::runtime_error if the pack is not valid. Not supported on Windows.
+///
+/// @param path name of the pack file, empty to serve the base directory again.
+void set_static_pack(const char * path);
+
+/// \brief Create the named executor pool (bulkhead).
+///
+/// Create the pool of worker threads that executes the actions of the routes
+/// assigned to it (see set_route_executor), isolated from all other actions:
+/// at most concurrency actions of the pool are executed at the same time,
+/// at most queue_limit others wait for a free worker, and the requests beyond
+/// that are rejected immediately with 503 Service Unavailable.
+/// A degraded expensive route then exhausts only its own pool, while
+/// the other actions keep their workers, and static files (which are always
+/// served directly by the connection threads) are never queued behind any action.
+/// The request bodies and responses of these actions are received and sent
+/// by the connection threads, as with set_action_workers.
+/// Throws std::runtime_error if the pool of the same name already exists.
+///
+/// @param name name of the pool.
+/// @param concurrency number of worker threads of the pool.
+/// @param queue_limit number of requests that can wait for a worker.
+void create_executor_pool(const char * name, std::size_t concurrency,
+    std::size_t queue_limit);
+
+/// Assign the route to the executor pool.
+///
+/// Assign the route (GET and POST actions registered with the given name)
+/// to the executor pool created earlier with create_executor_pool.
+/// Throws std::runtime_error if there is no such pool.
+///
+/// @param name name of the action, as given at its registration.
+/// @param pool name of the pool, empty string restores the default execution.
+void set_route_executor(const char * name, const char * pool);
+
+/// \brief Run the server as shared-nothing shards.
+///
+/// When set before server_start, each TCP listener is bound once per shard
+/// (with SO_REUSEPORT, so that the kernel spreads new connections among them)
+/// and each shard accepts and serves its connections on its own: it keeps
+/// its own replica of the registered routes, pool of request memory
+/// and statistics, so that requests of different shards do not contend
+/// on any global lock. Actions registered while the server is running
+/// are sent to the shards as messages, which the shards apply within
+/// the poll period of their accept loops (200 ms).
+/// Unix domain listeners are served by the first shard.
+/// The listening sockets of the other shards are handed over to the next
+/// instance (see set_listener_handoff) as "address#shard", for example "8080#1",
+/// so both instances should run the same number of shards.
+///
+/// @param shards number of shards, zero means one per hardware thread (the default is 1).
+/// @param pin_threads whether the threads of each shard are bound to its own
+/// processor (supported on Linux only).
+void set_server_shards(std::size_t shards, bool pin_threads = true);
+
+/// Statistics of the single shard.
+struct shard_statistics
+{
+    std::size_t connections; ///< connections accepted so far
+    std::size_t requests;    ///< requests served so far, HTTP/2 streams included
+};
+
+/// Get the statistics of all shards of the running server, in the order of shards.
+std::vector<shard_statistics> get_shard_statistics();
+
+/// Set the connection timeouts.
+///
+/// Set the connection timeouts, which protect the server from clients
+/// that stop sending or receiving data, so that they do not hold
+/// the connection threads forever. The connection that exceeds
+/// any of the timeouts is closed. Zero value (the default) means no limit.
+/// Independently of the timeouts, request lines longer than 8KB are answered
+/// with 414 URI Too Long and header sections longer than 64KB with
+/// 431 Request Header Fields Too Large, after which the connection is closed.
+///
+/// @param idle maximum time of waiting for the next request on the open connection.
+/// @param header maximum time of receiving the complete request line and headers,
+/// counted from the first byte of the request.
+/// @param body maximum time of waiting for each next part of the request body.
+/// @param write maximum time of waiting for each part of the response to be sent.
+void set_connection_timeouts(std::chrono::milliseconds idle,
+    std::chrono::milliseconds header, std::chrono::milliseconds body,
+    std::chrono::milliseconds write);
+
+/// Enable adaptive load shedding.
+///
+/// Enable adaptive load shedding based on the queueing delay, measured
+/// from accepting the connection until its thread starts serving it,
+/// and for each request from the moment it is ready (with its body,
+/// if received in advance) until its handler starts, including the wait
+/// for a worker of the scheduler or executor pool. Occasional delays
+/// are tolerated, but when even the smallest delay observed during
+/// the whole interval exceeds the target (as in CoDel), the server
+/// is considered overloaded and new connections are rejected
+/// with immediate 503 Service Unavailable responses, written directly
+/// from the accepting thread, until the delays drop again.
+///
+/// @param target acceptable queueing delay, zero disables shedding (the default).
+/// @param interval window in which the minimum delay is tracked.
+void set_load_shedding(std::chrono::microseconds target,
+    std::chrono::microseconds interval = std::chrono::milliseconds(100));
+
+/// Mark the route as low priority.
+///
+/// Mark the route as low priority. While the server is overloaded
+/// (see set_load_shedding), requests for this route are rejected
+/// with 503 Service Unavailable also on already open connections.
+///
+/// @param name name of the action or static file, without the leading slash.
+void set_low_priority_route(const char * name);
+
+/// Limit the request rate of each client.
+///
+/// Limit the request rate of each client (identified by its network address)
+/// with the token bucket. Requests over the limit are rejected
+/// with 429 Too Many Requests before they are dispatched.
+/// The clients connected through the Unix sockets are identified by their
+/// user id on Linux (also in X-Forwarded-For of the proxied requests,
+/// as "unix:uid=1000"), elsewhere they all share the single bucket "unix".
+///
+/// @param rate sustained number of requests per second, zero disables the limit (the default).
+/// @param burst number of requests that can be made at once after the idle period.
+void set_client_rate_limit(double rate, double burst);
+
+/// Limit the request rate of the route.
+///
+/// Limit the total request rate of the route, from all clients,
+/// with the token bucket. Requests over the limit are rejected
+/// with 429 Too Many Requests before they are dispatched.
+///
+/// @param name name of the action or static file, without the leading slash.
+/// @param rate sustained number of requests per second, zero removes the limit.
+/// @param burst number of requests that can be made at once after the idle period.
+void set_route_rate_limit(const char * name, double rate, double burst);
+
 /// Type defining possible connection events, used to notify the connection callback.
 enum connection_event
 {
@@ -117,12 +371,111 @@ void register_html_get_action(const char * name, get_action_type f);
 /// @param f function callback that will handle the GET request.
 void register_text_get_action(const char * name, get_action_type f);
 
+/// Register cached text/html GET handler.
+///
+/// Register text/html GET handler with memoized responses.
+/// The handler is used as with register_html_get_action, but the complete
+/// response is stored and reused for subsequent requests with the same
+/// path and parameters (in any order), until the ttl expires.
+/// This is appropriate only for handlers whose output depends
+/// on the path and params alone.
+///
+/// Note: when the response is not in the cache, concurrent identical
+/// requests are coalesced - only one of them calls the handler
+/// and all of them receive its response.
+///
+/// @param name name of the "resource" to be handled by the callback.
+/// @param f function callback that will handle the GET request.
+/// @param ttl time for which the generated response remains valid.
+void register_cached_html_get_action(const char * name, get_action_type f,
+    std::chrono::milliseconds ttl);
+
+/// Register cached text/plain GET handler.
+///
+/// Register text/plain GET handler with memoized responses,
+/// see register_cached_html_get_action.
+///
+/// @param name name of the "resource" to be handled by the callback.
+/// @param f function callback that will handle the GET request.
+/// @param ttl time for which the generated response remains valid.
+void register_cached_text_get_action(const char * name, get_action_type f,
+    std::chrono::milliseconds ttl);
+
+/// Register coalesced text/html GET handler.
+///
+/// Register text/html GET handler with coalescing of concurrent requests.
+/// The handler is used as with register_html_get_action, but when
+/// identical requests (same path and params) arrive while the handler
+/// is already running for one of them, they wait for its result
+/// and receive the same response instead of calling the handler again.
+///
+/// @param name name of the "resource" to be handled by the callback.
+/// @param f function callback that will handle the GET request.
+void register_coalesced_html_get_action(const char * name, get_action_type f);
+
+/// Register coalesced text/plain GET handler.
+///
+/// Register text/plain GET handler with coalescing of concurrent requests,
+/// see register_coalesced_html_get_action.
+///
+/// @param name name of the "resource" to be handled by the callback.
+/// @param f function callback that will handle the GET request.
+void register_coalesced_text_get_action(const char * name, get_action_type f);
+
+/// Drop all cached responses of the given action.
+///
+/// @param name name of the "resource", as used for registration.
+void invalidate_cached_action(const char * name);
+
+/// Drop cached response of the given action for the given parameters.
+///
+/// @param name name of the "resource", as used for registration.
+/// @param params the URL parameters (from the '?' sign to the end of URL)
+void invalidate_cached_response(const char * name, const std::string & params);
+
+/// Set the memory budget of the response cache.
+///
+/// Set the memory budget of the response cache (64MB by default).
+/// Least recently used responses are evicted when the budget is exceeded.
+///
+/// @param bytes maximum number of bytes kept by the cache.
+void set_response_cache_size(std::size_t bytes);
+
+/// Register chunked GET handler.
+///
+/// Register chunked GET handler for streaming responses.
+/// The handler is responsible for producing only the response data,
+/// the HTTP headers are taken care of automatically and the response
+/// is sent with the chunked transfer coding.
+///
+/// Note: the chunked action is called in the context of the thread
+/// that is dedicated for the given connection. Every flush of the stream
+/// object sends the collected output to the client as a single chunk,
+/// so that large responses do not need to be buffered in memory.
+/// The last chunk is sent automatically when the handler returns.
+/// The actions executed by the workers (see set_action_workers
+/// and create_executor_pool) have their whole response buffered instead.
+///
+/// @param name name of the "resource" to be handled by the callback.
+/// @param mime_type MIME type declared for the response.
+/// @param f function callback that will handle the GET request.
+void register_chunked_get_action(const char * name, const char * mime_type,
+    get_action_type f);
+
+/// Value of the content_length parameter of POST handlers
+/// when the request body is chunked.
+///
+/// The body length is not known in advance in this case and the handler
+/// should read the in stream until its end.
+const std::size_t unknown_content_length = static_cast<std::size_t>(-1);
+
 /// Type of function callback for handling POST requests.
 /// @param out stream object handling the output part of the requesting client connection
 /// @param path name of the requested resource (up to the '?' sign, if any)
 /// @param params the URL parameters (from the '?' sign to the end of URL)
 /// @param in stream object handling the input part of the requesting connection
 /// @param content_length number of bytes to be consumed from the in stream
+/// (or unknown_content_length if the body is chunked)
 /// @param mime_type MIME type declared for the POST request by the client
 typedef std::function<void(std::ostream &, const std::string &, const std::string &,
     std::istream &, std::size_t, const std::string &)>
@@ -172,6 +525,98 @@ void register_html_post_action(const char * name, post_action_type f);
 /// @param f function callback that will handle the POST request.
 void register_text_post_action(const char * name, post_action_type f);
 
+/// Register chunked POST handler.
+///
+/// Register chunked POST handler for streaming responses,
+/// see register_chunked_get_action.
+///
+/// @param name name of the "resource" to be handled by the callback.
+/// @param mime_type MIME type declared for the response.
+/// @param f function callback that will handle the POST request.
+void register_chunked_post_action(const char * name, const char * mime_type,
+    post_action_type f);
+
+/// Type of function callback for handling JSON GET requests.
+/// @param out writer of the response body
+/// @param path name of the requested resource (up to the '?' sign, if any)
+/// @param params the URL parameters (from the '?' sign to the end of URL)
+typedef std::function<void(json_writer &, const std::string &, const std::string &)>
+    json_get_action_type;
+
+/// Register application/json GET handler.
+///
+/// Register application/json GET handler.
+/// The handler writes only the response body, with the json_writer
+/// that appends it to the buffer reused by the calling thread,
+/// the HTTP headers are taken care of automatically.
+/// If the handler throws, the client receives 500 Internal Server Error
+/// instead of the partially written body.
+///
+/// @param name name of the "resource" to be handled by the callback.
+/// @param f function callback that will handle the GET request.
+void register_json_get_action(const char * name, json_get_action_type f);
+
+/// Type of function callback for handling JSON POST requests.
+/// @param out writer of the response body
+/// @param path name of the requested resource (up to the '?' sign, if any)
+/// @param params the URL parameters (from the '?' sign to the end of URL)
+/// @param body the parsed request body
+typedef std::function<void(json_writer &, const std::string &, const std::string &,
+    const json_value &)>
+    json_post_action_type;
+
+/// Register application/json POST handler.
+///
+/// Register application/json POST handler, see register_json_get_action.
+/// The request body is read completely and parsed in situ before
+/// the handler is called, so that its strings refer to the body buffer
+/// (valid until the handler returns). Bodies that are not valid JSON
+/// are answered with 400 Bad Request, bodies longer than 16MB
+/// with 413 Payload Too Large, without calling the handler.
+///
+/// @param name name of the "resource" to be handled by the callback.
+/// @param f function callback that will handle the POST request.
+void register_json_post_action(const char * name, json_post_action_type f);
+
+/// Set the probability of tracing the request.
+///
+/// Sampled requests record the spans of their phases - the wait from
+/// the accept to the connection thread (for the first request of the connection),
+/// the header parsing, the route lookup, the handler and the response write,
+/// and the whole request - together with the spans added by the actions
+/// (see trace_span). Spans are kept in the ring buffer of each thread,
+/// so that recording takes no shared lock; requests that are not sampled
+/// cost a single comparison per span. Tracing is disabled by default.
+/// HTTP/2 streams record all spans but the accept and the header parsing.
+///
+/// @param probability fraction of the requests to be traced, zero disables tracing.
+void set_trace_sampling(double probability);
+
+/// Set the number of spans kept by each thread, 4096 by default;
+/// the oldest spans are overwritten.
+void set_trace_buffer_size(std::size_t events);
+
+/// Register the action returning the recorded spans.
+///
+/// Register application/json GET action returning the spans of all threads
+/// in the Chrome trace-event format, to be loaded into chrome://tracing
+/// or Perfetto.
+///
+/// @param name name of the "resource" (for example "trace").
+void register_trace_action(const char * name);
+
+/// Write the recorded spans when the process receives the signal.
+///
+/// Write the spans of all threads in the Chrome trace-event format
+/// to the file when the process receives the signal (for example SIGUSR1).
+/// The file is written by the timer thread within 100ms after the signal,
+/// not by the signal handler.
+/// Throws std::runtime_error if the handler cannot be installed.
+///
+/// @param signal_number the signal.
+/// @param file_name name of the file, replaced by each signal.
+void set_trace_signal(int signal_number, const char * file_name);
+
 /// Encode basic HTML entities.
 ///
 /// Encode basic HTML entities - '<', '>', '&'.
@@ -180,6 +625,26 @@ void register_text_post_action(const char * name, post_action_type f);
 /// @return encoded string.
 std::string html_encode(const std::string & s);
 
+/// Encode basic HTML entities, appending to the given string.
+///
+/// @param s pointer to the text to be encoded.
+/// @param n number of bytes to be encoded.
+/// @param out string to which the encoded text is appended.
+void html_encode(const char * s, std::size_t n, std::string & out);
+void html_encode(const char * s, std::size_t n, std::pmr::string & out);
+void html_encode(const std::string & s, std::string & out);
+
+/// Encode basic HTML entities into the caller-provided buffer.
+///
+/// @param s pointer to the text to be encoded.
+/// @param n number of bytes to be encoded.
+/// @param buf output buffer, at least html_encode_max_size(n) bytes long.
+/// @return number of bytes written to buf.
+std::size_t html_encode(const char * s, std::size_t n, char * buf);
+
+/// Maximum size of html_encode output for n bytes of input.
+inline std::size_t html_encode_max_size(std::size_t n) { return 5 * n; }
+
 /// Encode string for safe use within URL.
 ///
 /// Encode string for safe use within URL.
@@ -189,6 +654,26 @@ std::string html_encode(const std::string & s);
 /// @return encoded string.
 std::string url_encode(const std::string & s);
 
+/// Encode string for safe use within URL, appending to the given string.
+///
+/// @param s pointer to the text to be encoded.
+/// @param n number of bytes to be encoded.
+/// @param out string to which the encoded text is appended.
+void url_encode(const char * s, std::size_t n, std::string & out);
+void url_encode(const char * s, std::size_t n, std::pmr::string & out);
+void url_encode(const std::string & s, std::string & out);
+
+/// Encode string for safe use within URL into the caller-provided buffer.
+///
+/// @param s pointer to the text to be encoded.
+/// @param n number of bytes to be encoded.
+/// @param buf output buffer, at least url_encode_max_size(n) bytes long.
+/// @return number of bytes written to buf.
+std::size_t url_encode(const char * s, std::size_t n, char * buf);
+
+/// Maximum size of url_encode output for n bytes of input.
+inline std::size_t url_encode_max_size(std::size_t n) { return 3 * n; }
+
 /// Decode part of the URL (used for parameters).
 ///
 /// Decode part of the URL, using reverse logic of url_encode.
@@ -196,6 +681,25 @@ std::string url_encode(const std::string & s);
 /// @return decoded string.
 std::string url_decode(const std::string & s);
 
+/// Decode part of the URL, appending to the given string.
+///
+/// @param s pointer to the text to be decoded.
+/// @param n number of bytes to be decoded.
+/// @param out string to which the decoded text is appended.
+void url_decode(const char * s, std::size_t n, std::string & out);
+void url_decode(const char * s, std::size_t n, std::pmr::string & out);
+void url_decode(const std::string & s, std::string & out);
+
+/// Decode part of the URL into the caller-provided buffer.
+///
+/// The decoded text is never longer than the input,
+/// so buf needs to be at least n bytes long (it can also be s itself).
+/// @param s pointer to the text to be decoded.
+/// @param n number of bytes to be decoded.
+/// @param buf output buffer, at least n bytes long.
+/// @return number of bytes written to buf.
+std::size_t url_decode(const char * s, std::size_t n, char * buf);
+
 /// Type of map {key->value,...} for decoding URL and form parameters.
 typedef std::unordered_map<std::string, std::string> params_map_type;
 
@@ -208,6 +712,32 @@ typedef std::unordered_map<std::string, std::string> params_map_type;
 params_map_type decode_params(const std::string & params, bool decode);
 params_map_type decode_params(const std::vector<char> & params, bool decode);
 
+/// Type of map {key->value,...} allocated from the given memory resource.
+typedef std::pmr::unordered_map<std::pmr::string, std::pmr::string> pmr_params_map_type;
+
+/// Decode URL or form parameters into map allocated from the memory resource.
+///
+/// Decode URL or form parameters, see decode_params above.
+/// With request_memory() as the memory resource the map and its strings
+/// are released automatically after the response is sent.
+/// @param params pointer to parameters, stored as a single string.
+/// @param size number of bytes available at params.
+/// @param decode whether the keys and values should be URL-decoded.
+/// @param mr memory resource for the map and its strings.
+/// @return decoded parameter map.
+pmr_params_map_type decode_params(const char * params, std::size_t size,
+    bool decode, std::pmr::memory_resource * mr);
+
+/// Get the request-scoped memory resource.
+///
+/// Get the memory resource for data that does not outlive the current request.
+/// The memory is taken from the arena owned by the connection, which is
+/// released wholesale after each request, so that the request-scoped data
+/// does not need to be freed individually.
+/// Outside of the request handling context the default resource is returned.
+/// @return request-scoped memory resource.
+std::pmr::memory_resource * request_memory();
+
 /// Generate basic HTTP header.
 ///
 /// Generate basic HTTP header, typically for the generic resource handler,
@@ -216,6 +746,9 @@ params_map_type decode_params(const std::vector<char> & params, bool decode);
 /// Content-Type: mime_type
 /// Content-Length: content_length
 /// Cache-Control: ...
+/// Date: ...
+///
+/// See response_builder in http_response.h for other status codes and headers.
 ///
 /// @param mime_type MIME type declaration.
 /// @param content_length number of bytes in the response body.
@@ -224,6 +757,21 @@ params_map_type decode_params(const std::vector<char> & params, bool decode);
 std::string header(const std::string & mime_type,
     std::size_t content_length = 0, bool cache = false);
 
+/// Generate HTTP header for chunked response.
+///
+/// Generate HTTP header for the response body that is sent
+/// with chunked transfer coding (see chunked_ostream), of the form:
+/// HTTP/1.1 200 OK
+/// Content-Type: mime_type
+/// Transfer-Encoding: chunked
+/// Cache-Control: ...
+/// Date: ...
+///
+/// @param mime_type MIME type declaration.
+/// @param cache whether the given response is supposed to be cached
+/// @return generated HTTP header.
+std::string chunked_header(const std::string & mime_type, bool cache = false);
+
 } // namespace http
 
 #endif // HTTP_SERVER_H_INCLUDED
@@ -0,0 +1,149 @@
+//
+// This file declares the precompiled HTML templates.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_TEMPLATE_H_INCLUDED
+#define HTTP_TEMPLATE_H_INCLUDED
+
+#include <http_cache.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http
+{
+
+class template_values;
+
+/// \brief Precompiled HTML template.
+///
+/// Template text with placeholders, compiled once into the flat list
+/// of instructions, each of them either the range of the static text
+/// or the slot of the variable. Placeholder {{name}} is replaced with
+/// the value encoded with html_encode, {{{name}}} with the value as is.
+/// Rendering only copies the static ranges and the values to the output,
+/// so that the mostly static page is produced at the speed of memcpy.
+///
+/// Typical use in the action:
+///
+///     static const http::html_template page("<p>Hello {{name}}!</p>");
+///
+///     http::template_values values(page);
+///     values.set("name", name);
+///     page.render(out, values);
+class html_template
+{
+public:
+    /// Compile the template.
+    /// Throws std::runtime_error if the placeholder is not terminated or has no name.
+    /// @param text template text.
+    explicit html_template(std::string text);
+
+    /// Number of distinct variables.
+    std::size_t slots() const { return names_.size(); }
+
+    /// Get the slot of the variable.
+    /// @param name variable name.
+    /// @return the slot or npos if the template has no such variable.
+    std::size_t slot(std::string_view name) const;
+
+    /// Get the variable name.
+    const std::string & name(std::size_t slot) const { return names_[slot]; }
+
+    /// Render the template.
+    /// @param out stream (or string to append to) receiving the rendered text.
+    /// @param values values of the variables, created for this template.
+    void render(std::ostream & out, const template_values & values) const;
+    void render(std::string & out, const template_values & values) const;
+
+    /// Render the template, or reuse the fragment rendered before
+    /// with the same values.
+    /// @param out stream receiving the rendered text.
+    /// @param values values of the variables, created for this template.
+    /// @param fragments cache of the rendered fragments, can be shared by many templates.
+    void render(std::ostream & out, const template_values & values,
+        response_cache & fragments) const;
+
+    static const std::size_t npos = (std::size_t)-1;
+
+private:
+    // not for use
+    html_template(const html_template &);
+    void operator=(const html_template &);
+
+    struct instruction
+    {
+        enum kind_type { text, encoded, raw };
+
+        kind_type kind;
+        std::size_t offset; // of the static text
+        std::size_t size;
+        std::size_t slot;
+    };
+
+    template <class Sink>
+    void execute(Sink & sink, const template_values & values) const;
+
+    std::string text_;
+    std::vector<instruction> program_;
+    std::vector<std::string> names_; // by slot
+    std::size_t static_size_;
+    std::uint64_t id_; // distinguishes fragments of different templates
+};
+
+/// \brief Values of the template variables.
+///
+/// Values of the variables of the given template, by slot.
+/// Strings are referenced, not copied, so they have to outlive rendering;
+/// numbers are formatted and kept in the object. Variables that are
+/// not set are rendered as empty.
+class template_values
+{
+public:
+    /// Create the values for the template, all empty.
+    explicit template_values(const html_template & t);
+
+    /// Set the variable by its name.
+    /// Throws std::runtime_error if the template has no such variable.
+    template_values & set(std::string_view name, std::string_view value);
+    template_values & set(std::string_view name, long long value);
+
+    /// Set the variable by its slot (see html_template::slot).
+    template_values & set_slot(std::size_t slot, std::string_view value);
+    template_values & set_slot(std::size_t slot, long long value);
+
+    /// Get the value of the variable.
+    std::string_view get(std::size_t slot) const;
+
+    /// Template for which the values were created.
+    const html_template & owner() const { return owner_; }
+
+private:
+    // not for use
+    template_values(const template_values &);
+    void operator=(const template_values &);
+
+    struct value
+    {
+        const char * data;
+        std::size_t size;
+        char digits[24];
+    };
+
+    std::size_t checked_slot(std::string_view name) const;
+
+    const html_template & owner_;
+    std::vector<value> values_;
+};
+
+} // namespace http
+
+#endif // HTTP_TEMPLATE_H_INCLUDED
@@ -0,0 +1,100 @@
+//
+// This file declares the hierarchical timer wheel used for connection timeouts.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_TIMER_H_INCLUDED
+#define HTTP_TIMER_H_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace http
+{
+
+/// \brief Hierarchical timer wheel.
+///
+/// Hierarchical timer wheel, with constant-time arming and cancelling
+/// of timers, suitable for keeping a deadline for each of a large number
+/// of connections. The timers are intrusive (owned by the caller),
+/// so that re-arming does not allocate memory. Time advances only
+/// when advance() is called, typically from the dedicated thread.
+///
+/// Callbacks are invoked with the wheel locked: they should be short
+/// and must not arm or cancel timers of the same wheel. On the other hand,
+/// once cancel() returns, the callback is guaranteed not to be running.
+class timer_wheel
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+    /// \brief Timer registered in the wheel.
+    class timer
+    {
+    public:
+        /// Create the timer with the given expiration callback.
+        explicit timer(std::function<void()> callback)
+            : callback_(callback), slot_(NULL), prev_(NULL), next_(NULL), expires_(0)
+        {
+        }
+
+    private:
+        // not for use
+        timer(const timer &);
+        void operator=(const timer &);
+
+        friend class timer_wheel;
+
+        std::function<void()> callback_;
+        timer ** slot_; // head of the list containing the timer, null if not armed
+        timer * prev_;
+        timer * next_;
+        std::uint64_t expires_; // in ticks
+    };
+
+    /// Create the wheel.
+    /// @param resolution duration of the single tick.
+    explicit timer_wheel(std::chrono::milliseconds resolution = std::chrono::milliseconds(100));
+
+    /// Arm the timer, replacing its previous deadline (if any).
+    /// @param t the timer, must stay alive until it expires or is cancelled.
+    /// @param deadline time at which the callback should be invoked
+    /// (rounded up to the tick resolution).
+    void arm(timer & t, clock_type::time_point deadline);
+
+    /// Disarm the timer, it is not an error if it is not armed.
+    void cancel(timer & t);
+
+    /// Move the wheel to the given time and invoke the callbacks of expired timers.
+    void advance(clock_type::time_point now);
+
+private:
+    // not for use
+    timer_wheel(const timer_wheel &);
+    void operator=(const timer_wheel &);
+
+    static const int level_bits = 6;
+    static const int slots_per_level = 1 << level_bits;
+    static const int levels = 4;
+
+    void insert(timer & t);
+    void unlink(timer & t);
+    void cascade(int level);
+
+    std::mutex mtx_;
+    clock_type::time_point origin_;
+    clock_type::duration resolution_;
+    std::uint64_t current_;
+
+    // doubly linked lists of timers
+    timer * slots_[levels][slots_per_level];
+};
+
+} // namespace http
+
+#endif // HTTP_TIMER_H_INCLUDED
@@ -0,0 +1,103 @@
+//
+// This file declares the tracing of sampled requests.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef HTTP_TRACE_H_INCLUDED
+#define HTTP_TRACE_H_INCLUDED
+
+#include <http_json.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace http
+{
+
+namespace trace_details
+{
+
+typedef std::chrono::steady_clock clock_type;
+
+/// Sampled request served by the calling thread, zero if it is not sampled.
+extern thread_local std::uint64_t current_request;
+
+/// Decide whether the new request is sampled.
+/// @return identity of the sampled request, zero if it is not sampled.
+std::uint64_t sample_request();
+
+/// Record the span in the ring buffer of the calling thread.
+/// @param name name of the span, a string literal.
+/// @param request identity of the sampled request.
+/// @param detail additional text, truncated if long.
+void record(const char * name, std::uint64_t request,
+    clock_type::time_point begin, clock_type::time_point end,
+    std::string_view detail = std::string_view());
+
+/// Write the recorded spans of all threads in the Chrome trace-event format.
+void write_chrome_trace(json_writer & w);
+
+/// Set the sampling probability (0 disables tracing).
+void set_sampling(double probability);
+
+/// Set the number of spans kept by each thread.
+void set_buffer_size(std::size_t events);
+
+/// Forget all recorded spans.
+void clear();
+
+} // namespace trace_details
+
+/// \brief Span of the sampled request.
+///
+/// Span recorded from its construction to its destruction when the calling
+/// thread serves the sampled request, nothing is done otherwise
+/// (the check is the single comparison of the thread-local variable).
+/// The server records the spans of the phases of each sampled request,
+/// actions can add their own:
+///
+///     http::trace_span span("database query");
+class trace_span
+{
+public:
+    /// Start the span.
+    /// @param name name of the span, must remain valid (typically a string literal).
+    /// @param detail additional text shown with the span.
+    explicit trace_span(const char * name, std::string_view detail = std::string_view())
+        : name_(name), detail_(detail), request_(trace_details::current_request)
+    {
+        if (request_ != 0)
+        {
+            begin_ = trace_details::clock_type::now();
+        }
+    }
+
+    /// Record the span.
+    ~trace_span()
+    {
+        if (request_ != 0)
+        {
+            trace_details::record(name_, request_, begin_,
+                trace_details::clock_type::now(), detail_);
+        }
+    }
+
+private:
+    // not for use
+    trace_span(const trace_span &);
+    void operator=(const trace_span &);
+
+    const char * name_;
+    std::string_view detail_;
+    std::uint64_t request_;
+    trace_details::clock_type::time_point begin_;
+};
+
+} // namespace http
+
+#endif // HTTP_TRACE_H_INCLUDED
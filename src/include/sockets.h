@@ -29,6 +29,7 @@ typedef int socklen_t;
 #include <iostream>
 #include <ostream>
 #include <stdexcept>
+#include <vector>
 
 #include <stdio.h>
 
@@ -89,6 +90,58 @@ public:
 
     void close();
 
+    // forward up to len bytes read from this socket directly to another one
+    // (with splice() through a pipe on Linux, so that the data does not
+    // pass through the user space, and with read/write elsewhere)
+    // returns the number of bytes forwarded, less than len only
+    // if the end of stream was reached
+    size_t forward_to(base_socket_wrapper & to, size_t len);
+
+#ifndef WIN32
+    // sends up to len bytes of the open file, starting at the given offset,
+    // directly to the socket (with sendfile() on Linux, so that the data
+    // does not pass through the user space, and with pread/write elsewhere)
+    // returns the number of bytes sent, less than len only
+    // if the end of file was reached
+    size_t send_file(int file, off_t offset, size_t len);
+#endif
+
+    // shuts down both directions of the connection,
+    // so that the operations blocked on it (also in other threads) return,
+    // for listening socket this stops the pending accept (on Linux)
+    void shutdown();
+
+    // shuts down only the sending direction, so that the peer reads
+    // the end of stream after the data written so far
+    void shutdown_write();
+
+    // get the underlying socket handle
+    socket_type handle() const { return sock_; }
+
+    // takes over the socket that is already listening
+    // (for example inherited from another process)
+    void adopt_listening(socket_type s);
+
+    // switches the socket between blocking and non-blocking mode
+    void set_blocking(bool blocking);
+
+    // waits until the socket is readable (or has the pending connection),
+    // returns false after the timeout
+    bool wait_readable(int timeout_ms);
+
+    // limits the time of the blocking reads and writes (also of splicing),
+    // which fail when it passes, zero means no limit
+    void set_timeouts(int read_timeout_ms, int write_timeout_ms);
+
+    // checks without blocking whether the idle connection
+    // was closed by the peer (always false on Windows)
+    bool peer_closed() const;
+
+    // reads and throws away the data received so far without blocking,
+    // returns true when the peer closed its side or the connection failed
+    // (always true on Windows)
+    bool discard_input();
+
 protected:
 
     // proxy helper for syntax:
@@ -149,8 +202,10 @@ public:
 
     // server methods
 
-    // binds and listens on a given port number
-    void listen(int port, int backlog = 100);
+    // binds and listens on a given port number,
+    // with reuse_port many sockets can listen on the same port
+    // and the kernel spreads the new connections among them
+    void listen(int port, int backlog = 100, bool reuse_port = false);
     
     // accepts the new connection
     // it requires the earlier call to listen
@@ -161,6 +216,13 @@ public:
     // creates the new connection
     void connect(const std::string & address, int port);
 
+    // creates the new connection to the address resolved in advance
+    void connect(const sockaddr_in & address);
+
+    // resolves the host name or the numeric address
+    // (thread-safe, but it can block for a long time)
+    static sockaddr_in resolve(const std::string & address, int port);
+
     // general methods
 
     // get the network address and port number of the socket
@@ -211,6 +273,16 @@ public:
     // get the socket path
     std::string path() const;
 
+    // sends the message together with the socket handles
+    // (which stay open also in this process)
+    void send_handles(const std::string & message,
+        const std::vector<socket_type> & handles);
+
+    // receives the message sent with send_handles,
+    // the received handles are owned by the caller (and closed on exec),
+    // fails when not all of them arrived
+    std::string receive_handles(std::vector<socket_type> & handles);
+
 private:
     // not for use
     unix_socket_wrapper(const unix_socket_wrapper &);
@@ -2,6 +2,10 @@
 
 #include <sstream>
 
+#ifdef _WIN32
+#include <Ws2tcpip.h>
+#endif
+
 #ifndef WIN32
 #include <unistd.h>
 #include <sys/types.h>
@@ -12,13 +16,29 @@
 #include <cerrno>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR -1
 #define closesocket(s) ::close(s)
 #endif
 
+// writing to the connection closed by the peer should fail with EPIPE
+// instead of terminating the whole process with SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
 #include <stdio.h>
 
+#ifdef __linux__
+#define HAVE_SPLICE
+#define HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 socket_runtime_error::socket_runtime_error(const std::string & what)
     : runtime_error(what)
 {
@@ -56,7 +76,7 @@ void base_socket_wrapper::write(const void * buf, std::size_t len)
     int written;
     while (len != 0)
     {
-        if ((written = send(sock_, (const char *)buf, (int)len, 0))
+        if ((written = send(sock_, (const char *)buf, (int)len, SEND_FLAGS))
             == SOCKET_ERROR)
         {
             throw socket_runtime_error("write failed");
@@ -95,13 +115,386 @@ void base_socket_wrapper::close()
     }
 }
 
+void base_socket_wrapper::shutdown()
+{
+    if (sockstate_ == CLOSED)
+    {
+        return;
+    }
+
+#ifdef WIN32
+    (void)::shutdown(sock_, SD_BOTH);
+#else
+    (void)::shutdown(sock_, SHUT_RDWR);
+#endif
+}
+
+void base_socket_wrapper::shutdown_write()
+{
+    if (sockstate_ == CLOSED)
+    {
+        return;
+    }
+
+#ifdef WIN32
+    (void)::shutdown(sock_, SD_SEND);
+#else
+    (void)::shutdown(sock_, SHUT_WR);
+#endif
+}
+
+#ifdef HAVE_SPLICE
+
+namespace // unnamed
+{
+
+// pipe used as the intermediate kernel buffer for splice(),
+// created on the first use in each thread
+struct splice_pipe
+{
+    int fds[2];
+
+    splice_pipe()
+    {
+        if (pipe2(fds, O_CLOEXEC) != 0)
+        {
+            fds[0] = fds[1] = -1;
+        }
+    }
+
+    ~splice_pipe()
+    {
+        if (fds[0] != -1)
+        {
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+    }
+};
+
+const std::size_t splice_block = 64 * 1024;
+
+} // unnamed namespace
+
+#endif // HAVE_SPLICE
+
+std::size_t base_socket_wrapper::forward_to(base_socket_wrapper & to, std::size_t len)
+{
+    if (sockstate_ != CONNECTED && sockstate_ != ACCEPTED)
+    {
+        throw socket_logic_error("socket not connected");
+    }
+
+    std::size_t total = 0;
+
+#ifdef HAVE_SPLICE
+    thread_local splice_pipe pipe;
+
+    if ((pipe.fds[0] != -1) && (to.sockstate_ == CONNECTED || to.sockstate_ == ACCEPTED))
+    {
+        while (total != len)
+        {
+            std::size_t block = len - total < splice_block ? len - total : splice_block;
+
+            ssize_t in = splice(sock_, NULL, pipe.fds[1], NULL, block,
+                SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (in < 0)
+            {
+                if ((errno == EINVAL) && (total == 0))
+                {
+                    // splicing not supported for these descriptors
+                    break;
+                }
+
+                throw socket_runtime_error("read failed");
+            }
+
+            if (in == 0)
+            {
+                return total;
+            }
+
+            // the pipe has to be drained completely before it is used again
+            ssize_t remaining = in;
+            while (remaining != 0)
+            {
+                ssize_t out = splice(pipe.fds[0], NULL, to.sock_, NULL, remaining,
+                    SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (out <= 0)
+                {
+                    // the pipe contents are lost, so is the pipe
+                    ::close(pipe.fds[0]);
+                    ::close(pipe.fds[1]);
+                    pipe.fds[0] = pipe.fds[1] = -1;
+
+                    throw socket_runtime_error("write failed");
+                }
+
+                remaining -= out;
+            }
+
+            total += in;
+        }
+
+        if (total == len)
+        {
+            return total;
+        }
+    }
+#endif // HAVE_SPLICE
+
+    char buf[16 * 1024];
+
+    while (total != len)
+    {
+        std::size_t block = len - total < sizeof(buf) ? len - total : sizeof(buf);
+
+        std::size_t readn = read(buf, block);
+        if (readn == 0)
+        {
+            break;
+        }
+
+        to.write(buf, readn);
+        total += readn;
+    }
+
+    return total;
+}
+
+#ifndef WIN32
+
+std::size_t base_socket_wrapper::send_file(int file, off_t offset, std::size_t len)
+{
+    if (sockstate_ != CONNECTED && sockstate_ != ACCEPTED)
+    {
+        throw socket_logic_error("socket not connected");
+    }
+
+    std::size_t total = 0;
+
+#ifdef HAVE_SENDFILE
+    while (total != len)
+    {
+        ssize_t sent = ::sendfile(sock_, file, &offset, len - total);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (((errno == EINVAL) || (errno == ENOSYS)) && (total == 0))
+            {
+                // not supported for these descriptors
+                break;
+            }
+
+            throw socket_runtime_error("write failed");
+        }
+
+        if (sent == 0)
+        {
+            return total;
+        }
+
+        total += sent;
+    }
+
+    if (total == len)
+    {
+        return total;
+    }
+#endif // HAVE_SENDFILE
+
+    char buf[16 * 1024];
+
+    while (total != len)
+    {
+        std::size_t block = len - total < sizeof(buf) ? len - total : sizeof(buf);
+
+        ssize_t readn = ::pread(file, buf, block, offset);
+        if (readn < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw socket_runtime_error("read failed");
+        }
+
+        if (readn == 0)
+        {
+            break;
+        }
+
+        write(buf, readn);
+        offset += readn;
+        total += readn;
+    }
+
+    return total;
+}
+
+#endif // WIN32
+
+void base_socket_wrapper::adopt_listening(socket_type s)
+{
+    if (sockstate_ != CLOSED)
+    {
+        throw socket_logic_error("socket not in CLOSED state");
+    }
+
+    sock_ = s;
+    sockstate_ = LISTENING;
+}
+
+void base_socket_wrapper::set_blocking(bool blocking)
+{
+    if (sockstate_ == CLOSED)
+    {
+        throw socket_logic_error("socket not open");
+    }
+
+#ifdef WIN32
+    u_long mode = blocking ? 0 : 1;
+    if (::ioctlsocket(sock_, FIONBIO, &mode) == SOCKET_ERROR)
+    {
+        throw socket_runtime_error("ioctlsocket failed");
+    }
+#else
+    int flags = ::fcntl(sock_, F_GETFL, 0);
+    if ((flags == -1) ||
+        (::fcntl(sock_, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK)) == -1))
+    {
+        throw socket_runtime_error("fcntl failed");
+    }
+#endif
+}
+
+bool base_socket_wrapper::wait_readable(int timeout_ms)
+{
+    if (sockstate_ == CLOSED)
+    {
+        throw socket_logic_error("socket not open");
+    }
+
+#ifdef WIN32
+    WSAPOLLFD fd;
+    fd.fd = sock_;
+    fd.events = POLLRDNORM;
+    fd.revents = 0;
+
+    int n = ::WSAPoll(&fd, 1, timeout_ms);
+#else
+    pollfd fd;
+    fd.fd = sock_;
+    fd.events = POLLIN;
+    fd.revents = 0;
+
+    int n = ::poll(&fd, 1, timeout_ms);
+    if ((n < 0) && (errno == EINTR))
+    {
+        return false;
+    }
+#endif
+
+    if (n < 0)
+    {
+        throw socket_runtime_error("poll failed");
+    }
+
+    return n != 0;
+}
+
+void base_socket_wrapper::set_timeouts(int read_timeout_ms, int write_timeout_ms)
+{
+    if (sockstate_ == CLOSED)
+    {
+        throw socket_logic_error("socket not open");
+    }
+
+    int timeouts[2] = { read_timeout_ms, write_timeout_ms };
+    int options[2] = { SO_RCVTIMEO, SO_SNDTIMEO };
+
+    for (int i = 0; i != 2; ++i)
+    {
+#ifdef WIN32
+        DWORD tv = (DWORD)timeouts[i];
+#else
+        timeval tv;
+        tv.tv_sec = timeouts[i] / 1000;
+        tv.tv_usec = (timeouts[i] % 1000) * 1000;
+#endif
+        if (::setsockopt(sock_, SOL_SOCKET, options[i],
+            (const char *)&tv, sizeof(tv)) == SOCKET_ERROR)
+        {
+            throw socket_runtime_error("setsockopt failed");
+        }
+    }
+}
+
+bool base_socket_wrapper::peer_closed() const
+{
+    if (sockstate_ != CONNECTED && sockstate_ != ACCEPTED)
+    {
+        return true;
+    }
+
+#ifdef WIN32
+    return false;
+#else
+    char c;
+    int readn = recv(sock_, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    // no data pending on the live connection makes the call fail with EAGAIN
+    return (readn == 0) || ((readn < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK));
+#endif
+}
+
+bool base_socket_wrapper::discard_input()
+{
+    if (sockstate_ != CONNECTED && sockstate_ != ACCEPTED)
+    {
+        return true;
+    }
+
+#ifdef WIN32
+    return true;
+#else
+    char buf[4096];
+
+    // bounded, so that the peer that keeps sending does not hold the caller
+    for (int i = 0; i != 16; ++i)
+    {
+        ssize_t readn = recv(sock_, buf, sizeof(buf), MSG_DONTWAIT);
+
+        if (readn > 0)
+        {
+            continue;
+        }
+
+        if ((readn < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        // nothing more pending on the live connection fails with EAGAIN
+        return (readn == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK));
+    }
+
+    return false;
+#endif
+}
+
 tcp_socket_wrapper::tcp_socket_wrapper(
     const tcp_socket_wrapper::tcp_accepted_socket & as)
     : base_socket_wrapper(as), sockaddress_(as.addr_)
 {
 }
 
-void tcp_socket_wrapper::listen(int port, int backlog)
+void tcp_socket_wrapper::listen(int port, int backlog, bool reuse_port)
 {
     if (sockstate_ != CLOSED)
     {
@@ -125,6 +518,21 @@ void tcp_socket_wrapper::listen(int port, int backlog)
         closesocket(sock_);
         throw socket_runtime_error("setsockopt failed");
     }
+
+    if (reuse_port)
+    {
+#ifdef SO_REUSEPORT
+        if (::setsockopt(sock_, SOL_SOCKET, SO_REUSEPORT,
+            &option_value, sizeof(option_value)) == SOCKET_ERROR)
+        {
+            closesocket(sock_);
+            throw socket_runtime_error("setsockopt failed");
+        }
+#else
+        closesocket(sock_);
+        throw socket_logic_error("SO_REUSEPORT not supported");
+#endif
+    }
     
     sockaddr_in local;
 
@@ -183,48 +591,49 @@ tcp_socket_wrapper::tcp_accepted_socket tcp_socket_wrapper::accept()
     return tcp_accepted_socket(newsocket, from);
 }
 
-void tcp_socket_wrapper::connect(const std::string & address, int port)
+sockaddr_in tcp_socket_wrapper::resolve(const std::string & address, int port)
 {
-    if (sockstate_ != CLOSED)
-    {
-        throw socket_logic_error("socket not in CLOSED state");
-    }
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
 
-    sock_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock_ == INVALID_SOCKET)
+    addrinfo * result = NULL;
+    if ((::getaddrinfo(address.c_str(), NULL, &hints, &result) != 0) || (result == NULL))
     {
-        throw socket_runtime_error("socket failed");
+        throw socket_runtime_error("cannot resolve address");
     }
 
-    hostent * hp;
+    sockaddr_in resolved;
+    memset(&resolved, 0, sizeof(resolved));
+    memcpy(&resolved, result->ai_addr, sizeof(resolved));
+    resolved.sin_family = AF_INET;
+    resolved.sin_port = htons((u_short)port);
 
-    unsigned long addr = inet_addr(address.c_str());
-    if (addr != INADDR_NONE)
-    {
-        hp = gethostbyaddr((const char *)&addr, 4, AF_INET);
-    }
-    else
-    {
-        hp = gethostbyname(address.c_str());
-    }
+    ::freeaddrinfo(result);
+
+    return resolved;
+}
 
-    if (hp == NULL)
+void tcp_socket_wrapper::connect(const std::string & address, int port)
+{
+    connect(resolve(address, port));
+}
+
+void tcp_socket_wrapper::connect(const sockaddr_in & address)
+{
+    if (sockstate_ != CLOSED)
     {
-        closesocket(sock_);
-        throw socket_runtime_error("cannot resolve address");
+        throw socket_logic_error("socket not in CLOSED state");
     }
 
-    if (hp->h_addrtype != AF_INET)
+    sock_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock_ == INVALID_SOCKET)
     {
-        closesocket(sock_);
-        throw socket_runtime_error
-            ("address resolved with TCP incompatible type");
+        throw socket_runtime_error("socket failed");
     }
 
-    memset(&sockaddress_, 0, sizeof(sockaddress_));
-    memcpy(&(sockaddress_.sin_addr), hp->h_addr_list[0], hp->h_length);
-    sockaddress_.sin_family = AF_INET;
-    sockaddress_.sin_port = htons((u_short)port);
+    sockaddress_ = address;
 
     if (::connect(sock_, (sockaddr *)&sockaddress_, sizeof(sockaddress_))
         == SOCKET_ERROR)
@@ -335,6 +744,119 @@ unix_socket_wrapper::unix_accepted_socket unix_socket_wrapper::accept()
     return unix_accepted_socket(newsocket, from);
 }
 
+void unix_socket_wrapper::send_handles(const std::string & message,
+    const std::vector<socket_type> & handles)
+{
+    if (sockstate_ != CONNECTED && sockstate_ != ACCEPTED)
+    {
+        throw socket_logic_error("socket not connected");
+    }
+
+    // at least one byte of the regular data has to accompany the handles
+    std::string payload = message.empty() ? std::string(1, '\n') : message;
+
+    iovec iov;
+    iov.iov_base = &payload[0];
+    iov.iov_len = payload.size();
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * handles.size()));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (handles.empty() == false)
+    {
+        msg.msg_control = &control[0];
+        msg.msg_controllen = control.size();
+
+        cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * handles.size());
+        memcpy(CMSG_DATA(cmsg), &handles[0], sizeof(int) * handles.size());
+    }
+
+    if (::sendmsg(sock_, &msg, SEND_FLAGS) != (ssize_t)payload.size())
+    {
+        throw socket_runtime_error("sendmsg failed");
+    }
+}
+
+std::string unix_socket_wrapper::receive_handles(std::vector<socket_type> & handles)
+{
+    if (sockstate_ != CONNECTED && sockstate_ != ACCEPTED)
+    {
+        throw socket_logic_error("socket not connected");
+    }
+
+    const std::size_t max_handles = 64;
+
+    std::vector<char> payload(64 * 1024);
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * max_handles));
+
+    iovec iov;
+    iov.iov_base = &payload[0];
+    iov.iov_len = payload.size();
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control[0];
+    msg.msg_controllen = control.size();
+
+    // the received handles are not leaked to the programs started later
+#ifdef MSG_CMSG_CLOEXEC
+    const int flags = MSG_CMSG_CLOEXEC;
+#else
+    const int flags = 0;
+#endif
+
+    ssize_t readn = ::recvmsg(sock_, &msg, flags);
+    if (readn < 0)
+    {
+        throw socket_runtime_error("recvmsg failed");
+    }
+
+    handles.clear();
+
+    for (cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+        {
+            std::size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int * received = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+
+            handles.insert(handles.end(), received, received + n);
+        }
+    }
+
+#ifndef MSG_CMSG_CLOEXEC
+    for (int h : handles)
+    {
+        (void)::fcntl(h, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    // the handles discarded by the kernel (or the truncated message)
+    // make the rest impossible to match with their addresses
+    if ((msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) != 0)
+    {
+        for (int h : handles)
+        {
+            closesocket(h);
+        }
+
+        handles.clear();
+
+        throw socket_runtime_error("received handles truncated");
+    }
+
+    return std::string(&payload[0], readn);
+}
+
 void unix_socket_wrapper::connect(const std::string & path)
 {
     if (sockstate_ != CLOSED)
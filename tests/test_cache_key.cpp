@@ -0,0 +1,93 @@
+//
+// Tests of the cache keys of GET actions, which must not depend
+// on the order of the distinct URL parameters.
+//
+
+#include <http_cache.h>
+
+#include "test_check.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+using namespace http;
+
+namespace
+{
+
+bool same_key(const std::string & a, const std::string & b)
+{
+    return cache_key("/action", a) == cache_key("/action", b);
+}
+
+void test_ordering()
+{
+    test::check(same_key("a=1&b=2", "b=2&a=1"), "two parameters swapped");
+    test::check(same_key("c=3&a=1&b=2", "b=2&c=3&a=1"), "three parameters rotated");
+    test::check(cache_key("/action", "b=2&a=1") == "/action?a=1&b=2", "sorted form");
+    test::check(same_key("", ""), "no parameters");
+    test::check(cache_key("/action", "") == "/action?", "key without parameters");
+}
+
+void test_names()
+{
+    // sorted by the name alone, not by the whole field
+    test::check(cache_key("/action", "ab=1&a=2") == "/action?a=2&ab=1", "name prefix first");
+    test::check(cache_key("/action", "a=2&a-b=1") == "/action?a=2&a-b=1",
+        "name sorted before its longer variants");
+    test::check(same_key("flag&a=1", "a=1&flag"), "parameter without value");
+
+    // compared in the encoded form, as received
+    test::check(same_key("%41=1&B=2", "B=2&%41=1"), "encoded names");
+    test::check(same_key("a=1", "%61=1") == false, "encoded name differs from plain one");
+}
+
+void test_repeated()
+{
+    // the last value wins, so the order of the repeated names matters
+    test::check(same_key("a=1&a=2", "a=2&a=1") == false, "repeated name keeps its order");
+    test::check(same_key("a=1&b=0&a=2", "b=0&a=1&a=2"), "repeated name among others");
+    test::check(cache_key("/action", "a=2&b=0&a=1") == "/action?a=2&a=1&b=0",
+        "stable order of repeated names");
+}
+
+void test_separators()
+{
+    test::check(same_key("a=1&&b=2", "b=2&a=1"), "empty field ignored");
+    test::check(same_key("&a=1&", "a=1"), "leading and trailing separators");
+    test::check(same_key("a=1&b=2", "a=1&b=2&"), "trailing separator");
+    test::check(same_key("a=1&b=2", "a=12") == false, "values are not merged");
+    test::check(cache_key("/a", "b=1") != cache_key("/a?b=1", ""),
+        "path separated from parameters");
+    test::check(cache_key("/one", "a=1") != cache_key("/two", "a=1"), "different paths");
+}
+
+void test_cache_lookup()
+{
+    response_cache cache;
+    response_cache::clock_type::time_point expires =
+        response_cache::clock_type::now() + std::chrono::seconds(60);
+
+    cache.insert(cache_key("/report", "year=2024&month=5"),
+        std::make_shared<const std::string>("response"), expires);
+
+    response_cache::response_type found = cache.find(cache_key("/report", "month=5&year=2024"));
+
+    test::check((found != nullptr) && (*found == "response"), "found with reordered parameters");
+    test::check(cache.find(cache_key("/report", "month=6&year=2024")) == nullptr,
+        "other values not found");
+}
+
+} // unnamed namespace
+
+int main()
+{
+    test_ordering();
+    test_names();
+    test_repeated();
+    test_separators();
+    test_cache_lookup();
+
+    return test::result();
+}
@@ -0,0 +1,60 @@
+//
+// This file defines the checks shared by the tests, each of which
+// is a program that exits with non-zero status when any check failed.
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file Boost_Software_License_1_0.txt
+// or copy at http://www.opensource.org/licenses/bsl1.0.html)
+//
+
+#ifndef TEST_CHECK_H_INCLUDED
+#define TEST_CHECK_H_INCLUDED
+
+#include <iostream>
+#include <source_location>
+
+namespace test
+{
+
+inline int failures = 0;
+
+// reports the failed condition with its location, the test continues
+inline void check(bool condition, const char * what,
+    std::source_location where = std::source_location::current())
+{
+    if (condition == false)
+    {
+        std::cerr << where.file_name() << ':' << where.line() << ": failed: " << what << '\n';
+        ++failures;
+    }
+}
+
+// checks that the function throws the given exception
+template <typename Exception, typename Function>
+void check_throws(Function f, const char * what,
+    std::source_location where = std::source_location::current())
+{
+    try
+    {
+        f();
+    }
+    catch (const Exception &)
+    {
+        return;
+    }
+    catch (...)
+    {
+    }
+
+    check(false, what, where);
+}
+
+// exit status of the test
+inline int result()
+{
+    return (failures == 0) ? 0 : 1;
+}
+
+} // namespace test
+
+#endif // TEST_CHECK_H_INCLUDED
@@ -0,0 +1,210 @@
+//
+// Tests of the chunked transfer coding: the edge cases of the chunk size
+// line, the limits of the line lengths and the truncated bodies on input,
+// the termination on output.
+//
+
+#include <http_chunked.h>
+
+#include "test_check.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace http;
+
+namespace
+{
+
+struct decoded
+{
+    std::string body;
+    bool complete;
+    std::string rest; // left in the underlying stream
+};
+
+decoded decode(const std::string & encoded, std::size_t buffer_size = 8192)
+{
+    std::istringstream in(encoded);
+    chunked_istream chunked(in, buffer_size);
+
+    decoded result;
+
+    char buf[5];
+    while (chunked.read(buf, sizeof(buf)) || (chunked.gcount() != 0))
+    {
+        result.body.append(buf, (std::size_t)chunked.gcount());
+    }
+
+    result.complete = chunked.drain();
+
+    in.clear();
+    std::ostringstream rest;
+    rest << in.rdbuf();
+    result.rest = rest.str();
+
+    return result;
+}
+
+bool complete(const std::string & encoded, const std::string & body)
+{
+    decoded d = decode(encoded);
+
+    return d.complete && (d.body == body);
+}
+
+bool incomplete(const std::string & encoded)
+{
+    return decode(encoded).complete == false;
+}
+
+void test_chunk_sizes()
+{
+    test::check(complete("5\r\nhello\r\n0\r\n\r\n", "hello"), "single chunk");
+    test::check(complete("0\r\n\r\n", ""), "empty body");
+    test::check(complete("a\r\n0123456789\r\n1\r\n!\r\n0\r\n\r\n", "0123456789!"),
+        "lowercase hex");
+    test::check(complete("A\r\n0123456789\r\n0\r\n\r\n", "0123456789"), "uppercase hex");
+    test::check(complete("000005\r\nhello\r\n0\r\n\r\n", "hello"), "leading zeros");
+    test::check(complete("5;name=value\r\nhello\r\n0;last\r\n\r\n", "hello"),
+        "chunk extensions");
+    test::check(complete("5\nhello\n0\n\n", "hello"), "bare LF line ends");
+
+    test::check(incomplete("\r\nhello\r\n0\r\n\r\n"), "missing size");
+    test::check(incomplete("x5\r\nhello\r\n0\r\n\r\n"), "size not hexadecimal");
+    test::check(incomplete(" 5\r\nhello\r\n0\r\n\r\n"), "leading space");
+    test::check(incomplete("-5\r\nhello\r\n0\r\n\r\n"), "negative size");
+    test::check(incomplete("1000000000000000\r\nhello\r\n0\r\n\r\n"), "size too long");
+    test::check(incomplete("5\r\nhelloXX\r\n0\r\n\r\n"), "chunk longer than its size");
+}
+
+void test_large_chunks()
+{
+    // chunks larger than the decoding buffer
+    std::string body(100000, 'x');
+    for (std::size_t i = 0; i != body.size(); ++i)
+    {
+        body[i] = (char)('a' + i % 26);
+    }
+
+    std::ostringstream encoded;
+    encoded << std::hex << body.size() << "\r\n" << body << "\r\n0\r\n\r\n";
+
+    decoded d = decode(encoded.str(), 7);
+    test::check(d.complete && (d.body == body), "chunk larger than the buffer");
+}
+
+void test_trailers()
+{
+    decoded d = decode("5\r\nhello\r\n0\r\nExpires: never\r\nX-Sum: 1\r\n\r\nGET / HTTP/1.1\r\n");
+
+    test::check(d.complete && (d.body == "hello"), "trailer section skipped");
+    test::check(d.rest == "GET / HTTP/1.1\r\n", "positioned at the next request");
+}
+
+void test_long_lines()
+{
+    std::string extension = ";name=" + std::string(8000, 'x');
+    test::check(complete("5" + extension + "\r\nhello\r\n0\r\n\r\n", "hello"),
+        "long chunk extension");
+
+    // an endless line is not read into memory
+    extension = ";name=" + std::string(10000, 'x');
+    test::check(incomplete("5" + extension + "\r\nhello\r\n0\r\n\r\n"),
+        "chunk size line too long");
+    test::check(incomplete("5\r\nhello\r\n0" + extension + "\r\n\r\n"),
+        "last chunk line too long");
+
+    std::string trailer = "X-Long: " + std::string(70000, 'x') + "\r\n";
+    test::check(incomplete("5\r\nhello\r\n0\r\n" + trailer + "\r\n"), "trailer line too long");
+
+    std::string trailers;
+    for (int i = 0; i != 100; ++i)
+    {
+        trailers += "X-Field: " + std::string(1000, 'x') + "\r\n";
+    }
+
+    test::check(incomplete("5\r\nhello\r\n0\r\n" + trailers + "\r\n"),
+        "trailer section too long");
+    test::check(complete("5\r\nhello\r\n0\r\n" + trailers.substr(0, 50 * 1011) + "\r\n",
+        "hello"), "trailer section within the limit");
+}
+
+void test_truncated()
+{
+    test::check(incomplete(""), "no chunk at all");
+    test::check(incomplete("5\r\nhel"), "truncated chunk data");
+    test::check(incomplete("5\r\nhello"), "missing CRLF after the data");
+    test::check(incomplete("5\r\nhello\r\n"), "missing last chunk");
+    test::check(incomplete("5\r\nhello\r\n0"), "last chunk without its line end");
+    test::check(incomplete("5\r\nhello\r\n0\r\n"), "missing terminating empty line");
+    test::check(incomplete("5\r\nhello\r\n0\r\nX-Sum: 1\r\n"), "truncated trailer section");
+}
+
+void test_output()
+{
+    std::ostringstream out;
+    {
+        chunked_ostream chunked(out, 4);
+        chunked << "hello world";
+        chunked.flush();
+        chunked << "!";
+    }
+
+    test::check(out.str() == "4\r\nhell\r\n4\r\no wo\r\n3\r\nrld\r\n1\r\n!\r\n0\r\n\r\n",
+        "body terminated when the stream is destroyed");
+    test::check(complete(out.str(), "hello world!"), "output decoded back");
+
+    std::ostringstream empty;
+    {
+        chunked_ostream chunked(empty);
+        chunked.finish();
+        chunked << "ignored";
+    }
+
+    test::check(empty.str() == "0\r\n\r\n", "nothing written after finish");
+}
+
+void test_failed_output()
+{
+    std::ostringstream out;
+    {
+        chunked_ostream chunked(out);
+        chunked << "partial";
+        chunked.fail();
+    }
+
+    test::check(out.str() == "7\r\npartial\r\n", "no last chunk after fail");
+    test::check(out.bad(), "underlying stream marked bad");
+
+    std::ostringstream thrown;
+    try
+    {
+        chunked_ostream chunked(thrown);
+        chunked << "partial";
+
+        throw std::runtime_error("handler failed");
+    }
+    catch (const std::runtime_error &)
+    {
+    }
+
+    test::check(thrown.str() == "7\r\npartial\r\n", "no last chunk after exception");
+    test::check(incomplete(thrown.str()), "abandoned body seen as truncated");
+}
+
+} // unnamed namespace
+
+int main()
+{
+    test_chunk_sizes();
+    test_large_chunks();
+    test_trailers();
+    test_long_lines();
+    test_truncated();
+    test_output();
+    test_failed_output();
+
+    return test::result();
+}
@@ -0,0 +1,267 @@
+//
+// Tests of the HTTP/2 request fields: the malformed header blocks
+// (RFC 9113, section 8.2) must reset their streams with PROTOCOL_ERROR
+// before anything reaches the action.
+//
+
+#include <http_h2.h>
+#include <http_hpack.h>
+
+#include "test_check.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace http;
+
+namespace
+{
+
+typedef std::vector<header_field> header_list;
+
+const unsigned char headers_frame = 0x1;
+const unsigned char rst_stream_frame = 0x3;
+const unsigned char settings_frame = 0x4;
+const unsigned char end_stream_flag = 0x1;
+const unsigned char end_headers_flag = 0x4;
+const std::uint32_t protocol_error = 0x1;
+
+void append_frame(std::string & out, unsigned char type, unsigned char flags,
+    std::uint32_t stream_id, const std::string & payload)
+{
+    out.push_back((char)(payload.size() >> 16));
+    out.push_back((char)(payload.size() >> 8));
+    out.push_back((char)payload.size());
+    out.push_back((char)type);
+    out.push_back((char)flags);
+    out.push_back((char)(stream_id >> 24));
+    out.push_back((char)(stream_id >> 16));
+    out.push_back((char)(stream_id >> 8));
+    out.push_back((char)stream_id);
+    out.append(payload);
+}
+
+std::uint32_t read_uint(const std::string & s, std::size_t pos, std::size_t size)
+{
+    std::uint32_t v = 0;
+    for (std::size_t i = 0; i != size; ++i)
+    {
+        v = (v << 8) | (unsigned char)s[pos + i];
+    }
+
+    return v;
+}
+
+struct exchange
+{
+    std::vector<std::string> served;     // resources passed to the handler
+    std::uint32_t reset_code = 0;        // of the stream 1, 0 if not reset
+    bool responded = false;              // HEADERS sent on the stream 1
+    bool finished = false;               // stream 1 ended or reset
+};
+
+// scans the frames written so far
+void scan_output(const std::string & output, exchange & result)
+{
+    for (std::size_t pos = 0; pos + 9 <= output.size(); )
+    {
+        std::size_t length = read_uint(output, pos, 3);
+        unsigned char type = (unsigned char)output[pos + 3];
+        unsigned char flags = (unsigned char)output[pos + 4];
+        std::uint32_t stream_id = read_uint(output, pos + 5, 4) & 0x7fffffff;
+
+        if (pos + 9 + length > output.size())
+        {
+            break;
+        }
+
+        if ((stream_id == 1) && (type == rst_stream_frame) && (length == 4))
+        {
+            result.reset_code = read_uint(output, pos + 9, 4);
+            result.finished = true;
+        }
+        else if (stream_id == 1)
+        {
+            result.responded = result.responded || (type == headers_frame);
+            result.finished = result.finished || ((flags & end_stream_flag) != 0);
+        }
+
+        pos += 9 + length;
+    }
+}
+
+// the frames of the client, followed by the end of the connection
+// only after the server finished the stream 1 (or gave up waiting)
+class client_input : public std::stringbuf
+{
+public:
+    client_input(const std::string & frames, std::mutex & mtx, std::condition_variable & cv,
+        const exchange & result)
+        : std::stringbuf(frames, std::ios_base::in), mtx_(mtx), cv_(cv), result_(result)
+    {
+    }
+
+protected:
+    int_type underflow() override
+    {
+        int_type c = std::stringbuf::underflow();
+
+        if (c == traits_type::eof())
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            cv_.wait_for(lck, std::chrono::seconds(5), [this]() { return result_.finished; });
+        }
+
+        return c;
+    }
+
+private:
+    std::mutex & mtx_;
+    std::condition_variable & cv_;
+    const exchange & result_;
+};
+
+// sends the request of the stream 1 on a new connection
+exchange send_request(const header_list & fields)
+{
+    std::string block;
+    for (const header_field & f : fields)
+    {
+        hpack_encoder::encode(f.first, f.second, block);
+    }
+
+    std::string frames = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    append_frame(frames, settings_frame, 0, 0, "");
+    append_frame(frames, headers_frame, end_headers_flag | end_stream_flag, 1, block);
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::string output;
+    exchange result;
+
+    client_input input(frames, mtx, cv, result);
+    std::istream in(&input);
+
+    h2_details::serve(in,
+        [&](const char * data, std::size_t size)
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            output.append(data, size);
+            scan_output(output, result);
+            cv.notify_all();
+        },
+        [&](const h2_details::stream_request & request, std::istream &, std::ostream & out)
+        {
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                result.served.push_back(request.resource);
+            }
+
+            out << "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+        },
+        [](std::size_t) { return true; },
+        h2_details::connection_options());
+
+    return result;
+}
+
+header_list request_fields(const std::string & path)
+{
+    return { { ":method", "GET" }, { ":scheme", "http" }, { ":path", path },
+        { ":authority", "localhost" } };
+}
+
+header_list with_field(const std::string & name, const std::string & value)
+{
+    header_list fields = request_fields("/");
+    fields.push_back({ name, value });
+
+    return fields;
+}
+
+void check_rejected(const header_list & fields, const char * what)
+{
+    exchange e = send_request(fields);
+
+    test::check((e.reset_code == protocol_error) && e.served.empty() && (e.responded == false),
+        what);
+}
+
+void test_valid()
+{
+    exchange e = send_request(with_field("x-custom", "value with spaces"));
+
+    test::check((e.reset_code == 0) && (e.served.size() == 1) && (e.served[0] == "/") &&
+        e.responded, "valid request served");
+
+    e = send_request(with_field("te", "trailers"));
+    test::check((e.reset_code == 0) && (e.served.size() == 1), "te: trailers allowed");
+
+    header_list options = request_fields("*");
+    options[0].second = "OPTIONS";
+    e = send_request(options);
+    test::check((e.reset_code == 0) && (e.served.size() == 1), "asterisk of OPTIONS");
+}
+
+void test_names()
+{
+    check_rejected(with_field("X-Custom", "value"), "uppercase name");
+    check_rejected(with_field("x custom", "value"), "space in the name");
+    check_rejected(with_field("x-custom\r\nx-injected", "value"), "CRLF in the name");
+    check_rejected(with_field("", "value"), "empty name");
+    check_rejected(with_field(":status", "200"), "response pseudo-header");
+    check_rejected(with_field(":unknown", "value"), "unknown pseudo-header");
+
+    header_list late = with_field("x-custom", "value");
+    late.push_back({ ":method", "GET" });
+    check_rejected(late, "pseudo-header after the regular fields");
+}
+
+void test_values()
+{
+    check_rejected(with_field("x-custom", "a\r\nx-injected: 1"), "CRLF in the value");
+    check_rejected(with_field("x-custom", "a\nb"), "LF in the value");
+    check_rejected(with_field("x-custom", "a\rb"), "CR in the value");
+    check_rejected(with_field("x-custom", std::string("a\0b", 3)), "NUL in the value");
+}
+
+void test_connection_specific()
+{
+    check_rejected(with_field("connection", "close"), "connection");
+    check_rejected(with_field("keep-alive", "timeout=5"), "keep-alive");
+    check_rejected(with_field("proxy-connection", "keep-alive"), "proxy-connection");
+    check_rejected(with_field("transfer-encoding", "chunked"), "transfer-encoding");
+    check_rejected(with_field("upgrade", "websocket"), "upgrade");
+    check_rejected(with_field("te", "gzip"), "te other than trailers");
+}
+
+void test_path()
+{
+    check_rejected(request_fields("index.html"), "path without the leading slash");
+    check_rejected(request_fields("http://localhost/"), "absolute form");
+    check_rejected(request_fields("/a b"), "space in the path");
+    check_rejected(request_fields("/a\tb"), "tab in the path");
+    check_rejected(request_fields("/ HTTP/1.1\r\nhost: other\r\n\r\nGET /"),
+        "request smuggled in the path");
+    check_rejected(request_fields("*"), "asterisk of GET");
+    check_rejected(request_fields(""), "empty path");
+}
+
+} // unnamed namespace
+
+int main()
+{
+    test_valid();
+    test_names();
+    test_values();
+    test_connection_specific();
+    test_path();
+
+    return test::result();
+}
@@ -0,0 +1,288 @@
+//
+// Tests of the HPACK header compression with the examples
+// of RFC 7541, Appendix C, including the evictions from the dynamic table.
+//
+
+#include <http_hpack.h>
+
+#include "test_check.h"
+
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace http;
+
+namespace
+{
+
+typedef std::vector<header_field> header_list;
+
+// the header block written as in the RFC, hexadecimal with spaces
+std::vector<unsigned char> from_hex(const std::string & text)
+{
+    std::vector<unsigned char> bytes;
+    int high = -1;
+
+    for (char c : text)
+    {
+        if (std::isxdigit((unsigned char)c) == 0)
+        {
+            continue;
+        }
+
+        int v = std::isdigit((unsigned char)c) ? (c - '0') : (std::tolower(c) - 'a' + 10);
+
+        if (high < 0)
+        {
+            high = v;
+        }
+        else
+        {
+            bytes.push_back((unsigned char)(high * 16 + v));
+            high = -1;
+        }
+    }
+
+    return bytes;
+}
+
+header_list decode(hpack_decoder & decoder, const std::string & hex)
+{
+    std::vector<unsigned char> block = from_hex(hex);
+
+    header_list headers;
+    decoder.decode(block.data(), block.size(), headers);
+
+    return headers;
+}
+
+void check_decoded(hpack_decoder & decoder, const std::string & hex,
+    const header_list & expected, const char * what)
+{
+    try
+    {
+        test::check(decode(decoder, hex) == expected, what);
+    }
+    catch (const std::exception &)
+    {
+        test::check(false, what);
+    }
+}
+
+void check_rejected(hpack_decoder & decoder, const std::string & hex, const char * what)
+{
+    test::check_throws<std::runtime_error>([&decoder, &hex]() { decode(decoder, hex); }, what);
+}
+
+// C.2, the individual representations
+void test_literal_fields()
+{
+    hpack_decoder with_indexing;
+    check_decoded(with_indexing,
+        "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572",
+        { { "custom-key", "custom-header" } }, "C.2.1 literal with indexing");
+    check_decoded(with_indexing, "be",
+        { { "custom-key", "custom-header" } }, "C.2.1 entry added to the dynamic table");
+
+    hpack_decoder without_indexing;
+    check_decoded(without_indexing, "040c 2f73 616d 706c 652f 7061 7468",
+        { { ":path", "/sample/path" } }, "C.2.2 literal without indexing");
+    check_rejected(without_indexing, "be", "C.2.2 nothing added to the dynamic table");
+
+    hpack_decoder never_indexed;
+    check_decoded(never_indexed, "1008 7061 7373 776f 7264 0673 6563 7265 74",
+        { { "password", "secret" } }, "C.2.3 literal never indexed");
+    check_rejected(never_indexed, "be", "C.2.3 nothing added to the dynamic table");
+
+    hpack_decoder indexed;
+    check_decoded(indexed, "82", { { ":method", "GET" } }, "C.2.4 indexed field");
+}
+
+const header_list first_request =
+{
+    { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+    { ":authority", "www.example.com" }
+};
+
+const header_list second_request =
+{
+    { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+    { ":authority", "www.example.com" }, { "cache-control", "no-cache" }
+};
+
+const header_list third_request =
+{
+    { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+    { ":authority", "www.example.com" }, { "custom-key", "custom-value" }
+};
+
+// C.3, the requests on one connection, without Huffman coding
+void test_requests()
+{
+    hpack_decoder decoder;
+
+    check_decoded(decoder, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+        first_request, "C.3.1 first request");
+    check_decoded(decoder, "8286 84be 5808 6e6f 2d63 6163 6865",
+        second_request, "C.3.2 second request");
+    check_decoded(decoder,
+        "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+        third_request, "C.3.3 third request");
+}
+
+// C.4, the same requests with Huffman coding
+void test_requests_huffman()
+{
+    hpack_decoder decoder;
+
+    check_decoded(decoder, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+        first_request, "C.4.1 first request");
+    check_decoded(decoder, "8286 84be 5886 a8eb 1064 9cbf",
+        second_request, "C.4.2 second request");
+    check_decoded(decoder,
+        "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+        third_request, "C.4.3 third request");
+}
+
+const header_list first_response =
+{
+    { ":status", "302" }, { "cache-control", "private" },
+    { "date", "Mon, 21 Oct 2013 20:13:21 GMT" }, { "location", "https://www.example.com" }
+};
+
+const header_list second_response =
+{
+    { ":status", "307" }, { "cache-control", "private" },
+    { "date", "Mon, 21 Oct 2013 20:13:21 GMT" }, { "location", "https://www.example.com" }
+};
+
+const header_list third_response =
+{
+    { ":status", "200" }, { "cache-control", "private" },
+    { "date", "Mon, 21 Oct 2013 20:13:22 GMT" }, { "location", "https://www.example.com" },
+    { "content-encoding", "gzip" },
+    { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" }
+};
+
+// after the third response only its three new entries fit in the table:
+// set-cookie, content-encoding and date
+void check_evicted(hpack_decoder & decoder, const char * what)
+{
+    check_decoded(decoder, "be c0",
+        { third_response[5], third_response[2] }, what);
+    check_rejected(decoder, "c1", what);
+}
+
+// C.5, the responses with the dynamic table limited to 256 bytes,
+// so that the older entries are evicted, without Huffman coding
+void test_responses()
+{
+    hpack_decoder decoder(256);
+
+    check_decoded(decoder,
+        "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230"
+        "3133 2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65"
+        "7861 6d70 6c65 2e63 6f6d",
+        first_response, "C.5.1 first response");
+    check_decoded(decoder, "4803 3330 37c1 c0bf",
+        second_response, "C.5.2 second response, :status 302 evicted");
+    check_decoded(decoder,
+        "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220"
+        "474d 54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157"
+        "454f 5049 5541 5851 5745 4f49 553b 206d 6178 2d61 6765 3d33 3630 303b 2076"
+        "6572 7369 6f6e 3d31",
+        third_response, "C.5.3 third response, four entries evicted");
+
+    check_evicted(decoder, "C.5.3 dynamic table after the evictions");
+}
+
+// C.6, the same responses with Huffman coding
+void test_responses_huffman()
+{
+    hpack_decoder decoder(256);
+
+    check_decoded(decoder,
+        "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0"
+        "82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+        first_response, "C.6.1 first response");
+    check_decoded(decoder, "4883 640e ffc1 c0bf",
+        second_response, "C.6.2 second response, :status 302 evicted");
+    check_decoded(decoder,
+        "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b"
+        "d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27"
+        "0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+        third_response, "C.6.3 third response, four entries evicted");
+
+    check_evicted(decoder, "C.6.3 dynamic table after the evictions");
+}
+
+void test_table_size_update()
+{
+    hpack_decoder decoder(256);
+
+    check_decoded(decoder,
+        "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572",
+        { { "custom-key", "custom-header" } }, "entry added before the update");
+
+    // the size 0 evicts everything, the following block starts empty
+    check_decoded(decoder, "20 82", { { ":method", "GET" } }, "size update to zero");
+    check_rejected(decoder, "be", "table empty after the size update");
+
+    // the size 257 (31 + 98 + 128) exceeds the announced maximum
+    hpack_decoder limited(256);
+    check_rejected(limited, "3f e2 01", "size update above the maximum");
+}
+
+void test_malformed()
+{
+    hpack_decoder decoder;
+
+    check_rejected(decoder, "80", "index zero");
+    check_rejected(decoder, "ff 80 80 80 80 80 80 80 80 80 01", "index overflow");
+    check_rejected(decoder, "400a 6375 7374", "truncated string");
+    check_rejected(decoder, "4085 ffff ffff ff 00", "Huffman code of EOS");
+}
+
+void test_encoder()
+{
+    std::string block;
+    hpack_encoder::encode(":status", "200", block);
+    test::check(block == "\x88", "static entry encoded as its index");
+
+    const header_list fields =
+    {
+        { ":status", "404" }, { "content-type", "text/html; charset=utf-8" },
+        { "cache-control", "private" }, { "x-custom", "value with spaces" },
+        { "date", "Mon, 21 Oct 2013 20:13:21 GMT" }, { "empty", "" }
+    };
+
+    block.clear();
+    for (const header_field & f : fields)
+    {
+        hpack_encoder::encode(f.first, f.second, block);
+    }
+
+    hpack_decoder decoder;
+    header_list decoded;
+    decoder.decode(reinterpret_cast<const unsigned char *>(block.data()), block.size(), decoded);
+
+    test::check(decoded == fields, "encoded fields decoded back");
+}
+
+} // unnamed namespace
+
+int main()
+{
+    test_literal_fields();
+    test_requests();
+    test_requests_huffman();
+    test_responses();
+    test_responses_huffman();
+    test_table_size_update();
+    test_malformed();
+    test_encoder();
+
+    return test::result();
+}
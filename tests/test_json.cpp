@@ -0,0 +1,283 @@
+//
+// Tests of the JSON reader and writer: the nesting limit, the escape
+// sequences (also around the 16-byte blocks scanned at once)
+// and the edge cases of the number syntax and conversions.
+//
+
+#include <http_json.h>
+
+#include "test_check.h"
+
+#include <cmath>
+#include <limits>
+#include <string>
+
+using namespace http;
+
+namespace
+{
+
+// the document with its own copy of the text, which is modified by parsing
+struct parsed
+{
+    std::string text;
+    json_document doc;
+
+    explicit parsed(const std::string & json, std::size_t max_depth = 256)
+        : text(json)
+    {
+        doc.parse(&text[0], text.size(), max_depth);
+    }
+
+    json_value root() const { return doc.root(); }
+};
+
+bool valid(const std::string & json, std::size_t max_depth = 256)
+{
+    try
+    {
+        parsed p(json, max_depth);
+        return true;
+    }
+    catch (const json_error &)
+    {
+        return false;
+    }
+}
+
+std::string nested(std::size_t depth, char open, char close, const std::string & inner)
+{
+    return std::string(depth, open) + inner + std::string(depth, close);
+}
+
+std::string nested_objects(std::size_t depth)
+{
+    std::string json = "1";
+    for (std::size_t i = 0; i != depth; ++i)
+    {
+        json = "{\"a\":" + json + "}";
+    }
+
+    return json;
+}
+
+void test_depth()
+{
+    test::check(valid(nested(256, '[', ']', "")), "arrays at the default limit");
+    test::check(valid(nested(257, '[', ']', "")) == false, "arrays beyond the default limit");
+
+    test::check(valid(nested(3, '[', ']', "1"), 3), "arrays at the given limit");
+    test::check(valid(nested(4, '[', ']', "1"), 3) == false, "arrays beyond the given limit");
+    test::check(valid(nested_objects(3), 3), "objects at the given limit");
+    test::check(valid(nested_objects(4), 3) == false, "objects beyond the given limit");
+    test::check(valid("[{\"a\":[{}]}]", 4) && (valid("[{\"a\":[{}]}]", 3) == false),
+        "mixed containers counted together");
+
+    test::check(valid("\"scalar\"", 0) && (valid("[]", 0) == false), "zero limit");
+    test::check(valid("[[],[],[[]]]", 3), "siblings do not add up");
+
+    // far beyond the limit, rejected without exhausting the stack
+    test::check(valid(nested(1000000, '[', ']', "")) == false, "very deep nesting");
+
+    parsed p(nested(3, '[', ']', "7"));
+    test::check(p.root()[0][0][0].as_integer() == 7, "deepest value reached");
+}
+
+std::string string_value(const std::string & json)
+{
+    parsed p(json);
+
+    return std::string(p.root().as_string());
+}
+
+void test_escapes()
+{
+    test::check(string_value("\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"") == "\"\\/\b\f\n\r\t",
+        "simple escapes");
+    test::check(string_value("\"\\u0041\\u00e9\\u20AC\"") == "A\xc3\xa9\xe2\x82\xac",
+        "escaped code points of one to three UTF-8 bytes");
+    test::check(string_value("\"\\ud83d\\ude00\"") == "\xf0\x9f\x98\x80", "surrogate pair");
+    test::check(string_value("\"\\u0000\"") == std::string(1, '\0'), "escaped zero");
+    test::check(string_value("\"caf\xc3\xa9\"") == "caf\xc3\xa9", "UTF-8 passed through");
+
+    test::check(valid("\"\\x41\"") == false, "unknown escape");
+    test::check(valid("\"\\u12\"") == false, "short code point");
+    test::check(valid("\"\\u12g4\"") == false, "code point not hexadecimal");
+    test::check(valid("\"\\ud83d\"") == false, "lone high surrogate");
+    test::check(valid("\"\\ud83dx\\ude00\"") == false, "high surrogate not followed by escape");
+    test::check(valid("\"\\ud83d\\u0041\"") == false, "high surrogate followed by other code");
+    test::check(valid("\"\\ude00\"") == false, "lone low surrogate");
+    test::check(valid("\"a\tb\"") == false, "raw control character");
+    test::check(valid("\"abc") == false, "unterminated string");
+    test::check(valid("\"abc\\") == false, "unterminated escape");
+}
+
+void test_escapes_in_blocks()
+{
+    // the special character at every position of the first blocks
+    for (std::size_t pos = 0; pos != 40; ++pos)
+    {
+        std::string plain(48, 'x');
+        std::string decoded = plain;
+        decoded[pos] = '"';
+
+        std::string json = "\"" + plain.substr(0, pos) + "\\\"" + plain.substr(pos + 1) + "\"";
+        if (string_value(json) != decoded)
+        {
+            test::check(false, ("escape at " + std::to_string(pos)).c_str());
+        }
+
+        std::string raw = decoded;
+        raw[pos] = '\x1f';
+        if (valid("\"" + raw + "\""))
+        {
+            test::check(false, ("raw control character at " + std::to_string(pos)).c_str());
+        }
+
+        std::string written;
+        json_escape(raw, written);
+        if (written != "\"" + plain.substr(0, pos) + "\\u001f" + plain.substr(pos + 1) + "\"")
+        {
+            test::check(false, ("written escape at " + std::to_string(pos)).c_str());
+        }
+
+        if (string_value(written) != raw)
+        {
+            test::check(false, ("escape read back at " + std::to_string(pos)).c_str());
+        }
+    }
+
+    // the bytes above 0x7f are not taken for control characters
+    std::string high(40, '\xe9');
+    std::string written;
+    json_escape(high, written);
+    test::check(written == "\"" + high + "\"", "high bytes not escaped");
+}
+
+void test_number_syntax()
+{
+    const char * accepted[] =
+    {
+        "0", "-0", "1", "-1", "10", "0.5", "-0.5", "1.25e3", "1E3", "1e+3", "1e-3",
+        "0e0", "123456789012345678901234567890"
+    };
+
+    for (const char * json : accepted)
+    {
+        test::check(valid(json), json);
+    }
+
+    const char * rejected[] =
+    {
+        "01", "-01", "00", "+1", "-", ".5", "1.", "1.e3", "1e", "1e+", "-e1",
+        "0x10", "1_000", "Infinity", "NaN", "--1", "1 2"
+    };
+
+    for (const char * json : rejected)
+    {
+        test::check(valid(json) == false, json);
+    }
+}
+
+void test_number_values()
+{
+    test::check(parsed("9223372036854775807").root().as_integer() ==
+        std::numeric_limits<long long>::max(), "largest integer");
+    test::check(parsed("-9223372036854775808").root().as_integer() ==
+        std::numeric_limits<long long>::min(), "smallest integer");
+
+    test::check_throws<json_error>([]() { parsed("9223372036854775808").root().as_integer(); },
+        "integer overflow");
+    test::check_throws<json_error>([]() { parsed("1.0").root().as_integer(); },
+        "fraction is not an integer");
+    test::check_throws<json_error>([]() { parsed("1e2").root().as_integer(); },
+        "exponent is not an integer");
+    test::check(parsed("1.5").root().as_integer(7) == 7 &&
+        parsed("\"1\"").root().as_integer(7) == 7, "default of the integer");
+
+    test::check(parsed("0.1").root().as_double() == 0.1, "fraction");
+    test::check(parsed("-2.5E-3").root().as_double() == -0.0025, "negative exponent");
+    test::check(std::signbit(parsed("-0").root().as_double()), "negative zero");
+    test::check(parsed("9223372036854775808").root().as_double() == 9223372036854775808.0,
+        "large integer as double");
+
+    // out of the range of double
+    test::check(parsed("1e400").root().as_double() == HUGE_VAL, "overflow to infinity");
+    test::check(parsed("-1e400").root().as_double() == -HUGE_VAL, "overflow to -infinity");
+    test::check(parsed("123456789e999").root().as_double() == HUGE_VAL,
+        "overflow with many digits");
+    test::check(parsed("1e-400").root().as_double() == 0.0, "underflow to zero");
+    test::check(std::signbit(parsed("-1e-400").root().as_double()), "underflow to -zero");
+    test::check(parsed("0.0000000001e-320").root().as_double() == 0.0,
+        "underflow with fraction");
+    test::check(parsed("100000e-400").root().as_double() == 0.0,
+        "underflow despite the integer digits");
+    test::check(parsed("0.00001e400").root().as_double() == HUGE_VAL,
+        "overflow despite the fraction");
+    test::check(parsed("1e99999999999999999999").root().as_double() == HUGE_VAL,
+        "exponent beyond any range");
+}
+
+void test_structure()
+{
+    parsed p("{\"a\":1,\"b\":[true,false,null],\"a\":2,\"\":\"empty\"}");
+    json_value root = p.root();
+
+    test::check(root.size() == 4, "member count with repeated names");
+    test::check(root["a"].as_integer() == 1, "first of the repeated members");
+    test::check(root[""].as_string() == "empty", "empty member name");
+    test::check(root["b"].size() == 3 && root["b"][2].is_null(), "array elements");
+    test::check(root["missing"]["chained"][5].is_null(), "chained lookup of missing values");
+
+    const char * rejected[] =
+    {
+        "", " ", "[1,]", "[,1]", "{\"a\":1,}", "{\"a\" 1}", "{a:1}", "[1 2]",
+        "tru", "nul", "[1]]", "{\"a\":1}}", "\"a\" \"b\""
+    };
+
+    for (const char * json : rejected)
+    {
+        test::check(valid(json) == false, json);
+    }
+
+    test::check(valid(" \t\r\n[ 1 , { \"a\" : [ ] } ] \n"), "whitespace around tokens");
+}
+
+void test_writer()
+{
+    std::string out;
+    json_writer w(out);
+
+    w.begin_object()
+        .member("int", -42)
+        .member("big", 18446744073709551615ull)
+        .member("double", 0.1)
+        .member("infinite", HUGE_VAL)
+        .member("text", "quote \" slash \\ tab \t")
+        .key("list").begin_array().value(true).null().begin_object().end_object().end_array()
+     .end_object();
+
+    test::check(out == "{\"int\":-42,\"big\":18446744073709551615,\"double\":0.1,"
+        "\"infinite\":null,\"text\":\"quote \\\" slash \\\\ tab \\t\",\"list\":[true,null,{}]}",
+        "written document");
+
+    parsed p(out);
+    test::check(p.root()["text"].as_string() == "quote \" slash \\ tab \t",
+        "written string read back");
+    test::check(p.root()["double"].as_double() == 0.1, "written double read back");
+}
+
+} // unnamed namespace
+
+int main()
+{
+    test_depth();
+    test_escapes();
+    test_escapes_in_blocks();
+    test_number_syntax();
+    test_number_values();
+    test_structure();
+    test_writer();
+
+    return test::result();
+}
@@ -0,0 +1,184 @@
+//
+// Tests of the streaming multipart/form-data parser, mainly with
+// the delimiters split across the pieces in which the body arrives.
+//
+
+#include <http_multipart.h>
+
+#include "test_check.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace http;
+
+namespace
+{
+
+struct parsed_part
+{
+    std::string name;
+    std::string file_name;
+    std::string content_type;
+    std::string content;
+    bool complete = false;
+};
+
+// parses the body fed in pieces ending at the given offsets
+std::vector<parsed_part> parse(const std::string & boundary, const std::string & body,
+    const std::vector<std::size_t> & splits, std::size_t buffer_size = 8192)
+{
+    std::vector<parsed_part> parts;
+
+    multipart_parser parser(boundary,
+        [&parts](const multipart_part & part, multipart_event event,
+            const char * data, std::size_t size)
+        {
+            if (event == part_begin)
+            {
+                parts.push_back(parsed_part());
+                parts.back().name = part.name;
+                parts.back().file_name = part.file_name;
+                parts.back().content_type = part.content_type;
+            }
+            else if (event == part_data)
+            {
+                parts.back().content.append(data, size);
+            }
+            else
+            {
+                parts.back().complete = true;
+            }
+        },
+        buffer_size);
+
+    std::size_t pos = 0;
+    for (std::size_t split : splits)
+    {
+        parser.feed(body.data() + pos, split - pos);
+        pos = split;
+    }
+
+    parser.feed(body.data() + pos, body.size() - pos);
+    parser.finish();
+
+    return parts;
+}
+
+const std::string boundary = "----xyzBOUNDARY42";
+
+// the content resembles the delimiter, without being one
+const std::string text_content = "line\r\n--" + boundary.substr(0, 10) + "\r\n----\r\n";
+const std::string file_content = std::string("\r\n-\r\n--") + '\0' + "binary\r";
+
+const std::string body =
+    "preamble\r\n"
+    "--" + boundary + "\r\n"
+    "Content-Disposition: form-data; name=\"text\"\r\n"
+    "\r\n" +
+    text_content + "\r\n"
+    "--" + boundary + "\r\n"
+    "Content-Disposition: form-data; name=\"file\"; filename=\"a.bin\"\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "\r\n" +
+    file_content + "\r\n"
+    "--" + boundary + "\r\n"
+    "Content-Disposition: form-data; name=\"empty\"\r\n"
+    "\r\n"
+    "\r\n"
+    "--" + boundary + "--\r\n"
+    "epilogue";
+
+bool expected(const std::vector<parsed_part> & parts)
+{
+    return (parts.size() == 3) &&
+        (parts[0].name == "text") && (parts[0].content == text_content) && parts[0].complete &&
+        (parts[1].name == "file") && (parts[1].file_name == "a.bin") &&
+        (parts[1].content_type == "application/octet-stream") &&
+        (parts[1].content == file_content) && parts[1].complete &&
+        (parts[2].name == "empty") && parts[2].content.empty() && parts[2].complete;
+}
+
+void test_whole_body()
+{
+    test::check(expected(parse(boundary, body, {})), "body in one piece");
+}
+
+void test_every_split()
+{
+    // every position of the split, including those inside the delimiters
+    // and between the CR and LF preceding them
+    for (std::size_t i = 1; i < body.size(); ++i)
+    {
+        if (expected(parse(boundary, body, { i })) == false)
+        {
+            test::check(false, ("body split at " + std::to_string(i)).c_str());
+        }
+    }
+}
+
+void test_two_splits()
+{
+    // both delimiter halves in separate pieces, with a piece between them
+    for (std::size_t i = 1; i < body.size(); i += 3)
+    {
+        for (std::size_t j = i + 1; j < std::min(body.size(), i + 80); ++j)
+        {
+            if (expected(parse(boundary, body, { i, j })) == false)
+            {
+                test::check(false, ("body split at " + std::to_string(i) + " and " +
+                    std::to_string(j)).c_str());
+                return;
+            }
+        }
+    }
+}
+
+void test_byte_by_byte()
+{
+    std::vector<std::size_t> splits;
+    for (std::size_t i = 1; i < body.size(); ++i)
+    {
+        splits.push_back(i);
+    }
+
+    test::check(expected(parse(boundary, body, splits)), "body fed byte by byte");
+}
+
+void test_small_buffer()
+{
+    // the buffer just large enough for the part headers
+    std::vector<std::size_t> splits;
+    for (std::size_t i = 7; i < body.size(); i += 7)
+    {
+        splits.push_back(i);
+    }
+
+    test::check(expected(parse(boundary, body, splits, 128)), "small buffer");
+}
+
+void test_truncated()
+{
+    std::string truncated = body.substr(0, body.find("--" + boundary + "--") + 5);
+
+    test::check_throws<std::runtime_error>([&truncated]()
+        {
+            parse(boundary, truncated, { truncated.size() / 2 });
+        },
+        "missing closing delimiter");
+}
+
+} // unnamed namespace
+
+int main()
+{
+    test_whole_body();
+    test_every_split();
+    test_two_splits();
+    test_byte_by_byte();
+    test_small_buffer();
+    test_truncated();
+
+    return test::result();
+}
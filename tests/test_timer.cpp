@@ -0,0 +1,215 @@
+//
+// Tests of the hierarchical timer wheel: the timers armed for the ticks
+// across all levels must fire exactly at their tick, after being cascaded
+// to the lower levels.
+//
+
+#include <http_timer.h>
+
+#include "test_check.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace http;
+
+namespace
+{
+
+typedef timer_wheel::clock_type clock_type;
+
+// the wheel is driven by the given time points only, so it runs
+// in the virtual time of long ticks: the moment of its creation
+// is within the first half of the tick 0
+const std::chrono::milliseconds tick(1000);
+
+struct virtual_wheel
+{
+    clock_type::time_point start;
+    timer_wheel wheel;
+
+    virtual_wheel()
+        : start(clock_type::now()), wheel(tick)
+    {
+    }
+
+    // the deadline rounded up to the given tick
+    clock_type::time_point deadline(std::uint64_t ticks) const
+    {
+        return start + tick * (std::int64_t)ticks - tick / 2;
+    }
+
+    void advance(std::uint64_t ticks)
+    {
+        wheel.advance(start + tick * (std::int64_t)ticks + tick / 2);
+    }
+};
+
+struct counted_timer
+{
+    int fired = 0;
+    timer_wheel::timer timer;
+
+    counted_timer()
+        : timer([this]() { ++fired; })
+    {
+    }
+};
+
+// arms the timers at the given distances from the current tick
+// and checks that each of them fires exactly at its tick
+void check_firing(std::uint64_t current, const std::vector<std::uint64_t> & distances)
+{
+    virtual_wheel w;
+    w.advance(current);
+
+    std::vector<std::unique_ptr<counted_timer> > timers;
+    for (std::uint64_t d : distances)
+    {
+        timers.push_back(std::make_unique<counted_timer>());
+        w.wheel.arm(timers.back()->timer, w.deadline(current + d));
+    }
+
+    std::vector<std::uint64_t> sorted(distances);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    for (std::uint64_t d : sorted)
+    {
+        w.advance(current + d - 1);
+
+        for (std::size_t i = 0; i != distances.size(); ++i)
+        {
+            int expected = (distances[i] < d) ? 1 : 0;
+            if (timers[i]->fired != expected)
+            {
+                test::check(false, ("timer at " + std::to_string(distances[i]) + " from " +
+                    std::to_string(current) + " before tick " + std::to_string(d)).c_str());
+            }
+        }
+
+        w.advance(current + d);
+
+        for (std::size_t i = 0; i != distances.size(); ++i)
+        {
+            int expected = (distances[i] <= d) ? 1 : 0;
+            if (timers[i]->fired != expected)
+            {
+                test::check(false, ("timer at " + std::to_string(distances[i]) + " from " +
+                    std::to_string(current) + " at tick " + std::to_string(d)).c_str());
+            }
+        }
+    }
+}
+
+// distances around the boundaries of the levels (64, 4096 and 262144 ticks)
+const std::vector<std::uint64_t> boundaries =
+{
+    1, 2, 63, 64, 65, 127, 128, 129,
+    4095, 4096, 4097, 4160, 8191, 8192,
+    262143, 262144, 262145, 266240, 300000
+};
+
+void test_cascade()
+{
+    // from the start, and from the current ticks not aligned
+    // with the slots of the higher levels
+    const std::uint64_t starts[] = { 0, 1, 37, 63, 64, 100, 4095, 4100, 262100 };
+
+    for (std::uint64_t current : starts)
+    {
+        check_firing(current, boundaries);
+    }
+}
+
+void test_rearm_and_cancel()
+{
+    virtual_wheel w;
+
+    counted_timer moved;
+    counted_timer cancelled;
+    counted_timer past;
+
+    // armed in the level 2, moved to the level 0 before its cascade
+    w.wheel.arm(moved.timer, w.deadline(5000));
+    w.wheel.arm(moved.timer, w.deadline(10));
+
+    // cancelled after it was cascaded to the lower level
+    w.wheel.arm(cancelled.timer, w.deadline(4200));
+    w.advance(4100);
+    w.wheel.cancel(cancelled.timer);
+    w.wheel.cancel(cancelled.timer);
+
+    test::check(moved.fired == 1, "re-armed timer fires at its new deadline");
+
+    // the deadline already passed fires at the next tick
+    w.wheel.arm(past.timer, w.deadline(50));
+    w.advance(4100);
+    test::check(past.fired == 0, "past deadline does not fire in the processed tick");
+    w.advance(4101);
+    test::check(past.fired == 1, "past deadline fires at the next tick");
+
+    w.advance(10000);
+    test::check(moved.fired == 1, "re-armed timer fires once");
+    test::check(cancelled.fired == 0, "cancelled timer does not fire");
+}
+
+void test_longest_delay()
+{
+    // beyond the range of the wheel the timer fires at its last tick
+    const std::uint64_t range = (std::uint64_t(1) << 24) - 1;
+
+    virtual_wheel w;
+    counted_timer t;
+
+    w.wheel.arm(t.timer, w.deadline(range + 1000));
+
+    w.advance(range - 1);
+    test::check(t.fired == 0, "long delay not fired early");
+    w.advance(range);
+    test::check(t.fired == 1, "long delay clamped to the range of the wheel");
+}
+
+void test_many_in_slot()
+{
+    // timers sharing the slots of every level are all cascaded
+    virtual_wheel w;
+
+    std::vector<std::unique_ptr<counted_timer> > timers;
+    for (std::uint64_t i = 0; i != 300; ++i)
+    {
+        timers.push_back(std::make_unique<counted_timer>());
+        w.wheel.arm(timers.back()->timer, w.deadline(4096 + i % 3));
+    }
+
+    w.advance(4095);
+    int early = 0;
+    for (const auto & t : timers)
+    {
+        early += t->fired;
+    }
+
+    w.advance(4098);
+    int fired = 0;
+    for (const auto & t : timers)
+    {
+        fired += t->fired;
+    }
+
+    test::check((early == 0) && (fired == 300), "all timers of the shared slots fired once");
+}
+
+} // unnamed namespace
+
+int main()
+{
+    test_cascade();
+    test_rearm_and_cancel();
+    test_longest_delay();
+    test_many_in_slot();
+
+    return test::result();
+}
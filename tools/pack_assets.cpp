@@ -0,0 +1,161 @@
+//
+// This tool packs the tree of static files into the single asset pack,
+// served by the server after http::set_static_pack.
+//
+// Usage: pack_assets [-z] base_dir pack_file
+//
+//   -z  add the gzip-compressed variant of each file that becomes
+//       at least 10% smaller (requires zlib)
+//
+
+#include <http_pack.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+
+std::string read_file(const std::filesystem::path & path)
+{
+    std::ifstream in(path, std::ifstream::binary);
+    if (!in)
+    {
+        throw std::runtime_error("cannot read " + path.string());
+    }
+
+    std::ostringstream content;
+    content << in.rdbuf();
+
+    return content.str();
+}
+
+#ifdef HAVE_ZLIB
+
+std::string gzip(const std::string & content)
+{
+    z_stream z;
+    std::memset(&z, 0, sizeof(z));
+
+    // 16 + window bits selects the gzip format
+    if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 9,
+        Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("cannot initialize zlib");
+    }
+
+    std::string result(deflateBound(&z, (uLong)content.size()) + 32, '\0');
+
+    z.next_in = (Bytef *)content.data();
+    z.avail_in = (uInt)content.size();
+    z.next_out = (Bytef *)&result[0];
+    z.avail_out = (uInt)result.size();
+
+    int status = deflate(&z, Z_FINISH);
+    result.resize(z.total_out);
+
+    deflateEnd(&z);
+
+    if (status != Z_STREAM_END)
+    {
+        throw std::runtime_error("cannot compress");
+    }
+
+    return result;
+}
+
+#endif
+
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    bool compress = false;
+    int arg = 1;
+
+    if ((arg < argc) && (std::strcmp(argv[arg], "-z") == 0))
+    {
+        compress = true;
+        ++arg;
+    }
+
+    if (argc - arg != 2)
+    {
+        std::cerr << "usage: pack_assets [-z] base_dir pack_file\n";
+        return 2;
+    }
+
+#ifndef HAVE_ZLIB
+    if (compress)
+    {
+        std::cerr << "pack_assets was built without zlib, -z is not supported\n";
+        return 2;
+    }
+#endif
+
+    try
+    {
+        std::filesystem::path root(argv[arg]);
+        std::filesystem::path pack_path(argv[arg + 1]);
+
+        http::asset_pack_writer writer;
+        std::size_t compressed_files = 0;
+
+        for (const std::filesystem::directory_entry & e :
+            std::filesystem::recursive_directory_iterator(root))
+        {
+            if ((e.is_regular_file() == false) ||
+                (std::filesystem::exists(pack_path) && std::filesystem::equivalent(e.path(), pack_path)))
+            {
+                continue;
+            }
+
+            // request path, with forward slashes on all platforms
+            std::string path = "/" + e.path().lexically_relative(root).generic_string();
+
+            std::string content = read_file(e.path());
+            std::string compressed;
+
+#ifdef HAVE_ZLIB
+            if (compress)
+            {
+                compressed = gzip(content);
+
+                if (compressed.size() > content.size() - content.size() / 10)
+                {
+                    compressed.clear();
+                }
+                else
+                {
+                    ++compressed_files;
+                }
+            }
+#endif
+
+            writer.add(path, std::move(content), std::move(compressed));
+        }
+
+        std::size_t files = writer.size();
+
+        writer.write(pack_path.string());
+
+        std::cout << "packed " << files << " files (" << compressed_files
+            << " compressed) into " << pack_path.string() << '\n';
+    }
+    catch (const std::exception & e)
+    {
+        std::cerr << "pack_assets: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}